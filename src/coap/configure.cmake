@@ -0,0 +1,25 @@
+# Copyright (C) 2025 The Qt Company Ltd.
+# SPDX-License-Identifier: BSD-3-Clause
+
+#### Inputs
+
+
+
+#### Libraries
+
+
+
+#### Tests
+
+
+
+#### Features
+
+qt_feature("coap-websockets" PRIVATE
+    LABEL "CoAP over WebSockets"
+    PURPOSE "Provides a transport exchanging CoAP messages over WebSockets."
+    CONDITION TARGET Qt::WebSockets
+)
+qt_configure_add_summary_section(NAME "Qt Coap")
+qt_configure_add_summary_entry(ARGS "coap-websockets")
+qt_configure_end_summary_section() # end of "Qt Coap" section
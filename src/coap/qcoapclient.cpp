@@ -5,10 +5,16 @@
 #include "qcoapclient_p.h"
 #include "qcoapprotocol_p.h"
 #include "qcoapreply.h"
+#include "qcoapobservegroup.h"
 #include "qcoapresourcediscoveryreply.h"
 #include "qcoapnamespace.h"
 #include "qcoapsecurityconfiguration.h"
 #include "qcoapqudpconnection_p.h"
+#include "qcoaptcpconnection_p.h"
+#include <QtCoap/private/qtcoap-config_p.h>
+#if QT_CONFIG(coap_websockets)
+#include "qcoapwebsocketconnection_p.h"
+#endif
 #include "qcoaprequest_p.h"
 #include "qcoapreply_p.h"
 #include <QtCore/qiodevice.h>
@@ -124,6 +130,53 @@ QCoapClientPrivate::~QCoapClientPrivate()
     \sa finished(), QCoapReply::error(), QCoapReply::finished()
 */
 
+/*!
+    \fn void QCoapClient::endpointBlockSizeChanged(const QUrl &endpoint, quint16 blockSize)
+
+    This signal is emitted when the block size used for blockwise transfers
+    with \a endpoint changes to \a blockSize. The \a endpoint URL only holds
+    the scheme, host and port of the server.
+
+    The block size of each endpoint starts from the value set with
+    setBlockSize(). It is reduced when the server asks for smaller blocks, as
+    described in \l{https://tools.ietf.org/html/rfc7959#section-2.5}{RFC 7959},
+    or after repeated losses of blocks. It grows again, up to the value set
+    with setBlockSize(), when blocks are transferred without loss.
+
+    \sa setBlockSize()
+*/
+
+/*!
+    \fn void QCoapClient::compactNotified(quint64 observation,
+                                          const QCoapMessage &message)
+
+    This signal is emitted whenever a notification is received for the
+    compact \a observation. Its \a message parameter holds the payload and
+    the details of the notification.
+
+    \sa observeCompact()
+*/
+
+/*!
+    \fn void QCoapClient::compactObserveFailed(quint64 observation,
+                                               QtCoap::Error error)
+
+    This signal is emitted when the server answers the compact
+    \a observation with an \a error. The observation is over.
+
+    \sa observeCompact()
+*/
+
+/*!
+    \fn void QCoapClient::connected(const QString &host, quint16 port)
+
+    This signal is emitted when the client is ready to send requests to
+    \a host on \a port, after connectToHost() was called. In the secure
+    modes, this is when the DTLS handshake with the server completed.
+
+    \sa connectToHost()
+*/
+
 /*!
     Constructs a QCoapClient object for the given \a securityMode and
     sets \a parent as the parent object.
@@ -136,13 +189,38 @@ QCoapClientPrivate::~QCoapClientPrivate()
     constructors.
 */
 QCoapClient::QCoapClient(QtCoap::SecurityMode securityMode, QObject *parent) :
-    QObject(*new QCoapClientPrivate(new QCoapProtocol, new QCoapQUdpConnection(securityMode)),
+    QCoapClient(QtCoap::Transport::Udp, securityMode, parent)
+{
+}
+
+/*!
+    Constructs a QCoapClient object exchanging the messages over the given
+    \a transport, for the given \a securityMode, and sets \a parent as the
+    parent object.
+
+    With QtCoap::Transport::Tcp, the client keeps a TCP connection with
+    each server, secured with TLS in the secure modes. The messages are
+    neither acknowledged nor retransmitted, and large payloads are
+    transferred in BERT blocks when the server supports them.
+
+    With QtCoap::Transport::WebSocket, the client keeps a WebSocket
+    connection with each server instead, open on the \c{/.well-known/coap}
+    path of the host and port of the request URLs. This transport requires
+    Qt WebSockets; the client falls back to UDP when Qt CoAP was built
+    without it.
+*/
+QCoapClient::QCoapClient(QtCoap::Transport transport, QtCoap::SecurityMode securityMode,
+                         QObject *parent) :
+    QObject(*new QCoapClientPrivate(new QCoapProtocol,
+                                    QCoapClientPrivate::createConnection(transport,
+                                                                         securityMode)),
             parent)
 {
     Q_D(QCoapClient);
 
     qRegisterMetaType<QCoapReply *>();
     qRegisterMetaType<QCoapMessage>();
+    qRegisterMetaType<QCoapRequest>();
     qRegisterMetaType<QPointer<QCoapReply>>();
     qRegisterMetaType<QPointer<QCoapResourceDiscoveryReply>>();
     qRegisterMetaType<QCoapConnection *>();
@@ -151,10 +229,12 @@ QCoapClient::QCoapClient(QtCoap::SecurityMode securityMode, QObject *parent) :
     qRegisterMetaType<QtCoap::Method>();
     qRegisterMetaType<QtCoap::SecurityMode>();
     qRegisterMetaType<QtCoap::MulticastGroup>();
+    qRegisterMetaType<QtCoap::Transport>();
     // Requires a name, as this is a typedef
     qRegisterMetaType<QCoapToken>("QCoapToken");
     qRegisterMetaType<QCoapMessageId>("QCoapMessageId");
     qRegisterMetaType<QAbstractSocket::SocketOption>();
+    qRegisterMetaType<CoapSavedObservation>();
 
     connect(d->connection, &QCoapConnection::readyRead, d->protocol,
             [this](const QByteArray &data, const QHostAddress &sender) {
@@ -166,6 +246,16 @@ QCoapClient::QCoapClient(QtCoap::SecurityMode securityMode, QObject *parent) :
                     Q_D(QCoapClient);
                     d->protocol->d_func()->onConnectionError(socketError);
             });
+    connect(d->connection, &QCoapConnection::frameDropped, d->protocol,
+            [this](const QByteArray &frame, QtCoap::Error error) {
+                    Q_D(QCoapClient);
+                    d->protocol->d_func()->onFrameDropped(frame, error);
+            });
+    connect(d->connection, &QCoapConnection::peerSettingsChanged, d->protocol,
+            [this](const CoapEndpoint &endpoint) {
+                    Q_D(QCoapClient);
+                    d->protocol->d_func()->onPeerSettingsChanged(endpoint);
+            });
 
     connect(d->protocol, &QCoapProtocol::finished,
             this, &QCoapClient::finished);
@@ -173,12 +263,48 @@ QCoapClient::QCoapClient(QtCoap::SecurityMode securityMode, QObject *parent) :
             this, &QCoapClient::responseToMulticastReceived);
     connect(d->protocol, &QCoapProtocol::error,
             this, &QCoapClient::error);
+    connect(d->protocol, &QCoapProtocol::endpointBlockSizeChanged,
+            this, &QCoapClient::endpointBlockSizeChanged);
+    connect(d->protocol, &QCoapProtocol::compactNotified,
+            this, &QCoapClient::compactNotified);
+    connect(d->protocol, &QCoapProtocol::compactObserveFailed,
+            this, &QCoapClient::compactObserveFailed);
+    connect(d->connection, &QCoapConnection::connected,
+            this, &QCoapClient::connected);
+}
+
+/*!
+    \internal
+
+    Returns a new connection exchanging the messages over the given
+    \a transport, for the given \a securityMode. Falls back to UDP if the
+    \a transport is not available in this build.
+*/
+QCoapConnection *QCoapClientPrivate::createConnection(QtCoap::Transport transport,
+                                                      QtCoap::SecurityMode securityMode)
+{
+    switch (transport) {
+    case QtCoap::Transport::Tcp:
+        return new QCoapTcpConnection(securityMode);
+    case QtCoap::Transport::WebSocket:
+#if QT_CONFIG(coap_websockets)
+        return new QCoapWebSocketConnection(securityMode);
+#else
+        qCWarning(lcCoapClient, "CoAP over WebSockets is disabled, falling back to UDP.");
+        break;
+#endif
+    case QtCoap::Transport::Udp:
+        break;
+    }
+    return new QCoapQUdpConnection(securityMode);
 }
 
 /*!
     \internal
 
-    Sets the client's connection to \a customConnection.
+    Sets the client's connection to \a customConnection. The connection is
+    moved to the worker thread of the protocol, like the default one, and
+    must not have a parent.
 */
 void QCoapClientPrivate::setConnection(QCoapConnection *customConnection)
 {
@@ -186,6 +312,7 @@ void QCoapClientPrivate::setConnection(QCoapConnection *customConnection)
 
     delete connection;
     connection = customConnection;
+    connection->moveToThread(workerThread);
 
     q->connect(connection, &QCoapConnection::readyRead, protocol,
             [this](const QByteArray &data, const QHostAddress &sender) {
@@ -195,6 +322,16 @@ void QCoapClientPrivate::setConnection(QCoapConnection *customConnection)
             [this](QAbstractSocket::SocketError socketError) {
                     protocol->d_func()->onConnectionError(socketError);
             });
+    q->connect(connection, &QCoapConnection::frameDropped, protocol,
+            [this](const QByteArray &frame, QtCoap::Error error) {
+                    protocol->d_func()->onFrameDropped(frame, error);
+            });
+    q->connect(connection, &QCoapConnection::peerSettingsChanged, protocol,
+            [this](const CoapEndpoint &endpoint) {
+                    protocol->d_func()->onPeerSettingsChanged(endpoint);
+            });
+    q->connect(connection, &QCoapConnection::connected,
+               q, &QCoapClient::connected);
 }
 
 /*!
@@ -434,6 +571,16 @@ QCoapResourceDiscoveryReply *QCoapClient::discover(const QUrl &url, const QStrin
     a new QCoapReply object which emits the \l QCoapReply::notified()
     signal whenever a new notification arrives.
 
+    If the same resource is already observed with identical options, no new
+    registration is sent to the server: the notifications of the running
+    observation are delivered to every QCoapReply observing it, and the
+    server registration is only cancelled along with the last of them.
+
+    If no notification arrives before the Max-Age of the last one expires,
+    the observation is registered again with the same token, and the
+    QCoapReply::observationStale() signal is emitted until the server
+    answers.
+
     \sa cancelObserve(), get(), post(), put(), deleteResource(), discover()
 */
 QCoapReply *QCoapClient::observe(const QCoapRequest &request)
@@ -461,12 +608,36 @@ QCoapReply *QCoapClient::observe(const QUrl &url)
     return observe(QCoapRequest(url));
 }
 
+/*!
+    \overload
+
+    Registers the observations of \a requests at a limited \a rate, in
+    registrations per second, and returns a new QCoapObserveGroup object
+    tracking their progress. A \a rate of 0 sends all the registrations at
+    once.
+
+    The interval between two registrations varies at random by up to
+    \a jitter times the average interval, \a jitter being between 0 and 1.
+    This spreads the registrations of large sets of resources, which would
+    otherwise be sent in a single burst.
+
+    \sa QCoapObserveGroup, cancelObserve()
+*/
+QCoapObserveGroup *QCoapClient::observe(const QList<QCoapRequest> &requests, uint rate,
+                                        double jitter)
+{
+    return new QCoapObserveGroup(this, requests, rate, jitter);
+}
+
 /*!
     \overload
 
     Cancels the observation of a resource using the reply \a notifiedReply returned by
     the observe() method.
 
+    Unless other replies observe the same resource, the observation is
+    deregistered from the server right away.
+
     \sa observe()
 */
 void QCoapClient::cancelObserve(QCoapReply *notifiedReply)
@@ -490,11 +661,229 @@ void QCoapClient::cancelObserve(const QUrl &url)
     QMetaObject::invokeMethod(d->protocol, "cancelObserve", Q_ARG(QUrl, adjustedUrl));
 }
 
+/*!
+    Cancels the observations of all the resources whose URL starts with
+    \a urlPrefix, for instance all the resources under a given path of a
+    server.
+
+    The URLs are compared as strings, after adding the default scheme and
+    port to \a urlPrefix if missing.
+
+    \sa cancelObserve(), cancelObserveHost()
+*/
+void QCoapClient::cancelObserveByPrefix(const QUrl &urlPrefix)
+{
+    Q_D(QCoapClient);
+    const auto adjustedUrl = QCoapRequestPrivate::adjustedUrl(urlPrefix,
+                                                              d->connection->isSecure());
+    QMetaObject::invokeMethod(d->protocol, "cancelObserveByPrefix", Qt::QueuedConnection,
+                              Q_ARG(QUrl, adjustedUrl));
+}
+
+/*!
+    Cancels the observations of all the resources of \a host, whatever
+    their port and path.
+
+    \sa cancelObserve(), cancelObserveByPrefix()
+*/
+void QCoapClient::cancelObserveHost(const QString &host)
+{
+    Q_D(QCoapClient);
+    QMetaObject::invokeMethod(d->protocol, "cancelObserveHost", Qt::QueuedConnection,
+                              Q_ARG(QString, host));
+}
+
+/*!
+    Limits the rate of the notifications delivered to \a notifiedReply, the
+    reply returned by the observe() method, to one every \a interval
+    milliseconds. The default is 0, which means that each notification is
+    delivered as soon as it is received.
+
+    Notifications received within the interval are conflated: only the most
+    recent one is delivered when the interval elapses, the older ones are
+    counted by QCoapReply::conflatedNotificationCount(). This keeps fast
+    changing resources from flooding the thread of \a notifiedReply.
+
+    \sa observe(), QCoapReply::notified()
+*/
+void QCoapClient::setNotificationInterval(QCoapReply *notifiedReply, uint interval)
+{
+    Q_D(QCoapClient);
+    QMetaObject::invokeMethod(d->protocol, "setNotificationInterval", Qt::QueuedConnection,
+                              Q_ARG(QPointer<QCoapReply>, QPointer<QCoapReply>(notifiedReply)),
+                              Q_ARG(uint, interval));
+}
+
+/*!
+    Sends a request to observe the target \a request, and returns an
+    identifier of the observation, or 0 if the request could not be sent.
+
+    Unlike observe(), no QCoapReply is created: the notifications are
+    delivered by the compactNotified() signal along with the identifier,
+    and the observation only keeps the encoded registration and the state
+    needed to renew it. This suits applications observing a very large
+    number of resources.
+
+    Notifications older than the last one are dropped, and the observation is
+    registered again when its Max-Age expires. Notifications are delivered
+    as received, blockwise notifications are not reassembled. Multicast
+    requests are not supported.
+
+    \sa cancelCompactObserve(), compactNotified(), compactObserveFailed()
+*/
+quint64 QCoapClient::observeCompact(const QCoapRequest &request)
+{
+    Q_D(QCoapClient);
+
+    QCoapRequest copyRequest = QCoapRequestPrivate::createRequest(request, QtCoap::Method::Get,
+                                                                  d->connection->isSecure());
+    copyRequest.enableObserve();
+    if (!d->canSend(copyRequest))
+        return 0;
+
+    if (QHostAddress(copyRequest.url().host()).isMulticast()) {
+        qCWarning(lcCoapClient, "Failed to observe, compact observations cannot be multicast.");
+        return 0;
+    }
+
+    const quint64 observation = ++d->lastCompactObservation;
+    QMetaObject::invokeMethod(d->protocol, "observeCompact", Qt::QueuedConnection,
+                              Q_ARG(quint64, observation),
+                              Q_ARG(QCoapRequest, copyRequest),
+                              Q_ARG(QCoapConnection *, d->connection));
+    return observation;
+}
+
+/*!
+    \overload
+
+    Sends a request to observe the target \a url, and returns an identifier
+    of the observation, or 0 if the request could not be sent.
+
+    \sa cancelCompactObserve(), compactNotified()
+*/
+quint64 QCoapClient::observeCompact(const QUrl &url)
+{
+    return observeCompact(QCoapRequest(url));
+}
+
+/*!
+    Cancels the compact \a observation returned by observeCompact().
+
+    \sa observeCompact()
+*/
+void QCoapClient::cancelCompactObserve(quint64 observation)
+{
+    Q_D(QCoapClient);
+    QMetaObject::invokeMethod(d->protocol, "cancelCompactObserve", Qt::QueuedConnection,
+                              Q_ARG(quint64, observation));
+}
+
+/*!
+    Returns a binary snapshot of the state of the observations of the
+    client, including their tokens, endpoints and last sequence numbers.
+
+    The snapshot can be passed to restoreObservations(), for instance after
+    the application restarted, so that the observations continue without
+    being registered again on the servers.
+
+    An observation shared by several replies is saved once. Multicast and
+    cancelled observations are not saved.
+
+    \note This method blocks until the state is collected.
+
+    \sa restoreObservations()
+*/
+QByteArray QCoapClient::saveObservations()
+{
+    Q_D(QCoapClient);
+
+    QByteArray snapshot;
+    QMetaObject::invokeMethod(d->protocol, "saveObservations", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QByteArray, snapshot));
+    return snapshot;
+}
+
+/*!
+    Restores the observations saved in \a snapshot by saveObservations(),
+    and returns the new replies of the observations. The compact
+    observations are restored with their identifiers, and their
+    notifications are delivered by the compactNotified() signal.
+
+    The observations keep their tokens, so that the notifications of the
+    servers are matched without registering again. An observation is
+    registered again if its Max-Age expired in the meantime.
+
+    Returns an empty list if the snapshot is not valid.
+
+    \sa saveObservations(), observe(), observeCompact()
+*/
+QList<QCoapReply *> QCoapClient::restoreObservations(const QByteArray &snapshot)
+{
+    Q_D(QCoapClient);
+
+    QList<CoapSavedObservation> observations;
+    if (!QCoapProtocolPrivate::readObservations(snapshot, &observations)) {
+        qCWarning(lcCoapClient, "Failed to restore observations, the snapshot is invalid.");
+        return {};
+    }
+
+    QList<QCoapReply *> replies;
+    for (const auto &observation : std::as_const(observations)) {
+        QCoapReply *reply = nullptr;
+        if (observation.compactId > 0) {
+            d->lastCompactObservation = qMax(d->lastCompactObservation, observation.compactId);
+        } else {
+            if (!d->canSend(observation.request))
+                continue;
+
+            reply = QCoapReplyPrivate::createCoapReply(observation.request, this);
+            replies.append(reply);
+        }
+
+        QMetaObject::invokeMethod(d->protocol, "restoreObservation", Qt::QueuedConnection,
+                                  Q_ARG(QPointer<QCoapReply>, QPointer<QCoapReply>(reply)),
+                                  Q_ARG(CoapSavedObservation, observation),
+                                  Q_ARG(QCoapConnection *, d->connection));
+    }
+
+    return replies;
+}
+
+/*!
+    Prepares the transport for sending requests to \a host on \a port
+    ahead of the first request, and emits the connected() signal when it
+    is ready. If \a port is \c 0, the default port of the security mode
+    is used.
+
+    In the secure modes, this does the DTLS handshake with the server, so
+    that the first requests to the server, such as latency-critical
+    commands, are sent right away instead of waiting for the handshake.
+    If the handshake fails, the error() signal is emitted without reply.
+
+    Requests can be sent before the connected() signal is emitted, they are
+    sent as soon as the transport is ready.
+
+    \sa connected(), disconnect()
+*/
+void QCoapClient::connectToHost(const QString &host, quint16 port)
+{
+    Q_D(QCoapClient);
+
+    if (port == 0) {
+        port = d->connection->isSecure() ? QtCoap::DefaultSecurePort
+                                         : QtCoap::DefaultPort;
+    }
+
+    QMetaObject::invokeMethod(d->connection, "connectToHost", Qt::QueuedConnection,
+                              Q_ARG(QString, host), Q_ARG(quint16, port));
+}
+
 /*!
     Closes the open sockets and connections to free the transport.
 
     \note In the secure mode this needs to be called before changing
-    the security configuration or connecting to another server.
+    the security configuration.
 
     \sa setSecurityConfiguration()
 */
@@ -552,31 +941,45 @@ QCoapResourceDiscoveryReply *QCoapClientPrivate::sendDiscovery(const QCoapReques
     Connect to the reply and use the protocol to send it.
 */
 bool QCoapClientPrivate::send(QCoapReply *reply)
+{
+    if (!canSend(reply->request()))
+        return false;
+
+    QMetaObject::invokeMethod(protocol, "sendRequest", Qt::QueuedConnection,
+                              Q_ARG(QPointer<QCoapReply>, QPointer<QCoapReply>(reply)),
+                              Q_ARG(QCoapConnection *, connection));
+
+    return true;
+}
+
+/*!
+    \internal
+
+    Returns \c true if the \a request can be sent through the connection
+    of the client. Otherwise, a warning is printed and \c false is returned.
+*/
+bool QCoapClientPrivate::canSend(const QCoapRequest &request) const
 {
     const auto scheme = connection->isSecure() ? QLatin1String("coaps") : QLatin1String("coap");
-    if (reply->request().url().scheme() != scheme) {
+    if (request.url().scheme() != scheme) {
         qCWarning(lcCoapClient, "Failed to send request, URL has an incorrect scheme.");
         return false;
     }
 
-    if (!QCoapRequestPrivate::isUrlValid(reply->request().url())) {
+    if (!QCoapRequestPrivate::isUrlValid(request.url())) {
         qCWarning(lcCoapClient, "Failed to send request for an invalid URL.");
         return false;
     }
 
     // According to https://tools.ietf.org/html/rfc7252#section-8.1,
     // multicast requests MUST be Non-confirmable.
-    if (QHostAddress(reply->url().host()).isMulticast()
-            && reply->request().type() == QCoapMessage::Type::Confirmable) {
+    if (QHostAddress(request.url().host()).isMulticast()
+            && request.type() == QCoapMessage::Type::Confirmable) {
         qCWarning(lcCoapClient, "Failed to send request, "
                                 "multicast requests must be non-confirmable.");
         return false;
     }
 
-    QMetaObject::invokeMethod(protocol, "sendRequest", Qt::QueuedConnection,
-                              Q_ARG(QPointer<QCoapReply>, QPointer<QCoapReply>(reply)),
-                              Q_ARG(QCoapConnection *, connection));
-
     return true;
 }
 
@@ -602,6 +1005,11 @@ void QCoapClient::setSecurityConfiguration(const QCoapSecurityConfiguration &con
     Sets the maximum block size used by the protocol to \a blockSize
     when sending requests and receiving replies. The block size must be
     a power of two.
+
+    The block size actually used is adapted for each endpoint, and never
+    exceeds \a blockSize.
+
+    \sa endpointBlockSizeChanged()
 */
 void QCoapClient::setBlockSize(quint16 blockSize)
 {
@@ -623,6 +1031,104 @@ void QCoapClient::setSocketOption(QAbstractSocket::SocketOption option, const QV
                               Q_ARG(QVariant, value));
 }
 
+/*!
+    Sets the time in milliseconds after which the DTLS session with a
+    server is shut down if no message was exchanged with it to \a timeout.
+    The default is 5 minutes. A \a timeout of \c 0 keeps the sessions open
+    until the client is disconnected.
+
+    A secure client sets up a separate DTLS session with each server it
+    sends requests to, all sharing the same socket. A new handshake is
+    done with a server when a request is sent to it after its session was
+    shut down.
+
+    The idle timeout is only used in the secure modes.
+
+    \sa disconnect()
+*/
+void QCoapClient::setDtlsSessionIdleTimeout(uint timeout)
+{
+    Q_D(QCoapClient);
+
+    QMetaObject::invokeMethod(d->connection, "setSessionIdleTimeout", Qt::QueuedConnection,
+                              Q_ARG(uint, timeout));
+}
+
+/*!
+    Sets the number of messages per second sent to a server above which
+    the client talks to that server through a dedicated UDP socket, to
+    \a rate. The default is \c 0, which sends all the messages through
+    the socket shared by all the servers.
+
+    The dedicated socket is connected to the server, so that the operating
+    system keeps the route to it and filters out the datagrams coming from
+    other hosts. It shares the local port of the client, and is closed once
+    the traffic with the server drops below half of \a rate. Up to 16
+    servers have a dedicated socket at once.
+
+    The dedicated sockets are only used in the QtCoap::NoSecurity mode.
+
+    \sa setSocketOption()
+*/
+void QCoapClient::setConnectedSocketThreshold(uint rate)
+{
+    Q_D(QCoapClient);
+
+    QMetaObject::invokeMethod(d->connection, "setConnectedSocketThreshold",
+                              Qt::QueuedConnection, Q_ARG(uint, rate));
+}
+
+/*!
+    Returns a binary snapshot of the DTLS sessions that the client keeps
+    for resumption.
+
+    A secure client remembers the last session with each server, so that
+    the next handshake with the server resumes it instead of doing a full
+    handshake, for instance after the session was idle for too long. Passing
+    the snapshot to restoreDtlsSessions() lets a new client, possibly after
+    the application restarted, resume the sessions as well.
+
+    \warning The snapshot holds the secrets of the sessions, and must be
+    stored as safely as the keys of the client.
+
+    \note This method blocks until the sessions are collected.
+
+    \sa restoreDtlsSessions(), setDtlsSessionIdleTimeout()
+*/
+QByteArray QCoapClient::saveDtlsSessions()
+{
+    Q_D(QCoapClient);
+
+    QByteArray snapshot;
+    QMetaObject::invokeMethod(d->connection, "saveSessions", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QByteArray, snapshot));
+    return snapshot;
+}
+
+/*!
+    Adds the DTLS sessions saved in \a snapshot by saveDtlsSessions() to the
+    sessions that the client offers to resume. Returns \c false if the
+    snapshot is not valid.
+
+    The sessions are dropped if the security configuration is changed
+    afterwards.
+
+    \note This method blocks until the sessions are restored.
+
+    \sa saveDtlsSessions(), setSecurityConfiguration()
+*/
+bool QCoapClient::restoreDtlsSessions(const QByteArray &snapshot)
+{
+    Q_D(QCoapClient);
+
+    bool restored = false;
+    QMetaObject::invokeMethod(d->connection, "restoreSessions", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, restored), Q_ARG(QByteArray, snapshot));
+    if (!restored)
+        qCWarning(lcCoapClient, "Failed to restore DTLS sessions, the snapshot is invalid.");
+    return restored;
+}
+
 /*!
     Sets the \c MAX_SERVER_RESPONSE_DELAY value to \a responseDelay in milliseconds.
     The default is 250 seconds.
@@ -692,4 +1198,99 @@ void QCoapClient::setMinimumTokenSize(int tokenSize)
                               Q_ARG(int, tokenSize));
 }
 
+/*!
+    Sets the maximum number of blocks requested in parallel during a blockwise
+    transfer to \a windowSize. The default is 1, which means that each block is
+    requested after the previous one has been received.
+
+    With a larger window, the client asks the server for the size of the
+    resource and requests the following blocks in parallel, which reduces the
+    transfer time on high-latency links. Each block is retransmitted
+    independently. The number of blocks in flight is also limited by
+    the \c NSTART value, which is shared by all the exchanges with the
+    same server.
+
+    \sa setMaximumConcurrentRequests(), setBlockSize()
+*/
+void QCoapClient::setBlockWindowSize(uint windowSize)
+{
+    Q_D(QCoapClient);
+    QMetaObject::invokeMethod(d->protocol, "setBlockWindowSize", Qt::QueuedConnection,
+                              Q_ARG(uint, windowSize));
+}
+
+/*!
+    Sets the \c NSTART value defined in \l {RFC 7252 - Section 4.7} to
+    \a maximumConcurrentRequests. This is the maximum number of simultaneous
+    outstanding interactions with a server. The default is 1.
+
+    All the exchanges waiting for a response from a server count against this
+    value, but only the blocks requested in parallel during a blockwise
+    transfer are held back by it. The first request of an exchange is always
+    sent right away, so a server can have more outstanding interactions than
+    \a maximumConcurrentRequests when several requests are sent at once.
+
+    \sa setBlockWindowSize()
+*/
+void QCoapClient::setMaximumConcurrentRequests(uint maximumConcurrentRequests)
+{
+    Q_D(QCoapClient);
+    QMetaObject::invokeMethod(d->protocol, "setMaximumConcurrentRequests", Qt::QueuedConnection,
+                              Q_ARG(uint, maximumConcurrentRequests));
+}
+
+/*!
+    Enables bulk transfers with the Q-Block1 and Q-Block2 options defined in
+    \l {RFC 9177} if \a enabled is \c true. The default is \c false.
+
+    Q-Block transfers are designed for lossy links: blocks are sent as
+    Non-confirmable messages in sets, and only the missing blocks are sent
+    again. If the server does not support these options, the request is sent
+    again as a usual blockwise transfer.
+
+    \sa setMaximumPayloads(), setBlockSize()
+*/
+void QCoapClient::setQBlockEnabled(bool enabled)
+{
+    Q_D(QCoapClient);
+    QMetaObject::invokeMethod(d->protocol, "setQBlockEnabled", Qt::QueuedConnection,
+                              Q_ARG(bool, enabled));
+}
+
+/*!
+    Sets the \c MAX_PAYLOADS value defined in \l {RFC 9177} to
+    \a maximumPayloads. This is the number of blocks sent, or requested,
+    in a single set of a Q-Block transfer. The default is 10.
+
+    \sa setQBlockEnabled()
+*/
+void QCoapClient::setMaximumPayloads(uint maximumPayloads)
+{
+    Q_D(QCoapClient);
+    QMetaObject::invokeMethod(d->protocol, "setMaximumPayloads", Qt::QueuedConnection,
+                              Q_ARG(uint, maximumPayloads));
+}
+
+/*!
+    Enables resumable blockwise downloads if \a enabled is \c true.
+    The default is \c false.
+
+    When a blockwise GET request fails with a QtCoap::Error::TimeOut error,
+    the blocks received so far are kept, along with the ETag of the resource.
+    The next GET request to the same URL continues the transfer from the
+    first missing block, if the ETag of the resource still matches. Otherwise,
+    the download starts again from the first block.
+
+    Blocks are only kept for resources having an ETag. Disabling resumable
+    downloads discards all the blocks kept so far.
+
+    \sa setBlockSize()
+*/
+void QCoapClient::setResumableDownloadEnabled(bool enabled)
+{
+    Q_D(QCoapClient);
+    QMetaObject::invokeMethod(d->protocol, "setResumableDownloadEnabled", Qt::QueuedConnection,
+                              Q_ARG(bool, enabled));
+}
+
 QT_END_NAMESPACE
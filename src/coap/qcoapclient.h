@@ -8,12 +8,14 @@
 #include <QtCore/qglobal.h>
 #include <QtCoap/qcoapglobal.h>
 #include <QtCoap/qcoapnamespace.h>
+#include <QtCore/qlist.h>
 #include <QtCore/qobject.h>
 #include <QtNetwork/qabstractsocket.h>
 
 QT_BEGIN_NAMESPACE
 
 class QCoapReply;
+class QCoapObserveGroup;
 class QCoapResourceDiscoveryReply;
 class QCoapRequest;
 class QCoapProtocol;
@@ -29,6 +31,9 @@ class Q_COAP_EXPORT QCoapClient : public QObject
 public:
     explicit QCoapClient(QtCoap::SecurityMode securityMode = QtCoap::SecurityMode::NoSecurity,
                          QObject *parent = nullptr);
+    explicit QCoapClient(QtCoap::Transport transport,
+                         QtCoap::SecurityMode securityMode = QtCoap::SecurityMode::NoSecurity,
+                         QObject *parent = nullptr);
     ~QCoapClient();
 
     QCoapReply *get(const QCoapRequest &request);
@@ -43,8 +48,19 @@ public:
     QCoapReply *deleteResource(const QUrl &url);
     QCoapReply *observe(const QCoapRequest &request);
     QCoapReply *observe(const QUrl &request);
+    QCoapObserveGroup *observe(const QList<QCoapRequest> &requests, uint rate,
+                               double jitter = 0.5);
     void cancelObserve(QCoapReply *notifiedReply);
     void cancelObserve(const QUrl &url);
+    void cancelObserveByPrefix(const QUrl &urlPrefix);
+    void cancelObserveHost(const QString &host);
+    void setNotificationInterval(QCoapReply *notifiedReply, uint interval);
+    quint64 observeCompact(const QCoapRequest &request);
+    quint64 observeCompact(const QUrl &url);
+    void cancelCompactObserve(quint64 observation);
+    QByteArray saveObservations();
+    QList<QCoapReply *> restoreObservations(const QByteArray &snapshot);
+    void connectToHost(const QString &host, quint16 port = 0);
     void disconnect();
 
     QCoapResourceDiscoveryReply *discover(
@@ -58,17 +74,30 @@ public:
     void setSecurityConfiguration(const QCoapSecurityConfiguration &configuration);
     void setBlockSize(quint16 blockSize);
     void setSocketOption(QAbstractSocket::SocketOption option, const QVariant &value);
+    void setDtlsSessionIdleTimeout(uint timeout);
+    void setConnectedSocketThreshold(uint rate);
+    QByteArray saveDtlsSessions();
+    bool restoreDtlsSessions(const QByteArray &snapshot);
     void setMaximumServerResponseDelay(uint responseDelay);
     void setAckTimeout(uint ackTimeout);
     void setAckRandomFactor(double ackRandomFactor);
     void setMaximumRetransmitCount(uint maximumRetransmitCount);
     void setMinimumTokenSize(int tokenSize);
+    void setBlockWindowSize(uint windowSize);
+    void setMaximumConcurrentRequests(uint maximumConcurrentRequests);
+    void setQBlockEnabled(bool enabled);
+    void setMaximumPayloads(uint maximumPayloads);
+    void setResumableDownloadEnabled(bool enabled);
 
 Q_SIGNALS:
     void finished(QCoapReply *reply);
     void responseToMulticastReceived(QCoapReply *reply, const QCoapMessage &message,
                                      const QHostAddress &sender);
     void error(QCoapReply *reply, QtCoap::Error error);
+    void endpointBlockSizeChanged(const QUrl &endpoint, quint16 blockSize);
+    void compactNotified(quint64 observation, const QCoapMessage &message);
+    void compactObserveFailed(quint64 observation, QtCoap::Error error);
+    void connected(const QString &host, quint16 port);
 
 protected:
     Q_DECLARE_PRIVATE(QCoapClient)
@@ -32,12 +32,16 @@ public:
     QCoapProtocol *protocol = nullptr;
     QCoapConnection *connection = nullptr;
     QThread *workerThread = nullptr;
+    quint64 lastCompactObservation = 0;
 
     QCoapReply *sendRequest(const QCoapRequest &request);
     QCoapResourceDiscoveryReply *sendDiscovery(const QCoapRequest &request);
     bool send(QCoapReply *reply);
+    bool canSend(const QCoapRequest &request) const;
 
     void setConnection(QCoapConnection *customConnection);
+    static QCoapConnection *createConnection(QtCoap::Transport transport,
+                                             QtCoap::SecurityMode securityMode);
 
     Q_DECLARE_PUBLIC(QCoapClient)
 };
@@ -5,10 +5,22 @@
 
 #include <QtCore/qloggingcategory.h>
 
+#include <utility>
+
 QT_BEGIN_NAMESPACE
 
 Q_LOGGING_CATEGORY(lcCoapConnection, "qt.coap.connection")
 
+namespace {
+
+// MAX_TRANSMIT_WAIT with the default transmission parameters, after which the
+// exchange of a frame is over, see RFC 7252 section 4.8.2
+constexpr qint64 FrameLifetime = 93 * 1000;
+// Version, type, token length, code and message ID, identifying a message
+constexpr qsizetype MessageHeaderSize = 4;
+
+} // namespace
+
 /*!
     \internal
 
@@ -68,6 +80,17 @@ Q_LOGGING_CATEGORY(lcCoapConnection, "qt.coap.connection")
     \sa bind()
 */
 
+/*!
+    \internal
+
+    \fn void QCoapConnection::connected(const QString &host, quint16 port)
+
+    This signal is emitted when the transport is ready for data transmission
+    to the given \a host on \a port, after connectToHost() was called.
+
+    \sa connectToHost()
+*/
+
 /*!
     \fn void QCoapConnection::securityConfigurationChanged()
 
@@ -77,10 +100,34 @@ Q_LOGGING_CATEGORY(lcCoapConnection, "qt.coap.connection")
 /*!
     \internal
 
-    \fn void QCoapConnection::bind(const QString &host, quint16 port)
+    \fn void QCoapConnection::frameDropped(const QByteArray &frame, QtCoap::Error error)
 
-    Prepares the underlying transport for data transmission to to the given \a host
-    address on \a port. Emits the bound() signal when the transport is ready.
+    This signal is emitted when the transport drops a \a frame after
+    accepting it, for instance because it was waiting for a connection
+    which failed. The \a error parameter describes why, and the exchange
+    of the \a frame fails with it.
+*/
+
+/*!
+    \internal
+
+    \fn void QCoapConnection::peerSettingsChanged(const CoapEndpoint &endpoint)
+
+    This signal is emitted when the settings of the peer at \a endpoint,
+    such as its BERT support, are received, or when the session waiting for
+    them is closed. The exchanges held back by waitForPeerSettings() can
+    then be sent.
+
+    \sa QCoapConnectionPrivate::waitForPeerSettings()
+*/
+
+/*!
+    \internal
+
+    \fn void QCoapConnection::bind(const CoapEndpoint &endpoint)
+
+    Prepares the underlying transport for data transmission to to the given
+    \a endpoint. Emits the bound() signal when the transport is ready.
 
     This is a pure virtual method.
 
@@ -101,13 +148,84 @@ Q_LOGGING_CATEGORY(lcCoapConnection, "qt.coap.connection")
 /*!
     \internal
 
-    \fn void QCoapConnection::writeData(const QByteArray &data, const QString &host, quint16 port)
+    \fn void QCoapConnection::writeData(const QByteArray &data, const CoapEndpoint &endpoint)
 
-    Sends the given \a data frame to the host address \a host at port \a port.
+    Sends the given \a data frame to the \a endpoint.
 
     This is a pure virtual method.
 */
 
+/*!
+    \internal
+
+    \class CoapFrameQueue
+    \inmodule QtCoap
+
+    \brief The CoapFrameQueue class holds the frames waiting for the
+    transport to be ready for a peer.
+
+    The queue holds at most Capacity frames. A retransmission replaces the
+    queued frame of the same message instead of being queued again, and the
+    frames are dropped once their exchange is over, so that a stalled
+    transport neither accumulates frames nor sends stale ones when it gets
+    ready.
+*/
+
+/*!
+    \internal
+
+    Queues the \a frame, or replaces the queued frame of the same message.
+    Returns \c false if the \a frame is dropped because the queue is full.
+*/
+bool CoapFrameQueue::enqueue(const QByteArray &frame)
+{
+    removeExpiredFrames();
+
+    if (frame.size() >= MessageHeaderSize) {
+        const QByteArrayView header(frame.constData(), MessageHeaderSize);
+        for (auto &queued : frames) {
+            if (queued.data.startsWith(header)) {
+                queued = { frame, QDeadlineTimer(FrameLifetime) };
+                return true;
+            }
+        }
+    }
+
+    if (frames.size() >= Capacity)
+        return false;
+
+    frames.append({ frame, QDeadlineTimer(FrameLifetime) });
+    return true;
+}
+
+/*!
+    \internal
+
+    Removes the frames of the queue which did not expire, and returns them
+    in order.
+*/
+QList<QByteArray> CoapFrameQueue::takeAll()
+{
+    removeExpiredFrames();
+
+    QList<QByteArray> data;
+    data.reserve(frames.size());
+    for (const auto &frame : std::as_const(frames))
+        data.append(frame.data);
+    frames.clear();
+    return data;
+}
+
+/*!
+    \internal
+
+    Drops the frames queued for longer than the lifetime of an exchange.
+*/
+void CoapFrameQueue::removeExpiredFrames()
+{
+    frames.removeIf([](const QueuedFrame &frame) { return frame.expiry.hasExpired(); });
+}
+
 QCoapConnectionPrivate::QCoapConnectionPrivate(QtCoap::SecurityMode security)
     : securityMode(security)
     , state(QCoapConnection::ConnectionState::Unconnected)
@@ -136,7 +254,13 @@ QCoapConnection::QCoapConnection(QObjectPrivate &dd, QObject *parent)
             [this]() {
                 Q_D(QCoapConnection);
                 d->state = ConnectionState::Bound;
-                startToSendRequest();
+
+                const auto hosts = std::exchange(d->hostsToConnect, {});
+                for (const auto &host : hosts)
+                    openSession(host);
+
+                if (!d->framesToSend.isEmpty())
+                    startToSendRequest();
             });
 }
 
@@ -153,24 +277,80 @@ QCoapConnection::~QCoapConnection()
     \internal
 
     Prepares the underlying transport for data transmission and sends the given
-    \a request frame to the given \a host at the given \a port when the transport
-    is ready.
+    \a request frame to the given \a endpoint when the transport is ready.
 
     The preparation of the transport is done by calling the pure virtual bind() method,
-    which needs to be implemented by derived classes.
+    which needs to be implemented by derived classes. The frames sent in the meantime
+    are queued per peer, see CoapFrameQueue.
+
+    Returns \c false if the frame is dropped because too many frames are waiting
+    for the peer. Derived implementations queueing frames themselves, for instance
+    during a handshake, report it by setting frameRejected in writeData().
 */
-void
-QCoapConnectionPrivate::sendRequest(const QByteArray &request, const QString &host, quint16 port)
+bool QCoapConnectionPrivate::sendRequest(const QByteArray &request, const CoapEndpoint &endpoint)
 {
     Q_Q(QCoapConnection);
 
-    CoapFrame frame(request, host, port);
-    framesToSend.enqueue(frame);
+    if (state == QCoapConnection::ConnectionState::Bound) {
+        frameRejected = false;
+        q->writeData(request, endpoint);
+        return !std::exchange(frameRejected, false);
+    }
+
+    if (!framesToSend[endpoint].enqueue(request)) {
+        qCWarning(lcCoapConnection) << "Too many frames waiting for" << endpoint.host
+                                    << endpoint.port << "- dropping frame";
+        return false;
+    }
+
+    q->bind(endpoint);
+    return true;
+}
+
+/*!
+    \internal
+
+    Returns \c true if the transport delivers the frames reliably and in
+    order, in which case the protocol does not retransmit them. Derived
+    implementations over a reliable transport, such as TCP, must
+    reimplement this method.
+*/
+bool QCoapConnectionPrivate::isReliable() const
+{
+    return false;
+}
+
+/*!
+    \internal
+
+    Returns the size of the BERT blocks to use with the \a endpoint, or \c 0
+    if BERT is not supported by the transport or by the \a endpoint. BERT
+    blocks are made of several blocks of 1024 bytes, and are only used over
+    reliable transports, see
+    \l{https://tools.ietf.org/html/rfc8323#section-6}{RFC 8323}.
+*/
+uint QCoapConnectionPrivate::bertBlockSize(const CoapEndpoint &endpoint) const
+{
+    Q_UNUSED(endpoint)
+    return 0;
+}
+
+/*!
+    \internal
 
-    if (state == QCoapConnection::ConnectionState::Unconnected)
-        q->bind(host, port);
-    else
-        q->startToSendRequest();
+    Returns \c true if the settings of the peer at \a endpoint are not known
+    yet, in which case the session with the peer is set up and the
+    peerSettingsChanged() signal is emitted once they are. The protocol
+    holds back the new exchanges with the peer until then, so that they
+    use these settings, for instance BERT blocks.
+
+    The default implementation returns \c false, the transports without
+    any session settings do not need to reimplement it.
+*/
+bool QCoapConnectionPrivate::waitForPeerSettings(const CoapEndpoint &endpoint)
+{
+    Q_UNUSED(endpoint)
+    return false;
 }
 
 /*!
@@ -209,17 +389,18 @@ QCoapConnection::ConnectionState QCoapConnection::state() const
 /*!
     \internal
 
-    Sends the last stored frame to the server by calling the pure virtual
-    writeData() method.
+    Sends the frames queued while the transport was not ready by calling the
+    pure virtual writeData() method.
 */
 void QCoapConnection::startToSendRequest()
 {
     Q_D(QCoapConnection);
 
-    Q_ASSERT(!d->framesToSend.isEmpty());
-    while (!d->framesToSend.isEmpty()) {
-        const CoapFrame frame = d->framesToSend.dequeue();
-        writeData(frame.currentPdu, frame.host, frame.port);
+    auto queues = std::exchange(d->framesToSend, {});
+    for (auto it = queues.begin(); it != queues.end(); ++it) {
+        const auto frames = it->takeAll();
+        for (const auto &frame : frames)
+            writeData(frame, it.key());
     }
 }
 
@@ -253,6 +434,46 @@ QCoapSecurityConfiguration QCoapConnection::securityConfiguration() const
     return d->securityConfiguration;
 }
 
+/*!
+    \internal
+
+    Prepares the underlying transport for data transmission to the given
+    \a host on \a port ahead of the first request, and emits the
+    connected() signal when it is ready. For instance, a secure transport
+    completes its handshake with the \a host.
+
+    \sa connected(), openSession()
+*/
+void QCoapConnection::connectToHost(const QString &host, quint16 port)
+{
+    Q_D(QCoapConnection);
+
+    const CoapEndpoint endpoint(host, port, isSecure());
+    if (d->state == ConnectionState::Unconnected) {
+        d->hostsToConnect.append(endpoint);
+        bind(endpoint);
+    } else {
+        openSession(endpoint);
+    }
+}
+
+/*!
+    \internal
+
+    Sets up the session with the given \a endpoint, once the transport is
+    bound, and emits the connected() signal when it is ready.
+
+    The default implementation emits the connected() signal right away, as
+    no session is needed. Derived implementations with a session per host,
+    such as secure transports, must reimplement this method.
+
+    \sa connectToHost()
+*/
+void QCoapConnection::openSession(const CoapEndpoint &endpoint)
+{
+    emit connected(endpoint.host, endpoint.port);
+}
+
 /*!
     \internal
 
@@ -266,6 +487,7 @@ void QCoapConnection::disconnect()
     close();
 
     d->framesToSend.clear();
+    d->hostsToConnect.clear();
     d->state = ConnectionState::Unconnected;
 }
 
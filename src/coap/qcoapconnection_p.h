@@ -7,9 +7,12 @@
 #include <QtCoap/qcoapnamespace.h>
 #include <QtCoap/qcoapsecurityconfiguration.h>
 
-#include <QtCore/qqueue.h>
+#include <QtCore/qdeadlinetimer.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qlist.h>
 #include <QtCore/qobject.h>
 #include <QtNetwork/qabstractsocket.h>
+#include <private/qcoapendpoint_p.h>
 #include <private/qobject_p.h>
 
 //
@@ -45,13 +48,17 @@ public:
     QCoapSecurityConfiguration securityConfiguration() const;
 
     Q_INVOKABLE void setSecurityConfiguration(const QCoapSecurityConfiguration &configuration);
+    Q_INVOKABLE void connectToHost(const QString &host, quint16 port);
     Q_INVOKABLE void disconnect();
 
 Q_SIGNALS:
     void error(QAbstractSocket::SocketError error);
     void readyRead(const QByteArray &data, const QHostAddress &sender);
     void bound();
+    void connected(const QString &host, quint16 port);
     void securityConfigurationChanged();
+    void frameDropped(const QByteArray &frame, QtCoap::Error error);
+    void peerSettingsChanged(const CoapEndpoint &endpoint);
 
 private:
     void startToSendRequest();
@@ -59,9 +66,10 @@ private:
 protected:
     QCoapConnection(QObjectPrivate &dd, QObject *parent = nullptr);
 
-    virtual void bind(const QString &host, quint16 port) = 0;
-    virtual void writeData(const QByteArray &data, const QString &host, quint16 port) = 0;
+    virtual void bind(const CoapEndpoint &endpoint) = 0;
+    virtual void writeData(const QByteArray &data, const CoapEndpoint &endpoint) = 0;
     virtual void close() = 0;
+    virtual void openSession(const CoapEndpoint &endpoint);
 
 private:
     friend class QCoapProtocolPrivate;
@@ -69,13 +77,27 @@ private:
     Q_DECLARE_PRIVATE(QCoapConnection)
 };
 
-struct CoapFrame {
-    QByteArray currentPdu;
-    QString host;
-    quint16 port = 0;
+// Bounded queue of the frames waiting for the transport to be ready for a peer
+class Q_AUTOTEST_EXPORT CoapFrameQueue
+{
+public:
+    static constexpr qsizetype Capacity = 64;
+
+    bool enqueue(const QByteArray &frame);
+    QList<QByteArray> takeAll();
+
+    bool isEmpty() const { return frames.isEmpty(); }
+    qsizetype size() const { return frames.size(); }
+    void clear() { frames.clear(); }
 
-    CoapFrame(const QByteArray &pdu, const QString &hostName, quint16 portNumber)
-    : currentPdu(pdu), host(hostName), port(portNumber) {}
+private:
+    void removeExpiredFrames();
+
+    struct QueuedFrame {
+        QByteArray data;
+        QDeadlineTimer expiry;
+    };
+    QList<QueuedFrame> frames;
 };
 
 class Q_AUTOTEST_EXPORT QCoapConnectionPrivate : public QObjectPrivate
@@ -85,12 +107,18 @@ public:
 
     ~QCoapConnectionPrivate() override = default;
 
-    void sendRequest(const QByteArray &request, const QString &host, quint16 port);
+    bool sendRequest(const QByteArray &request, const CoapEndpoint &endpoint);
+
+    virtual bool isReliable() const;
+    virtual uint bertBlockSize(const CoapEndpoint &endpoint) const;
+    virtual bool waitForPeerSettings(const CoapEndpoint &endpoint);
 
     QCoapSecurityConfiguration securityConfiguration;
     QtCoap::SecurityMode securityMode;
     QCoapConnection::ConnectionState state;
-    QQueue<CoapFrame> framesToSend;
+    QHash<CoapEndpoint, CoapFrameQueue> framesToSend;
+    bool frameRejected = false;
+    QList<CoapEndpoint> hostsToConnect;
 
     Q_DECLARE_PUBLIC(QCoapConnection)
 };
@@ -0,0 +1,66 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include "qcoapendpoint_p.h"
+
+#include <QtCoap/qcoapnamespace.h>
+#include <QtCore/qurl.h>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \internal
+
+    \class CoapEndpoint
+    \inmodule QtCoap
+
+    \brief The CoapEndpoint class identifies the peer of an exchange.
+
+    The host of the target of a request is parsed once when the request is
+    set up, and the endpoint then goes with each of its frames to the
+    connection, so that neither the protocol nor the transport parse it
+    again per frame. The address is null if the host is a name, which the
+    transport resolves.
+
+    Two endpoints are equal if they have the same host, port and security.
+*/
+
+/*!
+    \internal
+
+    Constructs an endpoint for \a host at \a port, with \a secure telling
+    whether the exchanges with it are secured. \a host may be an IP address
+    or a host name.
+*/
+CoapEndpoint::CoapEndpoint(const QString &host, quint16 port, bool secure)
+    : host(host), address(host), port(port), secure(secure), multicast(address.isMulticast())
+{
+}
+
+/*!
+    \internal
+
+    Constructs an endpoint for \a address at \a port, with \a secure telling
+    whether the exchanges with it are secured.
+*/
+CoapEndpoint::CoapEndpoint(const QHostAddress &address, quint16 port, bool secure)
+    : host(address.toString()), address(address), port(port), secure(secure),
+      multicast(address.isMulticast())
+{
+}
+
+/*!
+    \internal
+
+    Returns the endpoint of the host and port of \a url. The exchanges are
+    secured for the \c coaps scheme. The port is the default port of the
+    scheme if \a url has none.
+*/
+CoapEndpoint CoapEndpoint::fromUrl(const QUrl &url)
+{
+    const bool secure = url.scheme() == QLatin1String("coaps");
+    const int defaultPort = secure ? QtCoap::DefaultSecurePort : QtCoap::DefaultPort;
+    return CoapEndpoint(url.host(), static_cast<quint16>(url.port(defaultPort)), secure);
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,64 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#ifndef QCOAPENDPOINT_P_H
+#define QCOAPENDPOINT_P_H
+
+#include <QtCoap/qcoapglobal.h>
+
+#include <QtCore/qhashfunctions.h>
+#include <QtCore/qstring.h>
+#include <QtNetwork/qhostaddress.h>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API. It exists purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+QT_BEGIN_NAMESPACE
+
+class QUrl;
+
+// Peer of an exchange, parsed once from the target of the request
+struct Q_AUTOTEST_EXPORT CoapEndpoint
+{
+    CoapEndpoint() = default;
+    CoapEndpoint(const QString &host, quint16 port, bool secure = false);
+    CoapEndpoint(const QHostAddress &address, quint16 port, bool secure = false);
+
+    static CoapEndpoint fromUrl(const QUrl &url);
+
+    bool isHostName() const { return address.isNull() && !host.isEmpty(); }
+
+    QString host;
+    // Null if the host is a name, the scope of IPv6 addresses included
+    QHostAddress address;
+    quint16 port = 0;
+    bool secure = false;
+    bool multicast = false;
+};
+
+inline bool operator==(const CoapEndpoint &lhs, const CoapEndpoint &rhs) noexcept
+{
+    return lhs.port == rhs.port && lhs.secure == rhs.secure && lhs.host == rhs.host;
+}
+
+inline bool operator!=(const CoapEndpoint &lhs, const CoapEndpoint &rhs) noexcept
+{
+    return !(lhs == rhs);
+}
+
+inline size_t qHash(const CoapEndpoint &endpoint, size_t seed = 0) noexcept
+{
+    return qHashMulti(seed, endpoint.host, endpoint.port, endpoint.secure);
+}
+
+QT_END_NAMESPACE
+
+#endif // QCOAPENDPOINT_P_H
@@ -81,13 +81,24 @@ QCoapInternalMessage::QCoapInternalMessage(QCoapInternalMessagePrivate &dd, QObj
     \note For block-wise transfer, the size of the block is expressed by a power
     of two. See
     \l{https://tools.ietf.org/html/rfc7959#section-2.2}{'Structure of a Block Option'}
-    in RFC 7959 for more information.
+    in RFC 7959 for more information. Over reliable transports, a SZX of 7
+    stands for a BERT block, made of one or more blocks of 1024 bytes, see
+    \l{https://tools.ietf.org/html/rfc8323#section-6}{RFC 8323}.
 */
 void QCoapInternalMessage::setFromDescriptiveBlockOption(const QCoapOption &option)
 {
     Q_D(QCoapInternalMessage);
 
     const auto value = option.opaqueValue();
+    if (value.isEmpty()) {
+        // A zero-length value stands for block 0, with no more blocks and a size of 16
+        d->currentBlockNumber = 0;
+        d->hasNextBlock = false;
+        d->blockSize = 16;
+        d->bertBlock = false;
+        return;
+    }
+
     const quint8 *optionData = reinterpret_cast<const quint8 *>(value.data());
     const quint8 lastByte = optionData[option.length() - 1];
     quint32 blockNumber = 0;
@@ -98,10 +109,8 @@ void QCoapInternalMessage::setFromDescriptiveBlockOption(const QCoapOption &opti
     blockNumber = (blockNumber << 4) | (lastByte >> 4);
     d->currentBlockNumber = blockNumber;
     d->hasNextBlock = ((lastByte & 0x8) == 0x8);
-    d->blockSize = static_cast<uint>(1u << ((lastByte & 0x7) + 4));
-
-    if (d->blockSize > 1024)
-        qCWarning(lcCoapExchange, "Received a block size larger than 1024, something may be wrong.");
+    d->bertBlock = (lastByte & 0x7) == 7;
+    d->blockSize = d->bertBlock ? 1024 : static_cast<uint>(1u << ((lastByte & 0x7) + 4));
 }
 
 /*!
@@ -205,6 +214,45 @@ uint QCoapInternalMessage::blockSize() const
     return d->blockSize;
 }
 
+/*!
+    \internal
+
+    Returns \c true if the current block is a BERT block. Its number then
+    counts blocks of 1024 bytes, and its payload may hold several of them.
+*/
+bool QCoapInternalMessage::isBertBlock() const
+{
+    Q_D(const QCoapInternalMessage);
+    return d->bertBlock;
+}
+
+/*!
+    \internal
+
+    Returns the offset of the current block in the whole payload.
+*/
+uint QCoapInternalMessage::blockOffset() const
+{
+    Q_D(const QCoapInternalMessage);
+    return d->currentBlockNumber * d->blockSize;
+}
+
+/*!
+    \internal
+
+    Returns the offset of the data following the current block in the
+    whole payload. The size of a BERT block is the size of its payload.
+*/
+uint QCoapInternalMessage::nextBlockOffset() const
+{
+    Q_D(const QCoapInternalMessage);
+    if (d->bertBlock) {
+        return d->currentBlockNumber * d->blockSize
+                + static_cast<uint>(d->message.payload().size());
+    }
+    return (d->currentBlockNumber + 1) * d->blockSize;
+}
+
 /*!
     \internal
 
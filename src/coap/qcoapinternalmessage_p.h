@@ -41,6 +41,9 @@ public:
     uint currentBlockNumber() const;
     bool hasMoreBlocksToReceive() const;
     uint blockSize() const;
+    bool isBertBlock() const;
+    uint blockOffset() const;
+    uint nextBlockOffset() const;
 
     virtual bool isValid() const;
     static bool isUrlValid(const QUrl &url);
@@ -64,6 +67,7 @@ public:
     uint currentBlockNumber = 0;
     bool hasNextBlock = false;
     uint blockSize = 0;
+    bool bertBlock = false;
 };
 
 QT_END_NAMESPACE
@@ -76,8 +76,8 @@ QCoapInternalReply *QCoapInternalReply::createFromFrame(const QByteArray &reply,
             ++i;
             optionDelta = pduData[i] + 13;
         } else if (optionDelta == 14) {
-            ++i;
-            optionDelta = pduData[i] + 269;
+            i += 2;
+            optionDelta = ((pduData[i - 1] << 8) | pduData[i]) + 269;
         }
 
         // Delta length > 12 : special values
@@ -85,8 +85,8 @@ QCoapInternalReply *QCoapInternalReply::createFromFrame(const QByteArray &reply,
             ++i;
             optionLength = pduData[i] + 13;
         } else if (optionLength == 14) {
-            ++i;
-            optionLength = pduData[i] + 269;
+            i += 2;
+            optionLength = ((pduData[i - 1] << 8) | pduData[i]) + 269;
         }
 
         quint16 optionNumber = lastOptionNumber + optionDelta;
@@ -122,7 +122,7 @@ void QCoapInternalReply::appendData(const QByteArray &data)
 */
 void QCoapInternalReply::addOption(const QCoapOption &option)
 {
-    if (option.name() == QCoapOption::Block2)
+    if (option.name() == QCoapOption::Block2 || option.name() == QCoapOption::QBlock2)
         setFromDescriptiveBlockOption(option);
 
     QCoapInternalMessage::addOption(option);
@@ -150,7 +150,7 @@ int QCoapInternalReply::nextBlockToSend() const
     Q_D(const QCoapInternalReply);
 
     QCoapOption option = d->message.option(QCoapOption::Block1);
-    if (!option.isValid())
+    if (!option.isValid() || option.length() == 0)
         return -1;
 
     const auto value = option.opaqueValue();
@@ -147,45 +147,52 @@ QByteArray QCoapInternalRequest::toQByteArray() const
                                     return a.name() < b.name();
                  }));
 
-        quint8 lastOptionNumber = 0;
+        quint16 lastOptionNumber = 0;
         for (const QCoapOption &option : std::as_const(options)) {
 
             quint16 optionDelta = static_cast<quint16>(option.name()) - lastOptionNumber;
             bool isOptionDeltaExtended = false;
-            quint8 optionDeltaExtended = 0;
+            quint16 optionDeltaExtended = 0;
 
             // Delta value > 12 : special values
             if (optionDelta > 268) {
-                optionDeltaExtended = static_cast<quint8>(optionDelta - 269);
+                optionDeltaExtended = static_cast<quint16>(optionDelta - 269);
                 optionDelta = 14;
                 isOptionDeltaExtended = true;
             } else if (optionDelta > 12) {
-                optionDeltaExtended = static_cast<quint8>(optionDelta - 13);
+                optionDeltaExtended = static_cast<quint16>(optionDelta - 13);
                 optionDelta = 13;
                 isOptionDeltaExtended = true;
             }
 
             quint16 optionLength = static_cast<quint16>(option.length());
             bool isOptionLengthExtended = false;
-            quint8 optionLengthExtended = 0;
+            quint16 optionLengthExtended = 0;
 
             // Length > 12 : special values
             if (optionLength > 268) {
-                optionLengthExtended = static_cast<quint8>(optionLength - 269);
+                optionLengthExtended = static_cast<quint16>(optionLength - 269);
                 optionLength = 14;
                 isOptionLengthExtended = true;
             } else if (optionLength > 12) {
-                optionLengthExtended = static_cast<quint8>(optionLength - 13);
+                optionLengthExtended = static_cast<quint16>(optionLength - 13);
                 optionLength = 13;
                 isOptionLengthExtended = true;
             }
 
             appendByte(&pdu, (optionDelta << 4) | (optionLength & 0x0F));
 
-            if (isOptionDeltaExtended)
-                appendByte(&pdu, optionDeltaExtended);
-            if (isOptionLengthExtended)
-                appendByte(&pdu, optionLengthExtended);
+            // Extended values use 1 byte for 13, and 2 bytes for 14
+            if (isOptionDeltaExtended) {
+                if (optionDelta == 14)
+                    appendByte(&pdu, optionDeltaExtended >> 8);
+                appendByte(&pdu, optionDeltaExtended & 0xFF);
+            }
+            if (isOptionLengthExtended) {
+                if (optionLength == 14)
+                    appendByte(&pdu, optionLengthExtended >> 8);
+                appendByte(&pdu, optionLengthExtended & 0xFF);
+            }
 
             pdu.append(option.opaqueValue());
 
@@ -218,29 +225,67 @@ void QCoapInternalRequest::setToRequestBlock(uint blockNumber, uint blockSize)
 
     d->message.removeOption(QCoapOption::Block1);
     d->message.removeOption(QCoapOption::Block2);
+    d->message.removeOption(QCoapOption::QBlock1);
+    d->message.removeOption(QCoapOption::QBlock2);
 
     addOption(blockOption(QCoapOption::Block2, blockNumber, blockSize));
 }
 
+/*!
+    \internal
+    Creates the Q-Block2 options needed to request the blocks listed in
+    \a blockNumbers, with a size of \a blockSize. If \a moreBlocks is \c true,
+    the M bit of the options is set, asking the server to also send the
+    blocks following the requested one, up to the end of the set.
+
+    For more details, refer to the
+    \l{https://tools.ietf.org/html/rfc9177#section-4.4}{RFC 9177}.
+
+    \sa blockOption(), setToRequestBlock()
+*/
+void QCoapInternalRequest::setToRequestQBlocks(const QList<uint> &blockNumbers, uint blockSize,
+                                               bool moreBlocks)
+{
+    Q_D(QCoapInternalRequest);
+
+    d->message.removeOption(QCoapOption::Block1);
+    d->message.removeOption(QCoapOption::Block2);
+    d->message.removeOption(QCoapOption::QBlock1);
+    d->message.removeOption(QCoapOption::QBlock2);
+
+    for (uint blockNumber : blockNumbers) {
+        if (checkBlockNumber(blockNumber))
+            addOption(blockOption(QCoapOption::QBlock2, blockNumber, blockSize, moreBlocks));
+    }
+}
+
 /*!
     \internal
     Initialize blocks parameters and creates the options needed to send the block with
-    the number \a blockNumber and with a size of \a blockSize.
+    the number \a blockNumber and with a size of \a blockSize. The block
+    option \a name should be either QCoapOption::Block1 or QCoapOption::QBlock1.
+    For BERT blocks, \a blockNumber counts blocks of 1024 bytes, see blockOption().
+
+    The Request-Tag option, if any, is kept on all blocks.
 
     \sa blockOption(), setToRequestBlock()
 */
-void QCoapInternalRequest::setToSendBlock(uint blockNumber, uint blockSize)
+void QCoapInternalRequest::setToSendBlock(uint blockNumber, uint blockSize,
+                                          QCoapOption::OptionName name)
 {
     Q_D(QCoapInternalRequest);
+    Q_ASSERT(name == QCoapOption::Block1 || name == QCoapOption::QBlock1);
 
     if (!checkBlockNumber(blockNumber))
         return;
 
-    d->message.setPayload(d->fullPayload.mid(static_cast<int>(blockNumber * blockSize),
+    const uint blockUnit = qMin(blockSize, 1024u);
+    d->message.setPayload(d->fullPayload.mid(static_cast<int>(blockNumber * blockUnit),
                                              static_cast<int>(blockSize)));
     d->message.removeOption(QCoapOption::Block1);
+    d->message.removeOption(QCoapOption::QBlock1);
 
-    addOption(blockOption(QCoapOption::Block1, blockNumber, blockSize));
+    addOption(blockOption(name, blockNumber, blockSize));
 }
 
 /*!
@@ -266,13 +311,23 @@ bool QCoapInternalRequest::checkBlockNumber(uint blockNumber)
     The \a blockSize should range from 16 to 1024 and be a power of 2,
     computed as 2^(SZX + 4), with SZX ranging from 0 to 6. For more details,
     refer to the \l{https://tools.ietf.org/html/rfc7959#section-2.2}{RFC 7959}.
+
+    Over reliable transports, \a blockSize may also be a multiple of 1024
+    larger than 1024, for a BERT block. SZX is then 7, and \a blockNumber
+    counts blocks of 1024 bytes. See
+    \l{https://tools.ietf.org/html/rfc8323#section-6}{RFC 8323}.
+
+    For Block1 and Q-Block1 options, the M bit is set if more blocks of the
+    payload follow. For Q-Block2 options, it is set if \a moreBlocks is \c true.
 */
-QCoapOption QCoapInternalRequest::blockOption(QCoapOption::OptionName name, uint blockNumber, uint blockSize) const
+QCoapOption QCoapInternalRequest::blockOption(QCoapOption::OptionName name, uint blockNumber,
+                                              uint blockSize, bool moreBlocks) const
 {
     Q_D(const QCoapInternalRequest);
 
-    Q_ASSERT((blockSize & (blockSize - 1)) == 0); // is a power of two
-    Q_ASSERT(!(blockSize >> 11)); // blockSize <= 1024
+    const bool bert = blockSize > 1024;
+    Q_ASSERT(bert || (blockSize & (blockSize - 1)) == 0); // is a power of two
+    Q_ASSERT(!bert || blockSize % 1024 == 0); // is a multiple of 1024 for BERT
 
     // NUM field: the relative number of the block within a sequence of blocks
     // 4, 12 or 20 bits (as little as possible)
@@ -280,15 +335,20 @@ QCoapOption QCoapInternalRequest::blockOption(QCoapOption::OptionName name, uint
     quint32 optionData = (blockNumber << 4);
 
     // SZX field: the size of the block
-    // 3 bits, set to "log2(blockSize) - 4"
-    optionData |= (blockSize >> 7)
-                  ? ((blockSize >> 10) ? 6 : (3 + (blockSize >> 8)))
-                  : (blockSize >> 5);
+    // 3 bits, set to "log2(blockSize) - 4", or to 7 for BERT
+    optionData |= bert ? 7
+                       : (blockSize >> 7)
+                         ? ((blockSize >> 10) ? 6 : (3 + (blockSize >> 8)))
+                         : (blockSize >> 5);
 
     // M field: whether more blocks are following
     // 1 bit
-    if (name == QCoapOption::Block1
-            && static_cast<int>((blockNumber + 1) * blockSize) < d->fullPayload.size()) {
+    const uint blockUnit = bert ? 1024 : blockSize;
+    if ((name == QCoapOption::Block1 || name == QCoapOption::QBlock1)
+            && static_cast<qsizetype>(blockNumber * blockUnit + blockSize)
+               < d->fullPayload.size()) {
+        optionData |= 8;
+    } else if (name == QCoapOption::QBlock2 && moreBlocks) {
         optionData |= 8;
     }
 
@@ -329,7 +389,7 @@ void QCoapInternalRequest::setToken(const QCoapToken &token)
 */
 void QCoapInternalRequest::addOption(const QCoapOption &option)
 {
-    if (option.name() == QCoapOption::Block1)
+    if (option.name() == QCoapOption::Block1 || option.name() == QCoapOption::QBlock1)
         setFromDescriptiveBlockOption(option);
 
     QCoapInternalMessage::addOption(option);
@@ -349,6 +409,7 @@ bool QCoapInternalRequest::addUriOptions(QUrl uri, const QUrl &proxyUri)
     Q_D(QCoapInternalRequest);
     // Set to an invalid state
     d->targetUri = QUrl();
+    d->endpoint = CoapEndpoint();
 
     // When using a proxy uri, we SHOULD NOT include Uri-Host/Port/Path/Query
     // options.
@@ -358,6 +419,7 @@ bool QCoapInternalRequest::addUriOptions(QUrl uri, const QUrl &proxyUri)
 
         addOption(QCoapOption(QCoapOption::ProxyUri, proxyUri.toString()));
         d->targetUri = proxyUri;
+        d->endpoint = CoapEndpoint::fromUrl(proxyUri);
         return true;
     }
 
@@ -405,6 +467,7 @@ bool QCoapInternalRequest::addUriOptions(QUrl uri, const QUrl &proxyUri)
     }
 
     d->targetUri = uri;
+    d->endpoint = CoapEndpoint::fromUrl(uri);
     return true;
 }
 
@@ -417,6 +480,49 @@ QCoapToken QCoapInternalRequest::token() const
     return message()->token();
 }
 
+/*!
+    \internal
+    Returns the complete payload of the request. It differs from the payload
+    of the message when the request is sent block by block.
+
+    \sa setToSendBlock()
+*/
+QByteArray QCoapInternalRequest::fullPayload() const
+{
+    Q_D(const QCoapInternalRequest);
+    return d->fullPayload;
+}
+
+/*!
+    \internal
+    Returns the value of the Request-Tag option of the request, or an empty
+    byte array if there is no such option.
+
+    \sa setRequestTag()
+*/
+QByteArray QCoapInternalRequest::requestTag() const
+{
+    Q_D(const QCoapInternalRequest);
+    return d->message.option(QCoapOption::RequestTag).opaqueValue();
+}
+
+/*!
+    \internal
+    Sets the Request-Tag option of the request to \a tag. All the blocks of
+    the request payload are sent with this option, so that the server can
+    tell apart concurrent blockwise transfers to the same resource.
+    For more details, refer to the
+    \l{https://tools.ietf.org/html/rfc9175#section-3}{RFC 9175}.
+
+    \sa requestTag(), setToSendBlock()
+*/
+void QCoapInternalRequest::setRequestTag(const QByteArray &tag)
+{
+    Q_D(QCoapInternalRequest);
+    d->message.removeOption(QCoapOption::RequestTag);
+    addOption(QCoapOption::RequestTag, tag);
+}
+
 /*!
     \internal
     Used to mark the transmission as "in progress", when starting or retrying
@@ -452,6 +558,22 @@ void QCoapInternalRequest::startMulticastTransmission()
     d->multicastExpireTimer->start();
 }
 
+/*!
+    \internal
+
+    Starts the timeout timer for \a timeout milliseconds, without changing the
+    retransmission counter or the current timeout value. This is used when
+    the retransmissions are tracked by the protocol, for example for
+    the blocks of a block window.
+
+    \sa restartTransmission(), stopTransmission()
+*/
+void QCoapInternalRequest::startTimeoutTimer(uint timeout)
+{
+    Q_D(QCoapInternalRequest);
+    d->timeoutTimer->start(static_cast<int>(timeout));
+}
+
 /*!
     \internal
     Marks the transmission as not running, after a successful reception or an
@@ -482,6 +604,19 @@ QUrl QCoapInternalRequest::targetUri() const
     return d->targetUri;
 }
 
+/*!
+    \internal
+    Returns the endpoint of the target uri, parsed once when the target
+    uri is set, for the frames of the request.
+
+    \sa targetUri()
+*/
+const CoapEndpoint &QCoapInternalRequest::endpoint() const
+{
+    Q_D(const QCoapInternalRequest);
+    return d->endpoint;
+}
+
 /*!
     \internal
     Returns the connection used to send this request.
@@ -536,8 +671,8 @@ bool QCoapInternalRequest::isObserveCancelled() const
 */
 bool QCoapInternalRequest::isMulticast() const
 {
-    const QHostAddress hostAddress(targetUri().host());
-    return hostAddress.isMulticast();
+    Q_D(const QCoapInternalRequest);
+    return d->endpoint.multicast;
 }
 
 /*!
@@ -596,6 +731,7 @@ void QCoapInternalRequest::setTargetUri(QUrl targetUri)
 {
     Q_D(QCoapInternalRequest);
     d->targetUri = targetUri;
+    d->endpoint = CoapEndpoint::fromUrl(targetUri);
 }
 
 /*!
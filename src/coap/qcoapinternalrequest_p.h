@@ -45,7 +45,9 @@ public:
     void setMessageId(quint16);
     void setToken(const QCoapToken&);
     void setToRequestBlock(uint blockNumber, uint blockSize);
-    void setToSendBlock(uint blockNumber, uint blockSize);
+    void setToRequestQBlocks(const QList<uint> &blockNumbers, uint blockSize, bool moreBlocks);
+    void setToSendBlock(uint blockNumber, uint blockSize,
+                        QCoapOption::OptionName name = QCoapOption::Block1);
     bool checkBlockNumber(uint blockNumber);
 
     using QCoapInternalMessage::addOption;
@@ -53,7 +55,11 @@ public:
     bool addUriOptions(QUrl uri, const QUrl &proxyUri = QUrl());
 
     QCoapToken token() const;
+    QByteArray fullPayload() const;
+    QByteArray requestTag() const;
+    void setRequestTag(const QByteArray &tag);
     QUrl targetUri() const;
+    const CoapEndpoint &endpoint() const;
     QtCoap::Method method() const;
     bool isObserve() const;
     bool isObserveCancelled() const;
@@ -70,6 +76,7 @@ public:
     void setMulticastTimeout(uint responseDelay);
     void restartTransmission();
     void startMulticastTransmission();
+    void startTimeoutTimer(uint timeout);
     void stopTransmission();
 
 Q_SIGNALS:
@@ -79,7 +86,8 @@ Q_SIGNALS:
 
 protected:
     QCoapOption uriHostOption(const QUrl &uri) const;
-    QCoapOption blockOption(QCoapOption::OptionName name, uint blockNumber, uint blockSize) const;
+    QCoapOption blockOption(QCoapOption::OptionName name, uint blockNumber, uint blockSize,
+                            bool moreBlocks = false) const;
 
 private:
     Q_DECLARE_PRIVATE(QCoapInternalRequest)
@@ -91,6 +99,7 @@ public:
     QCoapInternalRequestPrivate() = default;
 
     QUrl targetUri;
+    CoapEndpoint endpoint;
     QtCoap::Method method = QtCoap::Method::Invalid;
     QCoapConnection *connection = nullptr;
     QByteArray fullPayload;
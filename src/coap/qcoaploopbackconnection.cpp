@@ -0,0 +1,330 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include "qcoaploopbackconnection_p.h"
+
+#include <QtCoap/qcoapmessage.h>
+#include <QtCoap/qcoapoption.h>
+#include <QtCore/qendian.h>
+
+QT_BEGIN_NAMESPACE
+
+namespace {
+
+// Version, type, token length, code and message ID of a frame
+constexpr qsizetype FrameHeaderSize = 4;
+// Method codes of the requests, see RFC 7252 section 12.1.1
+constexpr quint8 GetCode = 0x01;
+
+/*
+    Returns a frame with the given \a type, \a code, \a messageId, \a token
+    and \a payload.
+*/
+QByteArray responseFrame(QCoapMessage::Type type, QtCoap::ResponseCode code,
+                         quint16 messageId, const QByteArray &token,
+                         const QByteArray &payload = QByteArray())
+{
+    QByteArray frame;
+    frame.reserve(FrameHeaderSize + token.size() + 1 + payload.size());
+    frame.append(static_cast<char>(0x40 | (static_cast<quint8>(type) << 4) | token.size()));
+    frame.append(static_cast<char>(code));
+    frame.append(static_cast<char>(messageId >> 8));
+    frame.append(static_cast<char>(messageId & 0xFF));
+    frame.append(token);
+    if (!payload.isEmpty()) {
+        frame.append(static_cast<char>(0xFF));
+        frame.append(payload);
+    }
+    return frame;
+}
+
+/*
+    Returns the path made of the Uri-Path options of the request \a options,
+    or a null string if the options are malformed.
+*/
+QString uriPath(QByteArrayView options)
+{
+    QString path;
+    quint32 number = 0;
+    qsizetype offset = 0;
+    while (offset < options.size()) {
+        const quint8 header = static_cast<quint8>(options.at(offset++));
+        if (header == 0xFF)
+            break;
+
+        quint32 fields[2] = { quint32(header >> 4), quint32(header & 0x0F) };
+        for (auto &field : fields) {
+            if (field == 13) {
+                if (offset + 1 > options.size())
+                    return QString();
+                field = 13 + static_cast<quint8>(options.at(offset));
+                offset += 1;
+            } else if (field == 14) {
+                if (offset + 2 > options.size())
+                    return QString();
+                field = 269 + qFromBigEndian<quint16>(options.data() + offset);
+                offset += 2;
+            } else if (field == 15) {
+                return QString();
+            }
+        }
+
+        number += fields[0];
+        if (offset + fields[1] > options.size())
+            return QString();
+        if (number == QCoapOption::UriPath)
+            path += QLatin1Char('/') + QString::fromUtf8(options.sliced(offset, fields[1]));
+        offset += fields[1];
+    }
+    return path.isEmpty() ? QStringLiteral("/") : path;
+}
+
+} // namespace
+
+/*!
+    \internal
+
+    \class QCoapLoopbackConnection
+    \inmodule QtCoap
+
+    \brief The QCoapLoopbackConnection class passes the frames to an
+    in-process responder.
+
+    \reentrant
+
+    The QCoapLoopbackConnection class hands each frame written by the
+    protocol to a responder function, and delivers the frames it returns
+    back to the protocol, without any socket. It is meant for measuring the
+    protocol without the noise of the kernel and the network, for testing
+    without a server, and for embedding a client with an in-process server.
+
+    The answers are delivered from the event loop of the thread of the
+    connection, as a real transport would do. QCoapScriptedResponder
+    provides a minimal responder serving a fixed set of resources.
+
+    \sa QCoapClientPrivate::setConnection()
+*/
+
+/*!
+    Constructs a new QCoapLoopbackConnection answering the frames with the
+    given \a responder, and sets \a parent as the parent object.
+*/
+QCoapLoopbackConnection::QCoapLoopbackConnection(const CoapLoopbackResponder &responder,
+                                                 QObject *parent) :
+    QCoapLoopbackConnection(*new QCoapLoopbackConnectionPrivate(responder), parent)
+{
+}
+
+/*!
+    \internal
+
+    Constructs a new QCoapLoopbackConnection as a child of \a parent, with
+    \a dd as its \c d_ptr. This constructor must be used when internally
+    subclassing the QCoapLoopbackConnection class.
+*/
+QCoapLoopbackConnection::QCoapLoopbackConnection(QCoapLoopbackConnectionPrivate &dd,
+                                                 QObject *parent) :
+    QCoapConnection(dd, parent)
+{
+}
+
+QCoapLoopbackConnectionPrivate::QCoapLoopbackConnectionPrivate(
+        const CoapLoopbackResponder &responder)
+    : QCoapConnectionPrivate(QtCoap::SecurityMode::NoSecurity), responder(responder)
+{
+}
+
+/*!
+    \internal
+
+    Returns the number of frames written by the protocol.
+*/
+quint64 QCoapLoopbackConnection::framesWritten() const
+{
+    Q_D(const QCoapLoopbackConnection);
+    return d->framesWritten.loadRelaxed();
+}
+
+/*!
+    \internal
+
+    Returns the number of frames delivered to the protocol.
+*/
+quint64 QCoapLoopbackConnection::framesDelivered() const
+{
+    Q_D(const QCoapLoopbackConnection);
+    return d->framesDelivered.loadRelaxed();
+}
+
+/*!
+    \internal
+
+    Prepares the transport for data transmission. There is nothing to set
+    up, so the transport is ready right away.
+*/
+void QCoapLoopbackConnection::bind(const CoapEndpoint &endpoint)
+{
+    Q_UNUSED(endpoint)
+    emit bound();
+}
+
+/*!
+    \internal
+
+    Hands the \a data frame to the responder, and queues the delivery of
+    its answers, as if they came from the \a endpoint.
+*/
+void QCoapLoopbackConnection::writeData(const QByteArray &data, const CoapEndpoint &endpoint)
+{
+    Q_D(QCoapLoopbackConnection);
+
+    d->framesWritten.fetchAndAddRelaxed(1);
+    if (!d->responder)
+        return;
+
+    const QList<QByteArray> answers = d->responder(data);
+    if (answers.isEmpty())
+        return;
+
+    // Deliver from the event loop, the protocol does not expect the answer
+    // while it is still sending the request
+    const QHostAddress sender = endpoint.address.isNull()
+            ? QHostAddress(QHostAddress::LocalHost) : endpoint.address;
+    QMetaObject::invokeMethod(this, [this, answers, sender]() {
+        Q_D(QCoapLoopbackConnection);
+        for (const auto &answer : answers) {
+            d->framesDelivered.fetchAndAddRelaxed(1);
+            emit readyRead(answer, sender);
+        }
+    }, Qt::QueuedConnection);
+}
+
+/*!
+    \internal
+
+    Closes the transport. There is nothing to release.
+*/
+void QCoapLoopbackConnection::close()
+{
+}
+
+/*!
+    \internal
+
+    \class QCoapScriptedResponder
+    \inmodule QtCoap
+
+    \brief The QCoapScriptedResponder class answers the requests for a
+    fixed set of resources.
+
+    The responder answers the GET requests for the resources added with
+    addResource(), 4.04 Not Found for the other paths, and 4.05 Method Not
+    Allowed for the other methods. Confirmable requests get a piggybacked
+    response, or an empty acknowledgment followed by a Confirmable response
+    if setSeparateResponses() is enabled. Non-confirmable requests get a
+    Non-confirmable response.
+
+    The Block and Observe options are ignored, so the payloads should fit
+    in a single frame. The responder converts to a CoapLoopbackResponder,
+    to be passed to QCoapLoopbackConnection.
+*/
+
+/*!
+    \internal
+
+    Adds the resource at \a path, answered with the response \a code and
+    the \a payload.
+*/
+void QCoapScriptedResponder::addResource(const QString &path, const QByteArray &payload,
+                                         QtCoap::ResponseCode code)
+{
+    const QString key = path.startsWith(QLatin1Char('/')) ? path : QLatin1Char('/') + path;
+    resources.insert(key, { code, payload });
+}
+
+/*!
+    \internal
+
+    Sets whether the Confirmable requests get separate responses, if
+    \a separate is \c true, or piggybacked ones otherwise.
+*/
+void QCoapScriptedResponder::setSeparateResponses(bool separate)
+{
+    separateResponses = separate;
+}
+
+/*!
+    \internal
+
+    Returns the frames answering the \a request frame. Acknowledgments,
+    resets and malformed frames are not answered, and empty Confirmable
+    messages are answered with a reset.
+*/
+QList<QByteArray> QCoapScriptedResponder::respond(const QByteArray &request) const
+{
+    if (request.size() < FrameHeaderSize)
+        return {};
+
+    const quint8 firstByte = static_cast<quint8>(request.at(0));
+    const auto type = static_cast<QCoapMessage::Type>((firstByte >> 4) & 0x03);
+    const qsizetype tokenLength = firstByte & 0x0F;
+    const quint8 code = static_cast<quint8>(request.at(1));
+    const quint16 messageId = qFromBigEndian<quint16>(request.constData() + 2);
+    if ((firstByte >> 6) != 1 || tokenLength > 8 || request.size() < FrameHeaderSize + tokenLength)
+        return {};
+
+    if (type == QCoapMessage::Type::Acknowledgment || type == QCoapMessage::Type::Reset)
+        return {};
+
+    if (code == 0) {
+        if (type != QCoapMessage::Type::Confirmable)
+            return {};
+        return { responseFrame(QCoapMessage::Type::Reset, QtCoap::ResponseCode::EmptyMessage,
+                               messageId, QByteArray()) };
+    }
+
+    const QByteArray token = request.mid(FrameHeaderSize, tokenLength);
+    const QString path = uriPath(QByteArrayView(request).sliced(FrameHeaderSize + tokenLength));
+    if (path.isNull())
+        return {};
+
+    QtCoap::ResponseCode responseCode = QtCoap::ResponseCode::NotFound;
+    QByteArray payload;
+    const auto it = resources.constFind(path);
+    if (it != resources.constEnd() && code != GetCode) {
+        responseCode = QtCoap::ResponseCode::MethodNotAllowed;
+    } else if (it != resources.constEnd()) {
+        responseCode = it->code;
+        payload = it->payload;
+    }
+
+    if (type == QCoapMessage::Type::NonConfirmable) {
+        return { responseFrame(QCoapMessage::Type::NonConfirmable, responseCode,
+                               ++nextMessageId, token, payload) };
+    }
+
+    if (!separateResponses) {
+        return { responseFrame(QCoapMessage::Type::Acknowledgment, responseCode,
+                               messageId, token, payload) };
+    }
+
+    return { responseFrame(QCoapMessage::Type::Acknowledgment, QtCoap::ResponseCode::EmptyMessage,
+                           messageId, QByteArray()),
+             responseFrame(QCoapMessage::Type::Confirmable, responseCode,
+                           ++nextMessageId, token, payload) };
+}
+
+/*!
+    \internal
+
+    Returns a responder answering the requests as respond() does, with a
+    copy of the resources of this responder.
+*/
+QCoapScriptedResponder::operator CoapLoopbackResponder() const
+{
+    return [responder = *this](const QByteArray &request) {
+        return responder.respond(request);
+    };
+}
+
+QT_END_NAMESPACE
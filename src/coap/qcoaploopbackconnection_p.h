@@ -0,0 +1,92 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#ifndef QCOAPLOOPBACKCONNECTION_P_H
+#define QCOAPLOOPBACKCONNECTION_P_H
+
+#include <QtCoap/qcoapnamespace.h>
+#include <private/qcoapconnection_p.h>
+
+#include <QtCore/qatomic.h>
+#include <QtCore/qhash.h>
+
+#include <functional>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API. It exists purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+QT_BEGIN_NAMESPACE
+
+// Returns the frames answering a request frame, in the order they are delivered
+using CoapLoopbackResponder = std::function<QList<QByteArray>(const QByteArray &request)>;
+
+class QCoapLoopbackConnectionPrivate;
+class Q_AUTOTEST_EXPORT QCoapLoopbackConnection : public QCoapConnection
+{
+    Q_OBJECT
+
+public:
+    explicit QCoapLoopbackConnection(const CoapLoopbackResponder &responder,
+                                     QObject *parent = nullptr);
+
+    ~QCoapLoopbackConnection() override = default;
+
+    quint64 framesWritten() const;
+    quint64 framesDelivered() const;
+
+protected:
+    explicit QCoapLoopbackConnection(QCoapLoopbackConnectionPrivate &dd,
+                                     QObject *parent = nullptr);
+
+    void bind(const CoapEndpoint &endpoint) override;
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override;
+    void close() override;
+
+    Q_DECLARE_PRIVATE(QCoapLoopbackConnection)
+};
+
+class Q_AUTOTEST_EXPORT QCoapLoopbackConnectionPrivate : public QCoapConnectionPrivate
+{
+public:
+    QCoapLoopbackConnectionPrivate(const CoapLoopbackResponder &responder);
+
+    CoapLoopbackResponder responder;
+    QAtomicInteger<quint64> framesWritten = 0;
+    QAtomicInteger<quint64> framesDelivered = 0;
+
+    Q_DECLARE_PUBLIC(QCoapLoopbackConnection)
+};
+
+// Answers the requests for a fixed set of resources, as a minimal server would
+class Q_AUTOTEST_EXPORT QCoapScriptedResponder
+{
+public:
+    void addResource(const QString &path, const QByteArray &payload,
+                     QtCoap::ResponseCode code = QtCoap::ResponseCode::Content);
+    void setSeparateResponses(bool separate);
+
+    QList<QByteArray> respond(const QByteArray &request) const;
+    operator CoapLoopbackResponder() const;
+
+private:
+    struct Resource {
+        QtCoap::ResponseCode code = QtCoap::ResponseCode::Content;
+        QByteArray payload;
+    };
+
+    QHash<QString, Resource> resources;
+    bool separateResponses = false;
+    mutable quint16 nextMessageId = 0;
+};
+
+QT_END_NAMESPACE
+
+#endif // QCOAPLOOPBACKCONNECTION_P_H
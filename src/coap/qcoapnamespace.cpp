@@ -183,6 +183,10 @@ QT_BEGIN_NAMESPACE
                                             specified in Proxy-Scheme.
 
     \value Unknown                          An unknown error occurred.
+
+    \value Busy                             Too many messages were waiting to be
+                                            sent to the server, and the request was
+                                            dropped. It can be sent again later.
 */
 
 /*!
@@ -243,6 +247,25 @@ QT_BEGIN_NAMESPACE
                                         Registry".
 */
 
+/*!
+    \enum QtCoap::Transport
+
+    This enum specifies the transport used for exchanging CoAP messages
+    with the servers.
+
+    \value Udp                      CoAP over UDP, secured with DTLS, as defined in
+                                    \l{https://tools.ietf.org/html/rfc7252}{RFC 7252}.
+
+    \value Tcp                      CoAP over TCP, secured with TLS, as defined in
+                                    \l{https://tools.ietf.org/html/rfc8323}{RFC 8323}.
+                                    Multicast is not supported over this transport.
+
+    \value WebSocket                CoAP over WebSockets, secured with TLS, as defined in
+                                    \l{https://tools.ietf.org/html/rfc8323}{RFC 8323}.
+                                    Multicast is not supported over this transport, which
+                                    requires Qt WebSockets.
+*/
+
 /*!
     \internal
 
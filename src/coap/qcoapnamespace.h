@@ -54,7 +54,8 @@ namespace QtCoap
         FOR_EACH_COAP_ERROR(SINGLE_ERROR)
 #undef SINGLE_ERROR
 
-        Unknown
+        Unknown,
+        Busy
     };
     Q_ENUM_NS(Error)
 
@@ -96,6 +97,13 @@ namespace QtCoap
     };
     Q_ENUM_NS(MulticastGroup)
 
+    enum class Transport : quint8 {
+        Udp,
+        Tcp,
+        WebSocket
+    };
+    Q_ENUM_NS(Transport)
+
     Q_CLASSINFO("RegisterEnumClassesUnscoped", "false")
 }
 
@@ -0,0 +1,325 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include "qcoapobservegroup_p.h"
+#include "qcoapclient.h"
+#include "qcoapreply.h"
+#include "qcoapnamespace_p.h"
+
+QT_BEGIN_NAMESPACE
+
+QCoapObserveGroupPrivate::QCoapObserveGroupPrivate(QCoapClient *client,
+                                                   const QList<QCoapRequest> &requests,
+                                                   uint rate, double jitter) :
+    client(client),
+    total(requests.size()),
+    interval(rate > 0 ? 1000 * 1000 * 1000 / rate : 0),
+    jitter(qBound(0.0, jitter, 1.0))
+{
+    pendingRequests.append(requests);
+}
+
+/*!
+    \internal
+
+    Sends the registrations which are due, and schedules the next one.
+    Several registrations may be sent at once if the rate is higher than
+    the resolution of the timer.
+*/
+void QCoapObserveGroupPrivate::registerDueRequests()
+{
+    Q_Q(QCoapObserveGroup);
+
+    while (!pendingRequests.isEmpty() && nextRegistration <= clock.nsecsElapsed()) {
+        const QCoapRequest request = pendingRequests.dequeue();
+        QCoapReply *reply = client ? client->observe(request) : nullptr;
+        if (!reply) {
+            onRegistrationFailed(request, nullptr);
+            continue;
+        }
+
+        replies.append(reply);
+        QObject::connect(reply, &QCoapReply::notified, q, [this](QCoapReply *notifiedReply) {
+            onNotified(notifiedReply);
+        });
+        QObject::connect(reply, &QCoapReply::finished, q,
+                         [this, request](QCoapReply *finishedReply) {
+            onFinished(finishedReply, request);
+        });
+        nextRegistration += nextInterval();
+    }
+
+    if (!pendingRequests.isEmpty()) {
+        const qint64 delay = (nextRegistration - clock.nsecsElapsed()) / (1000 * 1000);
+        timer.start(static_cast<int>(qMax<qint64>(delay, 0)));
+    }
+}
+
+/*!
+    \internal
+
+    Returns the delay in nanoseconds before the next registration. The delay
+    is drawn at random around the interval matching the rate, so that the
+    registrations of several groups or clients do not synchronize.
+*/
+qint64 QCoapObserveGroupPrivate::nextInterval() const
+{
+    if (interval == 0 || jitter == 0)
+        return interval;
+
+    const double factor = 1 - jitter + 2 * jitter * QtCoap::randomGenerator().generateDouble();
+    return static_cast<qint64>(interval * factor);
+}
+
+/*!
+    \internal
+
+    Counts the \a reply as registered when its first notification arrives.
+*/
+void QCoapObserveGroupPrivate::onNotified(QCoapReply *reply)
+{
+    if (registeredReplies.contains(reply))
+        return;
+
+    registeredReplies.insert(reply);
+    updateProgress();
+}
+
+/*!
+    \internal
+
+    Counts the \a reply to \a request as failed if it finished before
+    receiving any notification.
+*/
+void QCoapObserveGroupPrivate::onFinished(QCoapReply *reply, const QCoapRequest &request)
+{
+    if (cancelled || registeredReplies.contains(reply))
+        return;
+
+    onRegistrationFailed(request, reply);
+}
+
+/*!
+    \internal
+
+    Counts the registration of \a request as failed, and emits the
+    registrationFailed() signal with the \a reply, if any.
+*/
+void QCoapObserveGroupPrivate::onRegistrationFailed(const QCoapRequest &request,
+                                                    QCoapReply *reply)
+{
+    Q_Q(QCoapObserveGroup);
+
+    ++failedCount;
+    emit q->registrationFailed(request, reply);
+    updateProgress();
+}
+
+/*!
+    \internal
+
+    Emits the progress() signal, and the finished() signal once all the
+    registrations succeeded or failed.
+*/
+void QCoapObserveGroupPrivate::updateProgress()
+{
+    Q_Q(QCoapObserveGroup);
+
+    emit q->progress(registeredReplies.size(), failedCount, total);
+    if (q->isFinished())
+        emit q->finished(q);
+}
+
+/*!
+    \class QCoapObserveGroup
+    \inmodule QtCoap
+
+    \brief The QCoapObserveGroup class registers a set of observations at a
+    limited rate.
+
+    \reentrant
+
+    Registering a large number of observations at once produces a burst of
+    requests, which may overflow the buffers of the network and trigger as
+    many retransmissions. A QCoapObserveGroup is returned by
+    QCoapClient::observe() for a list of requests. It sends the
+    registrations at the given rate, with a random spread, and tracks their
+    progress as a whole.
+
+    A registration succeeds when the first notification is received. It
+    fails if its reply finishes before, for instance because of a timeout
+    or an error response.
+
+    \code
+        QList<QCoapRequest> requests;
+        for (const QUrl &url : sensors)
+            requests.append(QCoapRequest(url));
+
+        QCoapObserveGroup *group = client->observe(requests, 200);
+        connect(group, &QCoapObserveGroup::progress, this, &MyClass::onProgress);
+    \endcode
+
+    \sa QCoapClient::observe(), QCoapReply::notified()
+*/
+
+/*!
+    \fn void QCoapObserveGroup::progress(qsizetype registered, qsizetype failed,
+                                         qsizetype total)
+
+    This signal is emitted whenever an observation of the group is
+    registered, or fails to be registered.
+
+    The \a registered and \a failed parameters hold the number of
+    registrations which succeeded or failed so far, out of \a total.
+
+    \sa registeredCount(), failedCount(), size()
+*/
+
+/*!
+    \fn void QCoapObserveGroup::registrationFailed(const QCoapRequest &request,
+                                                   QCoapReply *reply)
+
+    This signal is emitted when the observation of \a request could not be
+    registered. The \a reply parameter is \nullptr if the request could not
+    be sent.
+
+    \sa failedCount()
+*/
+
+/*!
+    \fn void QCoapObserveGroup::finished(QCoapObserveGroup *group)
+
+    This signal is emitted once all the observations of the group were
+    registered or failed to be registered. The \a group parameter is the
+    QCoapObserveGroup itself for convenience.
+
+    \sa isFinished()
+*/
+
+/*!
+    \internal
+
+    Constructs a new group registering the observations of \a requests
+    through \a client, at \a rate registrations per second. The interval
+    between two registrations varies at random by up to \a jitter times the
+    average interval.
+*/
+QCoapObserveGroup::QCoapObserveGroup(QCoapClient *client, const QList<QCoapRequest> &requests,
+                                     uint rate, double jitter) :
+    QObject(*new QCoapObserveGroupPrivate(client, requests, rate, jitter), client)
+{
+    Q_D(QCoapObserveGroup);
+
+    d->timer.setSingleShot(true);
+    connect(&d->timer, &QTimer::timeout, this, [this]() {
+        Q_D(QCoapObserveGroup);
+        d->registerDueRequests();
+    });
+
+    d->clock.start();
+    d->timer.start(0);
+}
+
+/*!
+    Destroys the QCoapObserveGroup. The observations already registered are
+    not cancelled.
+
+    \sa cancel()
+*/
+QCoapObserveGroup::~QCoapObserveGroup()
+{
+}
+
+/*!
+    Returns the replies of the observations sent so far.
+*/
+QList<QCoapReply *> QCoapObserveGroup::replies() const
+{
+    Q_D(const QCoapObserveGroup);
+
+    QList<QCoapReply *> replies;
+    for (const auto &reply : d->replies) {
+        if (reply)
+            replies.append(reply);
+    }
+    return replies;
+}
+
+/*!
+    Returns the number of observations of the group.
+*/
+qsizetype QCoapObserveGroup::size() const
+{
+    Q_D(const QCoapObserveGroup);
+    return d->total;
+}
+
+/*!
+    Returns the number of observations which are not sent yet.
+*/
+qsizetype QCoapObserveGroup::pendingCount() const
+{
+    Q_D(const QCoapObserveGroup);
+    return d->pendingRequests.size();
+}
+
+/*!
+    Returns the number of observations which received a first notification.
+
+    \sa progress()
+*/
+qsizetype QCoapObserveGroup::registeredCount() const
+{
+    Q_D(const QCoapObserveGroup);
+    return d->registeredReplies.size();
+}
+
+/*!
+    Returns the number of observations which could not be registered.
+
+    \sa registrationFailed()
+*/
+qsizetype QCoapObserveGroup::failedCount() const
+{
+    Q_D(const QCoapObserveGroup);
+    return d->failedCount;
+}
+
+/*!
+    Returns \c true if all the observations were registered or failed to
+    be registered.
+
+    \sa finished()
+*/
+bool QCoapObserveGroup::isFinished() const
+{
+    Q_D(const QCoapObserveGroup);
+    return d->registeredReplies.size() + d->failedCount == d->total;
+}
+
+/*!
+    Stops sending the registrations, and cancels the observations of the
+    replies already sent. The requests not sent yet are removed from the
+    group.
+
+    \sa QCoapClient::cancelObserve()
+*/
+void QCoapObserveGroup::cancel()
+{
+    Q_D(QCoapObserveGroup);
+
+    d->cancelled = true;
+    d->timer.stop();
+    d->total -= d->pendingRequests.size();
+    d->pendingRequests.clear();
+
+    if (!d->client)
+        return;
+
+    for (const auto &reply : std::as_const(d->replies)) {
+        if (reply)
+            d->client->cancelObserve(reply);
+    }
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,48 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#ifndef QCOAPOBSERVEGROUP_H
+#define QCOAPOBSERVEGROUP_H
+
+#include <QtCoap/qcoapglobal.h>
+#include <QtCoap/qcoaprequest.h>
+#include <QtCore/qlist.h>
+#include <QtCore/qobject.h>
+
+QT_BEGIN_NAMESPACE
+
+class QCoapClient;
+class QCoapReply;
+
+class QCoapObserveGroupPrivate;
+class Q_COAP_EXPORT QCoapObserveGroup : public QObject
+{
+    Q_OBJECT
+
+public:
+    ~QCoapObserveGroup() override;
+
+    QList<QCoapReply *> replies() const;
+    qsizetype size() const;
+    qsizetype pendingCount() const;
+    qsizetype registeredCount() const;
+    qsizetype failedCount() const;
+    bool isFinished() const;
+    void cancel();
+
+Q_SIGNALS:
+    void progress(qsizetype registered, qsizetype failed, qsizetype total);
+    void registrationFailed(const QCoapRequest &request, QCoapReply *reply);
+    void finished(QCoapObserveGroup *group);
+
+private:
+    QCoapObserveGroup(QCoapClient *client, const QList<QCoapRequest> &requests,
+                      uint rate, double jitter);
+    friend class QCoapClient;
+
+    Q_DECLARE_PRIVATE(QCoapObserveGroup)
+};
+
+QT_END_NAMESPACE
+
+#endif // QCOAPOBSERVEGROUP_H
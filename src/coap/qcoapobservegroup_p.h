@@ -0,0 +1,61 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#ifndef QCOAPOBSERVEGROUP_P_H
+#define QCOAPOBSERVEGROUP_P_H
+
+#include <QtCoap/qcoapobservegroup.h>
+#include <QtCoap/qcoaprequest.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qpointer.h>
+#include <QtCore/qqueue.h>
+#include <QtCore/qset.h>
+#include <QtCore/qtimer.h>
+#include <private/qobject_p.h>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API. It exists purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+QT_BEGIN_NAMESPACE
+
+class Q_AUTOTEST_EXPORT QCoapObserveGroupPrivate : public QObjectPrivate
+{
+public:
+    QCoapObserveGroupPrivate(QCoapClient *client, const QList<QCoapRequest> &requests,
+                             uint rate, double jitter);
+
+    void registerDueRequests();
+    void onNotified(QCoapReply *reply);
+    void onFinished(QCoapReply *reply, const QCoapRequest &request);
+    void onRegistrationFailed(const QCoapRequest &request, QCoapReply *reply);
+    qint64 nextInterval() const;
+    void updateProgress();
+
+    QPointer<QCoapClient> client;
+    QQueue<QCoapRequest> pendingRequests;
+    QList<QPointer<QCoapReply>> replies;
+    QSet<const QCoapReply *> registeredReplies;
+    qsizetype total = 0;
+    qsizetype failedCount = 0;
+    bool cancelled = false;
+
+    qint64 interval = 0;
+    double jitter = 0;
+    qint64 nextRegistration = 0;
+    QElapsedTimer clock;
+    QTimer timer;
+
+    Q_DECLARE_PUBLIC(QCoapObserveGroup)
+};
+
+QT_END_NAMESPACE
+
+#endif // QCOAPOBSERVEGROUP_P_H
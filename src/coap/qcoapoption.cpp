@@ -35,8 +35,10 @@ Q_STATIC_LOGGING_CATEGORY(lcCoapOption, "qt.coap.option")
     Indicates the name of an option.
     The value of each ID is as specified by the CoAP standard, with the
     exception of Invalid. You can refer to
-    \l{https://tools.ietf.org/html/rfc7252#section-5.10}{RFC 7252} and
-    \l{https://tools.ietf.org/html/rfc7959#section-2.1}{RFC 7959} for more details.
+    \l{https://tools.ietf.org/html/rfc7252#section-5.10}{RFC 7252},
+    \l{https://tools.ietf.org/html/rfc7959#section-2.1}{RFC 7959},
+    \l{https://tools.ietf.org/html/rfc9177#section-4}{RFC 9177} and
+    \l{https://tools.ietf.org/html/rfc9175#section-3.2}{RFC 9175} for more details.
 
     \value Invalid                  An invalid option.
     \value IfMatch                  If-Match option.
@@ -51,13 +53,16 @@ Q_STATIC_LOGGING_CATEGORY(lcCoapOption, "qt.coap.option")
     \value MaxAge                   Max-Age option.
     \value UriQuery                 Uri-Query option.
     \value Accept                   Accept option.
+    \value QBlock1                  Q-Block1 option.
     \value LocationQuery            Location-Query option.
     \value Block2                   Block2 option.
     \value Block1                   Block1 option.
     \value Size2                    Size2 option.
+    \value QBlock2                  Q-Block2 option.
     \value ProxyUri                 Proxy-Uri option.
     \value ProxyScheme              Proxy-Scheme option.
     \value Size1                    Size1 option.
+    \value RequestTag               Request-Tag option.
 */
 
 /*!
@@ -171,6 +176,9 @@ QByteArray QCoapOption::opaqueValue() const
 
 /*!
     Returns the integer value of the option.
+
+    Integer option values are encoded in network byte order, as defined in
+    \l{https://tools.ietf.org/html/rfc7252#section-3.2}{RFC 7252}.
  */
 quint32 QCoapOption::uintValue() const
 {
@@ -178,7 +186,7 @@ quint32 QCoapOption::uintValue() const
 
     quint32 intValue = 0;
     for (int i = 0; i < d->value.size(); i++)
-        intValue |= static_cast<quint8>(d->value.at(i)) << (8 * i);
+        intValue = (intValue << 8) | static_cast<quint8>(d->value.at(i));
 
     return intValue;
 }
@@ -269,6 +277,7 @@ void QCoapOptionPrivate::setValue(const QByteArray &opaqueValue)
 
     case QCoapOption::IfMatch:
     case QCoapOption::Etag:
+    case QCoapOption::RequestTag:
         if (opaqueValue.size() > 8)
             oversized = true;
         break;
@@ -292,6 +301,8 @@ void QCoapOptionPrivate::setValue(const QByteArray &opaqueValue)
     case QCoapOption::Block2:
     case QCoapOption::Block1:
     case QCoapOption::Size2:
+    case QCoapOption::QBlock1:
+    case QCoapOption::QBlock2:
     default:
         break;
     }
@@ -321,9 +332,10 @@ void QCoapOptionPrivate::setValue(const QString &value)
  */
 void QCoapOptionPrivate::setValue(quint32 value)
 {
+    // Use network byte order and as few bytes as possible
     QByteArray data;
     for (; value; value >>= 8)
-        data.append(static_cast<qint8>(value & 0xFF));
+        data.prepend(static_cast<qint8>(value & 0xFF));
 
     setValue(data);
 }
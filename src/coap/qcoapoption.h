@@ -29,13 +29,16 @@ public:
         MaxAge          = 14,
         UriQuery        = 15,
         Accept          = 17,
+        QBlock1         = 19,
         LocationQuery   = 20,
         Block2          = 23,
         Block1          = 27,
         Size2           = 28,
+        QBlock2         = 31,
         ProxyUri        = 35,
         ProxyScheme     = 39,
-        Size1           = 60
+        Size1           = 60,
+        RequestTag      = 292
     };
 
     QCoapOption(OptionName name = Invalid, const QByteArray &opaqueValue = QByteArray());
@@ -9,8 +9,13 @@
 #include "qcoapconnection_p.h"
 #include "qcoapnamespace_p.h"
 
+#include <QtCore/qcborstreamreader.h>
+#include <QtCore/qdatastream.h>
+#include <QtCore/qdatetime.h>
+#include <QtCore/qendian.h>
 #include <QtCore/qrandom.h>
 #include <QtCore/qthread.h>
+#include <QtCore/qtimer.h>
 #include <QtCore/qloggingcategory.h>
 #include <QtNetwork/qnetworkdatagram.h>
 
@@ -18,6 +23,158 @@ QT_BEGIN_NAMESPACE
 
 Q_STATIC_LOGGING_CATEGORY(lcCoapProtocol, "qt.coap.protocol")
 
+namespace {
+
+constexpr uint LossesBeforeShrinking = 2;
+constexpr uint CleanBlocksBeforeGrowing = 8;
+constexpr quint16 MinimumBlockSize = 16;
+
+// Default Max-Age of a response, in seconds, see
+// https://tools.ietf.org/html/rfc7252#section-5.10.5
+constexpr qint64 DefaultMaxAge = 60;
+// Time left to the server, in milliseconds, to send a notification after
+// the Max-Age of the previous one expired
+constexpr qint64 MaxAgeMargin = 2000;
+constexpr qint64 MaximumReregistrationDelay = 60 * 1000;
+// Interrupted downloads kept for resuming, the least recently saved ones
+// are discarded first
+constexpr qsizetype MaximumPartialDownloads = 16;
+constexpr qint64 CompactSweepInterval = 1000;
+
+// Header of the snapshots of the observations, see QCoapClient::saveObservations()
+constexpr quint32 ObservationSnapshotMagic = 0x51434F42;
+constexpr quint8 ObservationSnapshotVersion = 2;
+
+/*
+    Returns the block size encoded in the SZX field of a Block1 or Block2
+    \a option, or 0 if the option is not valid. BERT blocks are counted in
+    blocks of 1024 bytes.
+*/
+uint blockSizeFromOption(const QCoapOption &option)
+{
+    if (!option.isValid())
+        return 0;
+
+    const QByteArray value = option.opaqueValue();
+    const quint8 szx = value.isEmpty() ? 0 : (static_cast<quint8>(value.back()) & 0x7);
+    return szx == 7 ? 1024 : 1u << (szx + 4);
+}
+
+/*
+    Returns \c true if the SZX field of a Block1 or Block2 \a option stands
+    for a BERT block, see https://tools.ietf.org/html/rfc8323#section-6.
+*/
+bool isBertOption(const QCoapOption &option)
+{
+    const QByteArray value = option.opaqueValue();
+    return option.isValid() && !value.isEmpty() && (static_cast<quint8>(value.back()) & 0x7) == 7;
+}
+
+/*
+    Returns \c true if the Observe \a sequenceNumber is newer than
+    \a lastSequenceNumber. Sequence numbers are 24-bit values, which wrap
+    around, see https://tools.ietf.org/html/rfc7641#section-3.4.
+*/
+bool isNewerSequenceNumber(quint32 sequenceNumber, quint32 lastSequenceNumber)
+{
+    constexpr quint32 halfRange = 1u << 23;
+    return (lastSequenceNumber < sequenceNumber && sequenceNumber - lastSequenceNumber < halfRange)
+            || (lastSequenceNumber > sequenceNumber
+                && lastSequenceNumber - sequenceNumber > halfRange);
+}
+
+/*
+    Returns the key of the observation registered by \a request. Requests
+    with the same key observe the same resource through the same connection,
+    with the same options, and can share a single registration.
+*/
+QByteArray observationKey(const QCoapInternalRequest *request)
+{
+    QByteArray key = request->targetUri().toEncoded();
+    key.append('\0');
+    key.append(static_cast<char>(request->method()));
+    const quintptr connection = reinterpret_cast<quintptr>(request->connection());
+    key.append(reinterpret_cast<const char *>(&connection), sizeof(connection));
+
+    for (const auto &option : request->message()->options()) {
+        // Ignore the options set by the protocol itself
+        switch (option.name()) {
+        case QCoapOption::Block1:
+        case QCoapOption::Block2:
+        case QCoapOption::QBlock1:
+        case QCoapOption::QBlock2:
+        case QCoapOption::Size2:
+        case QCoapOption::RequestTag:
+            continue;
+        default:
+            break;
+        }
+
+        const quint16 name = static_cast<quint16>(option.name());
+        const quint32 length = static_cast<quint32>(option.length());
+        key.append(reinterpret_cast<const char *>(&name), sizeof(name));
+        key.append(reinterpret_cast<const char *>(&length), sizeof(length));
+        key.append(option.opaqueValue());
+    }
+
+    key.append(request->fullPayload());
+    return key;
+}
+
+/*
+    Returns a copy of the encoded \a registration of an observation with the
+    Observe option set to 1, which deregisters the observation, see
+    https://tools.ietf.org/html/rfc7641#section-3.6. Returns an empty
+    QByteArray if the Observe option could not be found.
+*/
+QByteArray deregistrationFrame(const QByteArray &registration)
+{
+    const auto byteAt = [&registration](qsizetype position) -> quint32 {
+        return position < registration.size() ? static_cast<quint8>(registration.at(position)) : 0;
+    };
+    // Reads the extended value of an option delta or length nibble
+    const auto extendedValue = [&byteAt](quint32 nibble, qsizetype &position) -> quint32 {
+        if (nibble == 13)
+            return 13 + byteAt(position++);
+        if (nibble == 14) {
+            const quint32 value = 269 + (byteAt(position) << 8 | byteAt(position + 1));
+            position += 2;
+            return value;
+        }
+        return nibble;
+    };
+
+    // Skip the header and the token
+    qsizetype position = 4 + (byteAt(0) & 0x0F);
+    quint32 optionNumber = 0;
+    while (position < registration.size() && byteAt(position) != 0xFF) {
+        const quint32 optionHeader = byteAt(position);
+        qsizetype valuePosition = position + 1;
+        optionNumber += extendedValue(optionHeader >> 4, valuePosition);
+        const quint32 length = extendedValue(optionHeader & 0x0F, valuePosition);
+
+        if (optionNumber == QCoapOption::Observe) {
+            QByteArray frame = registration;
+            if (length == 0) {
+                frame[position] = static_cast<char>(optionHeader | 1);
+                frame.insert(valuePosition, '\x01');
+            } else if (length == 1) {
+                frame[valuePosition] = '\x01';
+            } else {
+                return QByteArray();
+            }
+            return frame;
+        }
+
+        if (optionNumber > QCoapOption::Observe)
+            break;
+        position = valuePosition + length;
+    }
+    return QByteArray();
+}
+
+} // namespace
+
 /*!
     \internal
 
@@ -77,6 +234,17 @@ Q_STATIC_LOGGING_CATEGORY(lcCoapProtocol, "qt.coap.protocol")
     \sa finished(), QCoapReply::error(), QCoapReply::finished()
 */
 
+/*!
+    \internal
+
+    \fn void QCoapProtocol::endpointBlockSizeChanged(const QUrl &endpoint, quint16 blockSize)
+
+    This signal is emitted when the block size used for blockwise transfers
+    with \a endpoint changes to \a blockSize.
+
+    \sa blockSizeForEndpoint()
+*/
+
 /*!
     \internal
 
@@ -113,9 +281,11 @@ void QCoapProtocol::sendRequest(QPointer<QCoapReply> reply, QCoapConnection *con
             || !QCoapRequestPrivate::isUrlValid(reply->request().url()))
         return;
 
-    connect(reply.data(), &QCoapReply::aborted, this, [this](const QCoapToken &token) {
+    const QCoapReply *abortedReply = reply.data();
+    connect(reply.data(), &QCoapReply::aborted, this,
+            [this, abortedReply](const QCoapToken &token) {
         Q_D(QCoapProtocol);
-        d->onRequestAborted(token);
+        d->onRequestAborted(token, abortedReply);
     });
 
     auto internalRequest = QSharedPointer<QCoapInternalRequest>::create(reply->request(), this);
@@ -135,36 +305,23 @@ void QCoapProtocol::sendRequest(QPointer<QCoapReply> reply, QCoapConnection *con
                                              + maximumServerResponseDelay());
     }
 
+    // Share the registration of an identical observation, if any
+    internalRequest->setConnection(connection);
+    if (internalRequest->token().isEmpty() && d->addObserver(reply, internalRequest.data()))
+        return;
+
     // Set a unique Message Id and Token
     QCoapMessage *requestMessage = internalRequest->message();
     internalRequest->setMessageId(d->generateUniqueMessageId());
     if (internalRequest->token().isEmpty())
         internalRequest->setToken(d->generateUniqueToken());
-    internalRequest->setConnection(connection);
 
     d->registerExchange(requestMessage->token(), reply, internalRequest);
     QMetaObject::invokeMethod(reply, "_q_setRunning", Qt::QueuedConnection,
                               Q_ARG(QCoapToken, requestMessage->token()),
                               Q_ARG(QCoapMessageId, requestMessage->messageId()));
 
-    // Set block size for blockwise request/replies, if specified
-    if (d->blockSize > 0) {
-        internalRequest->setToRequestBlock(0, d->blockSize);
-        if (requestMessage->payload().size() > d->blockSize)
-            internalRequest->setToSendBlock(0, d->blockSize);
-    }
-
-    if (requestMessage->type() == QCoapMessage::Type::Confirmable) {
-        const auto minTimeout = minimumTimeout();
-        const auto maxTimeout = maximumTimeout();
-        Q_ASSERT(minTimeout <= maxTimeout);
-
-        internalRequest->setTimeout(minTimeout == maxTimeout
-                                    ? minTimeout
-                                    : QtCoap::randomGenerator().bounded(minTimeout, maxTimeout));
-    } else {
-        internalRequest->setTimeout(maximumTimeout());
-    }
+    internalRequest->setTimeout(d->initialTimeout(internalRequest.data()));
 
     connect(internalRequest.data(), &QCoapInternalRequest::timeout, this,
             [this](QCoapInternalRequest *request) {
@@ -176,24 +333,152 @@ void QCoapProtocol::sendRequest(QPointer<QCoapReply> reply, QCoapConnection *con
                     Q_D(QCoapProtocol);
                     d->onRequestMaxTransmissionSpanReached(request);
             });
-    d->sendRequest(internalRequest.data());
+
+    // Over reliable transports, the block sizes depend on the settings sent by
+    // the server once the connection with it is set up
+    if (!d->waitForPeerSettings(internalRequest.data()))
+        d->startExchange(internalRequest.data());
+}
+
+/*!
+    \internal
+
+    Sets the block options of the registered \a request and sends its first
+    message, or starts its Q-Block transfer. The exchange fails if the
+    connection rejects the message.
+*/
+void QCoapProtocolPrivate::startExchange(QCoapInternalRequest *request)
+{
+    QCoapMessage *requestMessage = request->message();
+
+    // Use Q-Block options for bulk transfers, if enabled.
+    // See https://tools.ietf.org/html/rfc9177.
+    const bool useQBlock = openQBlockTransfer(request);
+
+    // Set block size for blockwise request/replies, if specified or
+    // negotiated with the endpoint. Over reliable transports, the server
+    // may take BERT blocks instead. See https://tools.ietf.org/html/rfc8323#section-6.
+    const uint bertSize = bertBlockSize(request);
+    const uint initialBlockSize = bertSize > 0
+            ? bertSize
+            : endpointBlockSize(request->targetUri());
+    if (!useQBlock && initialBlockSize > 0) {
+        request->setToRequestBlock(0, initialBlockSize);
+        if (requestMessage->payload().size() > static_cast<qsizetype>(initialBlockSize)) {
+            if (!requestMessage->hasOption(QCoapOption::RequestTag))
+                request->setRequestTag(generateUniqueRequestTag());
+            request->setToSendBlock(0, initialBlockSize);
+        }
+    }
+
+    // Ask the server for the size of the resource, so that the remaining blocks can
+    // be requested in parallel. See https://tools.ietf.org/html/rfc7959#section-4.
+    if (!useQBlock && effectiveBlockWindowSize() > 1
+            && request->method() == QtCoap::Method::Get
+            && !request->isObserve() && !request->isMulticast()
+            && !requestMessage->hasOption(QCoapOption::Size2)) {
+        request->addOption(QCoapOption::Size2, 0u);
+    }
+
+    // Continue a blockwise download interrupted earlier, if any
+    if (!useQBlock)
+        resumePartialDownload(request);
+
+    if (useQBlock) {
+        startQBlockTransfer(request);
+    } else if (!sendRequest(request)) {
+        // Do not hold a new exchange while the connection cannot keep up with it
+        onRequestError(request, QtCoap::Error::Busy);
+    }
+}
+
+/*!
+    \internal
+
+    Returns \c true if the first message of \a request must wait for the
+    settings of its server, in which case it is sent by
+    onPeerSettingsChanged(). The exchange still times out meanwhile.
+*/
+bool QCoapProtocolPrivate::waitForPeerSettings(QCoapInternalRequest *request)
+{
+    if (!request->connection() || request->isMulticast()
+            || !request->connection()->d_func()->waitForPeerSettings(request->endpoint())) {
+        return false;
+    }
+
+    exchangesAwaitingPeerSettings[request->endpoint()].append(request->token());
+    request->startTimeoutTimer(initialTimeout(request));
+    return true;
+}
+
+/*!
+    \internal
+
+    Starts the exchanges which were waiting for the settings of the server
+    at \a endpoint. The settings are known, or the session with the server
+    was closed, in which case the exchanges set up a new one.
+
+    The exchanges are started from the event loop, the connection may be
+    in the middle of processing a message.
+*/
+void QCoapProtocolPrivate::onPeerSettingsChanged(const CoapEndpoint &endpoint)
+{
+    if (!exchangesAwaitingPeerSettings.contains(endpoint))
+        return;
+
+    QMetaObject::invokeMethod(q_func(), [this, endpoint]() {
+        const QList<QCoapToken> tokens = exchangesAwaitingPeerSettings.take(endpoint);
+        for (const auto &token : tokens) {
+            // The exchange may have timed out or been aborted meanwhile
+            if (QCoapInternalRequest *request = requestForToken(token))
+                startExchange(request);
+        }
+    }, Qt::QueuedConnection);
+}
+
+/*!
+    \internal
+
+    Fails the exchange of the \a frame dropped by the connection after it
+    accepted it, with the given \a error.
+
+    The exchange fails from the event loop, the frame may be dropped while
+    the protocol is still sending it.
+*/
+void QCoapProtocolPrivate::onFrameDropped(const QByteArray &frame, QtCoap::Error error)
+{
+    // Version, type and token length, followed by the code, the message ID and the token
+    const qsizetype tokenLength = frame.isEmpty() ? 0 : frame.at(0) & 0x0F;
+    if (tokenLength == 0 || frame.size() < 4 + tokenLength)
+        return;
+
+    const QCoapToken token = frame.mid(4, tokenLength);
+    QMetaObject::invokeMethod(q_func(), [this, token, error]() {
+        if (QCoapInternalRequest *request = requestForToken(token))
+            onRequestError(request, error);
+    }, Qt::QueuedConnection);
 }
 
 /*!
     \internal
 
-    Encodes and sends the given \a request to the server. If \a host is not empty,
-    sends the request to \a host, instead of using the host address from the request.
-    The \a host parameter is relevant for multicast blockwise transfers.
+    Encodes and sends the given \a request to the server. If \a destination is not
+    null, sends the request to \a destination, instead of using the endpoint of the
+    request. The \a destination parameter is relevant for multicast blockwise transfers.
+
+    Returns \c false if the request could not be sent, for instance if the
+    connection dropped it because too many frames are waiting for the server.
+    A dropped retransmission is handled as a lost message.
 */
-void QCoapProtocolPrivate::sendRequest(QCoapInternalRequest *request, const QString& host) const
+bool QCoapProtocolPrivate::sendRequest(QCoapInternalRequest *request,
+                                       const QHostAddress &destination) const
 {
     Q_Q(const QCoapProtocol);
     Q_ASSERT(QThread::currentThread() == q->thread());
 
     if (!request || !request->connection()) {
         qCWarning(lcCoapProtocol, "Request null or not bound to any connection: aborted.");
-        return;
+        return false;
     }
 
     if (request->isMulticast())
@@ -201,11 +486,67 @@ void QCoapProtocolPrivate::sendRequest(QCoapInternalRequest *request, const QStr
     else
         request->restartTransmission();
 
-    QByteArray requestFrame = request->toQByteArray();
-    QUrl uri = request->targetUri();
-    const auto& hostAddress = host.isEmpty() ? uri.host() : host;
-    request->connection()->d_func()->sendRequest(requestFrame, hostAddress,
-                                                 static_cast<quint16>(uri.port()));
+    const QByteArray requestFrame = request->toQByteArray();
+    const CoapEndpoint &endpoint = request->endpoint();
+    if (!destination.isNull()) {
+        return request->connection()->d_func()->sendRequest(
+                    requestFrame, CoapEndpoint(destination, endpoint.port, endpoint.secure));
+    }
+    return request->connection()->d_func()->sendRequest(requestFrame, endpoint);
+}
+
+/*!
+    \internal
+
+    Returns the initial transmission timeout in milliseconds for the
+    given \a request. For Confirmable messages, this is a random value between
+    minimumTimeout() and maximumTimeout(). Over reliable transports, this is
+    maximumTransmitWait().
+*/
+uint QCoapProtocolPrivate::initialTimeout(const QCoapInternalRequest *request) const
+{
+    Q_Q(const QCoapProtocol);
+
+    // Nothing is retransmitted, the exchange is only bounded in time
+    if (isReliable(request))
+        return q->maximumTransmitWait();
+
+    if (request->message()->type() == QCoapMessage::Type::Confirmable) {
+        const auto minTimeout = q->minimumTimeout();
+        const auto maxTimeout = q->maximumTimeout();
+        Q_ASSERT(minTimeout <= maxTimeout);
+
+        return minTimeout == maxTimeout
+                ? minTimeout
+                : QtCoap::randomGenerator().bounded(minTimeout, maxTimeout);
+    }
+
+    return q->maximumTimeout();
+}
+
+/*!
+    \internal
+
+    Returns \c true if the connection of \a request delivers the frames
+    reliably, in which case they are not retransmitted, and neither block
+    windows nor Q-Block transfers are used.
+*/
+bool QCoapProtocolPrivate::isReliable(const QCoapInternalRequest *request) const
+{
+    return request->connection() && request->connection()->d_func()->isReliable();
+}
+
+/*!
+    \internal
+
+    Returns the size of the BERT blocks to use for \a request, or \c 0 if its
+    connection or its server does not support BERT.
+*/
+uint QCoapProtocolPrivate::bertBlockSize(const QCoapInternalRequest *request) const
+{
+    if (!request->connection() || request->isMulticast())
+        return 0;
+    return request->connection()->d_func()->bertBlockSize(request->endpoint());
 }
 
 /*!
@@ -222,8 +563,20 @@ void QCoapProtocolPrivate::onRequestTimeout(QCoapInternalRequest *request)
     if (!isRequestRegistered(request))
         return;
 
+    if (blockWindowForToken(request->token())) {
+        onBlockWindowTimeout(request);
+        return;
+    }
+
+    if (qBlockTransferForToken(request->token())) {
+        onQBlockTimeout(request);
+        return;
+    }
+
     if (request->message()->type() == QCoapMessage::Type::Confirmable
-            && request->retransmissionCounter() < maximumRetransmitCount) {
+            && request->retransmissionCounter() < maximumRetransmitCount
+            && !isReliable(request)) {
+        onBlockLost(request);
         sendRequest(request);
     } else {
         onRequestError(request, QtCoap::Error::TimeOut);
@@ -291,20 +644,26 @@ void QCoapProtocolPrivate::onRequestError(QCoapInternalRequest *request, QtCoap:
     Q_ASSERT(request);
 
     auto userReply = userReplyForToken(request->token());
+    const auto userReplies = userRepliesForToken(request->token());
 
-    if (!userReply.isNull()) {
+    // Keep the blocks received so far, if the transfer can be resumed later
+    if (!reply)
+        savePartialDownload(request);
+
+    // All the subscribers of a shared observation are notified of the error
+    for (const auto &subscriber : userReplies) {
         // Set error from content, or error enum
         if (reply) {
-            QMetaObject::invokeMethod(userReply.data(), "_q_setContent", Qt::QueuedConnection,
+            QMetaObject::invokeMethod(subscriber.data(), "_q_setContent", Qt::QueuedConnection,
                                       Q_ARG(QHostAddress, reply->senderAddress()),
                                       Q_ARG(QCoapMessage, *reply->message()),
                                       Q_ARG(QtCoap::ResponseCode, reply->responseCode()));
         } else {
-            QMetaObject::invokeMethod(userReply.data(), "_q_setError", Qt::QueuedConnection,
+            QMetaObject::invokeMethod(subscriber.data(), "_q_setError", Qt::QueuedConnection,
                                       Q_ARG(QtCoap::Error, error));
         }
 
-        QMetaObject::invokeMethod(userReply.data(), "_q_setFinished", Qt::QueuedConnection,
+        QMetaObject::invokeMethod(subscriber.data(), "_q_setFinished", Qt::QueuedConnection,
                                   Q_ARG(QtCoap::Error, QtCoap::Error::Ok));
     }
 
@@ -325,6 +684,9 @@ void QCoapProtocolPrivate::onFrameReceived(const QByteArray &data, const QHostAd
     QSharedPointer<QCoapInternalReply> reply(decode(data, sender));
     const QCoapMessage *messageReceived = reply->message();
 
+    if (onCompactNotification(reply.data(), sender))
+        return;
+
     QCoapInternalRequest *request = nullptr;
     if (!messageReceived->token().isEmpty())
         request = requestForToken(messageReceived->token());
@@ -337,45 +699,92 @@ void QCoapProtocolPrivate::onFrameReceived(const QByteArray &data, const QHostAd
             return;
     }
 
-    QHostAddress originalTarget(request->targetUri().host());
-    if (!originalTarget.isMulticast() && !originalTarget.isEqual(sender)) {
+    // The address of a host name is only known to the connection, the
+    // token and message ID of the answer are checked instead
+    const CoapEndpoint &target = request->endpoint();
+    if (!target.isHostName() && !target.multicast && !target.address.isEqual(sender)) {
         qCDebug(lcCoapProtocol).nospace() << "QtCoap: Answer received from incorrect host ("
                                           << sender << " instead of "
-                                          << originalTarget << ")";
+                                          << target.address << ")";
         return;
     }
 
+    const bool retransmitted = request->retransmissionCounter() > 0;
     if (!request->isMulticast())
         request->stopTransmission();
     addReply(request->token(), reply);
 
+    if (onQBlockReply(request, reply, sender))
+        return;
+
+    if (!checkResumedDownload(request, reply.data()))
+        return;
+
+    if (request->isObserveCancelled()) {
+        onCancelledObservationReply(request, reply.data());
+        return;
+    }
+
     if (QtCoap::isError(reply->responseCode())) {
         onRequestError(request, reply.data());
         return;
     }
 
     // Reply when the server asks for an ACK
-    if (request->isObserveCancelled()) {
-        // Remove option to ensure that it will stop
-        request->removeOption(QCoapOption::Observe);
-        sendReset(request);
-    } else if (messageReceived->type() == QCoapMessage::Type::Confirmable) {
+    if (messageReceived->type() == QCoapMessage::Type::Confirmable)
         sendAcknowledgment(request);
+
+    // Drop notifications older than the last one, once acknowledged
+    if (!isFreshNotification(request, reply.data())) {
+        exchangeMap[request->token()].replies.removeLast();
+        return;
+    }
+
+    if (blockWindowForToken(request->token())) {
+        onBlockWindowReply(request, reply, sender);
+        return;
     }
 
+    if (!request->isMulticast() && !isReliable(request))
+        onBlockReceived(request, reply.data(), retransmitted);
+
     // Send next block, ask for next block, or process the final reply
     if (reply->hasMoreBlocksToSend() && reply->nextBlockToSend() >= 0) {
-        request->setToSendBlock(static_cast<uint>(reply->nextBlockToSend()), blockSize);
+        // The server may ask for smaller blocks, see
+        // https://tools.ietf.org/html/rfc7959#section-2.5
+        const QCoapOption block1 = reply->message()->option(QCoapOption::Block1);
+        const uint offset = request->nextBlockOffset();
+        uint size = 0;
+        if (request->isBertBlock() && isBertOption(block1)) {
+            size = qMax(bertBlockSize(request), 1024u);
+        } else {
+            const uint acceptedSize = qMin(request->blockSize(), blockSizeFromOption(block1));
+            size = nextBlockSize(request->targetUri(), offset, acceptedSize);
+        }
+        request->setToSendBlock(offset / qMin(size, 1024u), size);
         request->setMessageId(generateUniqueMessageId());
-        sendRequest(request);
+        if (!sendRequest(request))
+            onRequestError(request, QtCoap::Error::Busy);
+    } else if (reply->hasMoreBlocksToReceive() && openBlockWindow(request, reply.data())) {
+        onBlockWindowReply(request, reply, sender);
     } else if (reply->hasMoreBlocksToReceive()) {
-        request->setToRequestBlock(reply->currentBlockNumber() + 1, reply->blockSize());
+        const uint offset = reply->nextBlockOffset();
+        const uint bertSize = bertBlockSize(request);
+        uint size = 0;
+        if (request->isMulticast())
+            size = reply->blockSize();
+        else if (reply->isBertBlock() && bertSize > 0)
+            size = bertSize;
+        else
+            size = nextBlockSize(request->targetUri(), offset, reply->blockSize());
+        request->setToRequestBlock(offset / qMin(size, 1024u), size);
         request->setMessageId(generateUniqueMessageId());
         // In case of multicast blockwise transfers, according to
         // https://tools.ietf.org/html/rfc7959#section-2.8, further blocks should be retrieved
         // via unicast requests. So instead of using the multicast request address, we need
         // to use the sender address for getting the next blocks.
-        sendRequest(request, sender.toString());
+        if (!sendRequest(request, sender))
+            onRequestError(request, QtCoap::Error::Busy);
     } else {
         onLastMessageReceived(request, sender);
     }
@@ -384,264 +793,2220 @@ void QCoapProtocolPrivate::onFrameReceived(const QByteArray &data, const QHostAd
 /*!
     \internal
 
-    Returns the internal request for the given \a token.
+    Returns the number of Block2 requests that can be in flight at the same
+    time for a single exchange. This is the block window size, limited by
+    the \c NSTART value. The windows opened with the same endpoint also
+    share \c NSTART, see fillBlockWindow().
+
+    \sa QCoapProtocol::setBlockWindowSize(), QCoapProtocol::setMaximumConcurrentRequests()
 */
-QCoapInternalRequest *QCoapProtocolPrivate::requestForToken(const QCoapToken &token) const
+uint QCoapProtocolPrivate::effectiveBlockWindowSize() const
 {
-    auto it = exchangeMap.find(token);
-    if (it != exchangeMap.constEnd())
-        return it->request.data();
-
-    return nullptr;
+    return qMin(blockWindowSize, maximumConcurrentRequests);
 }
 
 /*!
     \internal
 
-    Returns the QCoapReply instance of the given \a token.
+    Opens a block window for the exchange of \a request, using the first block
+    \a reply of a blockwise transfer. Returns \c true if the window was opened,
+    in which case the remaining blocks are requested in parallel. Returns
+    \c false if the blocks should be requested one after the other.
+
+    A window can only be opened for unicast and non-observe requests, when the
+    server indicated the size of the resource with a Size2 option. It is not
+    needed over reliable transports, which use BERT blocks instead.
 */
-QPointer<QCoapReply> QCoapProtocolPrivate::userReplyForToken(const QCoapToken &token) const
+bool QCoapProtocolPrivate::openBlockWindow(QCoapInternalRequest *request,
+                                           QCoapInternalReply *reply)
 {
-    auto it = exchangeMap.find(token);
-    if (it != exchangeMap.constEnd())
-        return it->userReply;
+    if (effectiveBlockWindowSize() < 2 || request->isMulticast() || request->isObserve()
+            || reply->currentBlockNumber() != 0 || reply->blockSize() == 0
+            || isReliable(request)) {
+        return false;
+    }
 
-    return nullptr;
+    const QCoapOption size2 = reply->message()->option(QCoapOption::Size2);
+    if (!size2.isValid())
+        return false;
+
+    const quint64 totalSize = size2.uintValue();
+    const quint64 blockCount = (totalSize + reply->blockSize() - 1) / reply->blockSize();
+
+    // Block numbers must fit in 20 bits
+    if (blockCount < 2 || blockCount > (1u << 20))
+        return false;
+
+    auto window = QSharedPointer<CoapBlockWindow>::create();
+    window->blockSize = reply->blockSize();
+    window->blockCount = static_cast<uint>(blockCount);
+    window->nextBlock = 1;
+    window->receivedBlocks.resize(window->blockCount);
+    window->payload.resize(static_cast<qsizetype>(totalSize));
+
+    exchangeMap[request->token()].blockWindow = window;
+    blockWindowsByEndpoint.insert(request->endpoint(), request->token());
+    return true;
 }
 
 /*!
     \internal
 
-    Returns the replies for the exchange identified by \a token.
+    Handles the \a reply received from \a sender for an exchange using a block
+    window. The payload of the block is copied at its position in the
+    window buffer, and new block requests are sent to keep the window full.
+    When all blocks have been received, the final reply is processed
+    as usual.
+
+    \sa openBlockWindow(), onBlockWindowTimeout()
 */
-QList<QSharedPointer<QCoapInternalReply>>
-QCoapProtocolPrivate::repliesForToken(const QCoapToken &token) const
+void QCoapProtocolPrivate::onBlockWindowReply(QCoapInternalRequest *request,
+                                              QSharedPointer<QCoapInternalReply> reply,
+                                              const QHostAddress &sender)
 {
-    auto it = exchangeMap.find(token);
-    if (it != exchangeMap.constEnd())
-        return it->replies;
+    auto exchange = exchangeMap.find(request->token());
+    Q_ASSERT(exchange != exchangeMap.end() && exchange->blockWindow);
+    CoapBlockWindow *window = exchange->blockWindow.data();
+
+    // The payloads are stored in the window, there is no need to keep the replies
+    exchange->replies = { reply };
+
+    const QCoapMessage *message = reply->message();
+    if (reply->responseCode() == QtCoap::ResponseCode::EmptyMessage) {
+        // The server will send a separate response for this block, so
+        // stop retransmitting it.
+        for (auto &pending : window->pendingBlocks) {
+            if (pending.messageId == message->messageId())
+                pending.deadline = QDeadlineTimer(QDeadlineTimer::Forever);
+        }
+        armBlockWindowTimer(request, window);
+        return;
+    }
 
-    return {};
+    const uint blockNumber = reply->currentBlockNumber();
+    if (!message->hasOption(QCoapOption::Block2) || reply->blockSize() != window->blockSize) {
+        qCWarning(lcCoapProtocol) << "Ignoring block reply not matching the block window size"
+                                  << window->blockSize;
+        armBlockWindowTimer(request, window);
+        return;
+    }
+
+    const CoapEndpoint endpoint = request->endpoint();
+    if (window->pendingBlocks.remove(blockNumber))
+        releaseBlockWindowRequests(endpoint, 1);
+    window->storeBlock(blockNumber, reply->hasMoreBlocksToReceive(), message->payload());
+
+    if (window->isComplete()) {
+        reply->message()->setPayload(window->payload);
+        releaseBlockWindowRequests(endpoint, static_cast<uint>(window->pendingBlocks.size()));
+        blockWindowsByEndpoint.remove(endpoint, request->token());
+        exchange->blockWindow.reset();
+        onLastMessageReceived(request, sender);
+        refillBlockWindows(endpoint);
+        return;
+    }
+
+    if (!fillBlockWindow(request, window))
+        return;
+
+    armBlockWindowTimer(request, window);
+    refillBlockWindows(endpoint);
 }
 
 /*!
     \internal
 
-    Returns the last reply for the exchange identified by \a token.
+    Retransmits the blocks of the window of \a request for which no response
+    arrived in time. Confirmable requests are retransmitted with the same
+    message ID, other requests are sent again with a new message ID. The
+    exchange fails with a timeout error when a block reaches the maximum
+    retransmission count.
 */
-QCoapInternalReply *QCoapProtocolPrivate::lastReplyForToken(const QCoapToken &token) const
+void QCoapProtocolPrivate::onBlockWindowTimeout(QCoapInternalRequest *request)
 {
-    auto it = exchangeMap.find(token);
-    if (it != exchangeMap.constEnd())
-        return it->replies.last().data();
+    CoapBlockWindow *window = blockWindowForToken(request->token());
+    Q_ASSERT(window);
 
-    return nullptr;
+    for (auto it = window->pendingBlocks.begin(); it != window->pendingBlocks.end(); ++it) {
+        if (!it->deadline.hasExpired())
+            continue;
+
+        if (it->retransmissionCounter >= maximumRetransmitCount) {
+            onRequestError(request, QtCoap::Error::TimeOut);
+            return;
+        }
+
+        ++it->retransmissionCounter;
+        it->timeout *= 2;
+        if (!sendBlockWindowRequest(request, &it.value(), it.key(), window->blockSize)) {
+            onRequestError(request, QtCoap::Error::Busy);
+            return;
+        }
+    }
+
+    armBlockWindowTimer(request, window);
 }
 
 /*!
     \internal
 
-    Finds an internal request matching the given \a reply.
+    Sends requests for the next missing blocks of \a window, until the number
+    of blocks in flight reaches the effective window size, or the number of
+    requests in flight to the endpoint of \a request reaches \c NSTART, see
+    requestsInFlight().
+
+    Returns \c false if the connection rejected a request, in which case the
+    exchange has failed and \a request must not be used anymore.
 */
-QCoapInternalRequest *QCoapProtocolPrivate::findRequestByUserReply(const QCoapReply *reply) const
+bool QCoapProtocolPrivate::fillBlockWindow(QCoapInternalRequest *request,
+                                           CoapBlockWindow *window)
 {
-    for (auto it = exchangeMap.constBegin(); it != exchangeMap.constEnd(); ++it) {
-        if (it->userReply == reply)
-            return it->request.data();
+    const uint windowSize = effectiveBlockWindowSize();
+    const CoapEndpoint &endpoint = request->endpoint();
+    const uint otherRequests = requestsInFlight(endpoint)
+            - blockWindowRequestsInFlight.value(endpoint);
+    while (static_cast<uint>(window->pendingBlocks.size()) < windowSize
+           && otherRequests + blockWindowRequestsInFlight.value(endpoint)
+                    < maximumConcurrentRequests
+           && window->nextBlock < window->blockCount) {
+        const uint blockNumber = window->nextBlock++;
+        if (window->receivedBlocks.testBit(blockNumber))
+            continue;
+
+        CoapBlockWindow::PendingBlock pending;
+        pending.timeout = initialTimeout(request);
+        if (!sendBlockWindowRequest(request, &pending, blockNumber, window->blockSize)) {
+            onRequestError(request, QtCoap::Error::Busy);
+            return false;
+        }
+        window->pendingBlocks.insert(blockNumber, pending);
+        ++blockWindowRequestsInFlight[endpoint];
     }
 
-    return nullptr;
+    return true;
 }
 
 /*!
     \internal
 
-    Finds an internal request containing the message id \a messageId.
+    Sends requests for the missing blocks of the windows opened with
+    \a endpoint, while the number of requests in flight to \a endpoint is
+    below \c NSTART.
+
+    \sa fillBlockWindow()
 */
-QCoapInternalRequest *QCoapProtocolPrivate::findRequestByMessageId(quint16 messageId) const
+void QCoapProtocolPrivate::refillBlockWindows(const CoapEndpoint &endpoint)
 {
-    for (auto it = exchangeMap.constBegin(); it != exchangeMap.constEnd(); ++it) {
-        if (it->request->message()->messageId() == messageId)
-            return it->request.data();
-    }
+    // Filling a window may fail its exchange, which is then removed
+    const QList<QCoapToken> tokens = blockWindowsByEndpoint.values(endpoint);
+    for (const auto &token : tokens) {
+        if (requestsInFlight(endpoint) >= maximumConcurrentRequests)
+            return;
 
-    return nullptr;
+        const auto exchange = exchangeMap.constFind(token);
+        if (exchange == exchangeMap.cend() || !exchange->blockWindow)
+            continue;
+
+        QCoapInternalRequest *request = exchange->request.data();
+        CoapBlockWindow *window = exchange->blockWindow.data();
+        if (fillBlockWindow(request, window))
+            armBlockWindowTimer(request, window);
+    }
 }
 
 /*!
     \internal
 
-    Handles what to do when we received the last block of a reply.
-
-    Merges all blocks, removes the request from the map, updates the
-    associated QCoapReply and emits the
-    \l{QCoapProtocol::finished(QCoapReply*)}{finished(QCoapReply*)} signal.
+    Refills the block windows opened with \a endpoint from the event loop,
+    once an exchange with \a endpoint no longer counts against \c NSTART.
 */
-void QCoapProtocolPrivate::onLastMessageReceived(QCoapInternalRequest *request,
-                                                 const QHostAddress &sender)
+void QCoapProtocolPrivate::scheduleBlockWindowRefill(const CoapEndpoint &endpoint)
 {
-    Q_ASSERT(request);
-    if (!request || !isRequestRegistered(request))
+    if (!blockWindowsByEndpoint.contains(endpoint))
         return;
 
-    auto replies = repliesForToken(request->token());
-    Q_ASSERT(!replies.isEmpty());
+    QMetaObject::invokeMethod(q_func(), [this, endpoint]() {
+        refillBlockWindows(endpoint);
+    }, Qt::QueuedConnection);
+}
 
-    //! TODO: Change QPointer<QCoapReply> into something independent from
-    //! User. QSharedPointer(s)?
-    QPointer<QCoapReply> userReply = userReplyForToken(request->token());
-    if (userReply.isNull() || replies.isEmpty()
-            || (request->isObserve() && request->isObserveCancelled())) {
-        forgetExchange(request);
-        return;
-    }
+/*!
+    \internal
 
-    auto lastReply = replies.last();
-    // Ignore empty ACK messages
-    if (lastReply->message()->type() == QCoapMessage::Type::Acknowledgment
-            && lastReply->responseCode() == QtCoap::ResponseCode::EmptyMessage) {
-        exchangeMap[request->token()].replies.takeLast();
+    Returns the number of requests in flight to \a endpoint, counted against
+    \c NSTART: the block requests of the windows opened with \a endpoint,
+    and one for each other exchange with \a endpoint waiting for a response.
+    An observation no longer counts once its first notification arrived.
+
+    Only the block windows are held back by \c NSTART, the first request of
+    an exchange is sent right away.
+*/
+uint QCoapProtocolPrivate::requestsInFlight(const CoapEndpoint &endpoint) const
+{
+    uint count = blockWindowRequestsInFlight.value(endpoint);
+    for (const auto &exchange : exchangeMap) {
+        const QCoapInternalRequest *request = exchange.request.data();
+        if (exchange.blockWindow || !request || request->endpoint() != endpoint
+                || (request->isObserve() && exchange.observeFreshness.hasNotification)) {
+            continue;
+        }
+        ++count;
+    }
+    return count;
+}
+
+/*!
+    \internal
+
+    Releases \a count block requests in flight to \a endpoint, which can be
+    used by the block windows opened with that endpoint.
+*/
+void QCoapProtocolPrivate::releaseBlockWindowRequests(const CoapEndpoint &endpoint, uint count)
+{
+    if (count == 0)
+        return;
+
+    const auto it = blockWindowRequestsInFlight.find(endpoint);
+    if (it == blockWindowRequestsInFlight.end())
         return;
+
+    if (*it <= count)
+        blockWindowRequestsInFlight.erase(it);
+    else
+        *it -= count;
+}
+
+/*!
+    \internal
+
+    Sends the request for the block \a blockNumber of size \a blockSize,
+    and updates the message ID and deadline of the \a pending block.
+    Returns \c false if the connection rejected the request.
+*/
+bool QCoapProtocolPrivate::sendBlockWindowRequest(QCoapInternalRequest *request,
+                                                  CoapBlockWindow::PendingBlock *pending,
+                                                  uint blockNumber, uint blockSize)
+{
+    if (pending->messageId == 0
+            || request->message()->type() != QCoapMessage::Type::Confirmable) {
+        pending->messageId = generateUniqueMessageId();
     }
+    pending->deadline = QDeadlineTimer(pending->timeout);
 
-    // Merge payloads for blockwise transfers
-    if (replies.size() > 1) {
+    request->setToRequestBlock(blockNumber, blockSize);
+    request->setMessageId(pending->messageId);
 
-        // In multicast case, multiple hosts will reply to the same multicast request.
-        // We are interested only in replies coming from the sender.
-        if (request->isMulticast()) {
-            replies.erase(std::remove_if(replies.begin(), replies.end(),
-                                         [sender](QSharedPointer<QCoapInternalReply> reply) {
-                                            return reply->senderAddress() != sender;
-                                         }), replies.end());
+    return request->connection()->d_func()->sendRequest(request->toQByteArray(),
+                                                        request->endpoint());
+}
+
+/*!
+    \internal
+
+    Starts the timeout timer of \a request so that it fires at the earliest
+    deadline of the blocks in flight in \a window.
+*/
+void QCoapProtocolPrivate::armBlockWindowTimer(QCoapInternalRequest *request,
+                                               const CoapBlockWindow *window)
+{
+    QDeadlineTimer earliest(QDeadlineTimer::Forever);
+    for (const auto &pending : window->pendingBlocks)
+        earliest = qMin(earliest, pending.deadline);
+
+    if (!earliest.isForever())
+        request->startTimeoutTimer(static_cast<uint>(qMax<qint64>(0, earliest.remainingTime())));
+}
+
+/*!
+    \internal
+
+    Copies the \a blockPayload of the block \a blockNumber at its position in
+    the window buffer. If \a moreBlocks is \c false, the block is the last
+    one of the resource. Returns \c true if the block was stored, or \c false
+    if it was already received.
+*/
+bool CoapBlockWindow::storeBlock(uint blockNumber, bool moreBlocks, const QByteArray &blockPayload)
+{
+    if (!moreBlocks) {
+        blockCount = blockNumber + 1;
+        lastBlockReceived = true;
+    } else if (!lastBlockReceived && blockNumber + 1 >= blockCount) {
+        // Size2 is only an estimate, the resource may have more blocks
+        blockCount = blockNumber + 2;
+    }
+    receivedBlocks.resize(blockCount);
+
+    if (blockNumber >= blockCount || receivedBlocks.testBit(blockNumber))
+        return false;
+
+    const qsizetype offset = static_cast<qsizetype>(blockNumber) * blockSize;
+    if (payload.size() < offset + blockPayload.size())
+        payload.resize(offset + blockPayload.size());
+    payload.replace(offset, blockPayload.size(), blockPayload);
+    receivedBlocks.setBit(blockNumber);
+
+    if (!moreBlocks)
+        payload.truncate(offset + blockPayload.size());
+
+    return true;
+}
+
+/*!
+    \internal
+
+    Returns \c true if all the blocks of the resource have been received.
+*/
+bool CoapBlockWindow::isComplete() const
+{
+    return lastBlockReceived
+            && receivedBlocks.count(true) == static_cast<qsizetype>(blockCount);
+}
+
+/*!
+    \internal
+
+    Returns the block window of the exchange identified by \a token, or
+    \nullptr if the exchange does not use a block window.
+*/
+CoapBlockWindow *QCoapProtocolPrivate::blockWindowForToken(const QCoapToken &token) const
+{
+    auto it = exchangeMap.find(token);
+    if (it != exchangeMap.constEnd())
+        return it->blockWindow.data();
+
+    return nullptr;
+}
+
+/*!
+    \internal
+
+    Returns the URL identifying the endpoint targeted by \a url, made of its
+    scheme, host and port.
+*/
+QUrl QCoapProtocolPrivate::endpointUrl(const QUrl &url)
+{
+    QUrl endpoint;
+    endpoint.setScheme(url.scheme());
+    endpoint.setHost(url.host());
+    endpoint.setPort(url.port());
+    return endpoint;
+}
+
+/*!
+    \internal
+
+    Returns the block size to use for new blockwise transfers with the
+    endpoint targeted by \a url. This is the size negotiated with the
+    endpoint if any, or the configured block size otherwise.
+
+    \sa QCoapProtocol::blockSizeForEndpoint()
+*/
+quint16 QCoapProtocolPrivate::endpointBlockSize(const QUrl &url) const
+{
+    const auto it = endpointBlockSizes.constFind(endpointUrl(url));
+    if (it != endpointBlockSizes.constEnd() && it->blockSize > 0)
+        return it->blockSize;
+
+    return blockSize;
+}
+
+/*!
+    \internal
+
+    Returns the size of the block starting at \a offset for a transfer with
+    the endpoint targeted by \a url, currently using blocks of size
+    \a currentSize. The block size can always be reduced. It is only
+    increased if \a offset is a multiple of the new size, so that the
+    blocks already transferred are not split.
+*/
+uint QCoapProtocolPrivate::nextBlockSize(const QUrl &url, uint offset, uint currentSize) const
+{
+    const auto it = endpointBlockSizes.constFind(endpointUrl(url));
+    if (it == endpointBlockSizes.constEnd() || it->blockSize == 0)
+        return currentSize;
+
+    const uint wantedSize = it->blockSize;
+    if (wantedSize <= currentSize || offset % wantedSize == 0)
+        return wantedSize;
+
+    return currentSize;
+}
+
+/*!
+    \internal
+
+    Called before the blockwise \a request is retransmitted. After repeated
+    losses, the block size of the endpoint is halved, to avoid IP
+    fragmentation on constrained links.
+*/
+void QCoapProtocolPrivate::onBlockLost(const QCoapInternalRequest *request)
+{
+    if (request->isMulticast())
+        return;
+
+    const QCoapMessage *message = request->message();
+    uint requestSize = 0;
+    if (message->hasOption(QCoapOption::Block1))
+        requestSize = request->blockSize();
+    else if (message->hasOption(QCoapOption::Block2))
+        requestSize = blockSizeFromOption(message->option(QCoapOption::Block2));
+    else
+        return;
+
+    const QUrl endpoint = endpointUrl(request->targetUri());
+    auto it = endpointBlockSizes.find(endpoint);
+    if (it == endpointBlockSizes.end()) {
+        CoapEndpointBlockSize state;
+        state.maximumBlockSize = blockSize > 0 ? blockSize : 1024;
+        it = endpointBlockSizes.insert(endpoint, state);
+    }
+
+    const quint16 size = it->blockSize > 0
+            ? it->blockSize
+            : static_cast<quint16>(qMin<uint>(it->maximumBlockSize, requestSize));
+
+    it->cleanBlocks = 0;
+    if (++it->consecutiveLosses < LossesBeforeShrinking || size <= MinimumBlockSize)
+        return;
+
+    it->consecutiveLosses = 0;
+    setEndpointBlockSize(endpoint, &it.value(), size / 2);
+}
+
+/*!
+    \internal
+
+    Updates the block size of the endpoint of \a request after receiving the
+    block \a reply. If the server chose a smaller block size than the one
+    requested, this size becomes the maximum size for the endpoint. If no
+    block was \a retransmitted for a while, the block size is doubled, up
+    to this maximum size.
+
+    For more details, refer to the
+    \l{https://tools.ietf.org/html/rfc7959#section-2.5}{RFC 7959}.
+*/
+void QCoapProtocolPrivate::onBlockReceived(const QCoapInternalRequest *request,
+                                           const QCoapInternalReply *reply, bool retransmitted)
+{
+    const QCoapMessage *message = reply->message();
+    uint requestedSize = 0;
+    uint receivedSize = 0;
+    if (message->hasOption(QCoapOption::Block2)) {
+        requestedSize = blockSizeFromOption(request->message()->option(QCoapOption::Block2));
+        receivedSize = reply->blockSize();
+    } else if (message->hasOption(QCoapOption::Block1)) {
+        requestedSize = request->blockSize();
+        receivedSize = blockSizeFromOption(message->option(QCoapOption::Block1));
+    } else {
+        return;
+    }
+
+    const QUrl endpoint = endpointUrl(request->targetUri());
+    auto it = endpointBlockSizes.find(endpoint);
+    if (it == endpointBlockSizes.end()) {
+        CoapEndpointBlockSize state;
+        // Without a size requested by the client, the server chose the block size
+        state.maximumBlockSize = static_cast<quint16>(requestedSize == 0 ? receivedSize
+                                                      : blockSize > 0 ? blockSize : 1024);
+        it = endpointBlockSizes.insert(endpoint, state);
+    }
+
+    // Late negotiation of the block size by the server
+    if (receivedSize < requestedSize && receivedSize < it->maximumBlockSize)
+        it->maximumBlockSize = static_cast<quint16>(receivedSize);
+
+    quint16 size = it->blockSize > 0
+            ? it->blockSize
+            : static_cast<quint16>(qMin<uint>(it->maximumBlockSize, receivedSize));
+    if (retransmitted) {
+        it->cleanBlocks = 0;
+    } else {
+        it->consecutiveLosses = 0;
+        if (++it->cleanBlocks >= CleanBlocksBeforeGrowing) {
+            it->cleanBlocks = 0;
+            size *= 2;
+        }
+    }
+
+    setEndpointBlockSize(endpoint, &it.value(), qMin(size, it->maximumBlockSize));
+}
+
+/*!
+    \internal
+
+    Sets the block size of the \a endpoint with the given \a state to
+    \a size, and emits the endpointBlockSizeChanged() signal if the block
+    size used for the endpoint changed.
+*/
+void QCoapProtocolPrivate::setEndpointBlockSize(const QUrl &endpoint,
+                                                CoapEndpointBlockSize *state, quint16 size)
+{
+    Q_Q(QCoapProtocol);
+
+    const quint16 previousSize = state->blockSize > 0 ? state->blockSize : blockSize;
+    size = qMax(size, MinimumBlockSize);
+    state->blockSize = size;
+    if (previousSize == size)
+        return;
+
+    qCDebug(lcCoapProtocol) << "Block size for" << endpoint << "changed from"
+                            << previousSize << "to" << size;
+    emit q->endpointBlockSizeChanged(endpoint, size);
+}
+
+/*!
+    \internal
+
+    Keeps the blocks received so far for the blockwise GET \a request, so
+    that a later request to the same URL can continue the transfer from the
+    first missing block. Only the blocks following each other from the
+    beginning of the resource are kept, together with the ETag of the
+    resource. Nothing is kept if the server did not provide an ETag, since
+    the blocks could not be validated later.
+
+    \sa resumePartialDownload(), QCoapProtocol::setResumableDownloadEnabled()
+*/
+void QCoapProtocolPrivate::savePartialDownload(const QCoapInternalRequest *request)
+{
+    if (!resumableDownloadEnabled || request->method() != QtCoap::Method::Get
+            || request->isObserve() || request->isMulticast() || isReliable(request)) {
+        return;
+    }
+
+    const auto exchange = exchangeMap.constFind(request->token());
+    if (exchange == exchangeMap.constEnd())
+        return;
+
+    CoapPartialDownload partial;
+    if (exchange->resumedDownload)
+        partial = *exchange->resumedDownload;
+
+    // The blocks are only valid as long as the last one kept is fresh
+    const QCoapMessage *lastMessage = nullptr;
+    if (exchange->blockWindow) {
+        const CoapBlockWindow *window = exchange->blockWindow.data();
+        uint receivedBlocks = 0;
+        while (receivedBlocks < window->blockCount
+               && window->receivedBlocks.testBit(receivedBlocks)) {
+            ++receivedBlocks;
         }
 
+        // The window keeps the last reply, which holds the ETag
+        if (!exchange->replies.isEmpty()) {
+            lastMessage = exchange->replies.last()->message();
+            partial.etag = lastMessage->option(QCoapOption::Etag).opaqueValue();
+        }
+        partial.blockSize = window->blockSize;
+        partial.nextBlock = receivedBlocks;
+        partial.payload = window->payload.left(receivedBlocks * window->blockSize);
+    } else {
+        auto replies = exchange->replies;
         std::stable_sort(std::begin(replies), std::end(replies),
         [](QSharedPointer<QCoapInternalReply> a, QSharedPointer<QCoapInternalReply> b) -> bool {
             return (a->currentBlockNumber() < b->currentBlockNumber());
         });
 
-        QByteArray finalPayload;
-        int lastBlockNumber = -1;
-        for (auto reply : std::as_const(replies)) {
-            int currentBlock = static_cast<int>(reply->currentBlockNumber());
-            QByteArray replyPayload = reply->message()->payload();
-            if (replyPayload.isEmpty() || currentBlock <= lastBlockNumber)
+        for (const auto &reply : std::as_const(replies)) {
+            const QCoapMessage *message = reply->message();
+            if (!message->hasOption(QCoapOption::Block2)
+                    || reply->currentBlockNumber() != partial.nextBlock) {
                 continue;
+            }
+
+            const QByteArray etag = message->option(QCoapOption::Etag).opaqueValue();
+            if (partial.nextBlock == 0) {
+                partial.etag = etag;
+                partial.blockSize = reply->blockSize();
+            } else if (etag != partial.etag || reply->blockSize() != partial.blockSize) {
+                break;
+            }
+
+            partial.payload.append(message->payload());
+            ++partial.nextBlock;
+            lastMessage = message;
+        }
+    }
+
+    if (partial.etag.isEmpty() || partial.nextBlock == 0)
+        return;
+
+    if (lastMessage) {
+        const QCoapOption maxAgeOption = lastMessage->option(QCoapOption::MaxAge);
+        const qint64 maxAge = maxAgeOption.isValid() ? maxAgeOption.uintValue() : DefaultMaxAge;
+        partial.expiry = QDeadlineTimer(maxAge * 1000);
+    }
+    if (partial.expiry.hasExpired())
+        return;
+
+    partial.validated = false;
+    storePartialDownload(request->targetUri(), partial);
+}
+
+/*!
+    \internal
 
-            finalPayload.append(replyPayload);
-            lastBlockNumber = currentBlock;
+    Keeps the \a partial download of the resource at \a url. The expired
+    partial downloads are discarded, and so is the least recently saved one
+    when more than MaximumPartialDownloads are kept.
+*/
+void QCoapProtocolPrivate::storePartialDownload(const QUrl &url,
+                                                const CoapPartialDownload &partial)
+{
+    for (auto it = partialDownloads.begin(); it != partialDownloads.end();) {
+        if (it->expiry.hasExpired()) {
+            partialDownloadOrder.removeOne(it.key());
+            it = partialDownloads.erase(it);
+        } else {
+            ++it;
         }
+    }
 
-        lastReply->message()->setPayload(finalPayload);
+    partialDownloadOrder.removeOne(url);
+    partialDownloadOrder.append(url);
+    partialDownloads.insert(url, partial);
+
+    while (partialDownloadOrder.size() > MaximumPartialDownloads)
+        partialDownloads.remove(partialDownloadOrder.takeFirst());
+}
+
+/*!
+    \internal
+
+    If blocks of the resource targeted by the GET \a request were kept after
+    an interrupted transfer, sets up the \a request to ask for the first
+    missing block instead of the first block.
+
+    \sa savePartialDownload(), checkResumedDownload()
+*/
+void QCoapProtocolPrivate::resumePartialDownload(QCoapInternalRequest *request)
+{
+    if (!resumableDownloadEnabled || request->method() != QtCoap::Method::Get
+            || request->isObserve() || request->isMulticast()) {
+        return;
     }
 
-    // Forward the answer
-    QMetaObject::invokeMethod(userReply, "_q_setContent", Qt::QueuedConnection,
-                              Q_ARG(QHostAddress, lastReply->senderAddress()),
-                              Q_ARG(QCoapMessage, *lastReply->message()),
-                              Q_ARG(QtCoap::ResponseCode, lastReply->responseCode()));
+    const auto it = partialDownloads.constFind(request->targetUri());
+    if (it == partialDownloads.constEnd())
+        return;
 
-    if (request->isObserve()) {
-        QMetaObject::invokeMethod(userReply, "_q_setNotified", Qt::QueuedConnection);
-        forgetExchangeReplies(request->token());
-    } else if (request->isMulticast()) {
-        Q_Q(QCoapProtocol);
-        emit q->responseToMulticastReceived(userReply, *lastReply->message(), sender);
-    } else {
-        QMetaObject::invokeMethod(userReply, "_q_setFinished", Qt::QueuedConnection,
-                                  Q_ARG(QtCoap::Error, QtCoap::Error::Ok));
-        forgetExchange(request);
+    const bool expired = it->expiry.hasExpired();
+    auto partial = QSharedPointer<CoapPartialDownload>::create(*it);
+    partialDownloadOrder.removeOne(it.key());
+    partialDownloads.erase(it);
+    if (expired)
+        return;
+
+    request->setToRequestBlock(partial->nextBlock, partial->blockSize);
+    exchangeMap[request->token()].resumedDownload = partial;
+}
+
+/*!
+    \internal
+
+    Validates the first \a reply to a resumed download for \a request.
+    The blocks kept from the interrupted transfer are used only if the
+    reply contains the requested block, with the same block size and ETag.
+    Otherwise, the resource has changed and the download starts again from
+    the first block. Returns \c false if the \a reply should not be
+    processed further.
+
+    \sa resumePartialDownload()
+*/
+bool QCoapProtocolPrivate::checkResumedDownload(QCoapInternalRequest *request,
+                                                QCoapInternalReply *reply)
+{
+    auto exchange = exchangeMap.find(request->token());
+    if (exchange == exchangeMap.end() || !exchange->resumedDownload
+            || exchange->resumedDownload->validated
+            || reply->responseCode() == QtCoap::ResponseCode::EmptyMessage) {
+        return true;
+    }
+
+    CoapPartialDownload *partial = exchange->resumedDownload.data();
+    const QCoapMessage *message = reply->message();
+    if (message->hasOption(QCoapOption::Block2)
+            && reply->currentBlockNumber() == partial->nextBlock
+            && reply->blockSize() == partial->blockSize
+            && message->option(QCoapOption::Etag).opaqueValue() == partial->etag) {
+        partial->validated = true;
+        return true;
+    }
+
+    const uint restartBlockSize = partial->blockSize;
+    exchange->resumedDownload.reset();
+
+    // The reply can be used as is if it is an error, the complete resource,
+    // or its first block.
+    if (QtCoap::isError(reply->responseCode()) || !message->hasOption(QCoapOption::Block2)
+            || reply->currentBlockNumber() == 0) {
+        return true;
+    }
+
+    qCDebug(lcCoapProtocol) << "The resource" << request->targetUri()
+                            << "has changed, restarting the download.";
+
+    if (message->type() == QCoapMessage::Type::Confirmable)
+        sendAcknowledgment(request);
+    forgetExchangeReplies(request->token());
+
+    const quint16 restartSize = endpointBlockSize(request->targetUri());
+    request->setToRequestBlock(0, restartSize > 0 ? restartSize : restartBlockSize);
+    request->setMessageId(generateUniqueMessageId());
+    if (!sendRequest(request))
+        onRequestError(request, QtCoap::Error::Busy);
+    return false;
+}
+
+/*!
+    \internal
+
+    Prepares the exchange of \a request for a Q-Block transfer, as described
+    in \l{https://tools.ietf.org/html/rfc9177}{RFC 9177}. Returns \c true if
+    the request will use Q-Block options, \c false otherwise.
+
+    Q-Block transfers are only used when enabled, for unicast and non-observe
+    requests over unreliable transports. Q-Block1 is used for requests with
+    a payload larger than the block size, and Q-Block2 for GET requests. All
+    the messages of the transfer are Non-confirmable.
+
+    \sa startQBlockTransfer(), QCoapProtocol::setQBlockEnabled()
+*/
+bool QCoapProtocolPrivate::openQBlockTransfer(QCoapInternalRequest *request)
+{
+    if (!qBlockEnabled || request->isMulticast() || request->isObserve()
+            || isReliable(request)) {
+        return false;
+    }
+
+    const uint size = blockSize > 0 ? blockSize : 1024;
+    const qsizetype payloadSize = request->fullPayload().size();
+    const bool uploading = payloadSize > static_cast<qsizetype>(size);
+    if (!uploading && request->method() != QtCoap::Method::Get)
+        return false;
+
+    auto transfer = QSharedPointer<CoapQBlockTransfer>::create();
+    transfer->originalType = request->message()->type();
+    transfer->blockSize = size;
+    transfer->uploading = uploading;
+    if (uploading) {
+        transfer->blockCount = static_cast<uint>((payloadSize + size - 1) / size);
+        if (!request->message()->hasOption(QCoapOption::Size1))
+            request->addOption(QCoapOption::Size1, static_cast<quint32>(payloadSize));
+        if (!request->message()->hasOption(QCoapOption::RequestTag))
+            request->setRequestTag(generateUniqueRequestTag());
+    }
+
+    request->message()->setType(QCoapMessage::Type::NonConfirmable);
+    exchangeMap[request->token()].qBlockTransfer = transfer;
+    return true;
+}
+
+/*!
+    \internal
+
+    Sends the first messages of the Q-Block transfer of \a request. For
+    Q-Block1 transfers, this is the first set of blocks of the payload.
+    For Q-Block2 transfers, this is a request for the first set of blocks of
+    the resource.
+
+    \sa openQBlockTransfer()
+*/
+void QCoapProtocolPrivate::startQBlockTransfer(QCoapInternalRequest *request)
+{
+    CoapQBlockTransfer *transfer = qBlockTransferForToken(request->token());
+    Q_ASSERT(transfer);
+
+    if (transfer->uploading)
+        sendQBlockSet(request, transfer);
+    else
+        sendQBlock2Request(request, { 0 }, transfer->blockSize, true);
+
+    armQBlockTimer(request, transfer);
+}
+
+/*!
+    \internal
+
+    Handles the \a reply received from \a sender for an exchange using
+    Q-Block options. Returns \c true if the reply was consumed by the
+    Q-Block transfer. Returns \c false if the reply should be processed
+    as usual, in which case the Q-Block transfer is over.
+
+    If the server does not support Q-Block options and answers the first
+    message with a 4.02 (Bad Option) response, the request is sent again
+    without Q-Block options.
+*/
+bool QCoapProtocolPrivate::onQBlockReply(QCoapInternalRequest *request,
+                                         QSharedPointer<QCoapInternalReply> reply,
+                                         const QHostAddress &sender)
+{
+    auto exchange = exchangeMap.find(request->token());
+    if (exchange == exchangeMap.end() || !exchange->qBlockTransfer)
+        return false;
+
+    CoapQBlockTransfer *transfer = exchange->qBlockTransfer.data();
+    const QCoapMessage *message = reply->message();
+
+    if (reply->responseCode() == QtCoap::ResponseCode::BadOption && !transfer->progress) {
+        qCDebug(lcCoapProtocol) << "Q-Block options not supported by the server,"
+                                << "falling back to blockwise transfers.";
+        fallBackFromQBlock(request);
+        return true;
+    }
+
+    if (transfer->uploading) {
+        if (reply->responseCode() == QtCoap::ResponseCode::Continue) {
+            transfer->progress = true;
+            transfer->retransmissionCounter = 0;
+            exchange->replies = { reply };
+            if (message->type() == QCoapMessage::Type::Confirmable)
+                sendAcknowledgment(request);
+
+            // Move on to the next set, if any
+            if (transfer->setStart + maximumPayloads < transfer->blockCount) {
+                transfer->setStart += maximumPayloads;
+                sendQBlockSet(request, transfer);
+            }
+            armQBlockTimer(request, transfer);
+            return true;
+        }
+
+        if (reply->responseCode() == QtCoap::ResponseCode::RequestEntityIncomplete) {
+            transfer->progress = true;
+            exchange->replies = { reply };
+            if (message->type() == QCoapMessage::Type::Confirmable)
+                sendAcknowledgment(request);
+
+            if (++transfer->retransmissionCounter > maximumRetransmitCount) {
+                onRequestError(request, QtCoap::Error::TimeOut);
+                return true;
+            }
+
+            // The payload lists the missing blocks as a CBOR sequence, see
+            // https://tools.ietf.org/html/rfc9177#section-5
+            QCborStreamReader missingBlocks(message->payload());
+            while (missingBlocks.isUnsignedInteger()) {
+                const quint64 blockNumber = missingBlocks.toUnsignedInteger();
+                if (blockNumber < transfer->blockCount)
+                    sendQBlock1Request(request, static_cast<uint>(blockNumber),
+                                       transfer->blockSize);
+                missingBlocks.next();
+            }
+            armQBlockTimer(request, transfer);
+            return true;
+        }
+
+        // Final response for the payload
+        exchange->qBlockTransfer.reset();
+        return false;
+    }
+
+    if (!message->hasOption(QCoapOption::QBlock2)) {
+        exchange->qBlockTransfer.reset();
+        return false;
+    }
+
+    CoapBlockWindow *window = &transfer->window;
+    if (window->receivedBlocks.count(true) == 0)
+        window->blockSize = reply->blockSize();
+
+    transfer->progress = true;
+    exchange->replies = { reply };
+    if (message->type() == QCoapMessage::Type::Confirmable)
+        sendAcknowledgment(request);
+
+    if (reply->blockSize() != window->blockSize) {
+        qCWarning(lcCoapProtocol) << "Ignoring Q-Block2 reply not matching the block size"
+                                  << window->blockSize;
+        armQBlockTimer(request, transfer);
+        return true;
+    }
+
+    window->storeBlock(reply->currentBlockNumber(), reply->hasMoreBlocksToReceive(),
+                       message->payload());
+
+    if (window->isComplete()) {
+        reply->message()->setPayload(window->payload);
+        exchange->qBlockTransfer.reset();
+        onLastMessageReceived(request, sender);
+        return true;
+    }
+
+    // Ask for the next set once the current one is complete
+    const uint setEnd = transfer->setStart + maximumPayloads;
+    if (window->blockCount >= setEnd && missingQBlocks(transfer).isEmpty()) {
+        transfer->setStart = setEnd;
+        transfer->retransmissionCounter = 0;
+        sendQBlock2Request(request, { setEnd }, window->blockSize, true);
+    }
+
+    armQBlockTimer(request, transfer);
+    return true;
+}
+
+/*!
+    \internal
+
+    Handles the expiration of the timeout of a Q-Block transfer for
+    \a request. Missing blocks are requested, or sent again, and the
+    transfer fails with a timeout error when no progress is made after
+    the maximum retransmission count.
+*/
+void QCoapProtocolPrivate::onQBlockTimeout(QCoapInternalRequest *request)
+{
+    CoapQBlockTransfer *transfer = qBlockTransferForToken(request->token());
+    Q_ASSERT(transfer);
+
+    if (++transfer->retransmissionCounter > maximumRetransmitCount) {
+        onRequestError(request, QtCoap::Error::TimeOut);
+        return;
+    }
+
+    if (transfer->uploading) {
+        // Without any response from the server, keep on sending the next
+        // set. Once all sets are sent, send the last block again to get
+        // the response or the list of missing blocks.
+        if (transfer->setStart + maximumPayloads < transfer->blockCount) {
+            transfer->setStart += maximumPayloads;
+            sendQBlockSet(request, transfer);
+        } else {
+            sendQBlock1Request(request, transfer->blockCount - 1, transfer->blockSize);
+        }
+    } else if (!transfer->progress) {
+        sendQBlock2Request(request, { 0 }, transfer->blockSize, true);
+    } else {
+        const QList<uint> missing = missingQBlocks(transfer);
+        if (missing.isEmpty()) {
+            sendQBlock2Request(request, { transfer->window.blockCount },
+                               transfer->window.blockSize, true);
+        } else {
+            sendQBlock2Request(request, missing, transfer->window.blockSize, false);
+        }
+    }
+
+    armQBlockTimer(request, transfer);
+}
+
+/*!
+    \internal
+
+    Sends the \a request again without any Q-Block option, using the message
+    type it had before the Q-Block transfer started.
+*/
+void QCoapProtocolPrivate::fallBackFromQBlock(QCoapInternalRequest *request)
+{
+    auto exchange = exchangeMap.find(request->token());
+    Q_ASSERT(exchange != exchangeMap.end() && exchange->qBlockTransfer);
+
+    request->message()->setType(exchange->qBlockTransfer->originalType);
+    request->removeOption(QCoapOption::QBlock1);
+    request->removeOption(QCoapOption::QBlock2);
+    request->message()->setPayload(request->fullPayload());
+    exchange->qBlockTransfer.reset();
+    exchange->replies.clear();
+
+    if (blockSize > 0) {
+        request->setToRequestBlock(0, blockSize);
+        if (request->fullPayload().size() > blockSize)
+            request->setToSendBlock(0, blockSize);
+    }
+
+    request->setMessageId(generateUniqueMessageId());
+    request->setTimeout(initialTimeout(request));
+    if (!sendRequest(request))
+        onRequestError(request, QtCoap::Error::Busy);
+}
+
+/*!
+    \internal
+
+    Sends the blocks of the current set of the Q-Block1 \a transfer, that is
+    up to maximumPayloads blocks starting from the first block of the set.
+*/
+void QCoapProtocolPrivate::sendQBlockSet(QCoapInternalRequest *request,
+                                         CoapQBlockTransfer *transfer)
+{
+    const uint setEnd = qMin(transfer->setStart + maximumPayloads, transfer->blockCount);
+    for (uint blockNumber = transfer->setStart; blockNumber < setEnd; ++blockNumber)
+        sendQBlock1Request(request, blockNumber, transfer->blockSize);
+}
+
+/*!
+    \internal
+
+    Sends the block \a blockNumber of size \a blockSize of the payload of
+    \a request, with a Q-Block1 option.
+*/
+void QCoapProtocolPrivate::sendQBlock1Request(QCoapInternalRequest *request, uint blockNumber,
+                                              uint blockSize)
+{
+    request->setToSendBlock(blockNumber, blockSize, QCoapOption::QBlock1);
+    sendQBlockFrame(request);
+}
+
+/*!
+    \internal
+
+    Sends the \a request asking for the blocks listed in \a blockNumbers,
+    with a size of \a blockSize. If \a moreBlocks is \c true, the server
+    is asked to send the whole set of blocks starting from the requested one.
+*/
+void QCoapProtocolPrivate::sendQBlock2Request(QCoapInternalRequest *request,
+                                              const QList<uint> &blockNumbers, uint blockSize,
+                                              bool moreBlocks)
+{
+    request->setToRequestQBlocks(blockNumbers, blockSize, moreBlocks);
+    sendQBlockFrame(request);
+}
+
+/*!
+    \internal
+
+    Sends the current message of \a request with a new message ID. The
+    retransmissions of Q-Block transfers are handled by the protocol, so
+    the transmission state of the request is not changed.
+*/
+void QCoapProtocolPrivate::sendQBlockFrame(QCoapInternalRequest *request)
+{
+    request->setMessageId(generateUniqueMessageId());
+
+    request->connection()->d_func()->sendRequest(request->toQByteArray(), request->endpoint());
+}
+
+/*!
+    \internal
+
+    Returns the numbers of the blocks of the current set of the Q-Block2
+    \a transfer which have not been received yet.
+*/
+QList<uint> QCoapProtocolPrivate::missingQBlocks(const CoapQBlockTransfer *transfer) const
+{
+    const CoapBlockWindow &window = transfer->window;
+    const uint setEnd = qMin(transfer->setStart + maximumPayloads, window.blockCount);
+
+    QList<uint> missing;
+    for (uint blockNumber = transfer->setStart; blockNumber < setEnd; ++blockNumber) {
+        if (!window.receivedBlocks.testBit(blockNumber))
+            missing.append(blockNumber);
+    }
+
+    return missing;
+}
+
+/*!
+    \internal
+
+    Starts the timeout timer of \a request for the Q-Block \a transfer.
+    Senders wait for \c NON_TIMEOUT before going on with the transfer,
+    and receivers wait for \c NON_RECEIVE_TIMEOUT before asking for the
+    missing blocks.
+*/
+void QCoapProtocolPrivate::armQBlockTimer(QCoapInternalRequest *request,
+                                          const CoapQBlockTransfer *transfer)
+{
+    Q_Q(const QCoapProtocol);
+    request->startTimeoutTimer(transfer->uploading ? q->nonTimeout() : q->nonReceiveTimeout());
+}
+
+/*!
+    \internal
+
+    Returns the Q-Block transfer of the exchange identified by \a token, or
+    \nullptr if the exchange does not use Q-Block options.
+*/
+CoapQBlockTransfer *QCoapProtocolPrivate::qBlockTransferForToken(const QCoapToken &token) const
+{
+    auto it = exchangeMap.find(token);
+    if (it != exchangeMap.constEnd())
+        return it->qBlockTransfer.data();
+
+    return nullptr;
+}
+
+/*!
+    \internal
+
+    Returns the internal request for the given \a token.
+*/
+QCoapInternalRequest *QCoapProtocolPrivate::requestForToken(const QCoapToken &token) const
+{
+    auto it = exchangeMap.find(token);
+    if (it != exchangeMap.constEnd())
+        return it->request.data();
+
+    return nullptr;
+}
+
+/*!
+    \internal
+
+    Returns the QCoapReply instance of the given \a token.
+*/
+QPointer<QCoapReply> QCoapProtocolPrivate::userReplyForToken(const QCoapToken &token) const
+{
+    auto it = exchangeMap.find(token);
+    if (it != exchangeMap.constEnd())
+        return it->userReply;
+
+    return nullptr;
+}
+
+/*!
+    \internal
+
+    Returns all the QCoapReply instances of the given \a token, including
+    the subscribers sharing the same observation. Deleted replies are
+    skipped.
+*/
+QList<QPointer<QCoapReply>> QCoapProtocolPrivate::userRepliesForToken(const QCoapToken &token) const
+{
+    QList<QPointer<QCoapReply>> userReplies;
+    auto it = exchangeMap.find(token);
+    if (it == exchangeMap.constEnd())
+        return userReplies;
+
+    if (it->userReply)
+        userReplies.append(it->userReply);
+    for (const auto &observer : it->observers) {
+        if (observer)
+            userReplies.append(observer);
+    }
+    return userReplies;
+}
+
+/*!
+    \internal
+
+    Returns the replies for the exchange identified by \a token.
+*/
+QList<QSharedPointer<QCoapInternalReply>>
+QCoapProtocolPrivate::repliesForToken(const QCoapToken &token) const
+{
+    auto it = exchangeMap.find(token);
+    if (it != exchangeMap.constEnd())
+        return it->replies;
+
+    return {};
+}
+
+/*!
+    \internal
+
+    Returns the last reply for the exchange identified by \a token.
+*/
+QCoapInternalReply *QCoapProtocolPrivate::lastReplyForToken(const QCoapToken &token) const
+{
+    auto it = exchangeMap.find(token);
+    if (it != exchangeMap.constEnd())
+        return it->replies.last().data();
+
+    return nullptr;
+}
+
+/*!
+    \internal
+
+    Finds an internal request matching the given \a reply.
+*/
+QCoapInternalRequest *QCoapProtocolPrivate::findRequestByUserReply(const QCoapReply *reply) const
+{
+    for (auto it = exchangeMap.constBegin(); it != exchangeMap.constEnd(); ++it) {
+        if (it->userReply == reply)
+            return it->request.data();
+    }
+
+    return nullptr;
+}
+
+/*!
+    \internal
+
+    Finds an internal request containing the message id \a messageId.
+*/
+QCoapInternalRequest *QCoapProtocolPrivate::findRequestByMessageId(quint16 messageId) const
+{
+    for (auto it = exchangeMap.constBegin(); it != exchangeMap.constEnd(); ++it) {
+        if (it->request->message()->messageId() == messageId)
+            return it->request.data();
+
+        if (it->blockWindow) {
+            for (const auto &pending : std::as_const(it->blockWindow->pendingBlocks)) {
+                if (pending.messageId == messageId)
+                    return it->request.data();
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+/*!
+    \internal
+
+    Returns \c true if the notification \a reply for the Observe \a request
+    is newer than the notifications received so far, or if \a reply is not
+    a notification. Otherwise, the notification is counted as stale and
+    \c false is returned.
+
+    For more details, refer to the
+    \l{https://tools.ietf.org/html/rfc7641#section-3.4}{RFC 7641}.
+*/
+bool QCoapProtocolPrivate::isFreshNotification(QCoapInternalRequest *request,
+                                               const QCoapInternalReply *reply)
+{
+    const QCoapOption observeOption = reply->message()->option(QCoapOption::Observe);
+    if (!request->isObserve() || !observeOption.isValid())
+        return true;
+
+    auto exchange = exchangeMap.find(request->token());
+    if (exchange == exchangeMap.end())
+        return true;
+
+    const quint32 sequenceNumber = observeOption.uintValue() & 0xFFFFFF;
+    CoapObserveFreshness &freshness = exchange->observeFreshness;
+
+    const bool isFresh = !freshness.hasNotification
+            || isNewerSequenceNumber(sequenceNumber, freshness.sequenceNumber)
+            || freshness.freshnessDeadline.hasExpired();
+
+    if (!isFresh) {
+        ++freshness.staleNotificationCount;
+        qCDebug(lcCoapProtocol).nospace() << "Dropping stale notification " << sequenceNumber
+                                          << " for token '" << request->token() << "'";
+        for (const auto &subscriber : userRepliesForToken(request->token())) {
+            QMetaObject::invokeMethod(subscriber, "_q_setStaleNotificationCount",
+                                      Qt::QueuedConnection,
+                                      Q_ARG(uint, freshness.staleNotificationCount));
+        }
+        return false;
+    }
+
+    freshness.sequenceNumber = sequenceNumber;
+    freshness.freshnessDeadline.setRemainingTime(std::chrono::seconds(128));
+    // The observation no longer counts against NSTART
+    if (!std::exchange(freshness.hasNotification, true))
+        scheduleBlockWindowRefill(request->endpoint());
+    return true;
+}
+
+/*!
+    \internal
+
+    Handles what to do when we received the last block of a reply.
+
+    Merges all blocks, removes the request from the map, updates the
+    associated QCoapReply and emits the
+    \l{QCoapProtocol::finished(QCoapReply*)}{finished(QCoapReply*)} signal.
+*/
+void QCoapProtocolPrivate::onLastMessageReceived(QCoapInternalRequest *request,
+                                                 const QHostAddress &sender)
+{
+    Q_ASSERT(request);
+    if (!request || !isRequestRegistered(request))
+        return;
+
+    auto replies = repliesForToken(request->token());
+    Q_ASSERT(!replies.isEmpty());
+
+    //! TODO: Change QPointer<QCoapReply> into something independent from
+    //! User. QSharedPointer(s)?
+    QPointer<QCoapReply> userReply = userReplyForToken(request->token());
+    const auto userReplies = userRepliesForToken(request->token());
+    if (userReplies.isEmpty() || replies.isEmpty()
+            || (request->isObserve() && request->isObserveCancelled())) {
+        forgetExchange(request);
+        return;
+    }
+
+    auto lastReply = replies.last();
+    // Ignore empty ACK messages
+    if (lastReply->message()->type() == QCoapMessage::Type::Acknowledgment
+            && lastReply->responseCode() == QtCoap::ResponseCode::EmptyMessage) {
+        exchangeMap[request->token()].replies.takeLast();
+        return;
+    }
+
+    // Merge payloads for blockwise transfers, after the blocks received
+    // before the transfer was interrupted, if any
+    const auto resumedDownload = exchangeMap.value(request->token()).resumedDownload;
+    if (replies.size() > 1 || resumedDownload) {
+
+        // In multicast case, multiple hosts will reply to the same multicast request.
+        // We are interested only in replies coming from the sender.
+        if (request->isMulticast()) {
+            replies.erase(std::remove_if(replies.begin(), replies.end(),
+                                         [sender](QSharedPointer<QCoapInternalReply> reply) {
+                                            return reply->senderAddress() != sender;
+                                         }), replies.end());
+        }
+
+        // The block size may change during the transfer, so the blocks are
+        // ordered by their offset rather than their number.
+        std::stable_sort(std::begin(replies), std::end(replies),
+        [](QSharedPointer<QCoapInternalReply> a, QSharedPointer<QCoapInternalReply> b) -> bool {
+            return (a->blockOffset() < b->blockOffset());
+        });
+
+        QByteArray finalPayload = resumedDownload ? resumedDownload->payload : QByteArray();
+        for (auto reply : std::as_const(replies)) {
+            const QByteArray replyPayload = reply->message()->payload();
+            const qsizetype offset = reply->blockOffset();
+            if (replyPayload.isEmpty() || offset + replyPayload.size() <= finalPayload.size())
+                continue;
+
+            if (offset > finalPayload.size()) {
+                qCWarning(lcCoapProtocol).nospace() << "Missing data at offset "
+                                                    << finalPayload.size() << " of the reply to "
+                                                    << request->targetUri();
+                onRequestError(request, QtCoap::Error::Unknown);
+                return;
+            }
+
+            // Blocks of different sizes may overlap
+            finalPayload.append(QByteArrayView(replyPayload).sliced(finalPayload.size() - offset));
+        }
+
+        lastReply->message()->setPayload(finalPayload);
+    }
+
+    if (request->isObserve()) {
+        // Fan the notification out to all the subscribers of the observation
+        for (const auto &subscriber : userReplies) {
+            if (!paceNotification(subscriber, lastReply))
+                deliverNotification(subscriber, lastReply.data());
+        }
+        exchangeMap[request->token()].lastNotification = lastReply;
+        forgetExchangeReplies(request->token());
+        refreshObservation(request, lastReply.data());
+        return;
+    }
+
+    // Forward the answer
+    QMetaObject::invokeMethod(userReply, "_q_setContent", Qt::QueuedConnection,
+                              Q_ARG(QHostAddress, lastReply->senderAddress()),
+                              Q_ARG(QCoapMessage, *lastReply->message()),
+                              Q_ARG(QtCoap::ResponseCode, lastReply->responseCode()));
+
+    if (request->isMulticast()) {
+        Q_Q(QCoapProtocol);
+        emit q->responseToMulticastReceived(userReply, *lastReply->message(), sender);
+    } else {
+        QMetaObject::invokeMethod(userReply, "_q_setFinished", Qt::QueuedConnection,
+                                  Q_ARG(QtCoap::Error, QtCoap::Error::Ok));
+        forgetExchange(request);
+    }
+}
+
+/*!
+    \internal
+
+    Sends an internal request acknowledging the given \a request, reusing its
+    URI and connection.
+*/
+void QCoapProtocolPrivate::sendAcknowledgment(QCoapInternalRequest *request) const
+{
+    Q_Q(const QCoapProtocol);
+    Q_ASSERT(QThread::currentThread() == q->thread());
+
+    QCoapInternalRequest ackRequest;
+    ackRequest.setTargetUri(request->targetUri());
+
+    auto internalReply = lastReplyForToken(request->token());
+    ackRequest.initEmptyMessage(internalReply->message()->messageId(),
+                                QCoapMessage::Type::Acknowledgment);
+    ackRequest.setConnection(request->connection());
+    sendRequest(&ackRequest);
+}
+
+/*!
+    \internal
+
+    Sends a Reset message (RST), reusing the details of the given
+    \a request. A Reset message indicates that a specific message has been
+    received, but cannot be properly processed.
+*/
+void QCoapProtocolPrivate::sendReset(QCoapInternalRequest *request) const
+{
+    Q_Q(const QCoapProtocol);
+    Q_ASSERT(QThread::currentThread() == q->thread());
+
+    QCoapInternalRequest resetRequest;
+    resetRequest.setTargetUri(request->targetUri());
+
+    auto lastReply = lastReplyForToken(request->token());
+    resetRequest.initEmptyMessage(lastReply->message()->messageId(), QCoapMessage::Type::Reset);
+    resetRequest.setConnection(request->connection());
+    sendRequest(&resetRequest);
+}
+
+/*!
+    \internal
+
+    Handles the \a reply received for the cancelled observation of
+    \a request.
+
+    The notifications still in flight are rejected with a Reset (RST)
+    message, and the response to the deregistration is acknowledged if
+    needed. The exchange is removed once either is received.
+*/
+void QCoapProtocolPrivate::onCancelledObservationReply(QCoapInternalRequest *request,
+                                                       const QCoapInternalReply *reply)
+{
+    const QCoapMessage *message = reply->message();
+    if (message->type() == QCoapMessage::Type::Acknowledgment
+            && reply->responseCode() == QtCoap::ResponseCode::EmptyMessage) {
+        // The response to the deregistration will be sent separately
+        exchangeMap[request->token()].replies.removeLast();
+        return;
+    }
+
+    if (message->hasOption(QCoapOption::Observe)
+            && message->type() != QCoapMessage::Type::Acknowledgment) {
+        sendReset(request);
+    } else if (message->type() == QCoapMessage::Type::Confirmable) {
+        sendAcknowledgment(request);
+    }
+
+    forgetExchange(request);
+}
+
+/*!
+    \internal
+
+    Deregisters the observation of \a request right away, as described in
+    \l{https://tools.ietf.org/html/rfc7641#section-3.6}{RFC 7641 section 3.6}:
+    the registration is sent again with the same token and options, and an
+    Observe option set to 1.
+
+    The deregistration is sent once. If it is lost, the next notification
+    is rejected with a Reset (RST) message instead. The exchange is removed
+    when the deregistration is answered, or after a timeout.
+*/
+void QCoapProtocolPrivate::sendDeregistration(QCoapInternalRequest *request)
+{
+    auto it = exchangeMap.find(request->token());
+    if (it == exchangeMap.end() || request->isMulticast())
+        return;
+
+    // Stop retransmitting the registration, if it was not answered yet
+    request->stopTransmission();
+
+    request->removeOption(QCoapOption::Observe);
+    request->addOption(QCoapOption::Observe, 1u);
+    reregisterObservation(request);
+
+    const QDeadlineTimer previousExpiry = it->observeLiveness.expiry;
+    it->observeLiveness.expiry.setRemainingTime(reregistrationDelay(0));
+    rescheduleObservation(it.key(), previousExpiry, it->observeLiveness.expiry);
+    armScheduler();
+}
+
+/*!
+    \internal
+
+    Cancels resource observation. The QCoapReply::notified() signal will not
+    be emitted after cancellation.
+
+    Unless other replies still share the same observation, it is
+    deregistered from the server right away.
+
+    \sa sendDeregistration()
+*/
+void QCoapProtocol::cancelObserve(QPointer<QCoapReply> reply)
+{
+    Q_D(QCoapProtocol);
+
+    if (reply.isNull())
+        return;
+
+    QCoapInternalRequest *request = d->requestForToken(reply->request().token());
+    if (request) {
+        // Stop here if already cancelled
+        if (!request->isObserve() || request->isObserveCancelled())
+            return;
+
+        // Keep the server registration while other subscribers remain
+        if (!d->removeObserver(request->token(), reply)) {
+            request->setObserveCancelled();
+            d->sendDeregistration(request);
+        }
+    }
+
+    // Drop the notification held back for the reply, if any
+    d->notificationPacing.remove(reply.data());
+
+    // Set as cancelled even if request is not tracked anymore
+    QMetaObject::invokeMethod(reply, "_q_setObserveCancelled", Qt::QueuedConnection);
+}
+
+/*!
+    \internal
+
+    Cancels resource observation for the given \a url. The QCoapReply::notified()
+    signal will not be emitted after cancellation.
+
+    \sa cancelObserve(QPointer<QCoapReply>)
+*/
+void QCoapProtocol::cancelObserve(const QUrl &url)
+{
+    Q_D(QCoapProtocol);
+
+    d->cancelObservations(url.host(), url, false);
+}
+
+/*!
+    \internal
+
+    Cancels the observations of all the resources whose URL starts with
+    \a urlPrefix.
+
+    \sa cancelObserve(QPointer<QCoapReply>)
+*/
+void QCoapProtocol::cancelObserveByPrefix(const QUrl &urlPrefix)
+{
+    Q_D(QCoapProtocol);
+
+    d->cancelObservations(urlPrefix.host(), urlPrefix, true);
+}
+
+/*!
+    \internal
+
+    Cancels the observations of all the resources of \a host.
+
+    \sa cancelObserve(QPointer<QCoapReply>)
+*/
+void QCoapProtocol::cancelObserveHost(const QString &host)
+{
+    Q_D(QCoapProtocol);
+
+    // Normalize the host the same way as the URLs of the requests
+    const QString normalizedHost = QUrl(QLatin1String("coap://") + host).host();
+    d->cancelObservations(normalizedHost, QUrl(), true);
+}
+
+/*!
+    \internal
+
+    Cancels the observations of the resources of \a host whose URL is
+    \a url, or starts with \a url if \a matchPrefix is \c true. The
+    observations are looked up in the index of the observations by host.
+*/
+void QCoapProtocolPrivate::cancelObservations(const QString &host, const QUrl &url,
+                                              bool matchPrefix)
+{
+    Q_Q(QCoapProtocol);
+
+    const QString prefix = url.toString();
+
+    // Cancelling may remove entries from the index
+    const auto tokens = observationsByHost.values(host);
+    for (const auto &token : tokens) {
+        const auto userReplies = userRepliesForToken(token);
+        for (const auto &userReply : userReplies) {
+            const bool matches = matchPrefix ? userReply->url().toString().startsWith(prefix)
+                                             : userReply->url() == url;
+            if (matches)
+                q->cancelObserve(userReply);
+        }
+    }
+}
+
+/*!
+    \internal
+
+    Sets the minimum \a interval in milliseconds between two notifications
+    delivered to \a reply. Notifications received in the meantime are
+    conflated, keeping only the most recent one.
+
+    An \a interval of 0 delivers each notification as soon as it arrives.
+*/
+void QCoapProtocol::setNotificationInterval(QPointer<QCoapReply> reply, uint interval)
+{
+    Q_D(QCoapProtocol);
+
+    if (reply.isNull())
+        return;
+
+    // Forget the deleted replies
+    for (auto it = d->notificationPacing.begin(); it != d->notificationPacing.end();) {
+        if (it->reply.isNull())
+            it = d->notificationPacing.erase(it);
+        else
+            ++it;
+    }
+
+    auto it = d->notificationPacing.find(reply.data());
+    if (interval == 0) {
+        if (it == d->notificationPacing.end())
+            return;
+
+        // Deliver the notification held back, if any
+        if (it->pendingNotification)
+            d->deliverNotification(reply, it->pendingNotification.data());
+        d->notificationPacing.erase(it);
+        d->armScheduler();
+        return;
+    }
+
+    if (it == d->notificationPacing.end())
+        it = d->notificationPacing.insert(reply.data(), CoapNotificationPacing());
+
+    it->reply = reply;
+    it->interval = interval;
+}
+
+/*!
+    \internal
+
+    Registers the compact observation identified by \a observation, of the
+    resource targeted by \a request, through \a connection.
+
+    Only the encoded registration and the state needed to filter and renew
+    the notifications are kept, without any QObject. The notifications are
+    forwarded with the compactNotified() signal. If the connection rejects
+    the registration, compactObserveFailed() is emitted with the
+    QtCoap::Error::Busy error.
+
+    \sa cancelCompactObserve()
+*/
+void QCoapProtocol::observeCompact(quint64 observation, const QCoapRequest &request,
+                                   QCoapConnection *connection)
+{
+    Q_D(QCoapProtocol);
+
+    // The registration is encoded once, and sent again as is when renewed
+    QCoapInternalRequest internalRequest(request);
+    internalRequest.setToken(d->generateUniqueToken());
+
+    CoapCompactObservation compactObservation;
+    compactObservation.id = observation;
+    compactObservation.endpoint = d->compactEndpointIndex(connection,
+                                                          internalRequest.targetUri());
+    compactObservation.registration = internalRequest.toQByteArray();
+
+    const QCoapToken token = internalRequest.token();
+    auto it = d->compactObservations.insert(token, compactObservation);
+    d->compactObservationTokens.insert(observation, token);
+
+    if (!d->sendCompactRegistration(*it)) {
+        d->forgetCompactObservation(token);
+        emit compactObserveFailed(observation, QtCoap::Error::Busy);
+        return;
+    }
+    d->armScheduler();
+}
+
+/*!
+    \internal
+
+    Cancels the compact observation identified by \a observation, and
+    deregisters it from the server right away.
+
+    If the deregistration is lost, a Reset (RST) message will be sent at
+    the reception of the next notification.
+*/
+void QCoapProtocol::cancelCompactObserve(quint64 observation)
+{
+    Q_D(QCoapProtocol);
+
+    const QCoapToken token = d->compactObservationTokens.take(observation);
+    auto it = d->compactObservations.find(token);
+    if (it == d->compactObservations.end())
+        return;
+
+    it->cancelled = true;
+    it->registration = deregistrationFrame(it->registration);
+    if (!it->registration.isEmpty())
+        d->sendCompactRegistration(*it);
+    it->expiry.setRemainingTime(d->reregistrationDelay(0));
+}
+
+/*!
+    \internal
+
+    Returns a snapshot of the state of the observations, that another
+    instance can restore with restoreObservation().
+
+    An observation shared by several replies is saved once. Multicast and
+    cancelled observations are not saved.
+
+    \sa writeObservations()
+*/
+QByteArray QCoapProtocol::saveObservations() const
+{
+    Q_D(const QCoapProtocol);
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const auto absoluteTime = [now](const QDeadlineTimer &deadline) -> qint64 {
+        return deadline.isForever() ? -1 : now + deadline.remainingTime();
+    };
+
+    QList<CoapSavedObservation> observations;
+    for (auto it = d->exchangeMap.cbegin(); it != d->exchangeMap.cend(); ++it) {
+        const QCoapInternalRequest *request = it->request.data();
+        if (!request->isObserve() || request->isObserveCancelled() || request->isMulticast())
+            continue;
+
+        const auto userReplies = d->userRepliesForToken(it.key());
+        if (userReplies.isEmpty())
+            continue;
+
+        CoapSavedObservation observation;
+        observation.request = userReplies.first()->request();
+        observation.request.setToken(it.key());
+        observation.sequenceNumber = it->observeFreshness.sequenceNumber;
+        observation.hasNotification = it->observeFreshness.hasNotification;
+        observation.freshUntil = absoluteTime(it->observeFreshness.freshnessDeadline);
+        observation.expiry = absoluteTime(it->observeLiveness.expiry);
+        observations.append(observation);
+    }
+
+    for (const auto &compactObservation : std::as_const(d->compactObservations)) {
+        if (compactObservation.cancelled)
+            continue;
+
+        const CoapCompactEndpoint &endpoint = d->compactEndpoints.at(compactObservation.endpoint);
+        CoapSavedObservation observation;
+        observation.compactId = compactObservation.id;
+        observation.host = endpoint.peer.host;
+        observation.port = endpoint.peer.port;
+        observation.secure = endpoint.peer.secure;
+        observation.registration = compactObservation.registration;
+        observation.sequenceNumber = compactObservation.sequenceNumber;
+        observation.hasNotification = compactObservation.hasNotification;
+        observation.freshUntil = absoluteTime(compactObservation.freshnessDeadline);
+        observation.expiry = absoluteTime(compactObservation.expiry);
+        observations.append(observation);
+    }
+
+    return QCoapProtocolPrivate::writeObservations(observations);
+}
+
+/*!
+    \internal
+
+    Restores the \a observation read from a snapshot, for \a reply and
+    through \a connection. If \a reply is \nullptr, the observation is
+    restored as a compact observation.
+
+    The observation keeps its token, so that the notifications for the
+    registration made before the snapshot are matched without registering
+    again. It is registered again if its Max-Age expired in the meantime,
+    or if no notification was received before the snapshot.
+
+    \sa saveObservations()
+*/
+void QCoapProtocol::restoreObservation(QPointer<QCoapReply> reply,
+                                       const CoapSavedObservation &observation,
+                                       QCoapConnection *connection)
+{
+    Q_D(QCoapProtocol);
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const auto deadline = [now](qint64 time) {
+        return time < 0 ? QDeadlineTimer(QDeadlineTimer::Forever)
+                        : QDeadlineTimer(qMax<qint64>(time - now, 0));
+    };
+
+    if (observation.compactId > 0) {
+        const QByteArray &registration = observation.registration;
+        const qsizetype tokenLength = registration.isEmpty() ? 0 : registration.at(0) & 0x0F;
+        const QCoapToken token = registration.mid(4, tokenLength);
+        if (token.isEmpty() || token.size() < tokenLength || d->isTokenRegistered(token)) {
+            qCWarning(lcCoapProtocol) << "Cannot restore compact observation"
+                                      << observation.compactId;
+            return;
+        }
+
+        QUrl uri;
+        uri.setScheme(observation.secure ? QStringLiteral("coaps") : QStringLiteral("coap"));
+        uri.setHost(observation.host);
+        uri.setPort(observation.port);
+
+        CoapCompactObservation compactObservation;
+        compactObservation.id = observation.compactId;
+        compactObservation.endpoint = d->compactEndpointIndex(connection, uri);
+        compactObservation.registration = registration;
+        compactObservation.sequenceNumber = observation.sequenceNumber;
+        compactObservation.hasNotification = observation.hasNotification;
+        compactObservation.freshnessDeadline = deadline(observation.freshUntil);
+        compactObservation.expiry = deadline(observation.expiry);
+
+        d->compactObservations.insert(token, compactObservation);
+        d->compactObservationTokens.insert(observation.compactId, token);
+        d->armScheduler();
+        return;
+    }
+
+    if (reply.isNull())
+        return;
+
+    const QCoapToken token = reply->request().token();
+    if (token.isEmpty() || d->isTokenRegistered(token)) {
+        qCWarning(lcCoapProtocol).nospace() << "Cannot restore observation with token '"
+                                            << token << "', it is already registered";
+        return;
+    }
+
+    const QCoapReply *abortedReply = reply.data();
+    connect(reply.data(), &QCoapReply::aborted, this,
+            [this, abortedReply](const QCoapToken &token) {
+        Q_D(QCoapProtocol);
+        d->onRequestAborted(token, abortedReply);
+    });
+    connect(reply.data(), &QCoapReply::finished, this, &QCoapProtocol::finished);
+
+    auto internalRequest = QSharedPointer<QCoapInternalRequest>::create(reply->request(), this);
+    internalRequest->setMaxTransmissionWait(maximumTransmitWait());
+    internalRequest->setConnection(connection);
+    internalRequest->setMessageId(d->generateUniqueMessageId());
+
+    d->registerExchange(token, reply, internalRequest);
+    QMetaObject::invokeMethod(reply, "_q_setRunning", Qt::QueuedConnection,
+                              Q_ARG(QCoapToken, token),
+                              Q_ARG(QCoapMessageId, internalRequest->message()->messageId()));
+
+    CoapExchangeData &exchange = d->exchangeMap[token];
+    exchange.observeFreshness.sequenceNumber = observation.sequenceNumber;
+    exchange.observeFreshness.hasNotification = observation.hasNotification;
+    exchange.observeFreshness.freshnessDeadline = deadline(observation.freshUntil);
+    exchange.observeLiveness.expiry = deadline(observation.expiry);
+
+    // The registration was not answered before the snapshot
+    if (observation.expiry < 0) {
+        d->reregisterObservation(internalRequest.data());
+        exchange.observeLiveness.expiry.setRemainingTime(
+                d->reregistrationDelay(exchange.observeLiveness.reregistrationCount++));
+    }
+
+    d->rescheduleObservation(token, QDeadlineTimer(QDeadlineTimer::Forever),
+                             exchange.observeLiveness.expiry);
+    d->armScheduler();
+}
+
+/*!
+    \internal
+
+    Returns the index of the endpoint of \a uri reached through
+    \a connection, in the table shared by the compact observations.
+    The endpoint is referenced until releaseCompactEndpoint() is called
+    with the returned index.
+*/
+quint32 QCoapProtocolPrivate::compactEndpointIndex(QCoapConnection *connection, const QUrl &uri)
+{
+    const CoapEndpoint peer = CoapEndpoint::fromUrl(uri);
+    const auto it = compactEndpointIndexes.constFind({ connection, peer });
+    if (it != compactEndpointIndexes.cend()) {
+        ++compactEndpoints[*it].references;
+        return *it;
+    }
+
+    quint32 index = 0;
+    if (!freeCompactEndpoints.isEmpty()) {
+        index = freeCompactEndpoints.takeLast();
+        compactEndpoints[index] = { connection, peer, 1 };
+    } else {
+        index = static_cast<quint32>(compactEndpoints.size());
+        compactEndpoints.append({ connection, peer, 1 });
+    }
+    compactEndpointIndexes.insert({ connection, peer }, index);
+    return index;
+}
+
+/*!
+    \internal
+
+    Releases a reference to the endpoint at \a index. The entry is reused
+    for another endpoint once no compact observation refers to it anymore.
+*/
+void QCoapProtocolPrivate::releaseCompactEndpoint(quint32 index)
+{
+    CoapCompactEndpoint &endpoint = compactEndpoints[index];
+    Q_ASSERT(endpoint.references > 0);
+    if (--endpoint.references > 0)
+        return;
+
+    compactEndpointIndexes.remove({ endpoint.connection, endpoint.peer });
+    endpoint = CoapCompactEndpoint();
+    freeCompactEndpoints.append(index);
+}
+
+/*!
+    \internal
+
+    Sends the registration of the compact \a observation with a new
+    message ID, and schedules the next attempt in case no notification
+    is received.
+
+    Returns \c false if the registration could not be sent, for instance
+    if the connection rejected it because too many frames are waiting for
+    the server.
+*/
+bool QCoapProtocolPrivate::sendCompactRegistration(CoapCompactObservation &observation)
+{
+    const CoapCompactEndpoint &endpoint = compactEndpoints.at(observation.endpoint);
+    if (!endpoint.connection)
+        return false;
+
+    const quint16 messageId = generateUniqueMessageId();
+    char *header = observation.registration.data();
+    header[2] = static_cast<char>(messageId >> 8);
+    header[3] = static_cast<char>(messageId & 0xFF);
+
+    observation.expiry.setRemainingTime(reregistrationDelay(observation.reregistrationCount++));
+    return endpoint.connection->d_func()->sendRequest(observation.registration, endpoint.peer);
+}
+
+/*!
+    \internal
+
+    Sends an empty message of the given \a type, acknowledging or rejecting
+    the message \a messageId received from \a endpoint.
+*/
+void QCoapProtocolPrivate::sendCompactEmptyMessage(const CoapCompactEndpoint &endpoint,
+                                                   quint16 messageId,
+                                                   QCoapMessage::Type type) const
+{
+    if (!endpoint.connection)
+        return;
+
+    // Version 1, no token, and an empty code
+    QByteArray frame(4, '\0');
+    frame[0] = static_cast<char>(0x40 | (static_cast<quint8>(type) << 4));
+    frame[2] = static_cast<char>(messageId >> 8);
+    frame[3] = static_cast<char>(messageId & 0xFF);
+    endpoint.connection->d_func()->sendRequest(frame, endpoint.peer);
+}
+
+/*!
+    \internal
+
+    Handles the \a reply received from \a sender if it belongs to a
+    compact observation, and returns \c true. Returns \c false otherwise.
+*/
+bool QCoapProtocolPrivate::onCompactNotification(const QCoapInternalReply *reply,
+                                                 const QHostAddress &sender)
+{
+    Q_Q(QCoapProtocol);
+
+    if (compactObservations.isEmpty())
+        return false;
+
+    const QCoapMessage *message = reply->message();
+    auto it = compactObservations.find(message->token());
+    if (it == compactObservations.end())
+        return false;
+
+    const CoapCompactEndpoint endpoint = compactEndpoints.at(it->endpoint);
+    if (!endpoint.peer.isHostName() && !endpoint.peer.address.isEqual(sender)) {
+        qCDebug(lcCoapProtocol).nospace() << "QtCoap: Notification received from incorrect host ("
+                                          << sender << " instead of " << endpoint.peer.host << ")";
+        return true;
+    }
+
+    // Separate response to a confirmable registration
+    if (reply->responseCode() == QtCoap::ResponseCode::EmptyMessage)
+        return true;
+
+    if (it->cancelled) {
+        // Reject the notifications still in flight, and acknowledge the
+        // response to the deregistration if needed
+        if (message->hasOption(QCoapOption::Observe)
+                && message->type() != QCoapMessage::Type::Acknowledgment) {
+            sendCompactEmptyMessage(endpoint, message->messageId(), QCoapMessage::Type::Reset);
+        } else if (message->type() == QCoapMessage::Type::Confirmable) {
+            sendCompactEmptyMessage(endpoint, message->messageId(),
+                                    QCoapMessage::Type::Acknowledgment);
+        }
+        forgetCompactObservation(message->token());
+        return true;
+    }
+
+    if (message->type() == QCoapMessage::Type::Confirmable)
+        sendCompactEmptyMessage(endpoint, message->messageId(),
+                                QCoapMessage::Type::Acknowledgment);
+
+    const quint64 observation = it->id;
+    if (QtCoap::isError(reply->responseCode())) {
+        forgetCompactObservation(message->token());
+        emit q->compactObserveFailed(observation,
+                                     QtCoap::errorForResponseCode(reply->responseCode()));
+        return true;
+    }
+
+    // Drop the notifications older than the last one, unless the last one
+    // is more than 128 seconds old, see RFC 7641 section 3.4
+    const QCoapOption observeOption = message->option(QCoapOption::Observe);
+    if (observeOption.isValid()) {
+        const quint32 sequenceNumber = observeOption.uintValue() & 0xFFFFFF;
+        if (it->hasNotification && !isNewerSequenceNumber(sequenceNumber, it->sequenceNumber)
+                && !it->freshnessDeadline.hasExpired()) {
+            return true;
+        }
+
+        it->sequenceNumber = sequenceNumber;
+        it->freshnessDeadline.setRemainingTime(std::chrono::seconds(128));
+        it->hasNotification = true;
     }
+
+    const QCoapOption maxAgeOption = message->option(QCoapOption::MaxAge);
+    const qint64 maxAge = maxAgeOption.isValid() ? maxAgeOption.uintValue() : DefaultMaxAge;
+    it->expiry.setRemainingTime(maxAge * 1000 + MaxAgeMargin);
+    it->reregistrationCount = 0;
+
+    emit q->compactNotified(observation, *message);
+    return true;
 }
 
 /*!
     \internal
 
-    Sends an internal request acknowledging the given \a request, reusing its
-    URI and connection.
+    Removes the compact observation registered with \a token.
 */
-void QCoapProtocolPrivate::sendAcknowledgment(QCoapInternalRequest *request) const
+void QCoapProtocolPrivate::forgetCompactObservation(const QCoapToken &token)
 {
-    Q_Q(const QCoapProtocol);
-    Q_ASSERT(QThread::currentThread() == q->thread());
-
-    QCoapInternalRequest ackRequest;
-    ackRequest.setTargetUri(request->targetUri());
+    const auto it = compactObservations.constFind(token);
+    if (it == compactObservations.cend())
+        return;
 
-    auto internalReply = lastReplyForToken(request->token());
-    ackRequest.initEmptyMessage(internalReply->message()->messageId(),
-                                QCoapMessage::Type::Acknowledgment);
-    ackRequest.setConnection(request->connection());
-    sendRequest(&ackRequest);
+    if (compactObservationTokens.value(it->id) == token)
+        compactObservationTokens.remove(it->id);
+    releaseCompactEndpoint(it->endpoint);
+    compactObservations.erase(it);
 }
 
 /*!
     \internal
 
-    Sends a Reset message (RST), reusing the details of the given
-    \a request. A Reset message indicates that a specific message has been
-    received, but cannot be properly processed.
+    Registers again the compact observations which did not receive any
+    notification before their expiry, and removes the cancelled ones.
 */
-void QCoapProtocolPrivate::sendReset(QCoapInternalRequest *request) const
+void QCoapProtocolPrivate::checkCompactObservations()
 {
-    Q_Q(const QCoapProtocol);
-    Q_ASSERT(QThread::currentThread() == q->thread());
+    if (!compactSweep.hasExpired())
+        return;
 
-    QCoapInternalRequest resetRequest;
-    resetRequest.setTargetUri(request->targetUri());
+    compactSweep = QDeadlineTimer(QDeadlineTimer::Forever);
+    for (auto it = compactObservations.begin(); it != compactObservations.end();) {
+        if (!it->expiry.hasExpired()) {
+            ++it;
+            continue;
+        }
 
-    auto lastReply = lastReplyForToken(request->token());
-    resetRequest.initEmptyMessage(lastReply->message()->messageId(), QCoapMessage::Type::Reset);
-    resetRequest.setConnection(request->connection());
-    sendRequest(&resetRequest);
+        if (it->cancelled) {
+            releaseCompactEndpoint(it->endpoint);
+            it = compactObservations.erase(it);
+            continue;
+        }
+
+        // The server may have restarted with new sequence numbers. A rejected
+        // registration is sent again after the next delay, as a lost one
+        it->hasNotification = false;
+        if (!sendCompactRegistration(*it)) {
+            qCDebug(lcCoapProtocol) << "Re-registration of compact observation" << it->id
+                                    << "rejected by the connection, retrying later.";
+        }
+        ++it;
+    }
 }
 
 /*!
     \internal
 
-    Cancels resource observation. The QCoapReply::notified() signal will not
-    be emitted after cancellation.
+    Encodes the state of \a observations into a binary snapshot.
 
-    A Reset (RST) message will be sent at the reception of the next message.
+    \sa readObservations()
 */
-void QCoapProtocol::cancelObserve(QPointer<QCoapReply> reply) const
+QByteArray QCoapProtocolPrivate::writeObservations(const QList<CoapSavedObservation> &observations)
 {
-    Q_D(const QCoapProtocol);
-
-    if (reply.isNull())
-        return;
-
-    QCoapInternalRequest *request = d->requestForToken(reply->request().token());
-    if (request) {
-        // Stop here if already cancelled
-        if (!request->isObserve() || request->isObserveCancelled())
-            return;
+    QByteArray snapshot;
+    QDataStream stream(&snapshot, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_0);
+
+    stream << ObservationSnapshotMagic << ObservationSnapshotVersion
+           << static_cast<quint32>(observations.size());
+    for (const auto &observation : observations) {
+        stream << observation.compactId << observation.sequenceNumber
+               << observation.hasNotification << observation.freshUntil << observation.expiry;
+        if (observation.compactId > 0) {
+            stream << observation.host << observation.port << observation.secure
+                   << observation.registration;
+            continue;
+        }
 
-        request->setObserveCancelled();
+        const QCoapRequest &request = observation.request;
+        stream << request.url() << static_cast<quint8>(request.method())
+               << static_cast<quint8>(request.type()) << request.token() << request.payload()
+               << static_cast<quint32>(request.options().size());
+        for (const auto &option : request.options())
+            stream << static_cast<quint16>(option.name()) << option.opaqueValue();
     }
 
-    // Set as cancelled even if request is not tracked anymore
-    QMetaObject::invokeMethod(reply, "_q_setObserveCancelled", Qt::QueuedConnection);
+    return snapshot;
 }
 
 /*!
     \internal
 
-    Cancels resource observation for the given \a url. The QCoapReply::notified()
-    signal will not be emitted after cancellation.
-
-    A Reset (RST) message will be sent at the reception of the next message.
+    Decodes the binary \a snapshot written by writeObservations() into
+    \a observations. Returns \c false if the snapshot is not valid. The
+    compact observations of the snapshots of version 1, which do not keep
+    whether their endpoint is secure, are restored as not secure.
 */
-void QCoapProtocol::cancelObserve(const QUrl &url) const
+bool QCoapProtocolPrivate::readObservations(const QByteArray &snapshot,
+                                            QList<CoapSavedObservation> *observations)
 {
-    Q_D(const QCoapProtocol);
+    QDataStream stream(snapshot);
+    stream.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0;
+    quint8 version = 0;
+    quint32 count = 0;
+    stream >> magic >> version >> count;
+    if (stream.status() != QDataStream::Ok || magic != ObservationSnapshotMagic
+            || version < 1 || version > ObservationSnapshotVersion) {
+        return false;
+    }
+
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        CoapSavedObservation observation;
+        stream >> observation.compactId >> observation.sequenceNumber
+               >> observation.hasNotification >> observation.freshUntil >> observation.expiry;
+        if (observation.compactId > 0) {
+            stream >> observation.host >> observation.port;
+            if (version >= 2)
+                stream >> observation.secure;
+            stream >> observation.registration;
+            observations->append(observation);
+            continue;
+        }
+
+        QUrl url;
+        quint8 method = 0;
+        quint8 type = 0;
+        QByteArray token;
+        QByteArray payload;
+        quint32 optionCount = 0;
+        stream >> url >> method >> type >> token >> payload >> optionCount;
+
+        QCoapRequest request(url, static_cast<QCoapMessage::Type>(type));
+        request.setToken(token);
+        request.setPayload(payload);
+        for (quint32 j = 0; j < optionCount && stream.status() == QDataStream::Ok; ++j) {
+            quint16 name = 0;
+            QByteArray value;
+            stream >> name >> value;
+            request.addOption(QCoapOption(static_cast<QCoapOption::OptionName>(name), value));
+        }
 
-    for (const auto &exchange : d->exchangeMap) {
-        Q_ASSERT(exchange.userReply);
-        if (exchange.userReply->url() == url)
-            cancelObserve(exchange.userReply);
+        const bool secure = url.scheme() == QLatin1String("coaps");
+        observation.request = QCoapRequestPrivate::createRequest(
+                    request, static_cast<QtCoap::Method>(method), secure);
+        observations->append(observation);
     }
+
+    return stream.status() == QDataStream::Ok;
 }
 
 /*!
@@ -678,127 +3043,594 @@ QCoapToken QCoapProtocolPrivate::generateUniqueToken() const
             tokenData[i] = static_cast<quint8>(QtCoap::randomGenerator().bounded(256));
     }
 
-    return token;
+    return token;
+}
+
+/*!
+    \internal
+
+    Returns a Request-Tag value which is not used by any ongoing exchange.
+    Each blockwise upload uses its own tag, so that several uploads to the
+    same resource can run at the same time.
+*/
+QByteArray QCoapProtocolPrivate::generateUniqueRequestTag() const
+{
+    QByteArray tag;
+    while (tag.isEmpty() || isRequestTagRegistered(tag)) {
+        const quint32 value = QtCoap::randomGenerator().generate();
+        tag.resize(sizeof(value));
+        qToBigEndian(value, tag.data());
+    }
+
+    return tag;
+}
+
+/*!
+    \internal
+
+    Returns a new unmanaged QCoapInternalReply based on \a data and \a sender.
+*/
+QCoapInternalReply *QCoapProtocolPrivate::decode(const QByteArray &data, const QHostAddress &sender)
+{
+    Q_Q(QCoapProtocol);
+    QCoapInternalReply *reply = QCoapInternalReply::createFromFrame(data, q);
+    reply->setSenderAddress(sender);
+
+    return reply;
+}
+
+/*!
+    \internal
+
+    Aborts the request identified by \a token, for the aborted \a reply. It is
+    triggered by the destruction of the QCoapReply object or a call to
+    QCoapReply::abortRequest().
+
+    The \a reply is only compared to the subscribers of the exchange, it
+    belongs to the thread of the application and is never dereferenced here.
+*/
+void QCoapProtocolPrivate::onRequestAborted(const QCoapToken &token, const QCoapReply *reply)
+{
+    QCoapInternalRequest *request = requestForToken(token);
+    if (!request)
+        return;
+
+    // Only the aborted subscriber is removed from a shared observation
+    if (removeObserver(token, reply))
+        return;
+
+    request->stopTransmission();
+    forgetExchange(request);
+}
+
+/*!
+    \internal
+
+    Triggered in case of a connection error.
+*/
+void QCoapProtocolPrivate::onConnectionError(QAbstractSocket::SocketError socketError)
+{
+    Q_Q(QCoapProtocol);
+
+    QtCoap::Error coapError;
+    switch (socketError) {
+    case QAbstractSocket::HostNotFoundError :
+        coapError = QtCoap::Error::HostNotFound;
+        break;
+    case QAbstractSocket::AddressInUseError :
+        coapError = QtCoap::Error::AddressInUse;
+        break;
+    default:
+        coapError = QtCoap::Error::Unknown;
+        break;
+    }
+
+    emit q->error(nullptr, coapError);
+}
+
+/*!
+    \internal
+
+    Registers a new CoAP exchange using \a token. Observations are also
+    indexed by host.
+*/
+void QCoapProtocolPrivate::registerExchange(const QCoapToken &token, QCoapReply *reply,
+                                            QSharedPointer<QCoapInternalRequest> request)
+{
+    QByteArray key;
+    if (request->isObserve()) {
+        observationsByHost.insert(request->targetUri().host(), token);
+        if (!request->isMulticast()) {
+            key = observationKey(request.data());
+            observationsByKey.insert(key, token);
+        }
+    }
+
+    CoapExchangeData data = { reply, request,
+                              QList<QSharedPointer<QCoapInternalReply> >(),
+                              QSharedPointer<CoapBlockWindow>(),
+                              QSharedPointer<CoapQBlockTransfer>(),
+                              QSharedPointer<CoapPartialDownload>(),
+                              CoapObserveFreshness(),
+                              QList<QPointer<QCoapReply>>(),
+                              QSharedPointer<QCoapInternalReply>(),
+                              CoapObserveLiveness(),
+                              key
+                            };
+
+    exchangeMap.insert(token, data);
+}
+
+/*!
+    \internal
+
+    Adds \a reply to the list of replies of the exchange identified by
+    \a token.
+    Returns \c true if the reply was successfully added. This method will fail
+    and return \c false if no exchange is associated with the \a token
+    provided.
+*/
+bool QCoapProtocolPrivate::addReply(const QCoapToken &token,
+                                    QSharedPointer<QCoapInternalReply> reply)
+{
+    if (!isTokenRegistered(token) || !reply) {
+        qCWarning(lcCoapProtocol).nospace() << "Reply token '" << token
+                                            << "' not registered, or reply is null.";
+        return false;
+    }
+
+    exchangeMap[token].replies.push_back(reply);
+    return true;
+}
+
+/*!
+    \internal
+
+    Remove the exchange identified by its \a token. This is
+    typically done when finished or aborted.
+    It will delete the QCoapInternalRequest and QCoapInternalReplies
+    associated with the exchange.
+
+    Returns \c true if the exchange was found and removed, \c false otherwise.
+*/
+bool QCoapProtocolPrivate::forgetExchange(const QCoapToken &token)
+{
+    const auto it = exchangeMap.constFind(token);
+    if (it == exchangeMap.cend())
+        return false;
+
+    observationsByHost.remove(it->request->targetUri().host(), token);
+    if (!it->observationKey.isEmpty())
+        observationsByKey.remove(it->observationKey, token);
+    if (!it->observeLiveness.expiry.isForever())
+        observationDeadlines.remove(it->observeLiveness.expiry.deadline(), token);
+
+    // The windows opened with the endpoint can use the released requests
+    const CoapEndpoint endpoint = it->request->endpoint();
+    if (it->blockWindow) {
+        releaseBlockWindowRequests(endpoint,
+                                   static_cast<uint>(it->blockWindow->pendingBlocks.size()));
+        blockWindowsByEndpoint.remove(endpoint, token);
+    }
+    scheduleBlockWindowRefill(endpoint);
+
+    exchangeMap.erase(it);
+    return true;
+}
+
+/*!
+    \internal
+
+    Remove the exchange using a request.
+
+    \sa forgetExchange(const QCoapToken &)
+*/
+bool QCoapProtocolPrivate::forgetExchange(const QCoapInternalRequest *request)
+{
+    return forgetExchange(request->token());
+}
+
+/*!
+    \internal
+
+    Attaches \a reply to a running observation registered with the same
+    options as \a request, so that a single registration is kept on the
+    server, and its notifications are dispatched to every subscriber.
+    The last notification received, if any, is delivered to \a reply
+    right away.
+
+    Returns \c true if such an observation was found, \c false otherwise.
+
+    \sa removeObserver()
+*/
+bool QCoapProtocolPrivate::addObserver(QCoapReply *reply, const QCoapInternalRequest *request)
+{
+    if (!request->isObserve() || request->isMulticast())
+        return false;
+
+    const auto tokens = observationsByKey.values(observationKey(request));
+    for (const auto &token : tokens) {
+        auto it = exchangeMap.find(token);
+        if (it == exchangeMap.end())
+            continue;
+
+        const QCoapInternalRequest *registered = it->request.data();
+        if (registered->isObserveCancelled())
+            continue;
+
+        it->observers.append(reply);
+        QMetaObject::invokeMethod(reply, "_q_setRunning", Qt::QueuedConnection,
+                                  Q_ARG(QCoapToken, registered->token()),
+                                  Q_ARG(QCoapMessageId, registered->message()->messageId()));
+
+        if (it->lastNotification)
+            deliverNotification(reply, it->lastNotification.data());
+
+        qCDebug(lcCoapProtocol).nospace() << "Sharing observation of " << request->targetUri()
+                                          << " with token '" << registered->token() << "'";
+        return true;
+    }
+
+    return false;
+}
+
+/*!
+    \internal
+
+    Detaches \a reply, along with the deleted replies, from the observation
+    identified by \a token. The replies aborted by the application are
+    detached by onRequestAborted(), which is called for each of them.
+
+    Returns \c true if other subscribers still share the observation, in which
+    case the exchange is kept. Otherwise, the subscribers are left untouched and
+    \c false is returned, so that the caller can end the exchange.
+
+    \sa addObserver()
+*/
+bool QCoapProtocolPrivate::removeObserver(const QCoapToken &token, const QCoapReply *reply)
+{
+    auto it = exchangeMap.find(token);
+    if (it == exchangeMap.end() || it->observers.isEmpty())
+        return false;
+
+    QList<QPointer<QCoapReply>> remaining;
+    for (const auto &userReply : userRepliesForToken(token)) {
+        if (userReply != reply)
+            remaining.append(userReply);
+    }
+
+    if (remaining.isEmpty())
+        return false;
+
+    it->userReply = remaining.takeFirst();
+    it->observers = remaining;
+    return true;
+}
+
+/*!
+    \internal
+
+    Forwards the observe \a notification to \a reply, which emits the
+    QCoapReply::notified() signal.
+*/
+void QCoapProtocolPrivate::deliverNotification(QCoapReply *reply,
+                                               const QCoapInternalReply *notification) const
+{
+    QMetaObject::invokeMethod(reply, "_q_setContent", Qt::QueuedConnection,
+                              Q_ARG(QHostAddress, notification->senderAddress()),
+                              Q_ARG(QCoapMessage, *notification->message()),
+                              Q_ARG(QtCoap::ResponseCode, notification->responseCode()));
+    QMetaObject::invokeMethod(reply, "_q_setNotified", Qt::QueuedConnection);
+}
+
+/*!
+    \internal
+
+    Holds the \a notification back if \a reply already received a
+    notification less than its minimum interval ago. A notification held back
+    before is replaced, and counted as conflated.
+
+    Returns \c true if the notification will be delivered later by
+    deliverPacedNotifications(), \c false if it must be delivered now.
+
+    \sa QCoapProtocol::setNotificationInterval()
+*/
+bool QCoapProtocolPrivate::paceNotification(QCoapReply *reply,
+                                            QSharedPointer<QCoapInternalReply> notification)
+{
+    auto it = notificationPacing.find(reply);
+    if (it == notificationPacing.end())
+        return false;
+
+    // The address may be reused by a new reply
+    if (it->reply != reply) {
+        notificationPacing.erase(it);
+        return false;
+    }
+
+    if (!it->pendingNotification && it->nextDelivery.hasExpired()) {
+        it->nextDelivery.setRemainingTime(it->interval);
+        return false;
+    }
+
+    if (it->pendingNotification) {
+        QMetaObject::invokeMethod(reply, "_q_setConflatedNotificationCount",
+                                  Qt::QueuedConnection, Q_ARG(uint, ++it->conflatedCount));
+    } else {
+        schedulePacedNotification(reply, it->nextDelivery);
+    }
+
+    it->pendingNotification = notification;
+    armScheduler();
+    return true;
 }
 
 /*!
     \internal
 
-    Returns a new unmanaged QCoapInternalReply based on \a data and \a sender.
+    Delivers the notifications held back whose minimum interval elapsed.
 */
-QCoapInternalReply *QCoapProtocolPrivate::decode(const QByteArray &data, const QHostAddress &sender)
+void QCoapProtocolPrivate::deliverPacedNotifications()
 {
-    Q_Q(QCoapProtocol);
-    QCoapInternalReply *reply = QCoapInternalReply::createFromFrame(data, q);
-    reply->setSenderAddress(sender);
+    const qint64 now = QDeadlineTimer::current().deadline();
+    while (!pacingDeadlines.isEmpty() && pacingDeadlines.firstKey() <= now) {
+        const auto first = pacingDeadlines.begin();
+        const qint64 deadline = first.key();
+        const QCoapReply *reply = first.value();
+        pacingDeadlines.erase(first);
+
+        auto it = notificationPacing.find(reply);
+        if (it == notificationPacing.end() || !it->pendingNotification
+                || it->nextDelivery.deadline() != deadline) {
+            continue;
+        }
 
-    return reply;
+        if (it->reply.isNull()) {
+            notificationPacing.erase(it);
+            continue;
+        }
+
+        deliverNotification(it->reply, it->pendingNotification.data());
+        it->pendingNotification.reset();
+        it->nextDelivery.setRemainingTime(it->interval);
+    }
 }
 
 /*!
     \internal
 
-    Aborts the request corresponding to the given \a reply. It is triggered
-    by the destruction of the QCoapReply object or a call to
-    QCoapReply::abortRequest().
+    Updates the expiry of the observation of \a request after receiving
+    the \a notification, based on its Max-Age option. If the observation was
+    stale, its subscribers are told that it recovered.
+
+    For more details, refer to the
+    \l{https://tools.ietf.org/html/rfc7641#section-3.3.1}{RFC 7641}.
 */
-void QCoapProtocolPrivate::onRequestAborted(const QCoapToken &token)
+void QCoapProtocolPrivate::refreshObservation(QCoapInternalRequest *request,
+                                              const QCoapInternalReply *notification)
 {
-    QCoapInternalRequest *request = requestForToken(token);
-    if (!request)
+    auto it = exchangeMap.find(request->token());
+    if (it == exchangeMap.end() || request->isMulticast())
         return;
 
-    request->stopTransmission();
-    forgetExchange(request);
+    const QCoapOption maxAgeOption = notification->message()->option(QCoapOption::MaxAge);
+    const qint64 maxAge = maxAgeOption.isValid() ? maxAgeOption.uintValue() : DefaultMaxAge;
+
+    CoapObserveLiveness &liveness = it->observeLiveness;
+    const QDeadlineTimer previousExpiry = liveness.expiry;
+    liveness.expiry.setRemainingTime(maxAge * 1000 + MaxAgeMargin);
+    liveness.reregistrationCount = 0;
+    rescheduleObservation(it.key(), previousExpiry, liveness.expiry);
+
+    if (liveness.stale) {
+        liveness.stale = false;
+        qCDebug(lcCoapProtocol).nospace() << "Observation of " << request->targetUri()
+                                          << " recovered";
+        for (const auto &subscriber : userRepliesForToken(request->token())) {
+            QMetaObject::invokeMethod(subscriber, "_q_setObservationStale",
+                                      Qt::QueuedConnection, Q_ARG(bool, false));
+        }
+    }
+
+    armScheduler();
 }
 
 /*!
     \internal
 
-    Triggered in case of a connection error.
+    Registers again the observations which did not receive any notification
+    before the Max-Age of the last one expired, reusing their token. The
+    subscribers are told that the observation is stale.
+
+    The registration is repeated with an exponential backoff and a random
+    jitter until a notification is received.
+
+    The cancelled observations whose deregistration was not answered in
+    time are removed.
 */
-void QCoapProtocolPrivate::onConnectionError(QAbstractSocket::SocketError socketError)
+void QCoapProtocolPrivate::checkObservationsLiveness()
 {
-    Q_Q(QCoapProtocol);
+    QList<QCoapToken> unansweredDeregistrations;
+    const qint64 now = QDeadlineTimer::current().deadline();
+    while (!observationDeadlines.isEmpty() && observationDeadlines.firstKey() <= now) {
+        const auto first = observationDeadlines.begin();
+        const qint64 deadline = first.key();
+        const QCoapToken token = first.value();
+        observationDeadlines.erase(first);
+
+        auto it = exchangeMap.find(token);
+        if (it == exchangeMap.end())
+            continue;
+
+        QCoapInternalRequest *request = it->request.data();
+        CoapObserveLiveness &liveness = it->observeLiveness;
+        if (!request->isObserve() || liveness.expiry.deadline() != deadline)
+            continue;
+
+        if (request->isObserveCancelled()) {
+            unansweredDeregistrations.append(it.key());
+            continue;
+        }
 
-    QtCoap::Error coapError;
-    switch (socketError) {
-    case QAbstractSocket::HostNotFoundError :
-        coapError = QtCoap::Error::HostNotFound;
-        break;
-    case QAbstractSocket::AddressInUseError :
-        coapError = QtCoap::Error::AddressInUse;
-        break;
-    default:
-        coapError = QtCoap::Error::Unknown;
-        break;
+        if (!liveness.stale) {
+            liveness.stale = true;
+            qCDebug(lcCoapProtocol).nospace() << "Observation of " << request->targetUri()
+                                              << " is stale";
+            for (const auto &subscriber : userRepliesForToken(request->token())) {
+                QMetaObject::invokeMethod(subscriber, "_q_setObservationStale",
+                                          Qt::QueuedConnection, Q_ARG(bool, true));
+            }
+        }
+
+        // The server may have restarted with new sequence numbers
+        it->observeFreshness.hasNotification = false;
+        reregisterObservation(request);
+
+        liveness.expiry.setRemainingTime(reregistrationDelay(liveness.reregistrationCount++));
+        rescheduleObservation(token, QDeadlineTimer(QDeadlineTimer::Forever), liveness.expiry);
     }
 
-    emit q->error(nullptr, coapError);
+    for (const auto &token : std::as_const(unansweredDeregistrations))
+        forgetExchange(token);
 }
 
 /*!
     \internal
 
-    Registers a new CoAP exchange using \a token.
+    Returns the delay in milliseconds before registering an observation
+    again, after \a attempt registrations failed. The delay grows
+    exponentially, and is spread at random to avoid synchronized bursts.
 */
-void QCoapProtocolPrivate::registerExchange(const QCoapToken &token, QCoapReply *reply,
-                                            QSharedPointer<QCoapInternalRequest> request)
+qint64 QCoapProtocolPrivate::reregistrationDelay(uint attempt) const
 {
-    CoapExchangeData data = { reply, request,
-                              QList<QSharedPointer<QCoapInternalReply> >()
-                            };
-
-    exchangeMap.insert(token, data);
+    const qint64 delay = qMin(static_cast<qint64>(ackTimeout) << qMin(attempt, 5u),
+                              MaximumReregistrationDelay);
+    return delay + QtCoap::randomGenerator().bounded(delay / 2 + 1);
 }
 
 /*!
     \internal
 
-    Adds \a reply to the list of replies of the exchange identified by
-    \a token.
-    Returns \c true if the reply was successfully added. This method will fail
-    and return \c false if no exchange is associated with the \a token
-    provided.
+    Sends the registration of the observation of \a request again, with a
+    new message ID and the same token.
 */
-bool QCoapProtocolPrivate::addReply(const QCoapToken &token,
-                                    QSharedPointer<QCoapInternalReply> reply)
+void QCoapProtocolPrivate::reregisterObservation(QCoapInternalRequest *request)
 {
-    if (!isTokenRegistered(token) || !reply) {
-        qCWarning(lcCoapProtocol).nospace() << "Reply token '" << token
-                                            << "' not registered, or reply is null.";
-        return false;
-    }
+    if (!request->connection())
+        return;
 
-    exchangeMap[token].replies.push_back(reply);
-    return true;
+    // Ask for the first block of the notification again
+    const quint16 blockSize = endpointBlockSize(request->targetUri());
+    if (blockSize > 0)
+        request->setToRequestBlock(0, blockSize);
+    else
+        request->removeOption(QCoapOption::Block2);
+
+    request->setMessageId(generateUniqueMessageId());
+
+    // Retransmissions are driven by the liveness of the observation
+    request->connection()->d_func()->sendRequest(request->toQByteArray(), request->endpoint());
 }
 
 /*!
     \internal
 
-    Remove the exchange identified by its \a token. This is
-    typically done when finished or aborted.
-    It will delete the QCoapInternalRequest and QCoapInternalReplies
-    associated with the exchange.
+    Moves the check of the observation identified by \a token from its
+    \a previous expiry to its new \a expiry.
 
-    Returns \c true if the exchange was found and removed, \c false otherwise.
+    \sa armScheduler()
 */
-bool QCoapProtocolPrivate::forgetExchange(const QCoapToken &token)
+void QCoapProtocolPrivate::rescheduleObservation(const QCoapToken &token,
+                                                 const QDeadlineTimer &previous,
+                                                 const QDeadlineTimer &expiry)
 {
-    return exchangeMap.remove(token) > 0;
+    if (!previous.isForever())
+        observationDeadlines.remove(previous.deadline(), token);
+    if (!expiry.isForever())
+        observationDeadlines.insert(expiry.deadline(), token);
 }
 
 /*!
     \internal
 
-    Remove the exchange using a request.
+    Schedules the delivery of the notification held back for \a reply at
+    \a delivery. The deadlines of the replies which are no longer paced
+    are skipped later.
 
-    \sa forgetExchange(const QCoapToken &)
+    \sa armScheduler()
 */
-bool QCoapProtocolPrivate::forgetExchange(const QCoapInternalRequest *request)
+void QCoapProtocolPrivate::schedulePacedNotification(const QCoapReply *reply,
+                                                     const QDeadlineTimer &delivery)
 {
-    return forgetExchange(request->token());
+    if (!delivery.isForever())
+        pacingDeadlines.insert(delivery.deadline(), reply);
+}
+
+/*!
+    \internal
+
+    Starts the timer shared by all the observations, so that it fires when the
+    next notification held back is due, or when the next observation expires.
+
+    The deadlines are kept in order, so only the first ones are looked at.
+    The outdated deadlines found first are dropped on the way.
+*/
+void QCoapProtocolPrivate::armScheduler()
+{
+    Q_Q(QCoapProtocol);
+
+    QDeadlineTimer next(QDeadlineTimer::Forever);
+    while (!pacingDeadlines.isEmpty()) {
+        const auto first = pacingDeadlines.begin();
+        const auto it = notificationPacing.constFind(first.value());
+        if (it != notificationPacing.cend() && it->pendingNotification
+                && it->nextDelivery.deadline() == first.key()) {
+            next = qMin(next, it->nextDelivery);
+            break;
+        }
+        pacingDeadlines.erase(first);
+    }
+
+    while (!observationDeadlines.isEmpty()) {
+        const auto first = observationDeadlines.begin();
+        const auto it = exchangeMap.constFind(first.value());
+        if (it != exchangeMap.cend() && it->request->isObserve()
+                && it->observeLiveness.expiry.deadline() == first.key()) {
+            next = qMin(next, it->observeLiveness.expiry);
+            break;
+        }
+        observationDeadlines.erase(first);
+    }
+
+    // Compact observations are checked periodically, so that arming the
+    // timer does not depend on their number
+    if (!compactObservations.isEmpty()) {
+        if (compactSweep.isForever())
+            compactSweep.setRemainingTime(CompactSweepInterval);
+        next = qMin(next, compactSweep);
+    } else {
+        compactSweep = QDeadlineTimer(QDeadlineTimer::Forever);
+    }
+
+    if (next.isForever()) {
+        if (scheduler)
+            scheduler->stop();
+        return;
+    }
+
+    if (!scheduler) {
+        scheduler = new QTimer(q);
+        scheduler->setSingleShot(true);
+        QObject::connect(scheduler, &QTimer::timeout, q, [this]() {
+            deliverPacedNotifications();
+            checkObservationsLiveness();
+            checkCompactObservations();
+            armScheduler();
+        });
+    }
+    // Long expiries are split, the timer is armed again when it fires
+    scheduler->start(static_cast<int>(qMin(next.remainingTime(),
+                                           static_cast<qint64>(MaximumReregistrationDelay))));
 }
 
 /*!
@@ -816,6 +3648,21 @@ bool QCoapProtocolPrivate::forgetExchangeReplies(const QCoapToken &token)
     return true;
 }
 
+/*!
+    \internal
+
+    Returns \c true if the Request-Tag \a tag is used by an ongoing exchange.
+*/
+bool QCoapProtocolPrivate::isRequestTagRegistered(const QByteArray &tag) const
+{
+    for (auto it = exchangeMap.constBegin(); it != exchangeMap.constEnd(); ++it) {
+        if (it->request->requestTag() == tag)
+            return true;
+    }
+
+    return false;
+}
+
 /*!
     \internal
 
@@ -828,7 +3675,7 @@ bool QCoapProtocolPrivate::isTokenRegistered(const QCoapToken &token) const
     if (token == QByteArray())
         return true;
 
-    return exchangeMap.contains(token);
+    return exchangeMap.contains(token) || compactObservations.contains(token);
 }
 
 /*!
@@ -862,6 +3709,13 @@ bool QCoapProtocolPrivate::isMessageIdRegistered(quint16 id) const
     for (auto it = exchangeMap.constBegin(); it != exchangeMap.constEnd(); ++it) {
         if (it->request->message()->messageId() == id)
             return true;
+
+        if (it->blockWindow) {
+            for (const auto &pending : std::as_const(it->blockWindow->pendingBlocks)) {
+                if (pending.messageId == id)
+                    return true;
+            }
+        }
     }
 
     return false;
@@ -924,6 +3778,22 @@ quint16 QCoapProtocol::blockSize() const
     return d->blockSize;
 }
 
+/*!
+    \internal
+
+    Returns the block size used for new blockwise transfers with the endpoint
+    targeted by \a url. It may differ from blockSize(), if the server asked
+    for smaller blocks, or if the block size was adapted to the losses on
+    the path to the endpoint.
+
+    \sa blockSize(), endpointBlockSizeChanged()
+*/
+quint16 QCoapProtocol::blockSizeForEndpoint(const QUrl &url) const
+{
+    Q_D(const QCoapProtocol);
+    return d->endpointBlockSize(url);
+}
+
 /*!
     \internal
 
@@ -1030,6 +3900,111 @@ uint QCoapProtocol::maximumServerResponseDelay() const
     return d->maximumServerResponseDelay;
 }
 
+/*!
+    \internal
+
+    Returns the maximum number of Block2 requests kept in flight for a
+    blockwise transfer. The default is 1, which means that the blocks are
+    requested one after the other.
+
+    \sa setBlockWindowSize(), maximumConcurrentRequests()
+*/
+uint QCoapProtocol::blockWindowSize() const
+{
+    Q_D(const QCoapProtocol);
+    return d->blockWindowSize;
+}
+
+/*!
+    \internal
+
+    Returns the \c NSTART value, as defined in
+    \l{https://tools.ietf.org/html/rfc7252#section-4.7}{RFC 7252}. This is the
+    maximum number of simultaneous outstanding interactions with an endpoint.
+    The default is 1.
+
+    \sa setMaximumConcurrentRequests(), blockWindowSize()
+*/
+uint QCoapProtocol::maximumConcurrentRequests() const
+{
+    Q_D(const QCoapProtocol);
+    return d->maximumConcurrentRequests;
+}
+
+/*!
+    \internal
+
+    Returns \c true if interrupted blockwise downloads can be resumed.
+    The default is \c false.
+
+    \sa setResumableDownloadEnabled()
+*/
+bool QCoapProtocol::isResumableDownloadEnabled() const
+{
+    Q_D(const QCoapProtocol);
+    return d->resumableDownloadEnabled;
+}
+
+/*!
+    \internal
+
+    Returns \c true if Q-Block options are used for bulk transfers.
+    The default is \c false.
+
+    \sa setQBlockEnabled()
+*/
+bool QCoapProtocol::isQBlockEnabled() const
+{
+    Q_D(const QCoapProtocol);
+    return d->qBlockEnabled;
+}
+
+/*!
+    \internal
+
+    Returns the \c MAX_PAYLOADS value, that is the number of blocks sent or
+    requested in a single set of a Q-Block transfer.
+
+    \sa setMaximumPayloads()
+*/
+uint QCoapProtocol::maximumPayloads() const
+{
+    Q_D(const QCoapProtocol);
+    return d->maximumPayloads;
+}
+
+/*!
+    \internal
+
+    Returns the \c NON_TIMEOUT value in milliseconds. This is the time to wait
+    after sending a set of blocks of a Q-Block transfer. It has the same value
+    as ackTimeout().
+
+    For more details, refer to the
+    \l{https://tools.ietf.org/html/rfc9177#section-7.2}{RFC 9177}.
+
+    \sa nonReceiveTimeout()
+*/
+uint QCoapProtocol::nonTimeout() const
+{
+    Q_D(const QCoapProtocol);
+    return d->ackTimeout;
+}
+
+/*!
+    \internal
+
+    Returns the \c NON_RECEIVE_TIMEOUT value in milliseconds. This is the time
+    to wait for missing blocks of a Q-Block transfer before requesting them
+    again. It is computed as \c {4 * NON_TIMEOUT}.
+
+    \sa nonTimeout()
+*/
+uint QCoapProtocol::nonReceiveTimeout() const
+{
+    return 4 * nonTimeout();
+}
+
 /*!
     \internal
 
@@ -1095,6 +4070,8 @@ void QCoapProtocol::setMaximumRetransmitCount(uint maximumRetransmitCount)
     The \a blockSize should be zero, or range from 16 to 1024 and be a
     power of 2. A size of 0 invites the server to choose the block size.
 
+    The block sizes negotiated with each endpoint so far are reset.
+
     \sa blockSize()
 */
 void QCoapProtocol::setBlockSize(quint16 blockSize)
@@ -1113,6 +4090,7 @@ void QCoapProtocol::setBlockSize(quint16 blockSize)
     }
 
     d->blockSize = blockSize;
+    d->endpointBlockSizes.clear();
 }
 
 /*!
@@ -1152,4 +4130,123 @@ void QCoapProtocol::setMinimumTokenSize(int tokenSize)
     }
 }
 
+/*!
+    \internal
+
+    Sets the maximum number of Block2 requests kept in flight for a blockwise
+    transfer to \a windowSize. The default is 1.
+
+    With a window size greater than 1, the client asks the server for the size
+    of the resource with a Size2 option. If the server provides it, the
+    remaining blocks are requested in parallel and reassembled in order once
+    received, as allowed by
+    \l{https://tools.ietf.org/html/rfc7959#section-2.4}{RFC 7959}. Each block is
+    retransmitted independently.
+
+    Further blocks are only requested while the exchanges in progress with the
+    server are fewer than maximumConcurrentRequests().
+
+    \sa blockWindowSize(), setMaximumConcurrentRequests()
+*/
+void QCoapProtocol::setBlockWindowSize(uint windowSize)
+{
+    Q_D(QCoapProtocol);
+
+    if (windowSize == 0) {
+        qCWarning(lcCoapProtocol, "The block window size should be at least 1.");
+        return;
+    }
+
+    d->blockWindowSize = windowSize;
+}
+
+/*!
+    \internal
+
+    Sets the \c NSTART value to \a maximumConcurrentRequests. The default is 1,
+    as recommended by \l{https://tools.ietf.org/html/rfc7252#section-4.7}{RFC 7252}.
+
+    Only the block windows are held back by this value, the first request of
+    an exchange is sent right away.
+
+    \sa maximumConcurrentRequests(), setBlockWindowSize()
+*/
+void QCoapProtocol::setMaximumConcurrentRequests(uint maximumConcurrentRequests)
+{
+    Q_D(QCoapProtocol);
+
+    if (maximumConcurrentRequests == 0) {
+        qCWarning(lcCoapProtocol, "The maximum number of concurrent requests should be at least 1.");
+        return;
+    }
+
+    d->maximumConcurrentRequests = maximumConcurrentRequests;
+}
+
+/*!
+    \internal
+
+    Enables resumable blockwise downloads if \a enabled is \c true.
+    The default is \c false.
+
+    When enabled, the blocks received for a GET request failing with a
+    timeout are kept, along with the ETag of the resource. The next GET
+    request to the same URL asks for the first missing block, and the kept
+    blocks are used if the ETag still matches. The blocks are kept until
+    the Max-Age of the last one expires, for the 16 most recently
+    interrupted downloads at most. Disabling resumable downloads discards
+    all the blocks kept so far.
+
+    \sa isResumableDownloadEnabled()
+*/
+void QCoapProtocol::setResumableDownloadEnabled(bool enabled)
+{
+    Q_D(QCoapProtocol);
+    d->resumableDownloadEnabled = enabled;
+    if (!enabled) {
+        d->partialDownloads.clear();
+        d->partialDownloadOrder.clear();
+    }
+}
+
+/*!
+    \internal
+
+    Enables Q-Block transfers if \a enabled is \c true. The default is \c false.
+
+    When enabled, GET requests ask for the resource with a Q-Block2 option,
+    and payloads larger than the block size are sent with Q-Block1 options.
+    Blocks are sent as Non-confirmable messages in sets of
+    maximumPayloads() blocks, and only the missing blocks are sent again,
+    as described in \l{https://tools.ietf.org/html/rfc9177}{RFC 9177}.
+    If the server does not support Q-Block options, the request is sent
+    again as a usual blockwise transfer.
+
+    \sa isQBlockEnabled(), setMaximumPayloads()
+*/
+void QCoapProtocol::setQBlockEnabled(bool enabled)
+{
+    Q_D(QCoapProtocol);
+    d->qBlockEnabled = enabled;
+}
+
+/*!
+    \internal
+
+    Sets the \c MAX_PAYLOADS value to \a maximumPayloads. The default is 10.
+
+    \sa maximumPayloads(), setQBlockEnabled()
+*/
+void QCoapProtocol::setMaximumPayloads(uint maximumPayloads)
+{
+    Q_D(QCoapProtocol);
+
+    if (maximumPayloads == 0) {
+        qCWarning(lcCoapProtocol, "The maximum number of payloads should be at least 1.");
+        return;
+    }
+
+    d->maximumPayloads = maximumPayloads;
+}
+
 QT_END_NAMESPACE
@@ -8,10 +8,16 @@
 #include <QtCoap/qcoapglobal.h>
 #include <QtCoap/qcoapreply.h>
 #include <QtCoap/qcoapresource.h>
+#include <QtCore/qbitarray.h>
+#include <QtCore/qdeadlinetimer.h>
+#include <QtCore/qhash.h>
 #include <QtCore/qlist.h>
+#include <QtCore/qmap.h>
 #include <QtCore/qqueue.h>
 #include <QtCore/qpointer.h>
 #include <QtCore/qobject.h>
+#include <QtCore/qurl.h>
+#include <private/qcoapendpoint_p.h>
 #include <private/qobject_p.h>
 
 //
@@ -31,6 +37,8 @@ class QCoapInternalRequest;
 class QCoapInternalReply;
 class QCoapProtocolPrivate;
 class QCoapConnection;
+class QTimer;
+struct CoapSavedObservation;
 class Q_AUTOTEST_EXPORT QCoapProtocol : public QObject
 {
     Q_OBJECT
@@ -42,6 +50,7 @@ public:
     double ackRandomFactor() const;
     uint maximumRetransmitCount() const;
     quint16 blockSize() const;
+    quint16 blockSizeForEndpoint(const QUrl &url) const;
     uint maximumTransmitSpan() const;
     uint maximumTransmitWait() const;
     uint maximumLatency() const;
@@ -51,12 +60,23 @@ public:
 
     uint nonConfirmLifetime() const;
     uint maximumServerResponseDelay() const;
+    uint blockWindowSize() const;
+    uint maximumConcurrentRequests() const;
+
+    bool isResumableDownloadEnabled() const;
+    bool isQBlockEnabled() const;
+    uint maximumPayloads() const;
+    uint nonTimeout() const;
+    uint nonReceiveTimeout() const;
 
 Q_SIGNALS:
     void finished(QCoapReply *reply);
     void responseToMulticastReceived(QCoapReply *reply, const QCoapMessage &message,
                                      const QHostAddress &sender);
     void error(QCoapReply *reply, QtCoap::Error error);
+    void endpointBlockSizeChanged(const QUrl &endpoint, quint16 blockSize);
+    void compactNotified(quint64 observation, const QCoapMessage &message);
+    void compactObserveFailed(quint64 observation, QtCoap::Error error);
 
 public:
     Q_INVOKABLE void setAckTimeout(uint ackTimeout);
@@ -65,11 +85,26 @@ public:
     Q_INVOKABLE void setBlockSize(quint16 blockSize);
     Q_INVOKABLE void setMaximumServerResponseDelay(uint responseDelay);
     Q_INVOKABLE void setMinimumTokenSize(int tokenSize);
+    Q_INVOKABLE void setBlockWindowSize(uint windowSize);
+    Q_INVOKABLE void setMaximumConcurrentRequests(uint maximumConcurrentRequests);
+    Q_INVOKABLE void setResumableDownloadEnabled(bool enabled);
+    Q_INVOKABLE void setQBlockEnabled(bool enabled);
+    Q_INVOKABLE void setMaximumPayloads(uint maximumPayloads);
 
 private:
     Q_INVOKABLE void sendRequest(QPointer<QCoapReply> reply, QCoapConnection *connection);
-    Q_INVOKABLE void cancelObserve(QPointer<QCoapReply> reply) const;
-    Q_INVOKABLE void cancelObserve(const QUrl &url) const;
+    Q_INVOKABLE void cancelObserve(QPointer<QCoapReply> reply);
+    Q_INVOKABLE void cancelObserve(const QUrl &url);
+    Q_INVOKABLE void cancelObserveByPrefix(const QUrl &urlPrefix);
+    Q_INVOKABLE void cancelObserveHost(const QString &host);
+    Q_INVOKABLE void setNotificationInterval(QPointer<QCoapReply> reply, uint interval);
+    Q_INVOKABLE void observeCompact(quint64 observation, const QCoapRequest &request,
+                                    QCoapConnection *connection);
+    Q_INVOKABLE void cancelCompactObserve(quint64 observation);
+    Q_INVOKABLE QByteArray saveObservations() const;
+    Q_INVOKABLE void restoreObservation(QPointer<QCoapReply> reply,
+                                        const CoapSavedObservation &observation,
+                                        QCoapConnection *connection);
 
 private:
     Q_DECLARE_PRIVATE(QCoapProtocol)
@@ -78,14 +113,124 @@ private:
     friend class QCoapClientPrivate;
 };
 
+struct CoapBlockWindow {
+    struct PendingBlock {
+        quint16 messageId = 0;
+        uint retransmissionCounter = 0;
+        uint timeout = 0;
+        QDeadlineTimer deadline;
+    };
+
+    QByteArray payload;
+    QBitArray receivedBlocks;
+    QHash<uint, PendingBlock> pendingBlocks;
+    uint blockSize = 0;
+    uint blockCount = 0;
+    uint nextBlock = 0;
+    bool lastBlockReceived = false;
+
+    bool storeBlock(uint blockNumber, bool moreBlocks, const QByteArray &blockPayload);
+    bool isComplete() const;
+};
+
+struct CoapQBlockTransfer {
+    CoapBlockWindow window;
+    QCoapMessage::Type originalType = QCoapMessage::Type::Confirmable;
+    uint blockSize = 0;
+    uint blockCount = 0;
+    uint setStart = 0;
+    uint retransmissionCounter = 0;
+    bool uploading = false;
+    bool progress = false;
+};
+
+struct CoapEndpointBlockSize {
+    quint16 blockSize = 0;
+    quint16 maximumBlockSize = 1024;
+    uint consecutiveLosses = 0;
+    uint cleanBlocks = 0;
+};
+
+struct CoapPartialDownload {
+    QByteArray etag;
+    QByteArray payload;
+    uint blockSize = 0;
+    uint nextBlock = 0;
+    QDeadlineTimer expiry;
+    bool validated = false;
+};
+
+struct CoapObserveFreshness {
+    quint32 sequenceNumber = 0;
+    QDeadlineTimer freshnessDeadline;
+    uint staleNotificationCount = 0;
+    bool hasNotification = false;
+};
+
+struct CoapObserveLiveness {
+    QDeadlineTimer expiry = QDeadlineTimer(QDeadlineTimer::Forever);
+    uint reregistrationCount = 0;
+    bool stale = false;
+};
+
 struct CoapExchangeData {
     QPointer<QCoapReply> userReply;
     QSharedPointer<QCoapInternalRequest> request;
     QList<QSharedPointer<QCoapInternalReply> > replies;
+    QSharedPointer<CoapBlockWindow> blockWindow;
+    QSharedPointer<CoapQBlockTransfer> qBlockTransfer;
+    QSharedPointer<CoapPartialDownload> resumedDownload;
+    CoapObserveFreshness observeFreshness;
+    QList<QPointer<QCoapReply>> observers;
+    QSharedPointer<QCoapInternalReply> lastNotification;
+    CoapObserveLiveness observeLiveness;
+    QByteArray observationKey;
 };
 
 typedef QMap<QByteArray, CoapExchangeData> CoapExchangeMap;
 
+struct CoapCompactEndpoint {
+    QCoapConnection *connection = nullptr;
+    CoapEndpoint peer;
+    quint32 references = 0;
+};
+
+// Long-lived observation without any QObject, see QCoapClient::observeCompact()
+struct CoapCompactObservation {
+    QByteArray registration;
+    QDeadlineTimer expiry;
+    QDeadlineTimer freshnessDeadline;
+    quint64 id = 0;
+    quint32 endpoint = 0;
+    quint32 sequenceNumber = 0;
+    quint16 reregistrationCount = 0;
+    bool hasNotification = false;
+    bool cancelled = false;
+};
+
+// State of an observation in a snapshot, see QCoapClient::saveObservations().
+// Times are in milliseconds since the epoch, or -1 if not set.
+struct CoapSavedObservation {
+    quint64 compactId = 0;
+    QCoapRequest request;
+    QString host;
+    quint16 port = 0;
+    bool secure = false;
+    QByteArray registration;
+    quint32 sequenceNumber = 0;
+    bool hasNotification = false;
+    qint64 freshUntil = -1;
+    qint64 expiry = -1;
+};
+
+struct CoapNotificationPacing {
+    QPointer<QCoapReply> reply;
+    uint interval = 0;
+    QDeadlineTimer nextDelivery;
+    QSharedPointer<QCoapInternalReply> pendingNotification;
+    uint conflatedCount = 0;
+};
+
 class Q_AUTOTEST_EXPORT QCoapProtocolPrivate : public QObjectPrivate
 {
 public:
@@ -93,13 +238,67 @@ public:
 
     quint16 generateUniqueMessageId() const;
     QCoapToken generateUniqueToken() const;
+    QByteArray generateUniqueRequestTag() const;
 
     QCoapInternalReply *decode(const QByteArray &data, const QHostAddress &sender);
 
     void sendAcknowledgment(QCoapInternalRequest *request) const;
     void sendReset(QCoapInternalRequest *request) const;
-    void sendRequest(QCoapInternalRequest *request, const QString& host = QString()) const;
+    bool sendRequest(QCoapInternalRequest *request,
+                     const QHostAddress &destination = QHostAddress()) const;
+    uint initialTimeout(const QCoapInternalRequest *request) const;
+    bool isReliable(const QCoapInternalRequest *request) const;
+    uint bertBlockSize(const QCoapInternalRequest *request) const;
+    void startExchange(QCoapInternalRequest *request);
+    bool waitForPeerSettings(QCoapInternalRequest *request);
+
+    uint effectiveBlockWindowSize() const;
+    bool openBlockWindow(QCoapInternalRequest *request, QCoapInternalReply *reply);
+    void onBlockWindowReply(QCoapInternalRequest *request,
+                            QSharedPointer<QCoapInternalReply> reply,
+                            const QHostAddress &sender);
+    void onBlockWindowTimeout(QCoapInternalRequest *request);
+    bool fillBlockWindow(QCoapInternalRequest *request, CoapBlockWindow *window);
+    void refillBlockWindows(const CoapEndpoint &endpoint);
+    void scheduleBlockWindowRefill(const CoapEndpoint &endpoint);
+    void releaseBlockWindowRequests(const CoapEndpoint &endpoint, uint count);
+    uint requestsInFlight(const CoapEndpoint &endpoint) const;
+    bool sendBlockWindowRequest(QCoapInternalRequest *request,
+                                CoapBlockWindow::PendingBlock *pending, uint blockNumber,
+                                uint blockSize);
+    void armBlockWindowTimer(QCoapInternalRequest *request, const CoapBlockWindow *window);
+    CoapBlockWindow *blockWindowForToken(const QCoapToken &token) const;
+
+    static QUrl endpointUrl(const QUrl &url);
+    quint16 endpointBlockSize(const QUrl &url) const;
+    uint nextBlockSize(const QUrl &url, uint offset, uint currentSize) const;
+    void onBlockLost(const QCoapInternalRequest *request);
+    void onBlockReceived(const QCoapInternalRequest *request, const QCoapInternalReply *reply,
+                         bool retransmitted);
+    void setEndpointBlockSize(const QUrl &endpoint, CoapEndpointBlockSize *state,
+                              quint16 size);
+
+    void savePartialDownload(const QCoapInternalRequest *request);
+    void storePartialDownload(const QUrl &url, const CoapPartialDownload &partial);
+    void resumePartialDownload(QCoapInternalRequest *request);
+    bool checkResumedDownload(QCoapInternalRequest *request, QCoapInternalReply *reply);
+
+    bool openQBlockTransfer(QCoapInternalRequest *request);
+    void startQBlockTransfer(QCoapInternalRequest *request);
+    bool onQBlockReply(QCoapInternalRequest *request, QSharedPointer<QCoapInternalReply> reply,
+                       const QHostAddress &sender);
+    void onQBlockTimeout(QCoapInternalRequest *request);
+    void fallBackFromQBlock(QCoapInternalRequest *request);
+    void sendQBlockSet(QCoapInternalRequest *request, CoapQBlockTransfer *transfer);
+    void sendQBlock1Request(QCoapInternalRequest *request, uint blockNumber, uint blockSize);
+    void sendQBlock2Request(QCoapInternalRequest *request, const QList<uint> &blockNumbers,
+                            uint blockSize, bool moreBlocks);
+    void sendQBlockFrame(QCoapInternalRequest *request);
+    QList<uint> missingQBlocks(const CoapQBlockTransfer *transfer) const;
+    void armQBlockTimer(QCoapInternalRequest *request, const CoapQBlockTransfer *transfer);
+    CoapQBlockTransfer *qBlockTransferForToken(const QCoapToken &token) const;
 
+    bool isFreshNotification(QCoapInternalRequest *request, const QCoapInternalReply *reply);
     void onLastMessageReceived(QCoapInternalRequest *request, const QHostAddress &sender);
     void onRequestError(QCoapInternalRequest *request, QCoapInternalReply *reply);
     void onRequestError(QCoapInternalRequest *request, QtCoap::Error error,
@@ -110,14 +309,18 @@ public:
     void onMulticastRequestExpired(QCoapInternalRequest *request);
     void onFrameReceived(const QByteArray &data, const QHostAddress &sender);
     void onConnectionError(QAbstractSocket::SocketError error);
-    void onRequestAborted(const QCoapToken &token);
+    void onPeerSettingsChanged(const CoapEndpoint &endpoint);
+    void onFrameDropped(const QByteArray &frame, QtCoap::Error error);
+    void onRequestAborted(const QCoapToken &token, const QCoapReply *reply);
 
     bool isMessageIdRegistered(quint16 id) const;
     bool isTokenRegistered(const QCoapToken &token) const;
+    bool isRequestTagRegistered(const QByteArray &tag) const;
     bool isRequestRegistered(const QCoapInternalRequest *request) const;
 
     QCoapInternalRequest *requestForToken(const QCoapToken &token) const;
     QPointer<QCoapReply> userReplyForToken(const QCoapToken &token) const;
+    QList<QPointer<QCoapReply>> userRepliesForToken(const QCoapToken &token) const;
     QList<QSharedPointer<QCoapInternalReply>> repliesForToken(const QCoapToken &token) const;
     QCoapInternalReply *lastReplyForToken(const QCoapToken &token) const;
     QCoapInternalRequest *findRequestByMessageId(quint16 messageId) const;
@@ -130,7 +333,61 @@ public:
     bool forgetExchange(const QCoapInternalRequest *request);
     bool forgetExchangeReplies(const QCoapToken &token);
 
+    bool addObserver(QCoapReply *reply, const QCoapInternalRequest *request);
+    bool removeObserver(const QCoapToken &token, const QCoapReply *reply);
+    void cancelObservations(const QString &host, const QUrl &url, bool matchPrefix);
+    void sendDeregistration(QCoapInternalRequest *request);
+    void onCancelledObservationReply(QCoapInternalRequest *request,
+                                     const QCoapInternalReply *reply);
+
+    void deliverNotification(QCoapReply *reply, const QCoapInternalReply *notification) const;
+    bool paceNotification(QCoapReply *reply, QSharedPointer<QCoapInternalReply> notification);
+    void deliverPacedNotifications();
+    void refreshObservation(QCoapInternalRequest *request,
+                            const QCoapInternalReply *notification);
+    void checkObservationsLiveness();
+    void reregisterObservation(QCoapInternalRequest *request);
+    qint64 reregistrationDelay(uint attempt) const;
+
+    quint32 compactEndpointIndex(QCoapConnection *connection, const QUrl &uri);
+    void releaseCompactEndpoint(quint32 index);
+    bool sendCompactRegistration(CoapCompactObservation &observation);
+    void sendCompactEmptyMessage(const CoapCompactEndpoint &endpoint, quint16 messageId,
+                                 QCoapMessage::Type type) const;
+    bool onCompactNotification(const QCoapInternalReply *reply, const QHostAddress &sender);
+    void forgetCompactObservation(const QCoapToken &token);
+    void checkCompactObservations();
+    void rescheduleObservation(const QCoapToken &token, const QDeadlineTimer &previous,
+                               const QDeadlineTimer &expiry);
+    void schedulePacedNotification(const QCoapReply *reply, const QDeadlineTimer &delivery);
+    void armScheduler();
+
+    static QByteArray writeObservations(const QList<CoapSavedObservation> &observations);
+    static bool readObservations(const QByteArray &snapshot,
+                                 QList<CoapSavedObservation> *observations);
+
     CoapExchangeMap exchangeMap;
+    QMultiHash<QString, QCoapToken> observationsByHost;
+    QMultiHash<QByteArray, QCoapToken> observationsByKey;
+    QHash<const QCoapReply *, CoapNotificationPacing> notificationPacing;
+    QTimer *scheduler = nullptr;
+    // Deadlines of the scheduler in order, outdated entries are skipped
+    QMultiMap<qint64, QCoapToken> observationDeadlines;
+    QMultiMap<qint64, const QCoapReply *> pacingDeadlines;
+
+    // First messages waiting for the settings of their server, in order
+    QHash<CoapEndpoint, QList<QCoapToken>> exchangesAwaitingPeerSettings;
+
+    // Block requests in flight per endpoint, limited to NSTART together
+    QHash<CoapEndpoint, uint> blockWindowRequestsInFlight;
+    QMultiHash<CoapEndpoint, QCoapToken> blockWindowsByEndpoint;
+
+    QHash<QCoapToken, CoapCompactObservation> compactObservations;
+    QHash<quint64, QCoapToken> compactObservationTokens;
+    QList<CoapCompactEndpoint> compactEndpoints;
+    QHash<std::pair<QCoapConnection *, CoapEndpoint>, quint32> compactEndpointIndexes;
+    QList<quint32> freeCompactEndpoints;
+    QDeadlineTimer compactSweep = QDeadlineTimer(QDeadlineTimer::Forever);
     quint16 blockSize = 0;
 
     uint maximumRetransmitCount = 4;
@@ -138,10 +395,21 @@ public:
     uint maximumServerResponseDelay = 250 * 1000;
     int minimumTokenSize = 4;
     double ackRandomFactor = 1.5;
+    uint blockWindowSize = 1;
+    uint maximumConcurrentRequests = 1;
+    uint maximumPayloads = 10;
+    bool qBlockEnabled = false;
+
+    QHash<QUrl, CoapEndpointBlockSize> endpointBlockSizes;
+    QHash<QUrl, CoapPartialDownload> partialDownloads;
+    QList<QUrl> partialDownloadOrder;
+    bool resumableDownloadEnabled = false;
 
     Q_DECLARE_PUBLIC(QCoapProtocol)
 };
 
 QT_END_NAMESPACE
 
+Q_DECLARE_METATYPE(CoapSavedObservation)
+
 #endif // QCOAPPROTOCOL_P_H
@@ -4,7 +4,11 @@
 
 #include "qcoapqudpconnection_p.h"
 
+#include <QtCore/qdatastream.h>
+#include <QtCore/qendian.h>
 #include <QtCore/qloggingcategory.h>
+#include <QtCore/qtimer.h>
+#include <QtNetwork/qhostinfo.h>
 #include <QtNetwork/qnetworkdatagram.h>
 
 #if QT_CONFIG(dtls)
@@ -14,8 +18,147 @@
 #include <QtNetwork/QSslKey>
 #endif
 
+#ifdef Q_OS_LINUX
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
 QT_BEGIN_NAMESPACE
 
+namespace {
+
+// Lifetime of the addresses of a host name. QHostInfo does not report the
+// time to live of the DNS records, this is the lifetime of its own cache.
+constexpr int HostCacheLifetime = 60 * 1000;
+// Delay before looking a name up again after a failure, while its previous
+// addresses are still used
+constexpr int FailedLookupRetryDelay = 5 * 1000;
+// Delay before trying the next address of a host name, see RFC 8305
+constexpr int AddressAttemptDelay = 250;
+// Number of host names above which the expired ones are dropped
+constexpr qsizetype MaximumResolvedHosts = 256;
+// Period over which the frames written to each peer are counted
+constexpr int TrafficWindow = 1000;
+// Number of peers which may have a connected socket at once
+constexpr qsizetype MaximumConnectedPeers = 16;
+
+/*
+    Returns the IPv4 address of \a address if it is an IPv4-mapped IPv6
+    address, as reported by dual-stack sockets, and \a address otherwise.
+*/
+QHostAddress unmappedAddress(const QHostAddress &address)
+{
+    bool isIPv4 = false;
+    const quint32 ipv4 = address.toIPv4Address(&isIPv4);
+    return isIPv4 ? QHostAddress(ipv4) : address;
+}
+
+/*
+    Returns the \a addresses of a host name in the order they are tried:
+    the family of the first address comes first, as sorted by the resolver,
+    then the families alternate as recommended by RFC 8305.
+*/
+QList<QHostAddress> interleaveAddresses(const QList<QHostAddress> &addresses)
+{
+    QList<QHostAddress> preferred;
+    QList<QHostAddress> others;
+    for (const auto &address : addresses) {
+        const QHostAddress unmapped = unmappedAddress(address);
+        if (unmapped.protocol() == unmappedAddress(addresses.first()).protocol())
+            preferred.append(unmapped);
+        else
+            others.append(unmapped);
+    }
+
+    QList<QHostAddress> sorted;
+    sorted.reserve(addresses.size());
+    for (qsizetype i = 0; i < qMax(preferred.size(), others.size()); ++i) {
+        if (i < preferred.size())
+            sorted.append(preferred.at(i));
+        if (i < others.size())
+            sorted.append(others.at(i));
+    }
+    return sorted;
+}
+
+} // namespace
+
+#ifdef Q_OS_LINUX
+namespace {
+
+// Number of datagrams read or written with a single system call
+constexpr int BatchSize = 16;
+// Largest datagram read, a CoAP message should fit in a single IP packet,
+// see https://tools.ietf.org/html/rfc7252#section-4.6. Larger datagrams
+// are dropped.
+constexpr int MaximumDatagramSize = 2048;
+
+/*
+    Fills \a storage with the socket address of \a address and \a port,
+    for a socket of the given \a family. IPv4 addresses are mapped to IPv6
+    for dual-stack sockets. Returns the length of the socket address, or 0
+    if it cannot be expressed for this socket.
+*/
+socklen_t toSocketAddress(const QHostAddress &address, quint16 port, int family,
+                          sockaddr_storage *storage)
+{
+    std::memset(storage, 0, sizeof(*storage));
+
+    bool isIPv4 = false;
+    const quint32 ipv4 = address.toIPv4Address(&isIPv4);
+    if (family == AF_INET) {
+        if (!isIPv4)
+            return 0;
+
+        auto *socketAddress = reinterpret_cast<sockaddr_in *>(storage);
+        socketAddress->sin_family = AF_INET;
+        socketAddress->sin_port = htons(port);
+        socketAddress->sin_addr.s_addr = htonl(ipv4);
+        return sizeof(sockaddr_in);
+    }
+
+    if (family != AF_INET6 || !address.scopeId().isEmpty())
+        return 0;
+
+    auto *socketAddress = reinterpret_cast<sockaddr_in6 *>(storage);
+    socketAddress->sin6_family = AF_INET6;
+    socketAddress->sin6_port = htons(port);
+    if (isIPv4) {
+        // IPv4-mapped IPv6 address, ::ffff:a.b.c.d
+        socketAddress->sin6_addr.s6_addr[10] = 0xFF;
+        socketAddress->sin6_addr.s6_addr[11] = 0xFF;
+        const quint32 networkOrder = htonl(ipv4);
+        std::memcpy(&socketAddress->sin6_addr.s6_addr[12], &networkOrder, sizeof(networkOrder));
+    } else {
+        const Q_IPV6ADDR ipv6 = address.toIPv6Address();
+        std::memcpy(socketAddress->sin6_addr.s6_addr, ipv6.c, sizeof(ipv6.c));
+    }
+    return sizeof(sockaddr_in6);
+}
+
+} // namespace
+#endif
+
+#if QT_CONFIG(dtls)
+namespace {
+
+constexpr quint32 SessionSnapshotMagic = 0x51434453;
+constexpr quint8 SessionSnapshotVersion = 1;
+// Number of servers whose DTLS session is kept for resumption
+constexpr int MaximumCachedSessions = 4096;
+// Number of sessions tried for a record coming from an unknown port
+constexpr int MaximumRebindingCandidates = 16;
+
+// DTLS 1.2 records, see RFC 6347
+constexpr int DtlsRecordHeaderSize = 13;
+constexpr uchar DtlsApplicationDataContentType = 23;
+
+} // namespace
+#endif
+
 /*!
     \internal
 
@@ -64,6 +207,13 @@ QCoapQUdpConnection::QCoapQUdpConnection(QCoapQUdpConnectionPrivate &dd, QObject
 
     createSocket();
 
+    d->trafficTimer = new QTimer(this);
+    d->trafficTimer->setInterval(TrafficWindow);
+    connect(d->trafficTimer, &QTimer::timeout, this, [this]() {
+        Q_D(QCoapQUdpConnection);
+        d->updateConnectedPeers();
+    });
+
     if (isSecure()) {
 #if QT_CONFIG(dtls)
         connect(this, &QCoapConnection::securityConfigurationChanged, this,
@@ -72,7 +222,10 @@ QCoapQUdpConnection::QCoapQUdpConnection(QCoapQUdpConnectionPrivate &dd, QObject
                        d->setSecurityConfiguration(securityConfiguration());
                 });
 
-        auto configuration = QSslConfiguration::defaultDtlsConfiguration();
+        d->dtlsConfiguration = QSslConfiguration::defaultDtlsConfiguration();
+        // Expose the sessions, so that they can be resumed
+        d->dtlsConfiguration.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+        d->sessionCache.setMaxCost(MaximumCachedSessions);
 
         switch (d->securityMode) {
         case QtCoap::SecurityMode::RawPublicKey:
@@ -81,25 +234,21 @@ QCoapQUdpConnection::QCoapQUdpConnection(QCoapQUdpConnectionPrivate &dd, QObject
             d->securityMode = QtCoap::SecurityMode::NoSecurity;
             break;
         case QtCoap::SecurityMode::PreSharedKey:
-            d->dtls = new QDtls(QSslSocket::SslClientMode, this);
-            configuration.setPeerVerifyMode(QSslSocket::VerifyNone);
-            d->dtls->setDtlsConfiguration(configuration);
-
-            connect(d->dtls.data(), &QDtls::pskRequired, this, &QCoapQUdpConnection::pskRequired);
-            connect(d->dtls.data(), &QDtls::handshakeTimeout,
-                    this, &QCoapQUdpConnection::handshakeTimeout);
+            d->dtlsConfiguration.setPeerVerifyMode(QSslSocket::VerifyNone);
             break;
         case QtCoap::SecurityMode::Certificate:
-            d->dtls = new QDtls(QSslSocket::SslClientMode, this);
-            configuration.setPeerVerifyMode(QSslSocket::VerifyPeer);
-            d->dtls->setDtlsConfiguration(configuration);
-
-            connect(d->dtls.data(), &QDtls::handshakeTimeout,
-                    this, &QCoapQUdpConnection::handshakeTimeout);
+            d->dtlsConfiguration.setPeerVerifyMode(QSslSocket::VerifyPeer);
             break;
         default:
             break;
         }
+
+        d->sessionTimer = new QTimer(this);
+        d->sessionTimer->setSingleShot(true);
+        connect(d->sessionTimer, &QTimer::timeout, this, [this]() {
+            Q_D(QCoapQUdpConnection);
+            d->removeIdleSessions();
+        });
 #else
         qCWarning(lcCoapConnection, "DTLS is disabled, falling back to QtCoap::NoSecurity mode.");
         d->securityMode = QtCoap::SecurityMode::NoSecurity;
@@ -133,9 +282,6 @@ void QCoapQUdpConnection::createSocket()
 
 QCoapQUdpConnectionPrivate::QCoapQUdpConnectionPrivate(QtCoap::SecurityMode security)
     : QCoapConnectionPrivate(security)
-#if QT_CONFIG(dtls)
-    , dtls(nullptr)
-#endif
     , udpSocket(nullptr)
 {
 }
@@ -143,9 +289,11 @@ QCoapQUdpConnectionPrivate::QCoapQUdpConnectionPrivate(QtCoap::SecurityMode secu
 QCoapQUdpConnectionPrivate::~QCoapQUdpConnectionPrivate()
 {
 #if QT_CONFIG(dtls)
-    if (dtls && dtls->isConnectionEncrypted()) {
-        Q_ASSERT(udpSocket);
-        dtls->shutdown(udpSocket);
+    for (const auto &session : std::as_const(dtlsSessions)) {
+        if (session.dtls && session.dtls->isConnectionEncrypted()) {
+            Q_ASSERT(udpSocket);
+            session.dtls->shutdown(udpSocket);
+        }
     }
 #endif
 }
@@ -177,44 +325,77 @@ void QCoapQUdpConnectionPrivate::bindSocket()
 /*!
     \internal
 
-    Prepares the socket for data transmission to the given \a host and
-    \a port by binding the socket. In case of a secure connection also
-    starts the handshake with the server.
+    Prepares the socket for data transmission to the given \a endpoint by
+    binding the socket.
     Emits the bound() signal when the transport is ready.
+
+    In case of a secure connection, the socket is shared by the DTLS
+    sessions with all the servers. The session with a server is set up
+    when the first frame is written to it, see writeData().
+*/
+void QCoapQUdpConnection::bind(const CoapEndpoint &endpoint)
+{
+    Q_D(QCoapQUdpConnection);
+    Q_UNUSED(endpoint);
+
+    d->bindSocket();
+}
+
+/*!
+    \internal
+
+    Sets up the DTLS session with the \a endpoint in case of a secure
+    connection, and emits the connected() signal once its handshake
+    completes. Emits the connected() signal right away otherwise.
+
+    If the host of the \a endpoint is a name, it is resolved first.
 */
-void QCoapQUdpConnection::bind(const QString &host, quint16 port)
+void QCoapQUdpConnection::openSession(const CoapEndpoint &endpoint)
 {
     Q_D(QCoapQUdpConnection);
 
-    if (!isSecure()) {
-        d->bindSocket();
+    QHostAddress address = endpoint.address;
+    if (endpoint.isHostName()) {
+        const auto resolved = d->resolvedHosts.constFind(endpoint.host);
+        if (resolved == d->resolvedHosts.constEnd()) {
+            // Opened again once the name is resolved, see onHostResolved()
+            d->lookupHost(endpoint.host);
+            d->hostLookups[endpoint.host].connectPorts.append(endpoint.port);
+            return;
+        }
+
+        if (resolved->expiry.hasExpired())
+            d->lookupHost(endpoint.host);
+        address = resolved->addresses.at(resolved->current);
+    }
+
 #if QT_CONFIG(dtls)
-    } else {
-        Q_ASSERT(d->dtls);
-        if (d->dtls->isConnectionEncrypted()) {
-            emit bound();
-        } else if (socket()->state() == QAbstractSocket::UnconnectedState) {
-            socket()->bind();
-            d->dtls->setPeer(QHostAddress(host), port);
-            if (!d->dtls->doHandshake(d->socket()))
-                qCWarning(lcCoapConnection) << "Handshake error: " << d->dtls->dtlsErrorString();
+    if (isSecure()) {
+        CoapDtlsSession *session = d->findOrCreateSession(d->dtlsPeer(address, endpoint.port));
+        if (!session) {
+            emit error(QAbstractSocket::SslHandshakeFailedError);
+            return;
+        }
+
+        d->touchSession(session);
+        if (!session->dtls->isConnectionEncrypted()) {
+            session->connectRequests.append({ endpoint.host, endpoint.port });
+            return;
         }
-#else
-        Q_UNUSED(host);
-        Q_UNUSED(port);
-#endif
     }
+#endif
+    emit connected(endpoint.host, endpoint.port);
 }
 
 /*!
     \internal
 
-    Sends the given \a data frame to the \a host at the \a port.
+    Sends the given \a data frame to the \a endpoint.
 */
-void QCoapQUdpConnection::writeData(const QByteArray &data, const QString &host, quint16 port)
+void QCoapQUdpConnection::writeData(const QByteArray &data, const CoapEndpoint &endpoint)
 {
     Q_D(QCoapQUdpConnection);
-    d->writeToSocket(data, host, port);
+    d->writeToSocket(data, endpoint);
 }
 
 /*!
@@ -223,20 +404,32 @@ void QCoapQUdpConnection::writeData(const QByteArray &data, const QString &host,
     \brief Close the UDP socket
 
     In the case of a secure connection, this also interrupts any ongoing
-    hand-shake and shuts down the DTLS connection.
+    hand-shake and shuts down the DTLS sessions.
 */
 void QCoapQUdpConnection::close()
 {
     Q_D(QCoapQUdpConnection);
 
-#if QT_CONFIG(dtls)
-    if (isSecure()) {
-        if (d->dtls->handshakeState() == QDtls::HandshakeInProgress)
-            d->dtls->abortHandshake(d->socket());
+    // The frames waiting for a name to be resolved are dropped
+    for (const auto &lookup : std::as_const(d->hostLookups))
+        QHostInfo::abortHostLookup(lookup.lookupId);
+    d->hostLookups.clear();
 
-        if (d->dtls->isConnectionEncrypted())
-            d->dtls->shutdown(d->socket());
-    }
+    for (auto it = d->peerTraffic.begin(); it != d->peerTraffic.end(); ++it)
+        d->demotePeer(it.key(), it.value());
+    d->peerTraffic.clear();
+    d->trafficTimer->stop();
+
+#if QT_CONFIG(dtls)
+    const auto peers = d->dtlsSessions.keys();
+    for (const auto &peer : peers)
+        d->removeSession(peer);
+    d->peerAliases.clear();
+#endif
+#ifdef Q_OS_LINUX
+    // Send the datagrams written so far before closing
+    d->flushDatagrams();
+    d->socketFamily = 0;
 #endif
     d->socket()->close();
 }
@@ -250,18 +443,70 @@ void QCoapQUdpConnection::setSocketOption(QAbstractSocket::SocketOption option,
 {
     Q_D(QCoapQUdpConnection);
     d->socket()->setSocketOption(option, value);
+    for (const auto &traffic : std::as_const(d->peerTraffic)) {
+        if (traffic.socket)
+            traffic.socket->setSocketOption(option, value);
+    }
 }
 
 /*!
     \internal
 
-    Sends the given \a data frame to the \a host at the \a port.
+    Sets the time in milliseconds after which a DTLS session without any
+    traffic is shut down to \a timeout. A new session is set up with the
+    server when a frame is written to it again. A \a timeout of \c 0
+    keeps the sessions open until the connection is closed.
+
+    The new timeout applies to the sessions from their next exchange.
 */
-void QCoapQUdpConnectionPrivate::writeToSocket(const QByteArray &data, const QString &host, quint16 port)
+void QCoapQUdpConnection::setSessionIdleTimeout(uint timeout)
 {
+    Q_D(QCoapQUdpConnection);
+
+    d->sessionIdleTimeout = timeout;
 #if QT_CONFIG(dtls)
-    Q_Q(QCoapQUdpConnection);
+    if (d->sessionTimer) {
+        d->sessionTimer->stop();
+        d->armSessionTimer();
+    }
 #endif
+}
+
+/*!
+    \internal
+
+    Sets the number of frames per second written to a peer above which
+    they are sent through a UDP socket connected to that peer, to \a rate.
+    The kernel then keeps the route to the peer, and delivers its answers
+    to that socket only. The socket is closed once the traffic drops below
+    half of \a rate. A \a rate of \c 0 sends all the frames through the
+    shared socket.
+
+    The connected sockets are bound to the port of the shared socket, so
+    that the peers still see the same endpoint. They are not used for
+    secure connections, whose DTLS sessions share a single socket.
+*/
+void QCoapQUdpConnection::setConnectedSocketThreshold(uint rate)
+{
+    Q_D(QCoapQUdpConnection);
+
+    d->connectedSocketThreshold = rate;
+    if (rate == 0) {
+        for (auto it = d->peerTraffic.begin(); it != d->peerTraffic.end(); ++it)
+            d->demotePeer(it.key(), it.value());
+        d->peerTraffic.clear();
+        d->trafficTimer->stop();
+    }
+}
+
+/*!
+    \internal
+
+    Sends the given \a data frame to the \a endpoint, whose host may be an
+    IP address or a host name.
+*/
+void QCoapQUdpConnectionPrivate::writeToSocket(const QByteArray &data, const CoapEndpoint &endpoint)
+{
     if (!socket()->isWritable()) {
         bool opened = socket()->open(socket()->openMode() | QIODevice::WriteOnly);
         if (!opened) {
@@ -270,21 +515,386 @@ void QCoapQUdpConnectionPrivate::writeToSocket(const QByteArray &data, const QSt
         }
     }
 
-    QHostAddress hostAddress(host);
-    if (hostAddress.isNull()) {
-        qCWarning(lcCoapConnection) << "Invalid host IP address" << host
-                                    << "- only IPv4/IPv6 destination addresses are supported.";
-        return;
-    }
+    if (endpoint.isHostName())
+        writeToHostName(data, endpoint.host, endpoint.port);
+    else
+        writeToAddress(data, endpoint.address, endpoint.port);
+}
+
+/*!
+    \internal
 
-    const qint64 bytesWritten =
+    Sends the given \a data frame to the \a address at the \a port.
+*/
+void QCoapQUdpConnectionPrivate::writeToAddress(const QByteArray &data,
+                                                const QHostAddress &address, quint16 port)
+{
 #if QT_CONFIG(dtls)
-            q->isSecure() ? (Q_ASSERT(dtls), dtls->writeDatagramEncrypted(socket(), data)) :
+    Q_Q(QCoapQUdpConnection);
+
+    if (q->isSecure()) {
+        writeEncrypted(data, dtlsPeer(address, port));
+        return;
+    }
+#endif
+    if (connectedSocketThreshold > 0 && writeToConnectedSocket(data, address, port))
+        return;
+#ifdef Q_OS_LINUX
+    if (isBatchingEnabled()) {
+        queueDatagram(data, address, port);
+        return;
+    }
 #endif
-            socket()->writeDatagram(data, hostAddress, port);
+    ++statistics.sendCalls;
 
+    const qint64 bytesWritten = socket()->writeDatagram(data, address, port);
     if (bytesWritten < 0)
         qCWarning(lcCoapConnection) << "Failed to write datagram:" << socket()->errorString();
+    else
+        ++statistics.sentDatagrams;
+}
+
+/*!
+    \internal
+
+    Counts the \a data frame written to the \a address at the \a port, and
+    sends it through the socket connected to that peer if there is one.
+    Returns \c false if the frame must go through the shared socket.
+*/
+bool QCoapQUdpConnectionPrivate::writeToConnectedSocket(const QByteArray &data,
+                                                        const QHostAddress &address,
+                                                        quint16 port)
+{
+    // The answers to a group request come from the unicast addresses of the servers
+    if (address.isMulticast() || address.isBroadcast())
+        return false;
+
+    CoapPeerTraffic &traffic = peerTraffic[{ unmappedAddress(address), port }];
+    ++traffic.frameCount;
+    if (!trafficTimer->isActive())
+        trafficTimer->start();
+
+    if (!traffic.socket || traffic.socket->state() != QAbstractSocket::ConnectedState)
+        return false;
+
+    ++statistics.sendCalls;
+    if (traffic.socket->write(data) < 0)
+        qCWarning(lcCoapConnection) << "Failed to write datagram:" << traffic.socket->errorString();
+    else
+        ++statistics.sentDatagrams;
+    return true;
+}
+
+/*!
+    \internal
+
+    Connects a socket to the peers to which more frames than the threshold
+    were written during the last period, and closes the sockets of the
+    peers whose traffic dropped below half of it. Only the peers with a
+    connected socket are tracked from one period to the next.
+*/
+void QCoapQUdpConnectionPrivate::updateConnectedPeers()
+{
+    qsizetype connectedCount = 0;
+    for (const auto &traffic : std::as_const(peerTraffic)) {
+        if (traffic.socket)
+            ++connectedCount;
+    }
+
+    for (auto it = peerTraffic.begin(); it != peerTraffic.end();) {
+        const quint64 frameCount = std::exchange(it->frameCount, 0);
+        if (it->socket && frameCount * 2 < connectedSocketThreshold) {
+            demotePeer(it.key(), it.value());
+            --connectedCount;
+        } else if (!it->socket && frameCount >= connectedSocketThreshold
+                   && connectedCount < MaximumConnectedPeers && promotePeer(it.key(), it.value())) {
+            ++connectedCount;
+        }
+
+        if (it->socket)
+            ++it;
+        else
+            it = peerTraffic.erase(it);
+    }
+
+    if (peerTraffic.isEmpty())
+        trafficTimer->stop();
+}
+
+/*!
+    \internal
+
+    Opens a UDP socket connected to the \a peer, sharing the local port of
+    the connection, and stores it in its \a traffic. Returns \c false if
+    the socket could not be set up.
+*/
+bool QCoapQUdpConnectionPrivate::promotePeer(const CoapUdpPeer &peer, CoapPeerTraffic &traffic)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    if (socket()->state() != QAbstractSocket::BoundState)
+        return false;
+
+    auto *connectedSocket = new QUdpSocket(q);
+    if (!connectedSocket->bind(QHostAddress::Any, socket()->localPort(),
+                               QAbstractSocket::ShareAddress
+                               | QAbstractSocket::ReuseAddressHint)) {
+        qCDebug(lcCoapConnection) << "Failed to bind a socket for" << peer.first << peer.second
+                                  << connectedSocket->errorString();
+        delete connectedSocket;
+        return false;
+    }
+
+    connectedSocket->connectToHost(peer.first, peer.second);
+    if (connectedSocket->state() == QAbstractSocket::UnconnectedState) {
+        qCDebug(lcCoapConnection) << "Failed to connect a socket to" << peer.first << peer.second
+                                  << connectedSocket->errorString();
+        delete connectedSocket;
+        return false;
+    }
+
+    QObject::connect(connectedSocket, &QUdpSocket::readyRead, q, [this, connectedSocket]() {
+        connectedSocketReadyRead(connectedSocket);
+    });
+
+    qCDebug(lcCoapConnection) << "Connected a socket to" << peer.first << peer.second;
+    traffic.socket = connectedSocket;
+    ++statistics.peerPromotions;
+    return true;
+}
+
+/*!
+    \internal
+
+    Closes the socket connected to the \a peer, if its \a traffic has one.
+    The frames to and from the peer go through the shared socket again.
+*/
+void QCoapQUdpConnectionPrivate::demotePeer(const CoapUdpPeer &peer, CoapPeerTraffic &traffic)
+{
+    if (!traffic.socket)
+        return;
+
+    qCDebug(lcCoapConnection) << "Closing the socket connected to" << peer.first << peer.second;
+
+    // Deliver the datagrams already received before closing
+    connectedSocketReadyRead(traffic.socket);
+    traffic.socket->close();
+    traffic.socket->deleteLater();
+    traffic.socket = nullptr;
+    ++statistics.peerDemotions;
+}
+
+/*!
+    \internal
+
+    Reads the datagrams received on the \a connectedSocket, and emits a
+    readyRead() signal for each of them.
+*/
+void QCoapQUdpConnectionPrivate::connectedSocketReadyRead(QUdpSocket *connectedSocket)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    while (connectedSocket->hasPendingDatagrams()) {
+        const QNetworkDatagram datagram = connectedSocket->receiveDatagram();
+        ++statistics.receiveCalls;
+        // Errors reported by the peer, such as an unreachable port, are not datagrams
+        if (!datagram.isValid())
+            break;
+
+        ++statistics.receivedDatagrams;
+        if (!unconfirmedHosts.isEmpty())
+            confirmAddress(datagram.senderAddress());
+        emit q->readyRead(datagram.data(), datagram.senderAddress());
+    }
+}
+
+/*!
+    \internal
+
+    Sends the given \a data frame to the \a host name at the \a port.
+
+    The name is looked up once, and its addresses are used by all the
+    frames until they expire. They are then looked up again in the
+    background, while the frames still go to the previous addresses. The
+    frames written before the first lookup completes wait for it.
+
+    A name may resolve to several IPv6 and IPv4 addresses, some of which
+    may not be reachable. Until an answer comes from the current address,
+    the next one is tried after a short delay, see tryNextAddress().
+*/
+void QCoapQUdpConnectionPrivate::writeToHostName(const QByteArray &data, const QString &host,
+                                                 quint16 port)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    const auto it = resolvedHosts.find(host);
+    if (it == resolvedHosts.end()) {
+        lookupHost(host);
+        if (!hostLookups[host].pendingFrames[port].enqueue(data)) {
+            qCWarning(lcCoapConnection) << "Too many frames waiting for the resolution of" << host
+                                        << "- dropping frame";
+            frameRejected = true;
+        }
+        return;
+    }
+
+    if (it->expiry.hasExpired())
+        lookupHost(host);
+
+    const QHostAddress address = it->addresses.at(it->current);
+    if (!it->confirmed && !it->racing && it->current + 1 < it->addresses.size()) {
+        it->racing = true;
+        QTimer::singleShot(AddressAttemptDelay, q, [this, host, port]() {
+            tryNextAddress(host, port);
+        });
+    }
+    writeToAddress(data, address, port);
+}
+
+/*!
+    \internal
+
+    Starts looking the \a host name up, unless it is already in progress.
+*/
+void QCoapQUdpConnectionPrivate::lookupHost(const QString &host)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    if (hostLookups.contains(host))
+        return;
+
+    const int lookupId = QHostInfo::lookupHost(host, q, [this](const QHostInfo &info) {
+        onHostResolved(info);
+    });
+    hostLookups[host].lookupId = lookupId;
+}
+
+/*!
+    \internal
+
+    Caches the addresses of the host name looked up in \a info, and sends
+    the frames waiting for them. If the name could not be resolved, its
+    previous addresses are still used for a while, and the error() signal
+    is emitted if there are none.
+*/
+void QCoapQUdpConnectionPrivate::onHostResolved(const QHostInfo &info)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    const QString host = info.hostName();
+    CoapHostLookup lookup = hostLookups.take(host);
+    const QList<QHostAddress> addresses = interleaveAddresses(info.addresses());
+    if (addresses.isEmpty()) {
+        qCWarning(lcCoapConnection) << "Failed to resolve" << host << "-" << info.errorString();
+        const auto it = resolvedHosts.find(host);
+        if (it != resolvedHosts.end())
+            it->expiry = QDeadlineTimer(FailedLookupRetryDelay);
+        else
+            emit q->error(QAbstractSocket::HostNotFoundError);
+        return;
+    }
+
+    if (resolvedHosts.size() >= MaximumResolvedHosts && !resolvedHosts.contains(host)) {
+        for (auto it = resolvedHosts.begin(); it != resolvedHosts.end();) {
+            if (it->expiry.hasExpired()) {
+                unconfirmedHosts.remove(it.key());
+                it = resolvedHosts.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Keep the address which answered, if it is still valid
+    CoapResolvedHost &resolved = resolvedHosts[host];
+    const qsizetype current = resolved.confirmed
+            ? addresses.indexOf(resolved.addresses.at(resolved.current)) : -1;
+    if (current >= 0) {
+        resolved.addresses = addresses;
+        resolved.current = current;
+    } else {
+        resolved = CoapResolvedHost();
+        resolved.addresses = addresses;
+        unconfirmedHosts.insert(host);
+    }
+    resolved.expiry = QDeadlineTimer(HostCacheLifetime);
+
+    for (auto it = lookup.pendingFrames.begin(); it != lookup.pendingFrames.end(); ++it) {
+        const QList<QByteArray> frames = it->takeAll();
+        for (const auto &frame : frames)
+            writeToHostName(frame, host, it.key());
+    }
+    for (const quint16 port : std::as_const(lookup.connectPorts))
+        q->openSession(CoapEndpoint(host, port, q->isSecure()));
+}
+
+/*!
+    \internal
+
+    Sends the next frames to the \a host name through its next address, if
+    no answer came from the current one yet. As the addresses of the IPv6
+    and IPv4 families alternate, a host is reached quickly even if one of
+    the families is broken, as for the connections of RFC 8305.
+
+    In case of a secure connection, a handshake is started with the next
+    address while the previous ones go on. The first one to complete takes
+    over the frames of the others, see adoptRacingSessions().
+*/
+void QCoapQUdpConnectionPrivate::tryNextAddress(const QString &host, quint16 port)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    const auto it = resolvedHosts.find(host);
+    if (it == resolvedHosts.end() || it->confirmed || it->current + 1 >= it->addresses.size())
+        return;
+
+    const QHostAddress previous = it->addresses.at(it->current);
+    const QHostAddress next = it->addresses.at(++it->current);
+    qCDebug(lcCoapConnection) << "No answer from" << previous << "for" << host << "yet, trying"
+                              << next;
+
+    if (it->current + 1 < it->addresses.size()) {
+        QTimer::singleShot(AddressAttemptDelay, q, [this, host, port]() {
+            tryNextAddress(host, port);
+        });
+    }
+
+#if QT_CONFIG(dtls)
+    if (q->isSecure()) {
+        if (CoapDtlsSession *session = findOrCreateSession(dtlsPeer(next, port)))
+            touchSession(session);
+    }
+#else
+    Q_UNUSED(port);
+#endif
+}
+
+/*!
+    \internal
+
+    Makes the \a address the one used by the host names resolving to it
+    which did not answer yet, since an answer came from it. Returns these
+    host names.
+*/
+QStringList QCoapQUdpConnectionPrivate::confirmAddress(const QHostAddress &address)
+{
+    const QHostAddress sender = unmappedAddress(address);
+
+    QStringList hosts;
+    for (auto host = unconfirmedHosts.begin(); host != unconfirmedHosts.end();) {
+        const auto it = resolvedHosts.find(*host);
+        const qsizetype index = it != resolvedHosts.end() ? it->addresses.indexOf(sender) : -1;
+        if (index < 0) {
+            ++host;
+            continue;
+        }
+
+        it->current = index;
+        it->confirmed = true;
+        hosts.append(*host);
+        host = unconfirmedHosts.erase(host);
+    }
+    return hosts;
 }
 
 /*!
@@ -305,9 +915,20 @@ void QCoapQUdpConnectionPrivate::socketReadyRead()
         }
     }
 
+#ifdef Q_OS_LINUX
+    if (isBatchingEnabled()) {
+        receiveBatch();
+        return;
+    }
+#endif
+
     while (socket()->hasPendingDatagrams()) {
         if (!q->isSecure()) {
             const auto &datagram = socket()->receiveDatagram();
+            ++statistics.receiveCalls;
+            ++statistics.receivedDatagrams;
+            if (!unconfirmedHosts.isEmpty())
+                confirmAddress(datagram.senderAddress());
             emit q->readyRead(datagram.data(), datagram.senderAddress());
 #if QT_CONFIG(dtls)
         } else {
@@ -317,6 +938,282 @@ void QCoapQUdpConnectionPrivate::socketReadyRead()
     }
 }
 
+#ifdef Q_OS_LINUX
+/*!
+    \internal
+
+    Returns \c true if the datagrams are read and written in batches, with
+    the \c recvmmsg() and \c sendmmsg() system calls. This is the case for
+    unsecure connections, once the socket is bound.
+*/
+bool QCoapQUdpConnectionPrivate::isBatchingEnabled() const
+{
+    Q_Q(const QCoapQUdpConnection);
+    return batchedIo && !q->isSecure() && socket()->socketDescriptor() >= 0;
+}
+
+/*!
+    \internal
+
+    Reads all the datagrams pending on the socket into a buffer reused
+    between calls, and emits a readyRead() signal for each of them. The
+    datagrams larger than MaximumDatagramSize are dropped.
+
+    The first datagram is read through the QUdpSocket, so that it keeps
+    notifying about incoming datagrams. The others are read in batches
+    with \c recvmmsg().
+*/
+void QCoapQUdpConnectionPrivate::receiveBatch()
+{
+    Q_Q(QCoapQUdpConnection);
+
+    if (receiveBuffer.isEmpty())
+        receiveBuffer.resize(BatchSize * MaximumDatagramSize);
+
+    QHostAddress sender;
+    const bool oversized = socket()->pendingDatagramSize() > MaximumDatagramSize;
+    const qint64 size = socket()->readDatagram(receiveBuffer.data(), MaximumDatagramSize,
+                                               &sender);
+    ++statistics.receiveCalls;
+    if (size < 0)
+        return;
+
+    if (oversized) {
+        dropOversizedDatagram(sender);
+    } else {
+        ++statistics.receivedDatagrams;
+        if (!unconfirmedHosts.isEmpty())
+            confirmAddress(sender);
+        emit q->readyRead(QByteArray(receiveBuffer.constData(), size), sender);
+    }
+
+    std::array<mmsghdr, BatchSize> messages;
+    std::array<iovec, BatchSize> vectors;
+    std::array<sockaddr_storage, BatchSize> addresses;
+    int received = BatchSize;
+    while (received == BatchSize && isBatchingEnabled()) {
+        for (int i = 0; i < BatchSize; ++i) {
+            vectors[i].iov_base = receiveBuffer.data() + i * MaximumDatagramSize;
+            vectors[i].iov_len = MaximumDatagramSize;
+            std::memset(&messages[i], 0, sizeof(mmsghdr));
+            messages[i].msg_hdr.msg_name = &addresses[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int descriptor = static_cast<int>(socket()->socketDescriptor());
+        do {
+            received = ::recvmmsg(descriptor, messages.data(), BatchSize, MSG_DONTWAIT, nullptr);
+        } while (received < 0 && errno == EINTR);
+        ++statistics.receiveCalls;
+
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                qCWarning(lcCoapConnection) << "Failed to read datagrams:" << qt_error_string(errno);
+            return;
+        }
+
+        for (int i = 0; i < received; ++i) {
+            sender.setAddress(reinterpret_cast<const sockaddr *>(&addresses[i]));
+            if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                dropOversizedDatagram(sender);
+                continue;
+            }
+
+            ++statistics.receivedDatagrams;
+            const QByteArray data(receiveBuffer.constData() + i * MaximumDatagramSize,
+                                  messages[i].msg_len);
+            if (!unconfirmedHosts.isEmpty())
+                confirmAddress(sender);
+            emit q->readyRead(data, sender);
+        }
+    }
+}
+
+/*!
+    \internal
+
+    Counts a datagram from \a sender dropped because it was larger than
+    MaximumDatagramSize, and so truncated when read.
+*/
+void QCoapQUdpConnectionPrivate::dropOversizedDatagram(const QHostAddress &sender)
+{
+    ++statistics.oversizedDatagrams;
+    qCWarning(lcCoapConnection) << "Dropping a datagram larger than" << MaximumDatagramSize
+                                << "bytes from" << sender;
+}
+
+/*!
+    \internal
+
+    Queues the \a data frame for the \a address at the \a port. The frames
+    queued during an iteration of the event loop are sent together by
+    flushDatagrams(), or as soon as a batch is full.
+*/
+void QCoapQUdpConnectionPrivate::queueDatagram(const QByteArray &data,
+                                               const QHostAddress &address, quint16 port)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    outgoingDatagrams.append({ data, address, port });
+    if (outgoingDatagrams.size() >= BatchSize) {
+        flushDatagrams();
+    } else if (!flushScheduled) {
+        flushScheduled = true;
+        QMetaObject::invokeMethod(q, [this]() { flushDatagrams(); }, Qt::QueuedConnection);
+    }
+}
+
+/*!
+    \internal
+
+    Sends the queued frames in batches with \c sendmmsg(). A frame which
+    cannot be sent is dropped with a warning, as it would be when written
+    by the QUdpSocket.
+*/
+void QCoapQUdpConnectionPrivate::flushDatagrams()
+{
+    flushScheduled = false;
+    if (outgoingDatagrams.isEmpty())
+        return;
+
+    const int descriptor = static_cast<int>(socket()->socketDescriptor());
+    if (descriptor < 0) {
+        outgoingDatagrams.clear();
+        return;
+    }
+
+    if (socketFamily == 0) {
+        sockaddr_storage localAddress;
+        socklen_t length = sizeof(localAddress);
+        if (::getsockname(descriptor, reinterpret_cast<sockaddr *>(&localAddress), &length) == 0)
+            socketFamily = localAddress.ss_family;
+    }
+
+    std::array<mmsghdr, BatchSize> messages;
+    std::array<iovec, BatchSize> vectors;
+    std::array<sockaddr_storage, BatchSize> addresses;
+    while (!outgoingDatagrams.isEmpty()) {
+        const int count = static_cast<int>(qMin<qsizetype>(outgoingDatagrams.size(), BatchSize));
+        int prepared = 0;
+        for (; prepared < count; ++prepared) {
+            const CoapPendingDatagram &datagram = outgoingDatagrams.at(prepared);
+            const socklen_t length = toSocketAddress(datagram.address, datagram.port,
+                                                     socketFamily, &addresses[prepared]);
+            if (length == 0)
+                break;
+
+            vectors[prepared].iov_base = const_cast<char *>(datagram.data.constData());
+            vectors[prepared].iov_len = datagram.data.size();
+            std::memset(&messages[prepared], 0, sizeof(mmsghdr));
+            messages[prepared].msg_hdr.msg_name = &addresses[prepared];
+            messages[prepared].msg_hdr.msg_namelen = length;
+            messages[prepared].msg_hdr.msg_iov = &vectors[prepared];
+            messages[prepared].msg_hdr.msg_iovlen = 1;
+        }
+
+        // Leave the addresses not supported here to the QUdpSocket
+        if (prepared == 0) {
+            const CoapPendingDatagram datagram = outgoingDatagrams.takeFirst();
+            ++statistics.sendCalls;
+            if (socket()->writeDatagram(datagram.data, datagram.address, datagram.port) < 0) {
+                qCWarning(lcCoapConnection) << "Failed to write datagram:"
+                                            << socket()->errorString();
+            } else {
+                ++statistics.sentDatagrams;
+            }
+            continue;
+        }
+
+        int sent = 0;
+        do {
+            sent = ::sendmmsg(descriptor, messages.data(), prepared, 0);
+        } while (sent < 0 && errno == EINTR);
+        ++statistics.sendCalls;
+
+        if (sent <= 0) {
+            qCWarning(lcCoapConnection) << "Failed to write datagram:" << qt_error_string(errno);
+            outgoingDatagrams.removeFirst();
+            continue;
+        }
+
+        statistics.sentDatagrams += sent;
+        outgoingDatagrams.remove(0, sent);
+    }
+}
+#endif
+
+/*!
+    \internal
+
+    Returns a binary snapshot of the DTLS sessions cached for resumption,
+    which can be passed to restoreSessions() by a new connection.
+*/
+QByteArray QCoapQUdpConnection::saveSessions()
+{
+    QByteArray snapshot;
+#if QT_CONFIG(dtls)
+    Q_D(QCoapQUdpConnection);
+
+    QDataStream stream(&snapshot, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_0);
+
+    const auto peers = d->sessionCache.keys();
+    stream << SessionSnapshotMagic << SessionSnapshotVersion
+           << static_cast<quint32>(peers.size());
+    for (const auto &peer : peers)
+        stream << peer.address.toString() << peer.port << *d->sessionCache.object(peer);
+#endif
+    return snapshot;
+}
+
+/*!
+    \internal
+
+    Adds the DTLS sessions saved in \a snapshot by saveSessions() to the
+    sessions cached for resumption. Returns \c false if the snapshot is
+    not valid.
+*/
+bool QCoapQUdpConnection::restoreSessions(const QByteArray &snapshot)
+{
+#if QT_CONFIG(dtls)
+    Q_D(QCoapQUdpConnection);
+
+    QDataStream stream(snapshot);
+    stream.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0;
+    quint8 version = 0;
+    quint32 count = 0;
+    stream >> magic >> version >> count;
+    if (stream.status() != QDataStream::Ok || magic != SessionSnapshotMagic
+            || version != SessionSnapshotVersion) {
+        return false;
+    }
+
+    QList<std::pair<CoapDtlsPeer, QByteArray>> sessions;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString address;
+        quint16 port = 0;
+        QByteArray ticket;
+        stream >> address >> port >> ticket;
+        const QHostAddress hostAddress(address);
+        if (!hostAddress.isNull() && !ticket.isEmpty())
+            sessions.append({ d->dtlsPeer(hostAddress, port), ticket });
+    }
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    for (const auto &session : std::as_const(sessions))
+        d->sessionCache.insert(session.first, new QByteArray(session.second));
+    return true;
+#else
+    Q_UNUSED(snapshot);
+    return false;
+#endif
+}
+
 /*!
     \internal
 
@@ -331,14 +1228,15 @@ QUdpSocket *QCoapQUdpConnection::socket() const
 /*!
     \internal
 
-    Sets the DTLS configuration.
+    Sets the DTLS configuration of the sessions set up from now on. The
+    sessions cached for resumption are dropped.
 */
 void QCoapQUdpConnectionPrivate::setSecurityConfiguration(
         const QCoapSecurityConfiguration &configuration)
 {
 #if QT_CONFIG(dtls)
-    Q_ASSERT(dtls);
-    auto dtlsConfig = dtls->dtlsConfiguration();
+    sessionCache.clear();
+    auto &dtlsConfig = dtlsConfiguration;
 
     if (!configuration.defaultCipherString().isEmpty()) {
         dtlsConfig.setBackendConfigurationOption("CipherString",
@@ -366,8 +1264,6 @@ void QCoapQUdpConnectionPrivate::setSecurityConfiguration(
             qCWarning(lcCoapConnection, "Failed to set private key, the provided key is invalid");
         }
     }
-
-    dtls->setDtlsConfiguration(dtlsConfig);
 #else
     Q_UNUSED(configuration);
 #endif
@@ -391,59 +1287,461 @@ void QCoapQUdpConnection::pskRequired(QSslPreSharedKeyAuthenticator *authenticat
 /*!
     \internal
 
-    This slot handles handshake timeouts.
+    Returns the key of the DTLS session with the server at \a address and
+    \a port. IPv4-mapped addresses, as reported by dual-stack sockets, are
+    converted to IPv4 so that they match the destination of the frames.
 */
-void QCoapQUdpConnection::handshakeTimeout()
+CoapDtlsPeer QCoapQUdpConnectionPrivate::dtlsPeer(const QHostAddress &address, quint16 port)
 {
-    Q_D(QCoapQUdpConnection);
+    return { unmappedAddress(address), port };
+}
 
-    qCWarning(lcCoapConnection, "Handshake timeout, trying to re-transmit");
-    if (d->dtls->handshakeState() == QDtls::HandshakeInProgress &&
-            !d->dtls->handleTimeout(d->udpSocket)) {
-        qCWarning(lcCoapConnection) << "Failed to re-transmit" << d->dtls->dtlsErrorString();
+/*!
+    \internal
+
+    Creates the DTLS session with the \a peer, and starts its handshake.
+    Returns the new session, or \nullptr if the handshake could not be
+    started.
+
+    If a previous session with the \a peer is cached, the handshake offers
+    to resume it, which saves the key exchange and the verification of the
+    certificates if the server accepts it.
+*/
+CoapDtlsSession *QCoapQUdpConnectionPrivate::createSession(const CoapDtlsPeer &peer)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    QSslConfiguration configuration = dtlsConfiguration;
+    const QByteArray *cachedSession = sessionCache.object(peer);
+    if (cachedSession)
+        configuration.setSessionTicket(*cachedSession);
+
+    auto *dtls = new QDtls(QSslSocket::SslClientMode, q);
+    dtls->setDtlsConfiguration(configuration);
+    dtls->setPeer(peer.address, peer.port);
+
+    if (securityMode == QtCoap::SecurityMode::PreSharedKey)
+        QObject::connect(dtls, &QDtls::pskRequired, q, &QCoapQUdpConnection::pskRequired);
+    QObject::connect(dtls, &QDtls::handshakeTimeout, q, [this, peer]() {
+        handleHandshakeTimeout(peer);
+    });
+
+    if (!dtls->doHandshake(socket())) {
+        qCWarning(lcCoapConnection) << "Handshake error: " << dtls->dtlsErrorString();
+        // Do not offer the cached session again
+        sessionCache.remove(peer);
+        delete dtls;
+        return nullptr;
+    }
+
+    CoapDtlsSession &session = dtlsSessions[peer];
+    session.dtls = dtls;
+    if (cachedSession)
+        session.offeredSession = *cachedSession;
+    armSessionTimer();
+    return &session;
+}
+
+/*!
+    \internal
+
+    Returns the DTLS session with the \a peer, or with its new port if it
+    changed, see handleRebinding(). Creates the session if there is none.
+    Returns \nullptr if the session could not be created.
+*/
+CoapDtlsSession *QCoapQUdpConnectionPrivate::findOrCreateSession(const CoapDtlsPeer &peer)
+{
+    const CoapDtlsPeer target = peerAliases.value(peer, peer);
+    const auto it = dtlsSessions.find(target);
+    return it != dtlsSessions.end() ? &it.value() : createSession(target);
+}
+
+/*!
+    \internal
+
+    Sends the \a data frame through the DTLS session with the \a peer,
+    setting the session up if needed. The frame is queued until the
+    handshake of the session completes.
+
+    If the port of the \a peer changed, the frame is sent to its new port,
+    see handleRebinding().
+*/
+void QCoapQUdpConnectionPrivate::writeEncrypted(const QByteArray &data, const CoapDtlsPeer &peer)
+{
+    CoapDtlsSession *session = findOrCreateSession(peer);
+    if (!session)
+        return;
+
+    touchSession(session);
+    if (session->dtls->isConnectionEncrypted()) {
+        sendEncrypted(session, data);
+    } else if (!session->pendingFrames.enqueue(data)) {
+        qCWarning(lcCoapConnection) << "Too many frames waiting for the handshake with"
+                                    << peer.address << peer.port << "- dropping frame";
+        frameRejected = true;
+    }
+}
+
+/*!
+    \internal
+
+    Sends the frames queued for the \a session, once it is encrypted.
+*/
+void QCoapQUdpConnectionPrivate::flushSession(CoapDtlsSession *session)
+{
+    const auto frames = session->pendingFrames.takeAll();
+    for (const auto &frame : frames)
+        sendEncrypted(session, frame);
+}
+
+/*!
+    \internal
+
+    Encrypts the \a frame and sends it through the established \a session.
+*/
+void QCoapQUdpConnectionPrivate::sendEncrypted(CoapDtlsSession *session, const QByteArray &frame)
+{
+    ++statistics.sendCalls;
+    if (session->dtls->writeDatagramEncrypted(socket(), frame) < 0) {
+        qCWarning(lcCoapConnection) << "Failed to write datagram:"
+                                    << session->dtls->dtlsErrorString();
+    } else {
+        ++statistics.sentDatagrams;
     }
 }
 
 /*!
     \internal
 
-    Returns a decrypted datagram received from a UDP socket.
+    Postpones the shutdown of the idle \a session after an exchange.
 */
-QNetworkDatagram QCoapQUdpConnectionPrivate::receiveDatagramDecrypted() const
+void QCoapQUdpConnectionPrivate::touchSession(CoapDtlsSession *session) const
 {
-    auto datagram = socket()->receiveDatagram();
-    const QByteArray plainText = dtls->decryptDatagram(socket(), datagram.data());
-    datagram.setData(plainText);
-    return datagram;
+    session->idleDeadline = sessionIdleTimeout > 0
+            ? QDeadlineTimer(sessionIdleTimeout)
+            : QDeadlineTimer(QDeadlineTimer::Forever);
 }
 
 /*!
     \internal
 
-    If the connection is encrypted, emits the readyRead() signal for
-    the pending datagram. Otherwise starts the DTLS handshake and
-    if it is completed, starts to send the pending request.
+    Reads the pending datagram, and passes it to the DTLS session with its
+    sender. If the session is encrypted, emits the readyRead() signal for
+    the decrypted datagram. Otherwise continues the handshake, and sends
+    the frames queued for the session once it is completed.
 */
 void QCoapQUdpConnectionPrivate::handleEncryptedDatagram()
 {
     Q_Q(QCoapQUdpConnection);
 
-    Q_ASSERT(dtls);
+    const QNetworkDatagram datagram = socket()->receiveDatagram();
+    ++statistics.receiveCalls;
+
+    const CoapDtlsPeer peer = dtlsPeer(datagram.senderAddress(), datagram.senderPort());
+    const auto it = dtlsSessions.find(peer);
+    if (it == dtlsSessions.end() || !it->dtls) {
+        if (!handleRebinding(peer, datagram)) {
+            qCDebug(lcCoapConnection) << "Ignoring datagram from" << peer.address << peer.port
+                                      << "without DTLS session";
+        }
+        return;
+    }
+
+    CoapDtlsSession *session = &it.value();
+    QDtls *dtls = session->dtls;
+    touchSession(session);
 
     if (dtls->isConnectionEncrypted()) {
-        const auto &datagram = receiveDatagramDecrypted();
-        emit q->readyRead(datagram.data(), datagram.senderAddress());
-    } else {
-        if (!dtls->doHandshake(socket(), socket()->receiveDatagram().data())) {
-            qCWarning(lcCoapConnection) << "Handshake error: " << dtls->dtlsErrorString();
-            return;
+        const QByteArray plainText = dtls->decryptDatagram(socket(), datagram.data());
+        if (!plainText.isEmpty()) {
+            ++statistics.receivedDatagrams;
+            emit q->readyRead(plainText, datagram.senderAddress());
+        } else if (dtls->dtlsError() == QDtlsError::RemoteClosedConnectionError) {
+            // A new session is set up with the server on the next frame
+            removeSession(peer);
+        }
+        return;
+    }
+
+    if (!dtls->doHandshake(socket(), datagram.data())) {
+        qCWarning(lcCoapConnection) << "Handshake error: " << dtls->dtlsErrorString();
+        if (!session->offeredSession.isEmpty())
+            sessionCache.remove(peer);
+        failSession(peer);
+        return;
+    }
+
+    if (dtls->isConnectionEncrypted())
+        completeHandshake(peer, session);
+}
+
+/*!
+    \internal
+
+    Counts the completed handshake of the \a session with the \a peer as
+    full or abbreviated, caches the session for resumption, and sends the
+    frames queued for it. Emits the connected() signal if connectToHost()
+    was called for the \a peer.
+
+    If the \a peer is an address of host names which did not answer yet,
+    the session also takes over the frames waiting for the handshakes with
+    their other addresses.
+*/
+void QCoapQUdpConnectionPrivate::completeHandshake(const CoapDtlsPeer &peer,
+                                                   CoapDtlsSession *session)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    if (!unconfirmedHosts.isEmpty()) {
+        const QStringList hosts = confirmAddress(peer.address);
+        if (!hosts.isEmpty()) {
+            adoptRacingSessions(peer, hosts);
+            // The sessions may have moved in the hash
+            session = &dtlsSessions[peer];
+        }
+    }
+
+    // The server resumed the session if it accepted the one offered, a full
+    // handshake sets up a new session
+    const QByteArray ticket = session->dtls->dtlsConfiguration().sessionTicket();
+    if (!session->offeredSession.isEmpty() && ticket == session->offeredSession)
+        ++statistics.abbreviatedHandshakes;
+    else
+        ++statistics.fullHandshakes;
+
+    if (!ticket.isEmpty())
+        sessionCache.insert(peer, new QByteArray(ticket));
+
+    const auto connectRequests = std::exchange(session->connectRequests, {});
+    flushSession(session);
+    for (const auto &request : connectRequests)
+        emit q->connected(request.first, request.second);
+}
+
+/*!
+    \internal
+
+    Moves the frames and the connectToHost() calls waiting for the
+    handshakes with the other addresses of the \a hosts to the established
+    session with the \a peer, and drops these handshakes.
+*/
+void QCoapQUdpConnectionPrivate::adoptRacingSessions(const CoapDtlsPeer &peer,
+                                                     const QStringList &hosts)
+{
+    for (const auto &host : hosts) {
+        const QList<QHostAddress> addresses = resolvedHosts.value(host).addresses;
+        for (const auto &address : addresses) {
+            const CoapDtlsPeer racingPeer = dtlsPeer(address, peer.port);
+            const auto it = dtlsSessions.find(racingPeer);
+            if (racingPeer == peer || it == dtlsSessions.end() || !it->dtls
+                    || it->dtls->isConnectionEncrypted()) {
+                continue;
+            }
+
+            const QList<QByteArray> frames = it->pendingFrames.takeAll();
+            const auto connectRequests = std::exchange(it->connectRequests, {});
+            removeSession(racingPeer);
+
+            CoapDtlsSession &session = dtlsSessions[peer];
+            for (const auto &frame : frames)
+                session.pendingFrames.enqueue(frame);
+            session.connectRequests.append(connectRequests);
+        }
+    }
+}
+
+/*!
+    \internal
+
+    Looks for the established session which the encrypted \a datagram
+    received from the unknown \a peer belongs to. Returns \c true if it
+    is found, after emitting the readyRead() signal for the decrypted
+    datagram.
+
+    A server behind a NAT may be given a new port, when the NAT drops an
+    idle mapping for instance. Its records then come from that port, and
+    are matched by decrypting them with the sessions of the same address.
+
+    QDtls does not support Connection IDs, which would identify the session
+    without trying them (RFC 9146), nor changing the peer of a session.
+    The session is therefore moved to the new port, see migrateSession().
+*/
+bool QCoapQUdpConnectionPrivate::handleRebinding(const CoapDtlsPeer &peer,
+                                                 const QNetworkDatagram &datagram)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    const QByteArray data = datagram.data();
+    if (data.size() < DtlsRecordHeaderSize
+            || uchar(data.at(0)) != DtlsApplicationDataContentType
+            || qFromBigEndian<quint16>(data.constData() + 3) == 0) {
+        return false;
+    }
+
+    int candidates = 0;
+    for (auto it = dtlsSessions.cbegin();
+         it != dtlsSessions.cend() && candidates < MaximumRebindingCandidates; ++it) {
+        if (it.key().address != peer.address || !it->dtls || !it->dtls->isConnectionEncrypted())
+            continue;
+
+        ++candidates;
+        const QByteArray plainText = it->dtls->decryptDatagram(socket(), data);
+        if (plainText.isEmpty())
+            continue;
+
+        const CoapDtlsPeer previousPeer = it.key();
+        qCDebug(lcCoapConnection) << "DTLS peer" << peer.address << "moved from port"
+                                  << previousPeer.port << "to" << peer.port;
+        ++statistics.peerRebindings;
+        migrateSession(previousPeer, peer);
+
+        ++statistics.receivedDatagrams;
+        emit q->readyRead(plainText, datagram.senderAddress());
+        return true;
+    }
+    return false;
+}
+
+/*!
+    \internal
+
+    Replaces the session with the peer at \a from by a new session with the
+    peer at \a to, and sends the frames written for \a from to \a to from
+    now on. The new handshake resumes the cached session when the server
+    supports it.
+*/
+void QCoapQUdpConnectionPrivate::migrateSession(const CoapDtlsPeer &from, const CoapDtlsPeer &to)
+{
+    // The previous port is gone, the session is dropped without shutting it down
+    CoapDtlsSession previous = dtlsSessions.take(from);
+    if (previous.dtls)
+        previous.dtls->deleteLater();
+
+    if (const QByteArray *ticket = sessionCache.object(from))
+        sessionCache.insert(to, new QByteArray(*ticket));
+
+    // Keep the aliases pointing to the address used by the requests
+    bool aliased = false;
+    for (auto &target : peerAliases) {
+        if (target == from) {
+            target = to;
+            aliased = true;
+        }
+    }
+    if (!aliased)
+        peerAliases.insert(from, to);
+    peerAliases.remove(to);
+
+    CoapDtlsSession *session = createSession(to);
+    if (session)
+        session->pendingFrames = std::move(previous.pendingFrames);
+    if (dtlsSessions.isEmpty())
+        sessionTimer->stop();
+}
+
+/*!
+    \internal
+
+    Handles the handshake timeouts of the session with the \a peer.
+*/
+void QCoapQUdpConnectionPrivate::handleHandshakeTimeout(const CoapDtlsPeer &peer)
+{
+    const auto it = dtlsSessions.constFind(peer);
+    if (it == dtlsSessions.constEnd() || !it->dtls)
+        return;
+
+    qCWarning(lcCoapConnection, "Handshake timeout, trying to re-transmit");
+    QDtls *dtls = it->dtls;
+    if (dtls->handshakeState() == QDtls::HandshakeInProgress && !dtls->handleTimeout(socket())) {
+        qCWarning(lcCoapConnection) << "Failed to re-transmit" << dtls->dtlsErrorString();
+        failSession(peer);
+    }
+}
+
+/*!
+    \internal
+
+    Interrupts the handshake or shuts down the DTLS session with the
+    \a peer, and drops the frames queued for it.
+*/
+void QCoapQUdpConnectionPrivate::removeSession(const CoapDtlsPeer &peer)
+{
+    const auto it = dtlsSessions.find(peer);
+    if (it == dtlsSessions.end())
+        return;
+
+    QDtls *dtls = it->dtls;
+    dtlsSessions.erase(it);
+
+    if (dtls) {
+        if (dtls->handshakeState() == QDtls::HandshakeInProgress
+                || dtls->handshakeState() == QDtls::PeerVerificationFailed) {
+            dtls->abortHandshake(socket());
+        } else if (dtls->isConnectionEncrypted()) {
+            dtls->shutdown(socket());
         }
+        // May be called from a signal of the session
+        dtls->deleteLater();
+    }
+
+    if (dtlsSessions.isEmpty())
+        sessionTimer->stop();
+}
+
+/*!
+    \internal
+
+    Removes the session with the \a peer after its handshake failed, and
+    emits the error() signal if connectToHost() was called for the \a peer.
+*/
+void QCoapQUdpConnectionPrivate::failSession(const CoapDtlsPeer &peer)
+{
+    Q_Q(QCoapQUdpConnection);
+
+    const auto it = dtlsSessions.constFind(peer);
+    const bool connecting = it != dtlsSessions.constEnd() && !it->connectRequests.isEmpty();
+    removeSession(peer);
+    if (connecting)
+        emit q->error(QAbstractSocket::SslHandshakeFailedError);
+}
+
+/*!
+    \internal
+
+    Shuts down the DTLS sessions without any traffic since the idle
+    timeout.
+*/
+void QCoapQUdpConnectionPrivate::removeIdleSessions()
+{
+    QList<CoapDtlsPeer> idlePeers;
+    for (auto it = dtlsSessions.cbegin(); it != dtlsSessions.cend(); ++it) {
+        if (it->idleDeadline.hasExpired())
+            idlePeers.append(it.key());
+    }
+
+    for (const auto &peer : std::as_const(idlePeers)) {
+        qCDebug(lcCoapConnection) << "Shutting down idle DTLS session with" << peer.address
+                                  << peer.port;
+        removeSession(peer);
+    }
+    armSessionTimer();
+}
+
+/*!
+    \internal
 
-        // The handshake is successfully done, emit the bound() signal to inform
-        // listeners that the socket is ready to start transferring data.
-        if (dtls->isConnectionEncrypted())
-            emit q->bound();
+    Starts the timer looking for idle sessions, if needed. The sessions are
+    checked a few times per idle timeout, at most once a minute.
+*/
+void QCoapQUdpConnectionPrivate::armSessionTimer()
+{
+    if (dtlsSessions.isEmpty() || sessionIdleTimeout == 0) {
+        sessionTimer->stop();
+        return;
     }
+
+    if (!sessionTimer->isActive())
+        sessionTimer->start(static_cast<int>(qBound(10u, sessionIdleTimeout / 4, 60u * 1000)));
 }
 
 #endif // dtls
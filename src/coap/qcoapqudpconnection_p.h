@@ -9,9 +9,17 @@
 #include <private/qcoapconnection_p.h>
 
 #include <QtNetwork/qudpsocket.h>
+#if QT_CONFIG(dtls)
+#include <QtNetwork/qsslconfiguration.h>
+#endif
 
+#include <QtCore/qcache.h>
+#include <QtCore/qdeadlinetimer.h>
+#include <QtCore/qhash.h>
 #include <QtCore/qpointer.h>
 #include <QtCore/qqueue.h>
+#include <QtCore/qset.h>
+#include <QtCore/qstringlist.h>
 
 //
 //  W A R N I N G
@@ -27,7 +35,9 @@
 QT_BEGIN_NAMESPACE
 
 class QDtls;
+class QHostInfo;
 class QSslPreSharedKeyAuthenticator;
+class QTimer;
 class QCoapQUdpConnectionPrivate;
 class Q_AUTOTEST_EXPORT QCoapQUdpConnection : public QCoapConnection
 {
@@ -41,27 +51,101 @@ public:
 
     QUdpSocket *socket() const;
 
+    Q_INVOKABLE QByteArray saveSessions();
+    Q_INVOKABLE bool restoreSessions(const QByteArray &snapshot);
+
 public Q_SLOTS:
     void setSocketOption(QAbstractSocket::SocketOption, const QVariant &value);
+    void setSessionIdleTimeout(uint timeout);
+    void setConnectedSocketThreshold(uint rate);
 
 #if QT_CONFIG(dtls)
 private Q_SLOTS:
     void pskRequired(QSslPreSharedKeyAuthenticator *authenticator);
-    void handshakeTimeout();
 #endif
 
 protected:
     explicit QCoapQUdpConnection(QCoapQUdpConnectionPrivate &dd, QObject *parent = nullptr);
 
-    void bind(const QString &host, quint16 port) override;
-    void writeData(const QByteArray &data, const QString &host, quint16 port) override;
+    void bind(const CoapEndpoint &endpoint) override;
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override;
     void close() override;
+    void openSession(const CoapEndpoint &endpoint) override;
 
     void createSocket();
 
     Q_DECLARE_PRIVATE(QCoapQUdpConnection)
 };
 
+struct CoapUdpStatistics {
+    quint64 receiveCalls = 0;
+    quint64 receivedDatagrams = 0;
+    quint64 oversizedDatagrams = 0;
+    quint64 sendCalls = 0;
+    quint64 sentDatagrams = 0;
+    quint64 fullHandshakes = 0;
+    quint64 abbreviatedHandshakes = 0;
+    quint64 peerRebindings = 0;
+    quint64 peerPromotions = 0;
+    quint64 peerDemotions = 0;
+};
+
+struct CoapPendingDatagram {
+    QByteArray data;
+    QHostAddress address;
+    quint16 port = 0;
+};
+
+// Addresses a host name resolved to, in the order they are tried
+struct CoapResolvedHost {
+    QList<QHostAddress> addresses;
+    qsizetype current = 0;
+    QDeadlineTimer expiry;
+    bool confirmed = false;
+    bool racing = false;
+};
+
+// Frames and connectToHost() calls waiting for a host name to be resolved
+struct CoapHostLookup {
+    int lookupId = -1;
+    QHash<quint16, CoapFrameQueue> pendingFrames;
+    QList<quint16> connectPorts;
+};
+
+using CoapUdpPeer = std::pair<QHostAddress, quint16>;
+
+// Frames written to a peer, which gets a connected socket while they are many
+struct CoapPeerTraffic {
+    quint32 frameCount = 0;
+    QPointer<QUdpSocket> socket;
+};
+
+#if QT_CONFIG(dtls)
+struct CoapDtlsPeer {
+    QHostAddress address;
+    quint16 port = 0;
+};
+
+inline bool operator==(const CoapDtlsPeer &lhs, const CoapDtlsPeer &rhs) noexcept
+{
+    return lhs.port == rhs.port && lhs.address == rhs.address;
+}
+
+inline size_t qHash(const CoapDtlsPeer &peer, size_t seed = 0) noexcept
+{
+    return qHashMulti(seed, peer.address, peer.port);
+}
+
+// DTLS session with one peer, sharing the socket of the connection
+struct CoapDtlsSession {
+    QPointer<QDtls> dtls;
+    CoapFrameQueue pendingFrames;
+    QDeadlineTimer idleDeadline;
+    QList<std::pair<QString, quint16>> connectRequests;
+    QByteArray offeredSession;
+};
+#endif
+
 class Q_AUTOTEST_EXPORT QCoapQUdpConnectionPrivate : public QCoapConnectionPrivate
 {
 public:
@@ -71,18 +155,74 @@ public:
     virtual bool bind();
 
     void bindSocket();
-    void writeToSocket(const QByteArray &data, const QString &host, quint16 port);
+    void writeToSocket(const QByteArray &data, const CoapEndpoint &endpoint);
+    void writeToAddress(const QByteArray &data, const QHostAddress &address, quint16 port);
+    void writeToHostName(const QByteArray &data, const QString &host, quint16 port);
+    void lookupHost(const QString &host);
+    void onHostResolved(const QHostInfo &info);
+    void tryNextAddress(const QString &host, quint16 port);
+    QStringList confirmAddress(const QHostAddress &address);
     QUdpSocket* socket() const { return udpSocket; }
     void socketReadyRead();
 
+#ifdef Q_OS_LINUX
+    bool isBatchingEnabled() const;
+    void receiveBatch();
+    void dropOversizedDatagram(const QHostAddress &sender);
+    void queueDatagram(const QByteArray &data, const QHostAddress &address, quint16 port);
+    void flushDatagrams();
+
+    QList<CoapPendingDatagram> outgoingDatagrams;
+    QByteArray receiveBuffer;
+    int socketFamily = 0;
+    bool flushScheduled = false;
+#endif
+    bool batchedIo = true;
+    CoapUdpStatistics statistics;
+
+    QHash<QString, CoapResolvedHost> resolvedHosts;
+    QHash<QString, CoapHostLookup> hostLookups;
+    QSet<QString> unconfirmedHosts;
+
+    bool writeToConnectedSocket(const QByteArray &data, const QHostAddress &address,
+                                quint16 port);
+    void updateConnectedPeers();
+    bool promotePeer(const CoapUdpPeer &peer, CoapPeerTraffic &traffic);
+    void demotePeer(const CoapUdpPeer &peer, CoapPeerTraffic &traffic);
+    void connectedSocketReadyRead(QUdpSocket *connectedSocket);
+
+    QHash<CoapUdpPeer, CoapPeerTraffic> peerTraffic;
+    QTimer *trafficTimer = nullptr;
+    uint connectedSocketThreshold = 0;
+
     void setSecurityConfiguration(const QCoapSecurityConfiguration &configuration);
 
 #if QT_CONFIG(dtls)
-    QNetworkDatagram receiveDatagramDecrypted() const;
+    static CoapDtlsPeer dtlsPeer(const QHostAddress &address, quint16 port);
+    CoapDtlsSession *createSession(const CoapDtlsPeer &peer);
+    CoapDtlsSession *findOrCreateSession(const CoapDtlsPeer &peer);
+    void writeEncrypted(const QByteArray &data, const CoapDtlsPeer &peer);
+    void flushSession(CoapDtlsSession *session);
+    void sendEncrypted(CoapDtlsSession *session, const QByteArray &frame);
+    void touchSession(CoapDtlsSession *session) const;
     void handleEncryptedDatagram();
-
-    QPointer<QDtls> dtls;
+    void completeHandshake(const CoapDtlsPeer &peer, CoapDtlsSession *session);
+    void adoptRacingSessions(const CoapDtlsPeer &peer, const QStringList &hosts);
+    bool handleRebinding(const CoapDtlsPeer &peer, const QNetworkDatagram &datagram);
+    void migrateSession(const CoapDtlsPeer &from, const CoapDtlsPeer &to);
+    void handleHandshakeTimeout(const CoapDtlsPeer &peer);
+    void removeSession(const CoapDtlsPeer &peer);
+    void failSession(const CoapDtlsPeer &peer);
+    void removeIdleSessions();
+    void armSessionTimer();
+
+    QSslConfiguration dtlsConfiguration;
+    QHash<CoapDtlsPeer, CoapDtlsSession> dtlsSessions;
+    QCache<CoapDtlsPeer, QByteArray> sessionCache;
+    QHash<CoapDtlsPeer, CoapDtlsPeer> peerAliases;
+    QTimer *sessionTimer = nullptr;
 #endif
+    uint sessionIdleTimeout = 5 * 60 * 1000;
     QPointer<QUdpSocket> udpSocket;
 
     Q_DECLARE_PUBLIC(QCoapQUdpConnection)
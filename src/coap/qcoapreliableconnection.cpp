@@ -0,0 +1,622 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include "qcoapreliableconnection_p.h"
+
+#include <QtCore/qendian.h>
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qtimer.h>
+
+#if QT_CONFIG(ssl)
+#include <QtNetwork/qsslkey.h>
+#include <QtNetwork/qsslpresharedkeyauthenticator.h>
+#include <QtNetwork/qsslsocket.h>
+#endif
+
+QT_BEGIN_NAMESPACE
+
+namespace {
+
+// Max-Message-Size of a server until it sent its CSM, see RFC 8323 section 5.3.1
+constexpr quint32 DefaultMaximumMessageSize = 1152;
+// Room left for the header and the options of a message carrying a BERT block
+constexpr quint32 BertMessageOverhead = 256;
+// Largest BERT block sent or requested
+constexpr uint MaximumBertBlockSize = 64 * 1024;
+// Period after which a session without any traffic is checked with a Ping,
+// and after which a Ping left unanswered closes the session
+constexpr int KeepAliveInterval = 30 * 1000;
+
+// Signaling codes and their options, see RFC 8323 section 5
+constexpr quint8 CsmCode = 0xE1;
+constexpr quint8 PingCode = 0xE2;
+constexpr quint8 PongCode = 0xE3;
+constexpr quint8 ReleaseCode = 0xE4;
+constexpr quint8 AbortCode = 0xE5;
+constexpr quint32 MaxMessageSizeOption = 2;
+constexpr quint32 BlockWiseTransferOption = 4;
+
+// Version, type, token length, code and message ID of the frames of the protocol
+constexpr qsizetype FrameHeaderSize = 4;
+
+/*
+    Returns the shortest encoding of the unsigned integer option \a value.
+*/
+QByteArray uintOptionValue(quint32 value)
+{
+    QByteArray data;
+    for (; value; value >>= 8)
+        data.prepend(static_cast<char>(value & 0xFF));
+    return data;
+}
+
+/*
+    Calls \a function with the number and the value of each option of
+    \a options, up to the payload marker. Returns \c false if the options
+    are malformed.
+*/
+template <typename Function>
+bool forEachOption(QByteArrayView options, Function function)
+{
+    quint32 number = 0;
+    qsizetype offset = 0;
+    while (offset < options.size()) {
+        const quint8 header = static_cast<quint8>(options.at(offset++));
+        if (header == 0xFF)
+            break;
+
+        quint32 fields[2] = { quint32(header >> 4), quint32(header & 0x0F) };
+        for (auto &field : fields) {
+            if (field == 13) {
+                if (offset + 1 > options.size())
+                    return false;
+                field = 13 + static_cast<quint8>(options.at(offset));
+                offset += 1;
+            } else if (field == 14) {
+                if (offset + 2 > options.size())
+                    return false;
+                field = 269 + qFromBigEndian<quint16>(options.data() + offset);
+                offset += 2;
+            } else if (field == 15) {
+                return false;
+            }
+        }
+
+        number += fields[0];
+        if (offset + fields[1] > options.size())
+            return false;
+        function(number, options.sliced(offset, fields[1]));
+        offset += fields[1];
+    }
+    return true;
+}
+
+} // namespace
+
+/*!
+    \internal
+
+    \class QCoapReliableConnectionPrivate
+    \inmodule QtCoap
+
+    \brief The QCoapReliableConnectionPrivate class implements the
+    signaling of CoAP over reliable transports.
+
+    The QCoapReliableConnectionPrivate class holds the parts of
+    \l{https://tools.ietf.org/html/rfc8323}{RFC 8323} shared by
+    QCoapTcpConnection and QCoapWebSocketConnection: a session with each
+    server, the Capabilities and Settings Messages (CSM), the Ping, Pong,
+    Release and Abort signals, the keepalive of the idle sessions, and the
+    size of the BERT blocks.
+
+    The frames written before the CSM of the server is received are held
+    back, so that its Max-Message-Size applies to them. The frames dropped
+    after being accepted are reported with the frameDropped() signal.
+
+    The transports open and close the sockets, and convert the frames to
+    and from their messages, through the openSocket(), closeSocket(),
+    toMessage() and sendMessage() functions. They call startSession() once
+    the socket of a session is connected, and processSignal() for the
+    signaling messages received.
+*/
+
+QCoapReliableConnectionPrivate::QCoapReliableConnectionPrivate(QtCoap::SecurityMode security)
+    : QCoapConnectionPrivate(security)
+{
+}
+
+/*!
+    \internal
+
+    Sets up the keepalive of the sessions, and the TLS configuration of
+    the secure modes. Since QtCoap::RawPublicKey is not supported, the
+    connection falls back to QtCoap::NoSecurity in this mode.
+*/
+void QCoapReliableConnectionPrivate::init()
+{
+    Q_Q(QCoapConnection);
+
+    keepAliveTimer = new QTimer(q);
+    keepAliveTimer->setInterval(KeepAliveInterval);
+    QObject::connect(keepAliveTimer, &QTimer::timeout, q, [this]() { checkKeepAlive(); });
+
+    if (!q->isSecure())
+        return;
+
+#if QT_CONFIG(ssl)
+    QObject::connect(q, &QCoapConnection::securityConfigurationChanged, q, [this, q]() {
+        setSecurityConfiguration(q->securityConfiguration());
+    });
+
+    sslConfiguration = QSslConfiguration::defaultConfiguration();
+
+    switch (securityMode) {
+    case QtCoap::SecurityMode::RawPublicKey:
+        qCWarning(lcCoapConnection, "RawPublicKey security is not supported yet,"
+                                    "disabling security");
+        securityMode = QtCoap::SecurityMode::NoSecurity;
+        break;
+    case QtCoap::SecurityMode::PreSharedKey:
+        sslConfiguration.setPeerVerifyMode(QSslSocket::VerifyNone);
+        break;
+    case QtCoap::SecurityMode::Certificate:
+        sslConfiguration.setPeerVerifyMode(QSslSocket::VerifyPeer);
+        break;
+    default:
+        break;
+    }
+#else
+    qCWarning(lcCoapConnection, "TLS is disabled, falling back to QtCoap::NoSecurity mode.");
+    securityMode = QtCoap::SecurityMode::NoSecurity;
+#endif
+}
+
+/*!
+    \internal
+
+    Returns \c true, the frames are neither lost nor reordered over the
+    reliable transports.
+*/
+bool QCoapReliableConnectionPrivate::isReliable() const
+{
+    return true;
+}
+
+/*!
+    \internal
+
+    Returns the size of the BERT blocks to use with the \a endpoint, or \c 0
+    if the server did not announce it supports them in its CSM. The blocks
+    are as large as the Max-Message-Size of the server allows.
+*/
+uint QCoapReliableConnectionPrivate::bertBlockSize(const CoapEndpoint &endpoint) const
+{
+    const auto it = sessions.constFind(endpoint);
+    if (it == sessions.constEnd() || !it->peerBlockWiseTransfer)
+        return 0;
+
+    const quint32 messageSize = qMin(it->peerMaximumMessageSize, MaximumMessageSize);
+    if (messageSize <= BertMessageOverhead)
+        return 0;
+
+    const uint size = qMin((messageSize - BertMessageOverhead) / 1024 * 1024,
+                           MaximumBertBlockSize);
+    return size > 1024 ? size : 0;
+}
+
+/*!
+    \internal
+
+    Returns \c true if the CSM of the server at \a endpoint was not received
+    yet, and starts connecting to it if needed.
+*/
+bool QCoapReliableConnectionPrivate::waitForPeerSettings(const CoapEndpoint &endpoint)
+{
+    if (endpoint.multicast)
+        return false;
+
+    const CoapReliableSession *session = findOrCreateSession(endpoint);
+    return session && !session->ready;
+}
+
+/*!
+    \internal
+
+    Sends the \a frame to the \a endpoint. The frame is queued until the
+    connection with the server is set up and its CSM is received, so that
+    it is checked against the Max-Message-Size of the server.
+*/
+void QCoapReliableConnectionPrivate::writeFrame(const QByteArray &frame,
+                                                const CoapEndpoint &endpoint)
+{
+    // Empty messages have no meaning over a reliable transport, see RFC 8323 section 3.4
+    if (frame.size() < FrameHeaderSize || frame.at(1) == 0)
+        return;
+
+    if (endpoint.multicast) {
+        qCWarning(lcCoapConnection) << "Multicast is not supported over reliable transports,"
+                                    << "dropping frame for" << endpoint.host;
+        frameRejected = true;
+        return;
+    }
+
+    CoapReliableSession *session = findOrCreateSession(endpoint);
+    if (!session) {
+        frameRejected = true;
+        return;
+    }
+
+    if (!session->ready) {
+        if (!session->pendingFrames.enqueue(frame)) {
+            qCWarning(lcCoapConnection) << "Too many frames waiting for the connection with"
+                                        << endpoint.host << endpoint.port << "- dropping frame";
+            frameRejected = true;
+        }
+        return;
+    }
+
+    writeMessage(session, frame);
+}
+
+/*!
+    \internal
+
+    Sets up the connection with the given \a endpoint, and emits the
+    connected() signal once the CSM of the server is received.
+*/
+void QCoapReliableConnectionPrivate::openSession(const CoapEndpoint &endpoint)
+{
+    Q_Q(QCoapConnection);
+
+    CoapReliableSession *session = findOrCreateSession(endpoint);
+    if (!session)
+        return;
+
+    if (session->ready)
+        emit q->connected(endpoint.host, endpoint.port);
+    else
+        session->connectRequested = true;
+}
+
+/*!
+    \internal
+
+    Releases the connections with all the servers, see
+    \l{https://tools.ietf.org/html/rfc8323#section-5.5}{RFC 8323}.
+*/
+void QCoapReliableConnectionPrivate::releaseSessions()
+{
+    const auto endpoints = sessions.keys();
+    for (const auto &endpoint : endpoints) {
+        CoapReliableSession &session = sessions[endpoint];
+        if (session.csmSent)
+            writeSignal(&session, ReleaseCode, QByteArray());
+        removeSession(endpoint);
+    }
+}
+
+/*!
+    \internal
+
+    Returns the session with the server at \a endpoint, and starts
+    connecting to it if there is none yet. Returns \nullptr if the
+    connection failed right away.
+*/
+CoapReliableSession *QCoapReliableConnectionPrivate::findOrCreateSession(
+        const CoapEndpoint &endpoint)
+{
+    auto it = sessions.find(endpoint);
+    if (it != sessions.end())
+        return &it.value();
+
+    CoapReliableSession &session = sessions[endpoint];
+    session.peerMaximumMessageSize = DefaultMaximumMessageSize;
+    if (!keepAliveTimer->isActive())
+        keepAliveTimer->start();
+
+    openSocket(endpoint, &session);
+
+    // Connecting may fail right away, and remove the session
+    it = sessions.find(endpoint);
+    return it != sessions.end() ? &it.value() : nullptr;
+}
+
+/*!
+    \internal
+
+    Sends the CSM through the connection of \a session, once it is set up.
+    The frames written in the meantime are sent once the CSM of the server
+    is received, see processSignal().
+*/
+void QCoapReliableConnectionPrivate::startSession(CoapReliableSession *session)
+{
+    session->csmSent = true;
+
+    // The CSM must be the first message of the connection, see RFC 8323 section 5.3
+    const QByteArray maximumSize = uintOptionValue(MaximumMessageSize);
+    QByteArray options;
+    options.append(static_cast<char>((MaxMessageSizeOption << 4) | maximumSize.size()));
+    options.append(maximumSize);
+    options.append(static_cast<char>((BlockWiseTransferOption - MaxMessageSizeOption) << 4));
+    writeSignal(session, CsmCode, QByteArray(), options);
+}
+
+/*!
+    \internal
+
+    Handles the \a socketError of the connection with the server at
+    \a endpoint, described by \a errorString. The session is dropped, and
+    set up again when the next frame is written to the server. A server
+    closing an idle connection is not reported as an error.
+*/
+void QCoapReliableConnectionPrivate::onSocketError(const CoapEndpoint &endpoint,
+                                                   QAbstractSocket::SocketError socketError,
+                                                   const QString &errorString)
+{
+    Q_Q(QCoapConnection);
+
+    if (!sessions.contains(endpoint))
+        return;
+
+    if (socketError == QAbstractSocket::RemoteHostClosedError) {
+        qCDebug(lcCoapConnection) << "Connection closed by" << endpoint.host << endpoint.port;
+        removeSession(endpoint);
+        return;
+    }
+
+    qCWarning(lcCoapConnection) << "CoAP socket error with" << endpoint.host << endpoint.port
+                                << socketError << errorString;
+    removeSession(endpoint, socketError == QAbstractSocket::HostNotFoundError
+                                    ? QtCoap::Error::HostNotFound : QtCoap::Error::Unknown);
+    emit q->error(socketError);
+}
+
+/*!
+    \internal
+
+    Handles the signaling message with the given \a code, \a token and
+    \a options received from the server at \a endpoint, see
+    \l{https://tools.ietf.org/html/rfc8323#section-5}{RFC 8323}.
+
+    The frames written before the first CSM of the server are sent once it
+    is received, and the peerSettingsChanged() signal is emitted for the
+    exchanges waiting for its settings.
+*/
+void QCoapReliableConnectionPrivate::processSignal(const CoapEndpoint &endpoint,
+                                                   CoapReliableSession *session, quint8 code,
+                                                   const QByteArray &token,
+                                                   QByteArrayView options)
+{
+    Q_Q(QCoapConnection);
+
+    switch (code) {
+    case CsmCode: {
+        const bool valid = forEachOption(options, [session](quint32 number, QByteArrayView value) {
+            if (number == MaxMessageSizeOption) {
+                quint32 size = 0;
+                for (const char byte : value)
+                    size = (size << 8) | static_cast<quint8>(byte);
+                session->peerMaximumMessageSize = size;
+            } else if (number == BlockWiseTransferOption) {
+                session->peerBlockWiseTransfer = true;
+            }
+        });
+        if (!valid)
+            qCWarning(lcCoapConnection) << "Malformed CSM from" << endpoint.host << endpoint.port;
+        qCDebug(lcCoapConnection) << "CSM from" << endpoint.host << endpoint.port
+                                  << "Max-Message-Size" << session->peerMaximumMessageSize
+                                  << "Block-Wise-Transfer" << session->peerBlockWiseTransfer;
+
+        if (!std::exchange(session->ready, true)) {
+            const auto frames = session->pendingFrames.takeAll();
+            for (const auto &frame : frames)
+                writeMessage(session, frame);
+            if (std::exchange(session->connectRequested, false))
+                emit q->connected(endpoint.host, endpoint.port);
+        }
+        emit q->peerSettingsChanged(endpoint);
+        break;
+    }
+    case PingCode:
+        writeSignal(session, PongCode, token);
+        break;
+    case PongCode:
+        break;
+    case ReleaseCode:
+        qCDebug(lcCoapConnection) << "Connection released by" << endpoint.host << endpoint.port;
+        removeSession(endpoint);
+        break;
+    case AbortCode:
+        qCWarning(lcCoapConnection) << "Connection aborted by" << endpoint.host << endpoint.port;
+        removeSession(endpoint);
+        emit q->error(QAbstractSocket::RemoteHostClosedError);
+        break;
+    default:
+        break;
+    }
+}
+
+/*!
+    \internal
+
+    Sends the \a frame through the connection of \a session. Returns
+    \c false if the frame is dropped because it is malformed or larger
+    than the Max-Message-Size of the server, in which case the
+    frameDropped() signal is emitted.
+*/
+bool QCoapReliableConnectionPrivate::writeMessage(CoapReliableSession *session,
+                                                  const QByteArray &frame)
+{
+    Q_Q(QCoapConnection);
+
+    const QByteArray message = toMessage(frame);
+    if (message.isEmpty()) {
+        emit q->frameDropped(frame, QtCoap::Error::Unknown);
+        return false;
+    }
+
+    if (message.size() > static_cast<qsizetype>(session->peerMaximumMessageSize)) {
+        qCWarning(lcCoapConnection) << "Message of" << message.size()
+                                    << "bytes larger than the Max-Message-Size of the server"
+                                    << session->peerMaximumMessageSize << "- dropping frame";
+        emit q->frameDropped(frame, QtCoap::Error::RequestEntityTooLarge);
+        return false;
+    }
+
+    sendMessage(session, message);
+    return true;
+}
+
+/*!
+    \internal
+
+    Sends the signaling message with the given \a code, \a token and
+    \a options through the connection of \a session.
+*/
+void QCoapReliableConnectionPrivate::writeSignal(CoapReliableSession *session, quint8 code,
+                                                 const QByteArray &token,
+                                                 const QByteArray &options)
+{
+    QByteArray frame;
+    frame.reserve(FrameHeaderSize + token.size() + options.size());
+    frame.append(static_cast<char>(0x40 | token.size()));
+    frame.append(static_cast<char>(code));
+    frame.append(2, '\0');
+    frame.append(token);
+    frame.append(options);
+    sendMessage(session, toMessage(frame));
+}
+
+/*!
+    \internal
+
+    Aborts the connection with the server at \a endpoint, after a fatal
+    error on our side, see
+    \l{https://tools.ietf.org/html/rfc8323#section-5.6}{RFC 8323}.
+*/
+void QCoapReliableConnectionPrivate::abortSession(const CoapEndpoint &endpoint)
+{
+    const auto it = sessions.find(endpoint);
+    if (it == sessions.end())
+        return;
+
+    writeSignal(&it.value(), AbortCode, QByteArray());
+    removeSession(endpoint);
+}
+
+/*!
+    \internal
+
+    Closes the connection with the server at \a endpoint, once the data
+    written to it is sent, and forgets its session. The frames still waiting
+    for the session are reported dropped with the given \a error.
+*/
+void QCoapReliableConnectionPrivate::removeSession(const CoapEndpoint &endpoint,
+                                                   QtCoap::Error error)
+{
+    Q_Q(QCoapConnection);
+
+    CoapReliableSession session = sessions.take(endpoint);
+    if (session.socket) {
+        QObject::disconnect(session.socket, nullptr, q, nullptr);
+        closeSocket(session.socket);
+        session.socket->deleteLater();
+    }
+
+    if (sessions.isEmpty())
+        keepAliveTimer->stop();
+
+    const auto frames = session.pendingFrames.takeAll();
+    for (const auto &frame : frames)
+        emit q->frameDropped(frame, error);
+    if (!session.ready)
+        emit q->peerSettingsChanged(endpoint);
+}
+
+/*!
+    \internal
+
+    Sends a Ping to the servers from which nothing was received since the
+    previous check, and closes the connections whose Ping was not answered.
+*/
+void QCoapReliableConnectionPrivate::checkKeepAlive()
+{
+    Q_Q(QCoapConnection);
+
+    const auto endpoints = sessions.keys();
+    for (const auto &endpoint : endpoints) {
+        CoapReliableSession &session = sessions[endpoint];
+        if (!session.csmSent)
+            continue;
+
+        if (session.pingOutstanding) {
+            qCWarning(lcCoapConnection) << "No answer from" << endpoint.host << endpoint.port
+                                        << "to a Ping, closing the connection";
+            removeSession(endpoint);
+            emit q->error(QAbstractSocket::SocketTimeoutError);
+        } else if (!std::exchange(session.active, false)) {
+            session.pingOutstanding = true;
+            writeSignal(&session, PingCode, QByteArray());
+        }
+    }
+}
+
+/*!
+    \internal
+
+    Sets the TLS configuration of the future connections from the security
+    \a configuration.
+*/
+void QCoapReliableConnectionPrivate::setSecurityConfiguration(
+        const QCoapSecurityConfiguration &configuration)
+{
+#if QT_CONFIG(ssl)
+    if (!configuration.defaultCipherString().isEmpty()) {
+        sslConfiguration.setBackendConfigurationOption("CipherString",
+                                                       configuration.defaultCipherString());
+    }
+
+    if (!configuration.caCertificates().isEmpty())
+        sslConfiguration.setCaCertificates(configuration.caCertificates().toList());
+
+    if (!configuration.localCertificateChain().isEmpty())
+        sslConfiguration.setLocalCertificateChain(configuration.localCertificateChain().toList());
+
+    if (!configuration.privateKey().isNull()) {
+        if (configuration.privateKey().algorithm() != QSsl::Opaque) {
+            QSslKey privateKey(configuration.privateKey().key(),
+                               configuration.privateKey().algorithm(),
+                               configuration.privateKey().encodingFormat(),
+                               QSsl::PrivateKey,
+                               configuration.privateKey().passPhrase());
+            sslConfiguration.setPrivateKey(privateKey);
+        } else if (configuration.privateKey().handle()) {
+            QSslKey opaqueKey(configuration.privateKey().handle());
+            sslConfiguration.setPrivateKey(opaqueKey);
+        } else {
+            qCWarning(lcCoapConnection, "Failed to set private key, the provided key is invalid");
+        }
+    }
+#else
+    Q_UNUSED(configuration);
+#endif
+}
+
+#if QT_CONFIG(ssl)
+/*!
+    \internal
+
+    Sets the identity and the pre-shared key of the \a authenticator, for
+    the TLS handshake with a server to complete.
+*/
+void QCoapReliableConnectionPrivate::setPreSharedKey(QSslPreSharedKeyAuthenticator *authenticator)
+{
+    Q_Q(QCoapConnection);
+
+    Q_ASSERT(authenticator);
+    authenticator->setIdentity(q->securityConfiguration().preSharedKeyIdentity());
+    authenticator->setPreSharedKey(q->securityConfiguration().preSharedKey());
+}
+#endif
+
+QT_END_NAMESPACE
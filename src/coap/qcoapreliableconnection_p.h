@@ -0,0 +1,102 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#ifndef QCOAPRELIABLECONNECTION_P_H
+#define QCOAPRELIABLECONNECTION_P_H
+
+#include <private/qcoapconnection_p.h>
+
+#if QT_CONFIG(ssl)
+#include <QtNetwork/qsslconfiguration.h>
+#endif
+
+#include <QtCore/qhash.h>
+#include <QtCore/qpointer.h>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API. It exists purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+QT_BEGIN_NAMESPACE
+
+class QSslPreSharedKeyAuthenticator;
+class QTimer;
+
+// Connection with one server over a reliable transport, see RFC 8323
+struct CoapReliableSession {
+    QPointer<QObject> socket;
+    // Incomplete message received, over the transports without message boundaries
+    QByteArray buffer;
+    CoapFrameQueue pendingFrames;
+    quint32 peerMaximumMessageSize = 0;
+    bool peerBlockWiseTransfer = false;
+    // Whether our CSM was sent, and whether the CSM of the server was received
+    bool csmSent = false;
+    bool ready = false;
+    bool connectRequested = false;
+    bool active = false;
+    bool pingOutstanding = false;
+};
+
+class Q_AUTOTEST_EXPORT QCoapReliableConnectionPrivate : public QCoapConnectionPrivate
+{
+public:
+    // Max-Message-Size announced to the servers
+    static constexpr quint32 MaximumMessageSize = 1024 * 1024;
+
+    QCoapReliableConnectionPrivate(
+            QtCoap::SecurityMode security = QtCoap::SecurityMode::NoSecurity);
+    ~QCoapReliableConnectionPrivate() override = default;
+
+    void init();
+
+    bool isReliable() const override;
+    uint bertBlockSize(const CoapEndpoint &endpoint) const override;
+    bool waitForPeerSettings(const CoapEndpoint &endpoint) override;
+
+    void writeFrame(const QByteArray &frame, const CoapEndpoint &endpoint);
+    void openSession(const CoapEndpoint &endpoint);
+    void releaseSessions();
+
+    CoapReliableSession *findOrCreateSession(const CoapEndpoint &endpoint);
+    void startSession(CoapReliableSession *session);
+    void onSocketError(const CoapEndpoint &endpoint, QAbstractSocket::SocketError socketError,
+                       const QString &errorString);
+    void processSignal(const CoapEndpoint &endpoint, CoapReliableSession *session, quint8 code,
+                       const QByteArray &token, QByteArrayView options);
+    bool writeMessage(CoapReliableSession *session, const QByteArray &frame);
+    void writeSignal(CoapReliableSession *session, quint8 code, const QByteArray &token,
+                     const QByteArray &options = QByteArray());
+    void abortSession(const CoapEndpoint &endpoint);
+    void removeSession(const CoapEndpoint &endpoint,
+                       QtCoap::Error error = QtCoap::Error::Unknown);
+    void checkKeepAlive();
+    void setSecurityConfiguration(const QCoapSecurityConfiguration &configuration);
+#if QT_CONFIG(ssl)
+    void setPreSharedKey(QSslPreSharedKeyAuthenticator *authenticator);
+#endif
+
+    // Hooks of the transports
+    virtual void openSocket(const CoapEndpoint &endpoint, CoapReliableSession *session) = 0;
+    virtual void closeSocket(QObject *socket) = 0;
+    virtual QByteArray toMessage(const QByteArray &frame) const = 0;
+    virtual void sendMessage(CoapReliableSession *session, const QByteArray &message) = 0;
+
+#if QT_CONFIG(ssl)
+    QSslConfiguration sslConfiguration;
+#endif
+    QHash<CoapEndpoint, CoapReliableSession> sessions;
+    QTimer *keepAliveTimer = nullptr;
+    quint16 nextMessageId = 0;
+};
+
+QT_END_NAMESPACE
+
+#endif // QCOAPRELIABLECONNECTION_P_H
@@ -89,6 +89,47 @@ void QCoapReplyPrivate::_q_setNotified()
         emit q->notified(q, message);
 }
 
+/*!
+    \internal
+
+    For an Observe request, sets the number of notifications discarded
+    because they were older than the last notification received to \a count.
+*/
+void QCoapReplyPrivate::_q_setStaleNotificationCount(uint count)
+{
+    staleNotificationCount = count;
+}
+
+/*!
+    \internal
+
+    For an Observe request, sets the number of notifications replaced by
+    a newer one before being delivered to \a count.
+*/
+void QCoapReplyPrivate::_q_setConflatedNotificationCount(uint count)
+{
+    conflatedNotificationCount = count;
+}
+
+/*!
+    \internal
+
+    For an Observe request, emits the observationStale() signal if \a stale
+    is \c true, or the observationRecovered() signal otherwise.
+*/
+void QCoapReplyPrivate::_q_setObservationStale(bool stale)
+{
+    Q_Q(QCoapReply);
+
+    if (q->isFinished())
+        return;
+
+    if (stale)
+        emit q->observationStale(q);
+    else
+        emit q->observationRecovered(q);
+}
+
 /*!
     \internal
 
@@ -188,6 +229,30 @@ void QCoapReplyPrivate::_q_setError(QtCoap::ResponseCode code)
     \sa QCoapClient::finished(), isFinished(), finished(), notified()
 */
 
+/*!
+    \fn void QCoapReply::observationStale(QCoapReply* reply)
+
+    This signal is emitted when no notification was received from an
+    observed resource before the Max-Age of the last notification expired.
+    The observation is then registered again until the server answers,
+    which emits the observationRecovered() signal.
+
+    The \a reply parameter is the QCoapReply itself for convenience.
+
+    \sa notified(), observationRecovered()
+*/
+
+/*!
+    \fn void QCoapReply::observationRecovered(QCoapReply* reply)
+
+    This signal is emitted when a notification is received again from an
+    observed resource, after the observationStale() signal was emitted.
+
+    The \a reply parameter is the QCoapReply itself for convenience.
+
+    \sa notified(), observationStale()
+*/
+
 /*!
     \fn void QCoapReply::error(QCoapReply* reply, QtCoap::Error error)
 
@@ -344,6 +409,38 @@ bool QCoapReply::isSuccessful() const
             && d->error == QtCoap::Error::Ok;
 }
 
+/*!
+    Returns the number of notifications discarded for an Observe request.
+
+    Notifications may arrive out of order. A notification older than the
+    last notification received is discarded, and the notified() signal is
+    not emitted for it. The order of notifications is determined by the
+    sequence number of the Observe option, as described in
+    \l{https://tools.ietf.org/html/rfc7641#section-3.4}{RFC 7641}.
+
+    \sa notified()
+*/
+uint QCoapReply::staleNotificationCount() const
+{
+    Q_D(const QCoapReply);
+    return d->staleNotificationCount;
+}
+
+/*!
+    Returns the number of notifications discarded for an Observe request
+    because a newer notification arrived before they could be delivered.
+
+    This only happens when a minimum interval between notifications is set
+    with QCoapClient::setNotificationInterval().
+
+    \sa notified(), staleNotificationCount()
+*/
+uint QCoapReply::conflatedNotificationCount() const
+{
+    Q_D(const QCoapReply);
+    return d->conflatedNotificationCount;
+}
+
 /*!
     Returns the target uri of the associated request.
 */
@@ -31,11 +31,15 @@ public:
     bool isFinished() const;
     bool isAborted() const;
     bool isSuccessful() const;
+    uint staleNotificationCount() const;
+    uint conflatedNotificationCount() const;
     void abortRequest();
 
 Q_SIGNALS:
     void finished(QCoapReply *reply);
     void notified(QCoapReply *reply, const QCoapMessage &message);
+    void observationStale(QCoapReply *reply);
+    void observationRecovered(QCoapReply *reply);
     void error(QCoapReply *reply, QtCoap::Error error);
     void aborted(const QCoapToken &token);
 
@@ -52,6 +56,9 @@ protected:
     Q_PRIVATE_SLOT(d_func(), void _q_setFinished(QtCoap::Error))
     Q_PRIVATE_SLOT(d_func(), void _q_setError(QtCoap::ResponseCode))
     Q_PRIVATE_SLOT(d_func(), void _q_setError(QtCoap::Error))
+    Q_PRIVATE_SLOT(d_func(), void _q_setStaleNotificationCount(uint))
+    Q_PRIVATE_SLOT(d_func(), void _q_setConflatedNotificationCount(uint))
+    Q_PRIVATE_SLOT(d_func(), void _q_setObservationStale(bool))
 
 private:
     explicit QCoapReply(QCoapReplyPrivate &dd, QObject *parent = nullptr);
@@ -35,6 +35,9 @@ public:
     void _q_setFinished(QtCoap::Error = QtCoap::Error::Ok);
     void _q_setError(QtCoap::ResponseCode code);
     void _q_setError(QtCoap::Error);
+    void _q_setStaleNotificationCount(uint count);
+    void _q_setConflatedNotificationCount(uint count);
+    void _q_setObservationStale(bool stale);
 
     static QCoapReply *createCoapReply(const QCoapRequest &request, QObject *parent = nullptr);
 
@@ -45,6 +48,8 @@ public:
     bool isRunning = false;
     bool isFinished = false;
     bool isAborted = false;
+    uint staleNotificationCount = 0;
+    uint conflatedNotificationCount = 0;
 
     Q_DECLARE_PUBLIC(QCoapReply)
 };
@@ -47,4 +47,6 @@ private:
 
 QT_END_NAMESPACE
 
+Q_DECLARE_METATYPE(QCoapRequest)
+
 #endif // QCOAPREQUEST_H
@@ -0,0 +1,460 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include "qcoaptcpconnection_p.h"
+
+#include <QtCore/qendian.h>
+#include <QtCore/qloggingcategory.h>
+
+#if QT_CONFIG(ssl)
+#include <QtNetwork/qsslsocket.h>
+#endif
+
+QT_BEGIN_NAMESPACE
+
+namespace {
+
+// Version, type, token length, code and message ID of the frames of the protocol
+constexpr qsizetype FrameHeaderSize = 4;
+
+/*
+    Returns the number of bytes of the extended length of a message, for
+    the given value of its Len field.
+*/
+qsizetype extendedLengthSize(quint8 lengthField)
+{
+    return lengthField < 13 ? 0 : lengthField == 13 ? 1 : lengthField == 14 ? 2 : 4;
+}
+
+} // namespace
+
+/*!
+    \internal
+
+    \class QCoapTcpConnection
+    \inmodule QtCoap
+
+    \brief The QCoapTcpConnection class transfers the frames to and from
+    the servers over TCP or TLS.
+
+    \reentrant
+
+    The QCoapTcpConnection class implements CoAP over reliable transports,
+    as described in \l{https://tools.ietf.org/html/rfc8323}{RFC 8323}. It
+    keeps a TCP connection with each server, secured with TLS in the secure
+    modes. The signaling shared with the other reliable transports, such as
+    the Capabilities and Settings Messages (CSM), is implemented by
+    QCoapReliableConnectionPrivate.
+
+    The frames written by the protocol are converted to the framing of
+    RFC 8323, which has neither a message type nor a message ID. The
+    acknowledgments and resets are not needed over a reliable transport and
+    are dropped. The messages received are converted back to
+    Non-confirmable frames. The protocol does not retransmit the frames
+    written to a reliable connection.
+
+    Large payloads are transferred in BERT blocks, made of several blocks
+    of 1024 bytes, when the server announces it supports them in its CSM.
+
+    \sa QCoapQUdpConnection, QCoapWebSocketConnection
+*/
+
+/*!
+    Constructs a new QCoapTcpConnection for the given \a securityMode and
+    sets \a parent as the parent object.
+
+    The secure modes use TLS. Since QtCoap::RawPublicKey is not supported,
+    the connection falls back to QtCoap::NoSecurity in this mode.
+*/
+QCoapTcpConnection::QCoapTcpConnection(QtCoap::SecurityMode securityMode, QObject *parent) :
+    QCoapTcpConnection(*new QCoapTcpConnectionPrivate(securityMode), parent)
+{
+}
+
+/*!
+    \internal
+
+    Constructs a new QCoapTcpConnection as a child of \a parent, with \a dd as
+    its \c d_ptr. This constructor must be used when internally subclassing
+    the QCoapTcpConnection class.
+*/
+QCoapTcpConnection::QCoapTcpConnection(QCoapTcpConnectionPrivate &dd, QObject *parent) :
+    QCoapConnection(dd, parent)
+{
+    Q_D(QCoapTcpConnection);
+
+    d->init();
+#if QT_CONFIG(ssl)
+    // Application-Layer Protocol Negotiation ID, see RFC 8323 section 4.3
+    if (isSecure())
+        d->sslConfiguration.setAllowedNextProtocols({ QByteArrayLiteral("coap") });
+#endif
+}
+
+QCoapTcpConnectionPrivate::QCoapTcpConnectionPrivate(QtCoap::SecurityMode security)
+    : QCoapReliableConnectionPrivate(security)
+{
+}
+
+/*!
+    \internal
+
+    Prepares the transport for data transmission. The TCP connection with
+    each server is set up when the first frame is written to it, so the
+    transport is ready right away.
+*/
+void QCoapTcpConnection::bind(const CoapEndpoint &endpoint)
+{
+    Q_UNUSED(endpoint)
+    emit bound();
+}
+
+/*!
+    \internal
+
+    Sends the given \a data frame to the \a endpoint, once the connection
+    with the server is set up and its CSM is received.
+*/
+void QCoapTcpConnection::writeData(const QByteArray &data, const CoapEndpoint &endpoint)
+{
+    Q_D(QCoapTcpConnection);
+    d->writeFrame(data, endpoint);
+}
+
+/*!
+    \internal
+
+    Releases the connections with all the servers.
+*/
+void QCoapTcpConnection::close()
+{
+    Q_D(QCoapTcpConnection);
+    d->releaseSessions();
+}
+
+/*!
+    \internal
+
+    Sets up the connection with the given \a endpoint, and emits the
+    connected() signal once the CSM of the server is received.
+*/
+void QCoapTcpConnection::openSession(const CoapEndpoint &endpoint)
+{
+    Q_D(QCoapTcpConnection);
+    d->openSession(endpoint);
+}
+
+/*!
+    \internal
+
+    Sets the socket \a option to \a value, for the current and the future
+    connections with the servers.
+*/
+void QCoapTcpConnection::setSocketOption(QAbstractSocket::SocketOption option,
+                                         const QVariant &value)
+{
+    Q_D(QCoapTcpConnection);
+
+    d->socketOptions.append({ option, value });
+    for (const auto &session : std::as_const(d->sessions)) {
+        if (session.csmSent)
+            d->tcpSocket(session)->setSocketOption(option, value);
+    }
+}
+
+/*!
+    \internal
+
+    Creates the socket of the \a session with the server at \a endpoint,
+    and starts connecting to the server.
+*/
+void QCoapTcpConnectionPrivate::openSocket(const CoapEndpoint &endpoint,
+                                           CoapReliableSession *session)
+{
+    Q_Q(QCoapTcpConnection);
+
+    QTcpSocket *socket = nullptr;
+#if QT_CONFIG(ssl)
+    if (q->isSecure()) {
+        auto *sslSocket = new QSslSocket(q);
+        sslSocket->setSslConfiguration(sslConfiguration);
+        QObject::connect(sslSocket, &QSslSocket::encrypted, q, [this, endpoint]() {
+            onSocketReady(endpoint);
+        });
+        QObject::connect(sslSocket, &QSslSocket::preSharedKeyAuthenticationRequired, q,
+                         [this](QSslPreSharedKeyAuthenticator *authenticator) {
+            setPreSharedKey(authenticator);
+        });
+        QObject::connect(sslSocket, &QSslSocket::sslErrors, q,
+                         [endpoint](const QList<QSslError> &errors) {
+            qCWarning(lcCoapConnection) << "TLS handshake with" << endpoint.host
+                                        << endpoint.port << "failed:" << errors;
+        });
+        socket = sslSocket;
+    } else
+#endif
+    {
+        socket = new QTcpSocket(q);
+        QObject::connect(socket, &QTcpSocket::connected, q, [this, endpoint]() {
+            onSocketReady(endpoint);
+        });
+    }
+
+    QObject::connect(socket, &QTcpSocket::readyRead, q, [this, endpoint]() {
+        onSocketReadyRead(endpoint);
+    });
+    QObject::connect(socket, &QTcpSocket::errorOccurred, q,
+                     [this, endpoint, socket](QAbstractSocket::SocketError socketError) {
+        onSocketError(endpoint, socketError, socket->errorString());
+    });
+    session->socket = socket;
+
+#if QT_CONFIG(ssl)
+    if (q->isSecure())
+        static_cast<QSslSocket *>(socket)->connectToHostEncrypted(endpoint.host, endpoint.port);
+    else
+#endif
+        socket->connectToHost(endpoint.host, endpoint.port);
+}
+
+/*!
+    \internal
+
+    Closes the \a socket of a session, once the data written to it is sent.
+*/
+void QCoapTcpConnectionPrivate::closeSocket(QObject *socket)
+{
+    static_cast<QTcpSocket *>(socket)->disconnectFromHost();
+}
+
+/*!
+    \internal
+
+    Returns the message of RFC 8323 over TCP for the \a frame, see
+    toTcpMessage().
+*/
+QByteArray QCoapTcpConnectionPrivate::toMessage(const QByteArray &frame) const
+{
+    return toTcpMessage(frame);
+}
+
+/*!
+    \internal
+
+    Writes the \a message to the socket of \a session.
+*/
+void QCoapTcpConnectionPrivate::sendMessage(CoapReliableSession *session,
+                                            const QByteArray &message)
+{
+    tcpSocket(*session)->write(message);
+}
+
+/*!
+    \internal
+
+    Returns the socket of the \a session.
+*/
+QTcpSocket *QCoapTcpConnectionPrivate::tcpSocket(const CoapReliableSession &session)
+{
+    return static_cast<QTcpSocket *>(session.socket.data());
+}
+
+/*!
+    \internal
+
+    Sets the options of the socket of the server at \a endpoint once the
+    connection with it is set up, and sends the CSM.
+*/
+void QCoapTcpConnectionPrivate::onSocketReady(const CoapEndpoint &endpoint)
+{
+    const auto it = sessions.find(endpoint);
+    if (it == sessions.end())
+        return;
+
+    QTcpSocket *socket = tcpSocket(it.value());
+    // Requests and responses are small, do not hold them back
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    for (const auto &option : std::as_const(socketOptions))
+        socket->setSocketOption(option.first, option.second);
+
+    startSession(&it.value());
+}
+
+/*!
+    \internal
+
+    Reads the data received from the server at \a endpoint, and processes
+    each complete message.
+*/
+void QCoapTcpConnectionPrivate::onSocketReadyRead(const CoapEndpoint &endpoint)
+{
+    Q_Q(QCoapTcpConnection);
+
+    auto it = sessions.find(endpoint);
+    if (it == sessions.end())
+        return;
+
+    it->active = true;
+    it->pingOutstanding = false;
+    QByteArray buffer = std::exchange(it->buffer, QByteArray());
+    buffer.append(tcpSocket(it.value())->readAll());
+
+    qsizetype offset = 0;
+    while (offset < buffer.size()) {
+        const QByteArrayView data = QByteArrayView(buffer).sliced(offset);
+        const qint64 length = messageLength(data);
+        if (length > MaximumMessageSize) {
+            qCWarning(lcCoapConnection) << "Message from" << endpoint.host << endpoint.port
+                                        << "larger than" << MaximumMessageSize
+                                        << "bytes, aborting the connection";
+            abortSession(endpoint);
+            emit q->error(QAbstractSocket::DatagramTooLargeError);
+            return;
+        }
+        if (length < 0 || data.size() < length)
+            break;
+
+        processMessage(endpoint, data.first(length));
+        offset += length;
+
+        // Processing the message may close the session, or add new ones
+        it = sessions.find(endpoint);
+        if (it == sessions.end())
+            return;
+    }
+
+    // Keep the incomplete message, without copying the rest of the buffer
+    buffer.remove(0, offset);
+    it->buffer = std::move(buffer);
+}
+
+/*!
+    \internal
+
+    Processes the \a message received from the server at \a endpoint. The
+    signaling messages are handled by processSignal(), the other ones are
+    converted to frames and emitted with the readyRead() signal.
+*/
+void QCoapTcpConnectionPrivate::processMessage(const CoapEndpoint &endpoint,
+                                               QByteArrayView message)
+{
+    Q_Q(QCoapTcpConnection);
+
+    CoapReliableSession *session = &sessions[endpoint];
+    const quint8 firstByte = static_cast<quint8>(message.at(0));
+    const qsizetype codeOffset = 1 + extendedLengthSize(firstByte >> 4);
+    const qsizetype tokenLength = firstByte & 0x0F;
+    const quint8 code = static_cast<quint8>(message.at(codeOffset));
+
+    // Signaling messages have a code of class 7
+    if ((code >> 5) == 7) {
+        const QByteArray token = message.sliced(codeOffset + 1, tokenLength).toByteArray();
+        processSignal(endpoint, session, code, token,
+                      message.sliced(codeOffset + 1 + tokenLength));
+        return;
+    }
+
+    if (code == 0)
+        return;
+
+    const QHostAddress sender = tcpSocket(*session)->peerAddress();
+    emit q->readyRead(fromTcpMessage(message, ++nextMessageId), sender);
+}
+
+/*!
+    \internal
+
+    Returns the message of RFC 8323 for the \a frame written by the
+    protocol. The message type and ID are dropped, and the length of the
+    options and payload is added. Returns an empty array if the \a frame is
+    malformed.
+*/
+QByteArray QCoapTcpConnectionPrivate::toTcpMessage(const QByteArray &frame)
+{
+    if (frame.size() < FrameHeaderSize)
+        return QByteArray();
+
+    const quint8 tokenLength = static_cast<quint8>(frame.at(0)) & 0x0F;
+    const qsizetype headerSize = FrameHeaderSize + tokenLength;
+    if (frame.size() < headerSize)
+        return QByteArray();
+
+    const quint32 length = static_cast<quint32>(frame.size() - headerSize);
+    QByteArray message;
+    message.reserve(frame.size() + 2);
+    if (length < 13) {
+        message.append(static_cast<char>((length << 4) | tokenLength));
+    } else if (length < 269) {
+        message.append(static_cast<char>((13 << 4) | tokenLength));
+        message.append(static_cast<char>(length - 13));
+    } else if (length < 65805) {
+        char extendedLength[2];
+        qToBigEndian<quint16>(static_cast<quint16>(length - 269), extendedLength);
+        message.append(static_cast<char>((14 << 4) | tokenLength));
+        message.append(extendedLength, sizeof(extendedLength));
+    } else {
+        char extendedLength[4];
+        qToBigEndian<quint32>(length - 65805, extendedLength);
+        message.append(static_cast<char>((15 << 4) | tokenLength));
+        message.append(extendedLength, sizeof(extendedLength));
+    }
+
+    // Code, token, options and payload
+    message.append(frame.at(1));
+    message.append(frame.constData() + FrameHeaderSize, frame.size() - FrameHeaderSize);
+    return message;
+}
+
+/*!
+    \internal
+
+    Returns the frame of the protocol for the complete \a message received
+    from a server. The frame is Non-confirmable, with the given
+    \a messageId.
+*/
+QByteArray QCoapTcpConnectionPrivate::fromTcpMessage(QByteArrayView message, quint16 messageId)
+{
+    const quint8 firstByte = static_cast<quint8>(message.at(0));
+    const qsizetype codeOffset = 1 + extendedLengthSize(firstByte >> 4);
+
+    QByteArray frame;
+    frame.reserve(FrameHeaderSize + message.size() - codeOffset - 1);
+    // Version 1, Non-confirmable, and the token length
+    frame.append(static_cast<char>(0x50 | (firstByte & 0x0F)));
+    frame.append(message.at(codeOffset));
+    frame.append(static_cast<char>(messageId >> 8));
+    frame.append(static_cast<char>(messageId & 0xFF));
+    frame.append(message.sliced(codeOffset + 1));
+    return frame;
+}
+
+/*!
+    \internal
+
+    Returns the size of the message at the beginning of \a buffer, or -1 if
+    its header is not complete yet.
+*/
+qint64 QCoapTcpConnectionPrivate::messageLength(QByteArrayView buffer)
+{
+    if (buffer.isEmpty())
+        return -1;
+
+    const auto *data = reinterpret_cast<const uchar *>(buffer.data());
+    const quint8 lengthField = data[0] >> 4;
+    const qsizetype extendedSize = extendedLengthSize(lengthField);
+    if (buffer.size() < 1 + extendedSize)
+        return -1;
+
+    qint64 length = lengthField;
+    if (lengthField == 13)
+        length = 13 + data[1];
+    else if (lengthField == 14)
+        length = 269 + qFromBigEndian<quint16>(data + 1);
+    else if (lengthField == 15)
+        length = 65805 + qint64(qFromBigEndian<quint32>(data + 1));
+
+    // Header, code, token, options and payload
+    return 1 + extendedSize + 1 + (data[0] & 0x0F) + length;
+}
+
+QT_END_NAMESPACE
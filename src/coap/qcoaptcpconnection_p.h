@@ -0,0 +1,76 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#ifndef QCOAPTCPCONNECTION_P_H
+#define QCOAPTCPCONNECTION_P_H
+
+#include <private/qcoapreliableconnection_p.h>
+
+#include <QtNetwork/qtcpsocket.h>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API. It exists purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+QT_BEGIN_NAMESPACE
+
+class QCoapTcpConnectionPrivate;
+class Q_AUTOTEST_EXPORT QCoapTcpConnection : public QCoapConnection
+{
+    Q_OBJECT
+
+public:
+    explicit QCoapTcpConnection(QtCoap::SecurityMode security = QtCoap::SecurityMode::NoSecurity,
+                                QObject *parent = nullptr);
+
+    ~QCoapTcpConnection() override = default;
+
+public Q_SLOTS:
+    void setSocketOption(QAbstractSocket::SocketOption, const QVariant &value);
+
+protected:
+    explicit QCoapTcpConnection(QCoapTcpConnectionPrivate &dd, QObject *parent = nullptr);
+
+    void bind(const CoapEndpoint &endpoint) override;
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override;
+    void close() override;
+    void openSession(const CoapEndpoint &endpoint) override;
+
+    Q_DECLARE_PRIVATE(QCoapTcpConnection)
+};
+
+class Q_AUTOTEST_EXPORT QCoapTcpConnectionPrivate : public QCoapReliableConnectionPrivate
+{
+public:
+    QCoapTcpConnectionPrivate(QtCoap::SecurityMode security = QtCoap::SecurityMode::NoSecurity);
+    ~QCoapTcpConnectionPrivate() override = default;
+
+    void openSocket(const CoapEndpoint &endpoint, CoapReliableSession *session) override;
+    void closeSocket(QObject *socket) override;
+    QByteArray toMessage(const QByteArray &frame) const override;
+    void sendMessage(CoapReliableSession *session, const QByteArray &message) override;
+
+    void onSocketReady(const CoapEndpoint &endpoint);
+    void onSocketReadyRead(const CoapEndpoint &endpoint);
+    void processMessage(const CoapEndpoint &endpoint, QByteArrayView message);
+
+    static QTcpSocket *tcpSocket(const CoapReliableSession &session);
+    static QByteArray toTcpMessage(const QByteArray &frame);
+    static QByteArray fromTcpMessage(QByteArrayView message, quint16 messageId);
+    static qint64 messageLength(QByteArrayView buffer);
+
+    QList<std::pair<QAbstractSocket::SocketOption, QVariant>> socketOptions;
+
+    Q_DECLARE_PUBLIC(QCoapTcpConnection)
+};
+
+QT_END_NAMESPACE
+
+#endif // QCOAPTCPCONNECTION_P_H
@@ -0,0 +1,341 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include "qcoapwebsocketconnection_p.h"
+
+#include <QtCore/qloggingcategory.h>
+#include <QtWebSockets/qwebsockethandshakeoptions.h>
+
+QT_BEGIN_NAMESPACE
+
+namespace {
+
+// Version, type, token length, code and message ID of the frames of the protocol
+constexpr qsizetype FrameHeaderSize = 4;
+
+} // namespace
+
+/*!
+    \internal
+
+    \class QCoapWebSocketConnection
+    \inmodule QtCoap
+
+    \brief The QCoapWebSocketConnection class transfers the frames to and
+    from the servers over WebSockets.
+
+    \reentrant
+
+    The QCoapWebSocketConnection class implements CoAP over WebSockets, as
+    described in \l{https://tools.ietf.org/html/rfc8323#section-4}{RFC 8323}.
+    It keeps a single WebSocket connection with each server, open on the
+    \c{/.well-known/coap} path with the \c coap subprotocol, and carries all
+    the concurrent exchanges with that server over it. The secure modes use
+    \c wss URLs.
+
+    Each WebSocket binary message carries one CoAP message, without the
+    length of RFC 8323 over TCP. The signaling is shared with
+    QCoapTcpConnection, see QCoapReliableConnectionPrivate: the first
+    message is a Capabilities and Settings Message (CSM), the frames are
+    held back until the CSM of the server is received, the messages have
+    neither a type nor an ID, and the acknowledgments and resets written by
+    the protocol are dropped.
+
+    \sa QCoapTcpConnection
+*/
+
+/*!
+    Constructs a new QCoapWebSocketConnection for the given \a securityMode
+    and sets \a parent as the parent object.
+
+    The secure modes use TLS. Since QtCoap::RawPublicKey is not supported,
+    the connection falls back to QtCoap::NoSecurity in this mode.
+*/
+QCoapWebSocketConnection::QCoapWebSocketConnection(QtCoap::SecurityMode securityMode,
+                                                   QObject *parent) :
+    QCoapWebSocketConnection(*new QCoapWebSocketConnectionPrivate(securityMode), parent)
+{
+}
+
+/*!
+    \internal
+
+    Constructs a new QCoapWebSocketConnection as a child of \a parent, with
+    \a dd as its \c d_ptr. This constructor must be used when internally
+    subclassing the QCoapWebSocketConnection class.
+*/
+QCoapWebSocketConnection::QCoapWebSocketConnection(QCoapWebSocketConnectionPrivate &dd,
+                                                   QObject *parent) :
+    QCoapConnection(dd, parent)
+{
+    Q_D(QCoapWebSocketConnection);
+    d->init();
+}
+
+QCoapWebSocketConnectionPrivate::QCoapWebSocketConnectionPrivate(QtCoap::SecurityMode security)
+    : QCoapReliableConnectionPrivate(security)
+{
+}
+
+/*!
+    \internal
+
+    Prepares the transport for data transmission. The WebSocket connection
+    with each server is opened when the first frame is written to it, so
+    the transport is ready right away.
+*/
+void QCoapWebSocketConnection::bind(const CoapEndpoint &endpoint)
+{
+    Q_UNUSED(endpoint)
+    emit bound();
+}
+
+/*!
+    \internal
+
+    Sends the given \a data frame to the \a endpoint, once the WebSocket
+    connection with the server is open and its CSM is received.
+*/
+void QCoapWebSocketConnection::writeData(const QByteArray &data, const CoapEndpoint &endpoint)
+{
+    Q_D(QCoapWebSocketConnection);
+    d->writeFrame(data, endpoint);
+}
+
+/*!
+    \internal
+
+    Releases the connections with all the servers, and closes them.
+*/
+void QCoapWebSocketConnection::close()
+{
+    Q_D(QCoapWebSocketConnection);
+    d->releaseSessions();
+}
+
+/*!
+    \internal
+
+    Opens the WebSocket connection with the given \a endpoint, and emits the
+    connected() signal once the CSM of the server is received.
+*/
+void QCoapWebSocketConnection::openSession(const CoapEndpoint &endpoint)
+{
+    Q_D(QCoapWebSocketConnection);
+    d->openSession(endpoint);
+}
+
+/*!
+    \internal
+
+    Creates the socket of the \a session with the server at \a endpoint,
+    and starts opening the WebSocket connection with it.
+*/
+void QCoapWebSocketConnectionPrivate::openSocket(const CoapEndpoint &endpoint,
+                                                 CoapReliableSession *session)
+{
+    Q_Q(QCoapWebSocketConnection);
+
+    auto *socket = new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, q);
+#if QT_CONFIG(ssl)
+    if (q->isSecure()) {
+        socket->setSslConfiguration(sslConfiguration);
+        QObject::connect(socket, &QWebSocket::preSharedKeyAuthenticationRequired, q,
+                         [this](QSslPreSharedKeyAuthenticator *authenticator) {
+            setPreSharedKey(authenticator);
+        });
+        QObject::connect(socket, &QWebSocket::sslErrors, q,
+                         [endpoint](const QList<QSslError> &errors) {
+            qCWarning(lcCoapConnection) << "TLS handshake with" << endpoint.host
+                                        << endpoint.port << "failed:" << errors;
+        });
+    }
+#endif
+
+    QObject::connect(socket, &QWebSocket::connected, q, [this, endpoint]() {
+        onSocketReady(endpoint);
+    });
+    QObject::connect(socket, &QWebSocket::binaryMessageReceived, q,
+                     [this, endpoint](const QByteArray &message) {
+        onMessageReceived(endpoint, message);
+    });
+    QObject::connect(socket, &QWebSocket::disconnected, q, [this, endpoint]() {
+        onSocketError(endpoint, QAbstractSocket::RemoteHostClosedError, QString());
+    });
+    QObject::connect(socket, &QWebSocket::errorOccurred, q,
+                     [this, endpoint, socket](QAbstractSocket::SocketError socketError) {
+        onSocketError(endpoint, socketError, socket->errorString());
+    });
+    session->socket = socket;
+
+    QWebSocketHandshakeOptions options;
+    // WebSocket subprotocol of CoAP, see RFC 8323 section 4.1
+    options.setSubprotocols({ QStringLiteral("coap") });
+    socket->open(webSocketUrl(endpoint), options);
+}
+
+/*!
+    \internal
+
+    Closes the WebSocket \a socket of a session.
+*/
+void QCoapWebSocketConnectionPrivate::closeSocket(QObject *socket)
+{
+    static_cast<QWebSocket *>(socket)->close();
+}
+
+/*!
+    \internal
+
+    Returns the WebSocket message for the \a frame, see toWebSocketMessage().
+*/
+QByteArray QCoapWebSocketConnectionPrivate::toMessage(const QByteArray &frame) const
+{
+    return toWebSocketMessage(frame);
+}
+
+/*!
+    \internal
+
+    Sends the \a message as a binary message through the WebSocket
+    connection of \a session.
+*/
+void QCoapWebSocketConnectionPrivate::sendMessage(CoapReliableSession *session,
+                                                  const QByteArray &message)
+{
+    webSocket(*session)->sendBinaryMessage(message);
+}
+
+/*!
+    \internal
+
+    Returns the WebSocket of the \a session.
+*/
+QWebSocket *QCoapWebSocketConnectionPrivate::webSocket(const CoapReliableSession &session)
+{
+    return static_cast<QWebSocket *>(session.socket.data());
+}
+
+/*!
+    \internal
+
+    Sends the CSM to the server at \a endpoint once the WebSocket connection
+    with it is open.
+*/
+void QCoapWebSocketConnectionPrivate::onSocketReady(const CoapEndpoint &endpoint)
+{
+    const auto it = sessions.find(endpoint);
+    if (it == sessions.end())
+        return;
+
+    if (webSocket(it.value())->subprotocol() != QLatin1String("coap")) {
+        qCWarning(lcCoapConnection) << "Server" << endpoint.host << endpoint.port
+                                    << "did not accept the coap subprotocol";
+    }
+    startSession(&it.value());
+}
+
+/*!
+    \internal
+
+    Processes the \a message received from the server at \a endpoint. The
+    signaling messages are handled by processSignal(), the other ones are
+    converted to frames and emitted with the readyRead() signal.
+*/
+void QCoapWebSocketConnectionPrivate::onMessageReceived(const CoapEndpoint &endpoint,
+                                                        const QByteArray &message)
+{
+    Q_Q(QCoapWebSocketConnection);
+
+    const auto it = sessions.find(endpoint);
+    if (it == sessions.end())
+        return;
+
+    CoapReliableSession *session = &it.value();
+    session->active = true;
+    session->pingOutstanding = false;
+
+    // The Len field is always 0 over WebSockets, see RFC 8323 section 4.4
+    const qsizetype tokenLength = message.isEmpty() ? 0 : message.at(0) & 0x0F;
+    if (message.size() < 2 + tokenLength || (message.at(0) & 0xF0)) {
+        qCWarning(lcCoapConnection) << "Malformed message from" << endpoint.host << endpoint.port;
+        return;
+    }
+
+    const quint8 code = static_cast<quint8>(message.at(1));
+    // Signaling messages have a code of class 7
+    if ((code >> 5) == 7) {
+        processSignal(endpoint, session, code, message.sliced(2, tokenLength),
+                      QByteArrayView(message).sliced(2 + tokenLength));
+        return;
+    }
+
+    if (code == 0)
+        return;
+
+    const QHostAddress sender = webSocket(*session)->peerAddress();
+    emit q->readyRead(fromWebSocketMessage(message, ++nextMessageId), sender);
+}
+
+/*!
+    \internal
+
+    Returns the URL of the CoAP resources of the server at \a endpoint, see
+    \l{https://tools.ietf.org/html/rfc8323#section-8.2}{RFC 8323}.
+*/
+QUrl QCoapWebSocketConnectionPrivate::webSocketUrl(const CoapEndpoint &endpoint)
+{
+    QUrl url;
+    url.setScheme(endpoint.secure ? QStringLiteral("wss") : QStringLiteral("ws"));
+    url.setHost(endpoint.address.isNull() ? endpoint.host : endpoint.address.toString());
+    url.setPort(endpoint.port);
+    url.setPath(QStringLiteral("/.well-known/coap"));
+    return url;
+}
+
+/*!
+    \internal
+
+    Returns the WebSocket message for the \a frame written by the protocol.
+    The message type and ID are dropped, and the Len field is 0. Returns an
+    empty array if the \a frame is malformed.
+*/
+QByteArray QCoapWebSocketConnectionPrivate::toWebSocketMessage(const QByteArray &frame)
+{
+    if (frame.size() < FrameHeaderSize)
+        return QByteArray();
+
+    const quint8 tokenLength = static_cast<quint8>(frame.at(0)) & 0x0F;
+    if (frame.size() < FrameHeaderSize + tokenLength)
+        return QByteArray();
+
+    // Token length, code, token, options and payload
+    QByteArray message;
+    message.reserve(frame.size() - 2);
+    message.append(static_cast<char>(tokenLength));
+    message.append(frame.at(1));
+    message.append(frame.constData() + FrameHeaderSize, frame.size() - FrameHeaderSize);
+    return message;
+}
+
+/*!
+    \internal
+
+    Returns the frame of the protocol for the \a message received from a
+    server. The frame is Non-confirmable, with the given \a messageId.
+*/
+QByteArray QCoapWebSocketConnectionPrivate::fromWebSocketMessage(const QByteArray &message,
+                                                                 quint16 messageId)
+{
+    QByteArray frame;
+    frame.reserve(message.size() + 2);
+    // Version 1, Non-confirmable, and the token length
+    frame.append(static_cast<char>(0x50 | (message.at(0) & 0x0F)));
+    frame.append(message.at(1));
+    frame.append(static_cast<char>(messageId >> 8));
+    frame.append(static_cast<char>(messageId & 0xFF));
+    frame.append(message.constData() + 2, message.size() - 2);
+    return frame;
+}
+
+QT_END_NAMESPACE
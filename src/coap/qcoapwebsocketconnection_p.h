@@ -0,0 +1,75 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#ifndef QCOAPWEBSOCKETCONNECTION_P_H
+#define QCOAPWEBSOCKETCONNECTION_P_H
+
+#include <private/qcoapreliableconnection_p.h>
+
+#include <QtWebSockets/qwebsocket.h>
+
+#include <QtCore/qurl.h>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API. It exists purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+QT_BEGIN_NAMESPACE
+
+class QCoapWebSocketConnectionPrivate;
+class Q_AUTOTEST_EXPORT QCoapWebSocketConnection : public QCoapConnection
+{
+    Q_OBJECT
+
+public:
+    explicit QCoapWebSocketConnection(
+            QtCoap::SecurityMode security = QtCoap::SecurityMode::NoSecurity,
+            QObject *parent = nullptr);
+
+    ~QCoapWebSocketConnection() override = default;
+
+protected:
+    explicit QCoapWebSocketConnection(QCoapWebSocketConnectionPrivate &dd,
+                                      QObject *parent = nullptr);
+
+    void bind(const CoapEndpoint &endpoint) override;
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override;
+    void close() override;
+    void openSession(const CoapEndpoint &endpoint) override;
+
+    Q_DECLARE_PRIVATE(QCoapWebSocketConnection)
+};
+
+class Q_AUTOTEST_EXPORT QCoapWebSocketConnectionPrivate : public QCoapReliableConnectionPrivate
+{
+public:
+    QCoapWebSocketConnectionPrivate(
+            QtCoap::SecurityMode security = QtCoap::SecurityMode::NoSecurity);
+    ~QCoapWebSocketConnectionPrivate() override = default;
+
+    void openSocket(const CoapEndpoint &endpoint, CoapReliableSession *session) override;
+    void closeSocket(QObject *socket) override;
+    QByteArray toMessage(const QByteArray &frame) const override;
+    void sendMessage(CoapReliableSession *session, const QByteArray &message) override;
+
+    void onSocketReady(const CoapEndpoint &endpoint);
+    void onMessageReceived(const CoapEndpoint &endpoint, const QByteArray &message);
+
+    static QWebSocket *webSocket(const CoapReliableSession &session);
+    static QUrl webSocketUrl(const CoapEndpoint &endpoint);
+    static QByteArray toWebSocketMessage(const QByteArray &frame);
+    static QByteArray fromWebSocketMessage(const QByteArray &message, quint16 messageId);
+
+    Q_DECLARE_PUBLIC(QCoapWebSocketConnection)
+};
+
+QT_END_NAMESPACE
+
+#endif // QCOAPWEBSOCKETCONNECTION_P_H
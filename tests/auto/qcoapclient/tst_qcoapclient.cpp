@@ -6,16 +6,22 @@
 #include <QCoreApplication>
 
 #include <QtCoap/qcoapclient.h>
+#include <QtCoap/qcoapobservegroup.h>
 #include <QtCoap/qcoaprequest.h>
 #include <QtCoap/qcoapreply.h>
 #include <QtCoap/qcoapresourcediscoveryreply.h>
 #include <QtCore/qbuffer.h>
+#include <QtCore/qmutex.h>
 #include <QtNetwork/qnetworkdatagram.h>
 #include <QtNetwork/qsslcipher.h>
+#include <QtNetwork/qtcpserver.h>
+#include <QtNetwork/qtcpsocket.h>
 #include <private/qcoapclient_p.h>
+#include <private/qcoapinternalreply_p.h>
 #include <private/qcoapqudpconnection_p.h>
 #include <private/qcoapprotocol_p.h>
 #include <private/qcoaprequest_p.h>
+#include <private/qcoaptcpconnection_p.h>
 
 #include "../coapnetworksettings.h"
 
@@ -47,6 +53,7 @@ private Q_SLOTS:
     void blockwiseReply();
     void blockwiseRequest_data();
     void blockwiseRequest();
+    void concurrentBlockwiseRequests();
     void discover_data();
     void discover();
     void observe_data();
@@ -54,8 +61,29 @@ private Q_SLOTS:
     void confirmableMulticast();
     void multicast();
     void multicast_blockwise();
+    void busyConnection();
+    void bertOverTcp();
     void setMinimumTokenSize_data();
     void setMinimumTokenSize();
+    void blockWindow_data();
+    void blockWindow();
+    void qBlockTransfer_data();
+    void qBlockTransfer();
+    void resumableDownload_data();
+    void resumableDownload();
+    void adaptiveBlockSize();
+    void blockSizeChangedMidTransfer_data();
+    void blockSizeChangedMidTransfer();
+    void observeReordering();
+    void observeMultiplexing();
+    void notificationInterval();
+    void observeReregistration();
+    void observeGroup();
+    void observeCompact();
+    void observeCompactFreshness();
+    void observeCompactSecureSnapshot();
+    void observeDeregistration();
+    void observeSnapshot();
 };
 
 class QCoapClientForSecurityTests : public QCoapClient
@@ -165,18 +193,16 @@ class QCoapConnectionMulticastTests : public QCoapConnection
 public:
     ~QCoapConnectionMulticastTests() override = default;
 
-    void bind(const QString &host, quint16 port) override
+    void bind(const CoapEndpoint &endpoint) override
     {
-        Q_UNUSED(host)
-        Q_UNUSED(port)
+        Q_UNUSED(endpoint)
         // Do nothing
     }
 
-    void writeData(const QByteArray &data, const QString &host, quint16 port) override
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override
     {
         Q_UNUSED(data)
-        Q_UNUSED(host)
-        Q_UNUSED(port)
+        Q_UNUSED(endpoint)
         // Do nothing
     }
 
@@ -199,6 +225,577 @@ public:
     }
 };
 
+class QCoapConnectionBlockServerTests : public QCoapConnection
+{
+public:
+    QCoapConnectionBlockServerTests(const QByteArray &resource, uint blockSize)
+        : resource(resource), blockSize(blockSize)
+    {}
+    ~QCoapConnectionBlockServerTests() override = default;
+
+    void bind(const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+        emit bound();
+    }
+
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+
+        // Parse the request with the reply parser, to get the Block2 option decoded
+        QScopedPointer<QCoapInternalReply> request(QCoapInternalReply::createFromFrame(data));
+        const QCoapMessage message = *request->message();
+        if (message.type() == QCoapMessage::Type::Acknowledgment
+                || message.type() == QCoapMessage::Type::Reset) {
+            return;
+        }
+
+        const uint block = request->currentBlockNumber();
+        {
+            QMutexLocker locker(&mutex);
+            requestedBlocks.append(block);
+            if (blocksToDrop.remove(block)
+                    || (unreachableFromBlock >= 0 && block >= uint(unreachableFromBlock))) {
+                return;
+            }
+
+            ++inFlight;
+            maxInFlight = qMax(maxInFlight, inFlight);
+        }
+
+        // Honor smaller block sizes asked by the client
+        uint size = blockSize;
+        uint replyBlock = block;
+        if (message.hasOption(QCoapOption::Block2)) {
+            size = qMin(blockSize, request->blockSize());
+            replyBlock = block * request->blockSize() / size;
+        }
+
+        // Reply from the main thread, and shuffle the order of the replies a bit
+        const QByteArray reply = blockReply(message, replyBlock, size);
+        QMetaObject::invokeMethod(this, [this, reply, block]() {
+            QTimer::singleShot((block % 3) * 10, this, [this, reply]() {
+                {
+                    QMutexLocker locker(&mutex);
+                    --inFlight;
+                }
+                emit readyRead(reply, QHostAddress(QHostAddress::LocalHost));
+            });
+        }, Qt::QueuedConnection);
+    }
+
+    void close() override {}
+
+    void dropBlockOnce(uint block)
+    {
+        QMutexLocker locker(&mutex);
+        blocksToDrop.insert(block);
+    }
+
+    void setUnreachableFromBlock(int block)
+    {
+        QMutexLocker locker(&mutex);
+        unreachableFromBlock = block;
+    }
+
+    void setEtag(const QByteArray &value)
+    {
+        QMutexLocker locker(&mutex);
+        etag = value;
+    }
+
+    void setMaxAge(int seconds)
+    {
+        QMutexLocker locker(&mutex);
+        maxAge = seconds;
+    }
+
+    QList<uint> blocksRequested()
+    {
+        QMutexLocker locker(&mutex);
+        return requestedBlocks;
+    }
+
+    void clearBlocksRequested()
+    {
+        QMutexLocker locker(&mutex);
+        requestedBlocks.clear();
+    }
+
+    uint maximumInFlight()
+    {
+        QMutexLocker locker(&mutex);
+        return maxInFlight;
+    }
+
+private:
+    QByteArray blockReply(const QCoapMessage &request, uint block, uint size) const
+    {
+        const bool confirmable = request.type() == QCoapMessage::Type::Confirmable;
+        const bool more = (block + 1) * size < static_cast<uint>(resource.size());
+        const quint32 szx = qCountTrailingZeroBits(size) - 4;
+        const quint16 messageId = confirmable ? request.messageId()
+                                              : static_cast<quint16>(0x1000 + block);
+
+        // Piggybacked ACK for confirmable requests, NON otherwise, with a 2.05 Content code
+        QByteArray frame;
+        frame.append(static_cast<char>((confirmable ? 0x60 : 0x50) | request.tokenLength()));
+        frame.append(static_cast<char>(0x45));
+        frame.append(static_cast<char>(messageId >> 8));
+        frame.append(static_cast<char>(messageId & 0xFF));
+        frame.append(request.token());
+
+        // ETag (option 4), Max-Age (option 14), Block2 (option 23) and Size2 (option 28)
+        quint8 previousOption = 0;
+        if (!etag.isEmpty()) {
+            frame.append(static_cast<char>((4 << 4) | etag.size()));
+            frame.append(etag);
+            previousOption = 4;
+        }
+        if (maxAge >= 0) {
+            const QByteArray value =
+                    QCoapOption(QCoapOption::MaxAge, static_cast<quint32>(maxAge)).opaqueValue();
+            frame.append(static_cast<char>(((14 - previousOption) << 4) | value.size()));
+            frame.append(value);
+            previousOption = 14;
+        }
+        const QByteArray block2 =
+                QCoapOption(QCoapOption::Block2, (block << 4) | (more ? 8u : 0u) | szx).opaqueValue();
+        if (previousOption == 14) {
+            frame.append(static_cast<char>(((23 - 14) << 4) | block2.size()));
+        } else {
+            frame.append(static_cast<char>(0xD0 | block2.size()));
+            frame.append(static_cast<char>(23 - previousOption - 13));
+        }
+        frame.append(block2);
+        const QByteArray size2 =
+                QCoapOption(QCoapOption::Size2, static_cast<quint32>(resource.size())).opaqueValue();
+        frame.append(static_cast<char>((5 << 4) | size2.size()));
+        frame.append(size2);
+
+        frame.append(static_cast<char>(0xFF));
+        frame.append(resource.mid(block * size, size));
+        return frame;
+    }
+
+    const QByteArray resource;
+    const uint blockSize;
+
+    QMutex mutex;
+    QSet<uint> blocksToDrop;
+    QList<uint> requestedBlocks;
+    QByteArray etag;
+    int maxAge = -1;
+    int unreachableFromBlock = -1;
+    uint inFlight = 0;
+    uint maxInFlight = 0;
+};
+
+class QCoapConnectionQBlockServerTests : public QCoapConnection
+{
+public:
+    QCoapConnectionQBlockServerTests(const QByteArray &resource, uint blockSize,
+                                     uint maximumPayloads, bool supportsQBlock)
+        : resource(resource), blockSize(blockSize), maximumPayloads(maximumPayloads),
+          supportsQBlock(supportsQBlock)
+    {}
+    ~QCoapConnectionQBlockServerTests() override = default;
+
+    void bind(const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+        emit bound();
+    }
+
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+
+        QScopedPointer<QCoapInternalReply> request(QCoapInternalReply::createFromFrame(data));
+        const QCoapMessage message = *request->message();
+        if (message.type() == QCoapMessage::Type::Acknowledgment
+                || message.type() == QCoapMessage::Type::Reset) {
+            return;
+        }
+
+        const uint blockCount = (static_cast<uint>(resource.size()) + blockSize - 1) / blockSize;
+        QList<QByteArray> replies;
+        if (!message.hasOption(QCoapOption::QBlock2)) {
+            // Usual blockwise transfer
+            replies.append(blockReply(message, QCoapOption::Block2,
+                                      request->currentBlockNumber()));
+        } else if (!supportsQBlock) {
+            replies.append(frame(message, 0x82, 0, {}, {}));
+        } else {
+            QMutexLocker locker(&mutex);
+            for (const QCoapOption &option : message.options(QCoapOption::QBlock2)) {
+                const uint value = option.uintValue();
+                const uint first = value >> 4;
+                const uint last = (value & 8) ? qMin(first + maximumPayloads, blockCount)
+                                              : first + 1;
+                for (uint block = first; block < last; ++block) {
+                    sentBlocks.append(block);
+                    if (!blocksToDrop.remove(block))
+                        replies.append(blockReply(message, QCoapOption::QBlock2, block));
+                }
+            }
+        }
+
+        QMetaObject::invokeMethod(this, [this, replies]() {
+            for (const QByteArray &reply : replies)
+                emit readyRead(reply, QHostAddress(QHostAddress::LocalHost));
+        }, Qt::QueuedConnection);
+    }
+
+    void close() override {}
+
+    void dropBlockOnce(uint block)
+    {
+        QMutexLocker locker(&mutex);
+        blocksToDrop.insert(block);
+    }
+
+    QList<uint> blocksSent()
+    {
+        QMutexLocker locker(&mutex);
+        return sentBlocks;
+    }
+
+private:
+    QByteArray blockReply(const QCoapMessage &request, QCoapOption::OptionName name,
+                          uint block) const
+    {
+        const bool more = (block + 1) * blockSize < static_cast<uint>(resource.size());
+        const quint32 szx = qCountTrailingZeroBits(blockSize) - 4;
+        const QByteArray value =
+                QCoapOption(name, (block << 4) | (more ? 8u : 0u) | szx).opaqueValue();
+
+        QByteArray option;
+        option.append(static_cast<char>(0xD0 | value.size()));
+        option.append(static_cast<char>(name - 13));
+        option.append(value);
+        return frame(request, 0x45, block, option, resource.mid(block * blockSize, blockSize));
+    }
+
+    static QByteArray frame(const QCoapMessage &request, quint8 code, uint block,
+                            const QByteArray &options, const QByteArray &payload)
+    {
+        // Piggybacked ACK for confirmable requests, NON otherwise
+        const bool confirmable = request.type() == QCoapMessage::Type::Confirmable;
+        const quint16 messageId = confirmable ? request.messageId()
+                                              : static_cast<quint16>(0x1000 + block);
+
+        QByteArray frame;
+        frame.append(static_cast<char>((confirmable ? 0x60 : 0x50) | request.tokenLength()));
+        frame.append(static_cast<char>(code));
+        frame.append(static_cast<char>(messageId >> 8));
+        frame.append(static_cast<char>(messageId & 0xFF));
+        frame.append(request.token());
+        frame.append(options);
+        if (!payload.isEmpty()) {
+            frame.append(static_cast<char>(0xFF));
+            frame.append(payload);
+        }
+        return frame;
+    }
+
+    const QByteArray resource;
+    const uint blockSize;
+    const uint maximumPayloads;
+    const bool supportsQBlock;
+
+    QMutex mutex;
+    QSet<uint> blocksToDrop;
+    QList<uint> sentBlocks;
+};
+
+class QCoapConnectionObserveServerTests : public QCoapConnection
+{
+public:
+    explicit QCoapConnectionObserveServerTests(const QList<quint32> &sequenceNumbers = {})
+        : sequenceNumbers(sequenceNumbers)
+    {}
+
+    int registrations()
+    {
+        QMutexLocker locker(&mutex);
+        return registrationCount;
+    }
+
+    int resets()
+    {
+        QMutexLocker locker(&mutex);
+        return resetCount;
+    }
+
+    QList<QCoapToken> registrationTokens()
+    {
+        QMutexLocker locker(&mutex);
+        return tokens;
+    }
+
+    QList<QCoapToken> deregistrationTokens()
+    {
+        QMutexLocker locker(&mutex);
+        return deregisteredTokens;
+    }
+
+    void setMaxAge(quint32 seconds)
+    {
+        QMutexLocker locker(&mutex);
+        maxAge = seconds;
+    }
+
+    void setSilent(bool silent)
+    {
+        QMutexLocker locker(&mutex);
+        isSilent = silent;
+    }
+
+    // Notifies the last registration, or the observation identified by token
+    void notify(quint32 sequenceNumber, const QCoapToken &token = QCoapToken())
+    {
+        QMetaObject::invokeMethod(this, [this, sequenceNumber, token]() {
+            QByteArray frame;
+            {
+                QMutexLocker locker(&mutex);
+                QCoapMessage observation = registration;
+                if (!token.isEmpty())
+                    observation.setToken(token);
+                frame = notification(observation, sequenceNumber);
+            }
+            emit readyRead(frame, QHostAddress(QHostAddress::LocalHost));
+        }, Qt::QueuedConnection);
+    }
+
+    void bind(const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+        emit bound();
+    }
+
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+
+        QScopedPointer<QCoapInternalReply> request(QCoapInternalReply::createFromFrame(data));
+        const QCoapMessage message = *request->message();
+        if (message.type() == QCoapMessage::Type::Reset) {
+            QMutexLocker locker(&mutex);
+            ++resetCount;
+            return;
+        }
+        if (!message.hasOption(QCoapOption::Observe))
+            return;
+
+        QMutexLocker locker(&mutex);
+        if (message.option(QCoapOption::Observe).uintValue() == 1) {
+            deregisteredTokens.append(message.token());
+            return;
+        }
+
+        ++registrationCount;
+        tokens.append(message.token());
+        registration = message;
+        if (isSilent)
+            return;
+
+        // Send all the notifications at once, in the given order
+        QList<QByteArray> notifications;
+        for (quint32 sequenceNumber : sequenceNumbers)
+            notifications.append(notification(message, sequenceNumber));
+
+        QMetaObject::invokeMethod(this, [this, notifications]() {
+            for (const QByteArray &frame : notifications)
+                emit readyRead(frame, QHostAddress(QHostAddress::LocalHost));
+        }, Qt::QueuedConnection);
+    }
+
+    void close() override {}
+
+private:
+    QByteArray notification(const QCoapMessage &request, quint32 sequenceNumber)
+    {
+        const QByteArray value = QCoapOption(QCoapOption::Observe, sequenceNumber).opaqueValue();
+        const quint16 messageId = ++lastMessageId;
+
+        // Non-confirmable 2.05 Content notification
+        QByteArray frame;
+        frame.append(static_cast<char>(0x50 | request.tokenLength()));
+        frame.append(static_cast<char>(0x45));
+        frame.append(static_cast<char>(messageId >> 8));
+        frame.append(static_cast<char>(messageId & 0xFF));
+        frame.append(request.token());
+        frame.append(static_cast<char>((QCoapOption::Observe << 4) | value.size()));
+        frame.append(value);
+        if (maxAge > 0) {
+            const QByteArray maxAgeValue = QCoapOption(QCoapOption::MaxAge, maxAge).opaqueValue();
+            frame.append(static_cast<char>(((QCoapOption::MaxAge - QCoapOption::Observe) << 4)
+                                           | maxAgeValue.size()));
+            frame.append(maxAgeValue);
+        }
+        frame.append(static_cast<char>(0xFF));
+        frame.append(QByteArray::number(sequenceNumber));
+        return frame;
+    }
+
+    const QList<quint32> sequenceNumbers;
+
+    QMutex mutex;
+    QCoapMessage registration;
+    QList<QCoapToken> tokens;
+    QList<QCoapToken> deregisteredTokens;
+    int registrationCount = 0;
+    int resetCount = 0;
+    quint32 maxAge = 0;
+    bool isSilent = false;
+    quint16 lastMessageId = 0;
+};
+
+class QCoapConnectionUploadServerTests : public QCoapConnection
+{
+public:
+    // Request-Tag of each block received, per token of the uploads
+    QHash<QCoapToken, QList<QByteArray>> requestTags()
+    {
+        QMutexLocker locker(&mutex);
+        return tags;
+    }
+
+    QHash<QCoapToken, QByteArray> payloads()
+    {
+        QMutexLocker locker(&mutex);
+        return uploads;
+    }
+
+    void bind(const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+        emit bound();
+    }
+
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+
+        QScopedPointer<QCoapInternalReply> request(QCoapInternalReply::createFromFrame(data));
+        const QCoapMessage message = *request->message();
+        if (message.type() != QCoapMessage::Type::Confirmable
+                || !message.hasOption(QCoapOption::Block1)) {
+            return;
+        }
+
+        const QCoapOption block1 = message.option(QCoapOption::Block1);
+        const bool moreBlocks = block1.uintValue() & 0x8;
+        {
+            QMutexLocker locker(&mutex);
+            tags[message.token()].append(message.option(QCoapOption::RequestTag).opaqueValue());
+            uploads[message.token()].append(message.payload());
+        }
+
+        // Piggybacked 2.31 Continue, or 2.04 Changed for the last block,
+        // echoing the Block1 option (option 27)
+        QByteArray frame;
+        frame.append(static_cast<char>(0x60 | message.tokenLength()));
+        frame.append(static_cast<char>(moreBlocks ? 0x5F : 0x44));
+        frame.append(static_cast<char>(message.messageId() >> 8));
+        frame.append(static_cast<char>(message.messageId() & 0xFF));
+        frame.append(message.token());
+        frame.append(static_cast<char>(0xD0 | block1.length()));
+        frame.append(static_cast<char>(QCoapOption::Block1 - 13));
+        frame.append(block1.opaqueValue());
+
+        // Reply from the main thread
+        QMetaObject::invokeMethod(this, [this, frame]() {
+            emit readyRead(frame, QHostAddress(QHostAddress::LocalHost));
+        }, Qt::QueuedConnection);
+    }
+
+    void close() override {}
+
+private:
+    QMutex mutex;
+    QHash<QCoapToken, QList<QByteArray>> tags;
+    QHash<QCoapToken, QByteArray> uploads;
+};
+
+/*
+    Accepts the TCP connections of the client, announces a Max-Message-Size
+    of 8 KiB and the support of BERT blocks in its CSM, and answers each
+    block of an upload, recording their Block1 options.
+*/
+class QCoapTcpBertServerTests : public QObject
+{
+public:
+    QCoapTcpBertServerTests()
+    {
+        connect(&server, &QTcpServer::newConnection, this, [this]() {
+            while (QTcpSocket *socket = server.nextPendingConnection()) {
+                socket->write(QByteArray::fromHex("40e122200020"));
+                connect(socket, &QTcpSocket::readyRead, this,
+                        [this, socket]() { onReadyRead(socket); });
+            }
+        });
+    }
+
+    bool listen() { return server.listen(QHostAddress::LocalHost); }
+    quint16 port() const { return server.serverPort(); }
+
+    QList<QCoapOption> blockOptions;
+    QByteArray payload;
+
+private:
+    void onReadyRead(QTcpSocket *socket)
+    {
+        buffer.append(socket->readAll());
+        for (;;) {
+            const qint64 length = QCoapTcpConnectionPrivate::messageLength(buffer);
+            if (length < 0 || buffer.size() < length)
+                return;
+
+            const QByteArray frame = QCoapTcpConnectionPrivate::fromTcpMessage(
+                        QByteArrayView(buffer).first(length), 0);
+            buffer.remove(0, length);
+            // Skip the signaling messages, such as the CSM of the client
+            if ((static_cast<quint8>(frame.at(1)) >> 5) == 7)
+                continue;
+
+            QScopedPointer<QCoapInternalReply> request(QCoapInternalReply::createFromFrame(frame));
+            const QCoapMessage message = *request->message();
+            const QCoapOption block1 = message.option(QCoapOption::Block1);
+            const bool moreBlocks = block1.uintValue() & 0x8;
+            blockOptions.append(block1);
+            payload.append(message.payload());
+
+            // 2.31 Continue, or 2.04 Changed for the last block, echoing the
+            // Block1 option (option 27)
+            QByteArray response;
+            response.append(static_cast<char>(0x50 | message.tokenLength()));
+            response.append(static_cast<char>(moreBlocks ? 0x5F : 0x44));
+            response.append(2, '\0');
+            response.append(message.token());
+            response.append(static_cast<char>(0xD0 | block1.length()));
+            response.append(static_cast<char>(QCoapOption::Block1 - 13));
+            response.append(block1.opaqueValue());
+            socket->write(QCoapTcpConnectionPrivate::toTcpMessage(response));
+        }
+    }
+
+    QTcpServer server;
+    QByteArray buffer;
+};
+
+class QCoapClientForCustomConnectionTests : public QCoapClient
+{
+public:
+    explicit QCoapClientForCustomConnectionTests(QCoapConnection *connection)
+    {
+        QCoapClientPrivate *privateClient = static_cast<QCoapClientPrivate *>(d_func());
+        privateClient->setConnection(connection);
+    }
+};
+
 #endif
 
 class Helper : public QObject
@@ -830,6 +1427,50 @@ void tst_QCoapClient::blockwiseRequest()
     QCOMPARE(reply->responseCode(), responseCode);
 }
 
+void tst_QCoapClient::concurrentBlockwiseRequests()
+{
+#ifdef QT_BUILD_INTERNAL
+    const uint blockSize = 64;
+    const QByteArray firstPayload(1000, 'a');
+    const QByteArray secondPayload(1000, 'b');
+    const int blockCount = (firstPayload.size() + blockSize - 1) / blockSize;
+
+    auto connection = new QCoapConnectionUploadServerTests;
+    QCoapClientForCustomConnectionTests client(connection);
+    client.setBlockSize(blockSize);
+
+    // Two uploads to the same resource at the same time
+    const QCoapRequest request("coap://127.0.0.1/upload", QCoapMessage::Type::Confirmable);
+    QScopedPointer<QCoapReply> firstReply(client.put(request, firstPayload));
+    QScopedPointer<QCoapReply> secondReply(client.put(request, secondPayload));
+    QVERIFY(firstReply);
+    QVERIFY(secondReply);
+
+    QTRY_VERIFY(firstReply->isFinished() && secondReply->isFinished());
+    QCOMPARE(firstReply->responseCode(), QtCoap::ResponseCode::Changed);
+    QCOMPARE(secondReply->responseCode(), QtCoap::ResponseCode::Changed);
+
+    const auto payloads = connection->payloads();
+    QCOMPARE(payloads.size(), 2);
+    QCOMPARE(payloads.value(firstReply->request().token()), firstPayload);
+    QCOMPARE(payloads.value(secondReply->request().token()), secondPayload);
+
+    // Each upload repeats its own tag on all its blocks
+    const auto tags = connection->requestTags();
+    const auto firstTags = tags.value(firstReply->request().token());
+    const auto secondTags = tags.value(secondReply->request().token());
+    QCOMPARE(firstTags.size(), blockCount);
+    QCOMPARE(secondTags.size(), blockCount);
+    QVERIFY(!firstTags.first().isEmpty());
+    QVERIFY(!secondTags.first().isEmpty());
+    QCOMPARE(firstTags.count(firstTags.first()), blockCount);
+    QCOMPARE(secondTags.count(secondTags.first()), blockCount);
+    QVERIFY(firstTags.first() != secondTags.first());
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
 void tst_QCoapClient::discover_data()
 {
     QTest::addColumn<QUrl>("url");
@@ -1054,6 +1695,65 @@ void tst_QCoapClient::multicast_blockwise()
 #endif
 }
 
+void tst_QCoapClient::busyConnection()
+{
+#ifdef QT_BUILD_INTERNAL
+    // The connection never binds, so the frames wait in its queue
+    QCoapClientForMulticastTests client;
+    client.setAckTimeout(60 * 1000);
+    const QCoapRequest request(QUrl("coap://10.20.30.40/test"),
+                               QCoapMessage::Type::NonConfirmable);
+
+    QList<QSharedPointer<QCoapReply>> queued;
+    for (qsizetype i = 0; i < CoapFrameQueue::Capacity; ++i)
+        queued.append(QSharedPointer<QCoapReply>(client.get(request)));
+
+    // The request rejected by the full queue fails with an error of its own
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("Too many frames waiting"));
+    QScopedPointer<QCoapReply> rejected(client.get(request));
+    QVERIFY(rejected);
+    QSignalSpy spyRejectedError(rejected.data(), &QCoapReply::error);
+
+    QTRY_COMPARE(spyRejectedError.size(), 1);
+    QCOMPARE(spyRejectedError.first().at(1).value<QtCoap::Error>(), QtCoap::Error::Busy);
+    QVERIFY(rejected->isFinished());
+    for (const auto &reply : std::as_const(queued))
+        QVERIFY(!reply->isFinished());
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::bertOverTcp()
+{
+#ifdef QT_BUILD_INTERNAL
+    QCoapTcpBertServerTests server;
+    QVERIFY(server.listen());
+
+    QByteArray payload;
+    for (int i = 0; i < 20000; ++i)
+        payload.append(static_cast<char>('a' + i % 26));
+
+    QCoapClient client(QtCoap::Transport::Tcp);
+    const QUrl url(QStringLiteral("coap://127.0.0.1:%1/upload").arg(server.port()));
+    QScopedPointer<QCoapReply> reply(client.post(QCoapRequest(url), payload));
+    QVERIFY(reply);
+
+    QTRY_VERIFY(reply->isFinished());
+    QCOMPARE(reply->errorReceived(), QtCoap::Error::Ok);
+    QCOMPARE(reply->responseCode(), QtCoap::ResponseCode::Changed);
+    QCOMPARE(server.payload, payload);
+
+    // The first exchange with the server already uses the BERT blocks allowed
+    // by its CSM, 7 KiB long
+    QCOMPARE(server.blockOptions.size(), 3);
+    for (const auto &option : std::as_const(server.blockOptions))
+        QCOMPARE(option.uintValue() & 0x7, 7u);
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
 void tst_QCoapClient::setMinimumTokenSize_data()
 {
     QTest::addColumn<int>("minTokenSize");
@@ -1097,6 +1797,686 @@ void tst_QCoapClient::setMinimumTokenSize()
 #endif
 }
 
+void tst_QCoapClient::blockWindow_data()
+{
+    QTest::addColumn<QCoapMessage::Type>("type");
+    QTest::addColumn<uint>("windowSize");
+    QTest::addColumn<uint>("maximumConcurrentRequests");
+    QTest::addColumn<int>("lostBlock");
+    QTest::addColumn<int>("transfers");
+
+    QTest::newRow("sequential") << QCoapMessage::Type::Confirmable << 1u << 4u << -1 << 1;
+    QTest::newRow("window_non_confirmable")
+            << QCoapMessage::Type::NonConfirmable << 4u << 4u << 5 << 1;
+    QTest::newRow("window_confirmable") << QCoapMessage::Type::Confirmable << 4u << 4u << 5 << 1;
+    QTest::newRow("window_limited_by_nstart")
+            << QCoapMessage::Type::Confirmable << 8u << 2u << -1 << 1;
+    QTest::newRow("windows_share_nstart")
+            << QCoapMessage::Type::Confirmable << 4u << 2u << -1 << 2;
+}
+
+void tst_QCoapClient::blockWindow()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(QCoapMessage::Type, type);
+    QFETCH(uint, windowSize);
+    QFETCH(uint, maximumConcurrentRequests);
+    QFETCH(int, lostBlock);
+    QFETCH(int, transfers);
+
+    const uint blockSize = 64;
+    QByteArray resource;
+    for (int i = 0; i < 1000; ++i)
+        resource.append(static_cast<char>('a' + i % 26));
+    const uint blockCount = (static_cast<uint>(resource.size()) + blockSize - 1) / blockSize;
+
+    auto connection = new QCoapConnectionBlockServerTests(resource, blockSize);
+    if (lostBlock >= 0)
+        connection->dropBlockOnce(static_cast<uint>(lostBlock));
+
+    QCoapClientForCustomConnectionTests client(connection);
+    client.setAckTimeout(100);
+    client.setAckRandomFactor(1);
+    client.setBlockWindowSize(windowSize);
+    client.setMaximumConcurrentRequests(maximumConcurrentRequests);
+
+    QList<QSharedPointer<QCoapReply>> replies;
+    for (int i = 0; i < transfers; ++i) {
+        replies.append(QSharedPointer<QCoapReply>(
+                client.get(QCoapRequest("coap://127.0.0.1/large", type))));
+        QVERIFY(replies.last());
+    }
+
+    for (const auto &reply : std::as_const(replies)) {
+        QTRY_VERIFY(reply->isFinished());
+        QVERIFY(reply->isSuccessful());
+        QCOMPARE(reply->readAll(), resource);
+    }
+
+    // Each block is requested once, only the lost block is retransmitted
+    const auto requested = connection->blocksRequested();
+    QCOMPARE(static_cast<uint>(requested.size()),
+             blockCount * transfers + (lostBlock >= 0 ? 1 : 0));
+    for (uint block = 0; block < blockCount; ++block) {
+        QCOMPARE(static_cast<int>(requested.count(block)),
+                 transfers + (static_cast<int>(block) == lostBlock ? 1 : 0));
+    }
+
+    // The windows opened with the same server share NSTART with the other
+    // exchanges, only the first requests of the transfers are not held back
+    const uint expectedInFlight = qMin(windowSize, maximumConcurrentRequests);
+    QVERIFY(connection->maximumInFlight() <= qMax(expectedInFlight, uint(transfers)));
+    if (expectedInFlight > 1)
+        QVERIFY(connection->maximumInFlight() > 1);
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::qBlockTransfer_data()
+{
+    QTest::addColumn<bool>("serverSupportsQBlock");
+    QTest::addColumn<int>("lostBlock");
+
+    QTest::newRow("q_block2") << true << -1;
+    QTest::newRow("q_block2_lost_block") << true << 5;
+    QTest::newRow("fallback_to_block2") << false << -1;
+}
+
+void tst_QCoapClient::qBlockTransfer()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(bool, serverSupportsQBlock);
+    QFETCH(int, lostBlock);
+
+    const uint blockSize = 64;
+    const uint maximumPayloads = 4;
+    QByteArray resource;
+    for (int i = 0; i < 1000; ++i)
+        resource.append(static_cast<char>('a' + i % 26));
+    const uint blockCount = (static_cast<uint>(resource.size()) + blockSize - 1) / blockSize;
+
+    auto connection = new QCoapConnectionQBlockServerTests(resource, blockSize, maximumPayloads,
+                                                           serverSupportsQBlock);
+    if (lostBlock >= 0)
+        connection->dropBlockOnce(static_cast<uint>(lostBlock));
+
+    QCoapClientForCustomConnectionTests client(connection);
+    client.setAckTimeout(50);
+    client.setAckRandomFactor(1);
+    client.setBlockSize(blockSize);
+    client.setQBlockEnabled(true);
+    client.setMaximumPayloads(maximumPayloads);
+
+    QScopedPointer<QCoapReply> reply(client.get(QCoapRequest("coap://127.0.0.1/large",
+                                                             QCoapMessage::Type::Confirmable)));
+    QVERIFY(reply);
+
+    QSignalSpy spyReplyFinished(reply.data(), &QCoapReply::finished);
+    QTRY_COMPARE(spyReplyFinished.size(), 1);
+    QVERIFY(reply->isSuccessful());
+    QCOMPARE(reply->readAll(), resource);
+
+    // Only the lost block is sent twice
+    const auto sent = connection->blocksSent();
+    if (serverSupportsQBlock) {
+        QCOMPARE(static_cast<uint>(sent.size()), blockCount + (lostBlock >= 0 ? 1 : 0));
+        for (uint block = 0; block < blockCount; ++block) {
+            QCOMPARE(static_cast<int>(sent.count(block)),
+                     static_cast<int>(block) == lostBlock ? 2 : 1);
+        }
+    } else {
+        QVERIFY(sent.isEmpty());
+    }
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::resumableDownload_data()
+{
+    QTest::addColumn<QByteArray>("firstEtag");
+    QTest::addColumn<QByteArray>("secondEtag");
+    QTest::addColumn<uint>("firstRequestedBlock");
+    QTest::addColumn<bool>("restarted");
+    QTest::addColumn<int>("maxAge");
+    QTest::addColumn<int>("interruptedBlock");
+
+    // The resource is made of 16 blocks
+    QTest::newRow("same_etag")
+            << QByteArray("v1") << QByteArray("v1") << 5u << false << -1 << 5;
+    QTest::newRow("changed_etag")
+            << QByteArray("v1") << QByteArray("v2") << 5u << true << -1 << 5;
+    QTest::newRow("no_etag") << QByteArray() << QByteArray() << 0u << true << -1 << 5;
+    // The blocks are discarded when their Max-Age expires
+    QTest::newRow("fresh") << QByteArray("v1") << QByteArray("v1") << 5u << false << 60 << 5;
+    QTest::newRow("expired") << QByteArray("v1") << QByteArray("v1") << 0u << true << 0 << 5;
+    QTest::newRow("one_block_left")
+            << QByteArray("v1") << QByteArray("v1") << 15u << false << -1 << 15;
+    QTest::newRow("several_blocks_left")
+            << QByteArray("v1") << QByteArray("v1") << 2u << false << -1 << 2;
+}
+
+void tst_QCoapClient::resumableDownload()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(QByteArray, firstEtag);
+    QFETCH(QByteArray, secondEtag);
+    QFETCH(uint, firstRequestedBlock);
+    QFETCH(bool, restarted);
+    QFETCH(int, maxAge);
+    QFETCH(int, interruptedBlock);
+
+    const uint blockSize = 64;
+    QByteArray resource;
+    for (int i = 0; i < 1000; ++i)
+        resource.append(static_cast<char>('a' + i % 26));
+
+    auto connection = new QCoapConnectionBlockServerTests(resource, blockSize);
+    connection->setEtag(firstEtag);
+    connection->setMaxAge(maxAge);
+    connection->setUnreachableFromBlock(interruptedBlock);
+
+    QCoapClientForCustomConnectionTests client(connection);
+    client.setAckTimeout(50);
+    client.setAckRandomFactor(1);
+    client.setMaximumRetransmitCount(1);
+    client.setBlockSize(blockSize);
+    client.setResumableDownloadEnabled(true);
+
+    const QCoapRequest request("coap://127.0.0.1/large", QCoapMessage::Type::Confirmable);
+    QScopedPointer<QCoapReply> reply(client.get(request));
+    QSignalSpy spyReplyFinished(reply.data(), &QCoapReply::finished);
+    QTRY_COMPARE(spyReplyFinished.size(), 1);
+    QCOMPARE(reply->errorReceived(), QtCoap::Error::TimeOut);
+
+    // The server is reachable again, and may have changed the resource
+    connection->setUnreachableFromBlock(-1);
+    connection->setEtag(secondEtag);
+    connection->clearBlocksRequested();
+
+    reply.reset(client.get(request));
+    QSignalSpy spyResumedFinished(reply.data(), &QCoapReply::finished);
+    QTRY_COMPARE(spyResumedFinished.size(), 1);
+    QVERIFY(reply->isSuccessful());
+    QCOMPARE(reply->readAll(), resource);
+
+    const auto requested = connection->blocksRequested();
+    QVERIFY(!requested.isEmpty());
+    QCOMPARE(requested.first(), firstRequestedBlock);
+    QCOMPARE(requested.contains(0u), restarted);
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::adaptiveBlockSize()
+{
+#ifdef QT_BUILD_INTERNAL
+    QByteArray resource;
+    for (int i = 0; i < 1000; ++i)
+        resource.append(static_cast<char>('a' + i % 26));
+
+    // The server only supports blocks of 64 bytes, and two blocks are lost
+    auto connection = new QCoapConnectionBlockServerTests(resource, 64);
+    connection->dropBlockOnce(3);
+    connection->dropBlockOnce(4);
+
+    QCoapClientForCustomConnectionTests client(connection);
+    client.setAckTimeout(50);
+    client.setAckRandomFactor(1);
+    client.setBlockSize(256);
+
+    QSignalSpy spyBlockSizeChanged(&client, &QCoapClient::endpointBlockSizeChanged);
+    QScopedPointer<QCoapReply> reply(client.get(QCoapRequest("coap://127.0.0.1/large",
+                                                             QCoapMessage::Type::Confirmable)));
+    QSignalSpy spyReplyFinished(reply.data(), &QCoapReply::finished);
+    QTRY_COMPARE(spyReplyFinished.size(), 1);
+    QVERIFY(reply->isSuccessful());
+    QCOMPARE(reply->readAll(), resource);
+
+    // Late negotiation by the server, then shrinking after two losses,
+    // then growing again up to the size negotiated with the server.
+    QList<quint16> blockSizes;
+    for (const auto &arguments : std::as_const(spyBlockSizeChanged)) {
+        QCOMPARE(arguments.at(0).toUrl(), QUrl("coap://127.0.0.1:5683"));
+        blockSizes.append(arguments.at(1).value<quint16>());
+    }
+    QCOMPARE(blockSizes, QList<quint16>({ 64, 32, 64 }));
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::blockSizeChangedMidTransfer_data()
+{
+    QTest::addColumn<int>("resourceSize");
+    QTest::addColumn<QList<uint>>("lostBlocks");
+
+    QTest::newRow("early") << 1000 << QList<uint>({ 1, 2 });
+    QTest::newRow("late") << 4000 << QList<uint>({ 20, 21 });
+}
+
+void tst_QCoapClient::blockSizeChangedMidTransfer()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, resourceSize);
+    QFETCH(QList<uint>, lostBlocks);
+
+    QByteArray resource;
+    for (int i = 0; i < resourceSize; ++i)
+        resource.append(static_cast<char>('a' + i % 26));
+
+    auto connection = new QCoapConnectionBlockServerTests(resource, 64);
+    for (uint block : std::as_const(lostBlocks))
+        connection->dropBlockOnce(block);
+
+    QCoapClientForCustomConnectionTests client(connection);
+    client.setAckTimeout(50);
+    client.setAckRandomFactor(1);
+    client.setBlockSize(64);
+
+    QSignalSpy spyBlockSizeChanged(&client, &QCoapClient::endpointBlockSizeChanged);
+    QScopedPointer<QCoapReply> reply(client.get(QCoapRequest("coap://127.0.0.1/large",
+                                                             QCoapMessage::Type::Confirmable)));
+    QSignalSpy spyReplyFinished(reply.data(), &QCoapReply::finished);
+    QTRY_COMPARE(spyReplyFinished.size(), 1);
+    QVERIFY(reply->isSuccessful());
+
+    // The blocks shrink to 32 bytes after the losses, then grow back to 64
+    // bytes, so the block numbers go backwards in the middle of the transfer
+    QList<quint16> blockSizes;
+    for (const auto &arguments : std::as_const(spyBlockSizeChanged))
+        blockSizes.append(arguments.at(1).value<quint16>());
+    QVERIFY(blockSizes.contains(32));
+    QCOMPARE(blockSizes.last(), 64);
+    const auto requested = connection->blocksRequested();
+    QVERIFY(!std::is_sorted(requested.cbegin(), requested.cend()));
+
+    QCOMPARE(reply->readAll(), resource);
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::observeReordering()
+{
+#ifdef QT_BUILD_INTERNAL
+    // The third notification is overtaken by the fourth one
+    auto connection = new QCoapConnectionObserveServerTests({ 1, 3, 2, 4 });
+    QCoapClientForCustomConnectionTests client(connection);
+
+    QScopedPointer<QCoapReply> reply(client.observe(QUrl("coap://127.0.0.1/temperature")));
+    QVERIFY(reply);
+    QSignalSpy spyNotified(reply.data(), &QCoapReply::notified);
+    QTRY_COMPARE(spyNotified.size(), 3);
+    QTRY_COMPARE(reply->staleNotificationCount(), 1u);
+
+    QList<QByteArray> payloads;
+    for (const auto &arguments : std::as_const(spyNotified))
+        payloads.append(arguments.at(1).value<QCoapMessage>().payload());
+    QCOMPARE(payloads, QList<QByteArray>({ "1", "3", "4" }));
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::observeMultiplexing()
+{
+#ifdef QT_BUILD_INTERNAL
+    auto connection = new QCoapConnectionObserveServerTests;
+    QCoapClientForCustomConnectionTests client(connection);
+
+    const QUrl url("coap://127.0.0.1/temperature");
+    QScopedPointer<QCoapReply> firstReply(client.observe(url));
+    QScopedPointer<QCoapReply> secondReply(client.observe(url));
+    QVERIFY(firstReply);
+    QVERIFY(secondReply);
+    QSignalSpy spyFirstNotified(firstReply.data(), &QCoapReply::notified);
+    QSignalSpy spySecondNotified(secondReply.data(), &QCoapReply::notified);
+
+    // A single registration is sent to the server, and shared by both replies
+    QTRY_VERIFY(firstReply->isRunning() && secondReply->isRunning());
+    QCOMPARE(connection->registrations(), 1);
+    QCOMPARE(secondReply->request().token(), firstReply->request().token());
+
+    connection->notify(1);
+    QTRY_COMPARE(spyFirstNotified.size(), 1);
+    QTRY_COMPARE(spySecondNotified.size(), 1);
+
+    // The registration is kept while a subscriber remains
+    client.cancelObserve(firstReply.data());
+    QTRY_VERIFY(firstReply->isFinished());
+    connection->notify(2);
+    QTRY_COMPARE(spySecondNotified.size(), 2);
+    QCOMPARE(spyFirstNotified.size(), 1);
+    QCOMPARE(connection->resets(), 0);
+    QVERIFY(connection->deregistrationTokens().isEmpty());
+
+    client.cancelObserve(secondReply.data());
+    QTRY_VERIFY(secondReply->isFinished());
+    QCOMPARE(connection->deregistrationTokens(),
+             QList<QCoapToken>({ secondReply->request().token() }));
+    connection->notify(3);
+    QTRY_COMPARE(connection->resets(), 1);
+    QCOMPARE(spySecondNotified.size(), 2);
+    QCOMPARE(connection->registrations(), 1);
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::notificationInterval()
+{
+#ifdef QT_BUILD_INTERNAL
+    auto connection = new QCoapConnectionObserveServerTests;
+    QCoapClientForCustomConnectionTests client(connection);
+
+    QScopedPointer<QCoapReply> reply(client.observe(QUrl("coap://127.0.0.1/acceleration")));
+    QVERIFY(reply);
+    QSignalSpy spyNotified(reply.data(), &QCoapReply::notified);
+    QTRY_VERIFY(reply->isRunning());
+    client.setNotificationInterval(reply.data(), 1000);
+
+    // Only the first and the most recent notifications are delivered
+    for (quint32 sequenceNumber : { 1, 2, 3, 4 })
+        connection->notify(sequenceNumber);
+
+    QTRY_COMPARE(spyNotified.size(), 1);
+    QTRY_COMPARE(reply->conflatedNotificationCount(), 2u);
+    QCOMPARE(spyNotified.size(), 1);
+    QTRY_COMPARE(spyNotified.size(), 2);
+
+    QList<QByteArray> payloads;
+    for (const auto &arguments : std::as_const(spyNotified))
+        payloads.append(arguments.at(1).value<QCoapMessage>().payload());
+    QCOMPARE(payloads, QList<QByteArray>({ "1", "4" }));
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::observeReregistration()
+{
+#ifdef QT_BUILD_INTERNAL
+    auto connection = new QCoapConnectionObserveServerTests({ 1 });
+    connection->setMaxAge(1);
+    QCoapClientForCustomConnectionTests client(connection);
+    client.setAckTimeout(100);
+
+    QScopedPointer<QCoapReply> reply(client.observe(QUrl("coap://127.0.0.1/temperature")));
+    QVERIFY(reply);
+    QSignalSpy spyNotified(reply.data(), &QCoapReply::notified);
+    QSignalSpy spyStale(reply.data(), &QCoapReply::observationStale);
+    QSignalSpy spyRecovered(reply.data(), &QCoapReply::observationRecovered);
+    QTRY_COMPARE(spyNotified.size(), 1);
+
+    // The server goes quiet, the observation is registered again once
+    // the Max-Age of the last notification expired
+    connection->setSilent(true);
+    QTRY_COMPARE_WITH_TIMEOUT(spyStale.size(), 1, 10000);
+    QTRY_VERIFY(connection->registrations() >= 3);
+    QCOMPARE(spyRecovered.size(), 0);
+
+    connection->setSilent(false);
+    QTRY_COMPARE(spyRecovered.size(), 1);
+    QCOMPARE(spyNotified.size(), 2);
+    QCOMPARE(spyStale.size(), 1);
+
+    const auto tokens = connection->registrationTokens();
+    QVERIFY(tokens.size() >= 4);
+    for (const auto &token : tokens)
+        QCOMPARE(token, reply->request().token());
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::observeGroup()
+{
+#ifdef QT_BUILD_INTERNAL
+    auto connection = new QCoapConnectionObserveServerTests({ 1 });
+    QCoapClientForCustomConnectionTests client(connection);
+
+    QList<QCoapRequest> requests;
+    for (int i = 0; i < 20; ++i)
+        requests.append(QCoapRequest(QUrl(QString("coap://127.0.0.1/sensor/%1").arg(i))));
+    requests.append(QCoapRequest(QUrl("http://127.0.0.1/sensor")));
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QScopedPointer<QCoapObserveGroup> group(client.observe(requests, 100));
+    QSignalSpy spyFinished(group.data(), &QCoapObserveGroup::finished);
+    QSignalSpy spyFailed(group.data(), &QCoapObserveGroup::registrationFailed);
+
+    QTRY_COMPARE(spyFinished.size(), 1);
+    QCOMPARE(group->size(), qsizetype(21));
+    QCOMPARE(group->registeredCount(), qsizetype(20));
+    QCOMPARE(group->failedCount(), qsizetype(1));
+    QCOMPARE(group->pendingCount(), qsizetype(0));
+    QCOMPARE(group->replies().size(), qsizetype(20));
+    QCOMPARE(connection->registrations(), 20);
+    QCOMPARE(spyFailed.size(), 1);
+    QCOMPARE(spyFailed.first().at(0).value<QCoapRequest>().url(), QUrl("http://127.0.0.1/sensor"));
+
+    // The registrations are spread over time, at 100 per second on average,
+    // with intervals between 5 and 15 ms
+    QVERIFY(elapsed.elapsed() >= 19 * 5);
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::observeCompact()
+{
+#ifdef QT_BUILD_INTERNAL
+    // The third notification is overtaken by the fourth one
+    auto connection = new QCoapConnectionObserveServerTests({ 1, 3, 2, 4 });
+    QCoapClientForCustomConnectionTests client(connection);
+    QSignalSpy spyNotified(&client, &QCoapClient::compactNotified);
+
+    const quint64 observation = client.observeCompact(QUrl("coap://127.0.0.1/temperature"));
+    QVERIFY(observation > 0);
+    QCOMPARE(client.observeCompact(QUrl("http://127.0.0.1/temperature")), quint64(0));
+
+    QTRY_COMPARE(spyNotified.size(), 3);
+    QList<QByteArray> payloads;
+    for (const auto &arguments : std::as_const(spyNotified)) {
+        QCOMPARE(arguments.at(0).value<quint64>(), observation);
+        payloads.append(arguments.at(1).value<QCoapMessage>().payload());
+    }
+    QCOMPARE(payloads, QList<QByteArray>({ "1", "3", "4" }));
+
+    // The observation is deregistered, and the next notification rejected
+    client.cancelCompactObserve(observation);
+    QTRY_COMPARE(connection->deregistrationTokens(), connection->registrationTokens());
+    connection->notify(5);
+    QTRY_COMPARE(connection->resets(), 1);
+    QCOMPARE(spyNotified.size(), 3);
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::observeCompactFreshness()
+{
+#ifdef QT_BUILD_INTERNAL
+    // Two compact observations at sequence number 100, the last notification
+    // of the first one is older than 128 seconds
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const QCoapToken staleToken("stale");
+    const QCoapToken freshToken("fresh");
+    CoapSavedObservation stale;
+    stale.compactId = 1;
+    stale.host = QStringLiteral("127.0.0.1");
+    stale.port = 5683;
+    stale.registration = QByteArray::fromHex("45010001") + staleToken;
+    stale.sequenceNumber = 100;
+    stale.hasNotification = true;
+    stale.freshUntil = now - 1000;
+    stale.expiry = now + 60 * 1000;
+    CoapSavedObservation fresh = stale;
+    fresh.compactId = 2;
+    fresh.registration = QByteArray::fromHex("45010002") + freshToken;
+    fresh.freshUntil = now + 60 * 1000;
+
+    auto connection = new QCoapConnectionObserveServerTests;
+    QCoapClientForCustomConnectionTests client(connection);
+    QSignalSpy spyNotified(&client, &QCoapClient::compactNotified);
+    QVERIFY(client.restoreObservations(
+                    QCoapProtocolPrivate::writeObservations({ stale, fresh })).isEmpty());
+
+    // After a restart of the server, only the observation whose last
+    // notification is no longer fresh accepts the lower sequence numbers
+    connection->notify(3, staleToken);
+    connection->notify(3, freshToken);
+    QTRY_COMPARE(spyNotified.size(), 1);
+    QTest::qWait(100);
+    QCOMPARE(spyNotified.size(), 1);
+    QCOMPARE(spyNotified.first().at(0).value<quint64>(), stale.compactId);
+
+    // The accepted notification is fresh again
+    connection->notify(2, staleToken);
+    connection->notify(4, staleToken);
+    QTRY_COMPARE(spyNotified.size(), 2);
+    QCOMPARE(spyNotified.last().at(1).value<QCoapMessage>().payload(), QByteArray("4"));
+
+    // The freshness of the compact observations is saved in the snapshots
+    QList<CoapSavedObservation> saved;
+    QVERIFY(QCoapProtocolPrivate::readObservations(client.saveObservations(), &saved));
+    QCOMPARE(saved.size(), 2);
+    for (const auto &observation : std::as_const(saved))
+        QVERIFY(observation.freshUntil > now);
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::observeCompactSecureSnapshot()
+{
+#ifdef QT_BUILD_INTERNAL
+    CoapSavedObservation secure;
+    secure.compactId = 1;
+    secure.host = QStringLiteral("127.0.0.1");
+    secure.port = 5684;
+    secure.secure = true;
+    secure.registration = QByteArray::fromHex("45010001") + QCoapToken("coaps");
+    secure.expiry = QDateTime::currentMSecsSinceEpoch() + 60 * 1000;
+    CoapSavedObservation plain = secure;
+    plain.compactId = 2;
+    plain.port = 5683;
+    plain.secure = false;
+    plain.registration = QByteArray::fromHex("45010002") + QCoapToken("coap!");
+
+    auto connection = new QCoapConnectionObserveServerTests;
+    QCoapClientForCustomConnectionTests client(connection);
+    QVERIFY(client.restoreObservations(
+                    QCoapProtocolPrivate::writeObservations({ secure, plain })).isEmpty());
+
+    // The compact observations come back under the endpoint they were saved with
+    QList<CoapSavedObservation> saved;
+    QVERIFY(QCoapProtocolPrivate::readObservations(client.saveObservations(), &saved));
+    QCOMPARE(saved.size(), 2);
+    for (const auto &observation : std::as_const(saved)) {
+        QCOMPARE(observation.secure, observation.compactId == secure.compactId);
+        QCOMPARE(observation.port, observation.compactId == secure.compactId ? secure.port
+                                                                         : plain.port);
+    }
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::observeDeregistration()
+{
+#ifdef QT_BUILD_INTERNAL
+    auto connection = new QCoapConnectionObserveServerTests;
+    QCoapClientForCustomConnectionTests client(connection);
+
+    QScopedPointer<QCoapReply> firstSensor(client.observe(QUrl("coap://127.0.0.1/sensors/1")));
+    QScopedPointer<QCoapReply> secondSensor(client.observe(QUrl("coap://127.0.0.1/sensors/2")));
+    QScopedPointer<QCoapReply> actuator(client.observe(QUrl("coap://127.0.0.1/actuators/1")));
+    QTRY_COMPARE(connection->registrations(), 3);
+    QTRY_VERIFY(firstSensor->isRunning() && secondSensor->isRunning() && actuator->isRunning());
+
+    // The observations are deregistered right away, with their own token
+    client.cancelObserveByPrefix(QUrl("coap://127.0.0.1/sensors/"));
+    QTRY_VERIFY(firstSensor->isFinished() && secondSensor->isFinished());
+    QTRY_COMPARE(connection->deregistrationTokens().size(), 2);
+    QVERIFY(connection->deregistrationTokens().contains(firstSensor->request().token()));
+    QVERIFY(connection->deregistrationTokens().contains(secondSensor->request().token()));
+    QVERIFY(actuator->isRunning());
+
+    client.cancelObserveHost("127.0.0.1");
+    QTRY_VERIFY(actuator->isFinished());
+    QTRY_COMPARE(connection->deregistrationTokens().size(), 3);
+    QCOMPARE(connection->deregistrationTokens().last(), actuator->request().token());
+    QCOMPARE(connection->registrations(), 3);
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
+void tst_QCoapClient::observeSnapshot()
+{
+#ifdef QT_BUILD_INTERNAL
+    const QUrl url("coap://127.0.0.1/temperature");
+    QByteArray snapshot;
+    QCoapToken token;
+    QCoapToken compactToken;
+    quint64 observation = 0;
+    {
+        auto connection = new QCoapConnectionObserveServerTests({ 5 });
+        QCoapClientForCustomConnectionTests client(connection);
+        QSignalSpy spyCompactNotified(&client, &QCoapClient::compactNotified);
+
+        QScopedPointer<QCoapReply> reply(client.observe(url));
+        QSignalSpy spyNotified(reply.data(), &QCoapReply::notified);
+        observation = client.observeCompact(QUrl("coap://127.0.0.1/humidity"));
+        QTRY_COMPARE(spyNotified.size(), 1);
+        QTRY_COMPARE(spyCompactNotified.size(), 1);
+
+        token = reply->request().token();
+        const auto tokens = connection->registrationTokens();
+        QCOMPARE(tokens.size(), 2);
+        compactToken = tokens.at(0) == token ? tokens.at(1) : tokens.at(0);
+
+        snapshot = client.saveObservations();
+        QVERIFY(!snapshot.isEmpty());
+    }
+
+    auto connection = new QCoapConnectionObserveServerTests;
+    QCoapClientForCustomConnectionTests client(connection);
+    QSignalSpy spyCompactNotified(&client, &QCoapClient::compactNotified);
+
+    QTest::ignoreMessage(QtWarningMsg, "Failed to restore observations, the snapshot is invalid.");
+    QVERIFY(client.restoreObservations("invalid").isEmpty());
+    const QList<QCoapReply *> replies = client.restoreObservations(snapshot);
+    QCOMPARE(replies.size(), 1);
+    QScopedPointer<QCoapReply> reply(replies.first());
+    QSignalSpy spyNotified(reply.data(), &QCoapReply::notified);
+    QTRY_VERIFY(reply->isRunning());
+    QCOMPARE(reply->request().token(), token);
+    QCOMPARE(reply->url(), url);
+
+    // The notifications are matched without registering again, and the
+    // last sequence number is kept
+    connection->notify(4, token);
+    QTRY_COMPARE(reply->staleNotificationCount(), 1u);
+    connection->notify(6, token);
+    QTRY_COMPARE(spyNotified.size(), 1);
+    QCOMPARE(spyNotified.first().at(1).value<QCoapMessage>().payload(), QByteArray("6"));
+
+    connection->notify(6, compactToken);
+    QTRY_COMPARE(spyCompactNotified.size(), 1);
+    QCOMPARE(spyCompactNotified.first().at(0).value<quint64>(), observation);
+    QVERIFY(client.observeCompact(QUrl("coap://127.0.0.1/pressure")) > observation);
+    QTRY_COMPARE(connection->registrations(), 1);
+#else
+    QSKIP("Not an internal build, skipping this test");
+#endif
+}
+
 QTEST_MAIN(tst_QCoapClient)
 
 #include "tst_qcoapclient.moc"
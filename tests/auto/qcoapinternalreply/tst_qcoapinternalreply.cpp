@@ -41,6 +41,10 @@ void tst_QCoapInternalReply::parseReplyPdu_data()
     QList<quint8> bigOptionLengthReply({26});
     QList<QByteArray> bigOptionValueReply({QByteArray("abcdefghijklmnopqrstuvwxyz")});
 
+    QList<QCoapOption::OptionName> requestTagNameReply({QCoapOption::RequestTag});
+    QList<quint8> requestTagLengthReply({4});
+    QList<QByteArray> requestTagValueReply({QByteArray::fromHex("01020304")});
+
     QTest::newRow("reply_with_options_and_payload")
             << QtCoap::ResponseCode::Content
             << QCoapMessage::Type::NonConfirmable
@@ -104,6 +108,18 @@ void tst_QCoapInternalReply::parseReplyPdu_data()
             << ""
             << "5445fbcf4647f09bdd2f0d6162636465666768696a6b6c6d6e6f707172737475"
                "767778797a";
+
+    QTest::newRow("reply_with_extended_option_number")
+            << QtCoap::ResponseCode::Content
+            << QCoapMessage::Type::NonConfirmable
+            << quint16(64463)
+            << QByteArray("4647f09b")
+            << quint8(4)
+            << requestTagNameReply
+            << requestTagLengthReply
+            << requestTagValueReply
+            << ""
+            << "5445fbcf4647f09be4001701020304";
 }
 
 void tst_QCoapInternalReply::parseReplyPdu()
@@ -24,6 +24,8 @@ private Q_SLOTS:
     void invalidUrls();
     void isMulticast_data();
     void isMulticast();
+    void endpoint_data();
+    void endpoint();
     void parseBlockOption_data();
     void parseBlockOption();
     void createBlockOption_data();
@@ -114,6 +116,15 @@ void tst_QCoapInternalRequest::requestToFrame_data()
         << "5401dc504647f09bb474657374dd240d6162636465666768696a6b6c6d6e6f70"
            "7172737475767778797aff"
         << "Some payload";
+
+    QTest::newRow("request_with_request_tag")
+        << QUrl("coap://10.20.30.40:5683/test")
+        << QtCoap::Method::Put
+        << QCoapRequest::Type::NonConfirmable
+        << quint16(56400)
+        << QByteArray::fromHex("4647f09b")
+        << "5403dc504647f09bb474657374e4000c01020304ff"
+        << "Some payload";
 }
 
 void tst_QCoapInternalRequest::requestToFrame()
@@ -133,6 +144,8 @@ void tst_QCoapInternalRequest::requestToFrame()
     request.setToken(token);
     if (qstrcmp(QTest::currentDataTag(), "request_with_big_option_number") == 0)
         request.addOption(QCoapOption::Size1, QByteArray("abcdefghijklmnopqrstuvwxyz"));
+    if (qstrcmp(QTest::currentDataTag(), "request_with_request_tag") == 0)
+        request.addOption(QCoapOption::RequestTag, QByteArray::fromHex("01020304"));
 
     QByteArray pdu;
     pdu.append(pduHeader.toUtf8());
@@ -293,6 +306,46 @@ void tst_QCoapInternalRequest::isMulticast()
     QCOMPARE(internalRequest.isMulticast(), result);
 }
 
+void tst_QCoapInternalRequest::endpoint_data()
+{
+    QTest::addColumn<QString>("url");
+    QTest::addColumn<QString>("host");
+    QTest::addColumn<QHostAddress>("address");
+    QTest::addColumn<quint16>("port");
+    QTest::addColumn<bool>("secure");
+
+    QTest::newRow("ipv4") << "coap://10.20.30.40:1234/path" << "10.20.30.40"
+                          << QHostAddress("10.20.30.40") << quint16(1234) << false;
+    QTest::newRow("ipv6_default_port") << "coap://[::1]/path" << "::1"
+                                       << QHostAddress(QHostAddress::LocalHostIPv6)
+                                       << quint16(QtCoap::DefaultPort) << false;
+    QTest::newRow("secure_default_port") << "coaps://10.20.30.40/path" << "10.20.30.40"
+                                         << QHostAddress("10.20.30.40")
+                                         << quint16(QtCoap::DefaultSecurePort) << true;
+    QTest::newRow("host_name") << "coap://example.com:5683/path" << "example.com"
+                               << QHostAddress() << quint16(5683) << false;
+}
+
+void tst_QCoapInternalRequest::endpoint()
+{
+    QFETCH(QString, url);
+    QFETCH(QString, host);
+    QFETCH(QHostAddress, address);
+    QFETCH(quint16, port);
+    QFETCH(bool, secure);
+
+    const QCoapRequest request(url);
+    const QCoapInternalRequest internalRequest(request);
+    const CoapEndpoint &endpoint = internalRequest.endpoint();
+    QCOMPARE(endpoint.host, host);
+    QCOMPARE(endpoint.address, address);
+    QCOMPARE(endpoint.isHostName(), address.isNull());
+    QCOMPARE(endpoint.port, port);
+    QCOMPARE(endpoint.secure, secure);
+    QVERIFY(!endpoint.multicast);
+    QCOMPARE(endpoint, CoapEndpoint(host, port, secure));
+}
+
 void tst_QCoapInternalRequest::parseBlockOption_data()
 {
     QTest::addColumn<QByteArray>("value");
@@ -300,6 +353,10 @@ void tst_QCoapInternalRequest::parseBlockOption_data()
     QTest::addColumn<bool>("hasNext");
     QTest::addColumn<uint>("blockSize");
 
+    QTest::newRow("block_option_empty") << QByteArray()
+                                        << 0u
+                                        << false
+                                        << 16u;
     QTest::newRow("block_option_1byte_more_blocks") << QByteArray::fromHex("3B")
                                                     << 3u
                                                     << true
@@ -324,6 +381,10 @@ void tst_QCoapInternalRequest::parseBlockOption_data()
                                                         << 15026u
                                                         << false
                                                         << 64u;
+    QTest::newRow("block_option_bert_more_blocks") << QByteArray::fromHex("2F")
+                                                   << 2u
+                                                   << true
+                                                   << 1024u;
 }
 
 void tst_QCoapInternalRequest::parseBlockOption()
@@ -401,6 +462,31 @@ void tst_QCoapInternalRequest::createBlockOption_data()
             << 4096u
             << 4u
             << QCoapOption(QCoapOption::Block2, QByteArray::fromHex("10000"));
+    QTest::newRow("block1_option_bert_more_blocks")
+            << largeData
+            << 2u
+            << 4096u
+            << QCoapOption(QCoapOption::Block1, QByteArray::fromHex("2F"));
+    QTest::newRow("block1_option_bert_no_more_blocks")
+            << largeData
+            << 28u
+            << 4096u
+            << QCoapOption(QCoapOption::Block1, QByteArray::fromHex("1C7"));
+    QTest::newRow("block2_option_bert")
+            << largeData
+            << 2u
+            << 4096u
+            << QCoapOption(QCoapOption::Block2, QByteArray::fromHex("27"));
+    QTest::newRow("qblock1_option_1byte_more_blocks")
+            << data
+            << 3u
+            << 64u
+            << QCoapOption(QCoapOption::QBlock1, QByteArray::fromHex("3A"));
+    QTest::newRow("qblock2_option_1byte")
+            << data
+            << 3u
+            << 64u
+            << QCoapOption(QCoapOption::QBlock2, QByteArray::fromHex("32"));
 }
 
 void tst_QCoapInternalRequest::createBlockOption()
@@ -413,12 +499,15 @@ void tst_QCoapInternalRequest::createBlockOption()
     QCoapRequest request;
     request.setPayload(payload);
     QCoapInternalRequest internalRequest(request);
-    if (expectedOption.name() == QCoapOption::Block1)
-        internalRequest.setToSendBlock(blockNumber, blockSize);
+    if (expectedOption.name() == QCoapOption::Block1
+            || expectedOption.name() == QCoapOption::QBlock1)
+        internalRequest.setToSendBlock(blockNumber, blockSize, expectedOption.name());
     else if (expectedOption.name() == QCoapOption::Block2)
         internalRequest.setToRequestBlock(blockNumber, blockSize);
+    else if (expectedOption.name() == QCoapOption::QBlock2)
+        internalRequest.setToRequestQBlocks({ blockNumber }, blockSize, false);
     else
-        QFAIL("Incorrect option, the test expects Block1 or Block2 options.");
+        QFAIL("Incorrect option, the test expects block options.");
 
     QCOMPARE(internalRequest.message()->options().size(), 1);
 
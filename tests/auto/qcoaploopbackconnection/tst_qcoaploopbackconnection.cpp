@@ -0,0 +1,136 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include <QtTest>
+#include <QCoreApplication>
+
+#include <QtCoap/qcoapclient.h>
+#include <QtCoap/qcoapreply.h>
+#include <QtCoap/qcoaprequest.h>
+#include <private/qcoapclient_p.h>
+#include <private/qcoaploopbackconnection_p.h>
+
+class tst_QCoapLoopbackConnection : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void scriptedResponder_data();
+    void scriptedResponder();
+    void clientExchange_data();
+    void clientExchange();
+};
+
+class QCoapClientForLoopbackTests : public QCoapClient
+{
+public:
+    explicit QCoapClientForLoopbackTests(QCoapLoopbackConnection *connection)
+    {
+        QCoapClientPrivate *privateClient = static_cast<QCoapClientPrivate *>(d_func());
+        privateClient->setConnection(connection);
+    }
+};
+
+void tst_QCoapLoopbackConnection::scriptedResponder_data()
+{
+    QTest::addColumn<bool>("separate");
+    QTest::addColumn<QByteArray>("request");
+    QTest::addColumn<QList<QByteArray>>("answers");
+
+    // GET with token "t" and Uri-Path "test"
+    QTest::newRow("confirmable")
+            << false << QByteArray::fromHex("41011234" "74" "b474657374")
+            << QList<QByteArray>{ QByteArray::fromHex("61451234" "74" "ff6869") };
+    QTest::newRow("non_confirmable")
+            << false << QByteArray::fromHex("51011234" "74" "b474657374")
+            << QList<QByteArray>{ QByteArray::fromHex("51450001" "74" "ff6869") };
+    QTest::newRow("separate")
+            << true << QByteArray::fromHex("41011234" "74" "b474657374")
+            << QList<QByteArray>{ QByteArray::fromHex("60001234"),
+                                  QByteArray::fromHex("41450001" "74" "ff6869") };
+    QTest::newRow("not_found")
+            << false << QByteArray::fromHex("41011234" "74" "b46e6f7065")
+            << QList<QByteArray>{ QByteArray::fromHex("61841234" "74") };
+    QTest::newRow("method_not_allowed")
+            << false << QByteArray::fromHex("41031234" "74" "b474657374")
+            << QList<QByteArray>{ QByteArray::fromHex("61851234" "74") };
+    QTest::newRow("ping")
+            << false << QByteArray::fromHex("40001234")
+            << QList<QByteArray>{ QByteArray::fromHex("70001234") };
+    QTest::newRow("acknowledgment")
+            << false << QByteArray::fromHex("60001234") << QList<QByteArray>();
+    QTest::newRow("malformed")
+            << false << QByteArray::fromHex("4801") << QList<QByteArray>();
+}
+
+void tst_QCoapLoopbackConnection::scriptedResponder()
+{
+    QFETCH(bool, separate);
+    QFETCH(QByteArray, request);
+    QFETCH(QList<QByteArray>, answers);
+
+    QCoapScriptedResponder responder;
+    responder.addResource(QStringLiteral("test"), "hi");
+    responder.setSeparateResponses(separate);
+
+    QCOMPARE(responder.respond(request), answers);
+}
+
+void tst_QCoapLoopbackConnection::clientExchange_data()
+{
+    QTest::addColumn<QCoapMessage::Type>("type");
+    QTest::addColumn<bool>("separate");
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<QtCoap::ResponseCode>("responseCode");
+    QTest::addColumn<QByteArray>("payload");
+    QTest::addColumn<quint64>("framesWritten");
+
+    QTest::newRow("confirmable")
+            << QCoapMessage::Type::Confirmable << false << QString("/sensors/temperature")
+            << QtCoap::ResponseCode::Content << QByteArray("21.5") << quint64(1);
+    QTest::newRow("non_confirmable")
+            << QCoapMessage::Type::NonConfirmable << false << QString("/sensors/temperature")
+            << QtCoap::ResponseCode::Content << QByteArray("21.5") << quint64(1);
+    // The Confirmable separate response is acknowledged
+    QTest::newRow("separate")
+            << QCoapMessage::Type::Confirmable << true << QString("/sensors/temperature")
+            << QtCoap::ResponseCode::Content << QByteArray("21.5") << quint64(2);
+    QTest::newRow("not_found")
+            << QCoapMessage::Type::Confirmable << false << QString("/sensors/humidity")
+            << QtCoap::ResponseCode::NotFound << QByteArray() << quint64(1);
+}
+
+/*
+    Sends a request through a client and the loopback connection, without
+    any server or socket.
+*/
+void tst_QCoapLoopbackConnection::clientExchange()
+{
+    QFETCH(QCoapMessage::Type, type);
+    QFETCH(bool, separate);
+    QFETCH(QString, path);
+    QFETCH(QtCoap::ResponseCode, responseCode);
+    QFETCH(QByteArray, payload);
+    QFETCH(quint64, framesWritten);
+
+    QCoapScriptedResponder responder;
+    responder.addResource(QStringLiteral("/sensors/temperature"), "21.5");
+    responder.setSeparateResponses(separate);
+
+    auto *connection = new QCoapLoopbackConnection(responder);
+    QCoapClientForLoopbackTests client(connection);
+
+    QCoapRequest request(QUrl(QStringLiteral("coap://127.0.0.1") + path));
+    request.setType(type);
+    QScopedPointer<QCoapReply> reply(client.get(request));
+    QVERIFY(reply);
+
+    QTRY_VERIFY(reply->isFinished());
+    QCOMPARE(reply->responseCode(), responseCode);
+    QCOMPARE(reply->message().payload(), payload);
+    QTRY_COMPARE(connection->framesWritten(), framesWritten);
+}
+
+QTEST_MAIN(tst_QCoapLoopbackConnection)
+
+#include "tst_qcoaploopbackconnection.moc"
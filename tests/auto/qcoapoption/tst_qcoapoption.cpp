@@ -78,6 +78,10 @@ void tst_QCoapOption::constructWithInteger()
     QCoapOption option(QCoapOption::Size1, value);
 
     QCOMPARE(option.uintValue(), value);
+
+    // Integer values are encoded in network byte order
+    QCOMPARE(option.opaqueValue(), QByteArray::fromHex("fa00"));
+    QCOMPARE(QCoapOption(QCoapOption::Size2, QByteArray::fromHex("0103e8")).uintValue(), 66536u);
 }
 
 void tst_QCoapOption::constructWithUtf8Characters()
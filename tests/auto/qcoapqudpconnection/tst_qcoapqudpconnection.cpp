@@ -8,8 +8,15 @@
 #include <QtCore/qglobal.h>
 #include <QtCoap/qcoapnamespace.h>
 #include <QtCore/qbuffer.h>
+#include <QtCore/qendian.h>
 #include <QtNetwork/qudpsocket.h>
 #include <QtNetwork/qnetworkdatagram.h>
+#if QT_CONFIG(dtls)
+#include <QtNetwork/qdtls.h>
+#include <QtNetwork/qsslcipher.h>
+#include <QtNetwork/qsslconfiguration.h>
+#include <QtNetwork/qsslpresharedkeyauthenticator.h>
+#endif
 #include <QtCoap/qcoapglobal.h>
 #include <QtCoap/qcoaprequest.h>
 #include <private/qcoapqudpconnection_p.h>
@@ -30,23 +37,135 @@ private Q_SLOTS:
     void reconnect();
     void sendRequest_data();
     void sendRequest();
+    void batchedDatagrams();
+    void multiplePeers();
+    void sessionSnapshot();
+    void peerRebinding();
+    void connectAheadOfRequests();
+    void boundedFrameQueue();
+    void hostNameResolution();
+    void connectedSockets();
 };
 
 class QCoapQUdpConnectionForTest : public QCoapQUdpConnection
 {
     Q_OBJECT
 public:
-    QCoapQUdpConnectionForTest(QObject *parent = nullptr) :
-        QCoapQUdpConnection(QtCoap::SecurityMode::NoSecurity, parent)
+    explicit QCoapQUdpConnectionForTest(
+            QtCoap::SecurityMode security = QtCoap::SecurityMode::NoSecurity,
+            QObject *parent = nullptr) :
+        QCoapQUdpConnection(security, parent)
     {}
 
     void bindSocketForTest() { d_func()->bindSocket(); }
-    void sendRequest(const QByteArray &request, const QString &host, quint16 port)
+    bool sendRequest(const QByteArray &request, const QString &host, quint16 port)
+    {
+        return d_func()->sendRequest(request, CoapEndpoint(host, port, isSecure()));
+    }
+    CoapUdpStatistics statistics() { return d_func()->statistics; }
+    bool isResolved(const QString &host) { return d_func()->resolvedHosts.contains(host); }
+    bool isConfirmed(const QString &host) { return d_func()->resolvedHosts.value(host).confirmed; }
+    bool hasConnectedSocket(const QHostAddress &address, quint16 port)
     {
-        d_func()->sendRequest(request, host, port);
+        return d_func()->peerTraffic.value({ address, port }).socket != nullptr;
     }
+#if QT_CONFIG(dtls)
+    int sessionCount() { return int(d_func()->dtlsSessions.size()); }
+    void cacheSession(const QHostAddress &address, quint16 port, const QByteArray &session)
+    {
+        d_func()->sessionCache.insert(d_func()->dtlsPeer(address, port), new QByteArray(session));
+    }
+    QByteArray cachedSession(const QHostAddress &address, quint16 port)
+    {
+        const QByteArray *session = d_func()->sessionCache.object(d_func()->dtlsPeer(address, port));
+        return session ? *session : QByteArray();
+    }
+#endif
 };
 
+#if QT_CONFIG(dtls)
+static bool hasPskCipher()
+{
+    const auto ciphers = QSslConfiguration::defaultDtlsConfiguration().ciphers();
+    return std::any_of(ciphers.cbegin(), ciphers.cend(), [](const QSslCipher &cipher) {
+        return cipher.name().startsWith("PSK-");
+    });
+}
+
+/*
+    DTLS server using the pre-shared key of the tests, which sends the
+    datagrams it receives back to the client.
+*/
+class DtlsEchoServer : public QObject
+{
+    Q_OBJECT
+public:
+    DtlsEchoServer() { rebind(); }
+
+    quint16 port() const { return socket->localPort(); }
+    int handshakeCount = 0;
+
+    // Moves the server to a new port, as a NAT would
+    void rebind()
+    {
+        if (socket)
+            socket->disconnect(this);
+
+        socket = new QUdpSocket(this);
+        socket->bind(QHostAddress::LocalHost, 0);
+        connect(socket, &QUdpSocket::readyRead, this, &DtlsEchoServer::readDatagrams);
+    }
+
+    void send(const QByteArray &data) { session->writeDatagramEncrypted(socket, data); }
+
+private:
+    void readDatagrams()
+    {
+        while (socket->hasPendingDatagrams()) {
+            const QNetworkDatagram datagram = socket->receiveDatagram();
+            // A new handshake from the client, in a plain handshake record of the
+            // first epoch, replaces the current session
+            const QByteArray record = datagram.data().left(5);
+            const bool newHandshake = record.size() == 5 && record.at(0) == 0x16
+                    && record.at(3) == 0 && record.at(4) == 0;
+            if (!session || (newHandshake && session->isConnectionEncrypted()))
+                createSession(datagram.senderAddress(), datagram.senderPort());
+
+            if (!session->isConnectionEncrypted()) {
+                session->doHandshake(socket, datagram.data());
+                if (session->isConnectionEncrypted())
+                    ++handshakeCount;
+                continue;
+            }
+
+            const QByteArray data = session->decryptDatagram(socket, datagram.data());
+            if (!data.isEmpty())
+                session->writeDatagramEncrypted(socket, data);
+            else if (session->dtlsError() == QDtlsError::RemoteClosedConnectionError)
+                session.reset();
+        }
+    }
+
+    void createSession(const QHostAddress &address, quint16 port)
+    {
+        auto configuration = QSslConfiguration::defaultDtlsConfiguration();
+        configuration.setPeerVerifyMode(QSslSocket::VerifyNone);
+        configuration.setDtlsCookieVerificationEnabled(false);
+
+        session.reset(new QDtls(QSslSocket::SslServerMode));
+        session->setDtlsConfiguration(configuration);
+        session->setPeer(address, port);
+        connect(session.get(), &QDtls::pskRequired, this,
+                [](QSslPreSharedKeyAuthenticator *authenticator) {
+            authenticator->setPreSharedKey("secretPSK");
+        });
+    }
+
+    QUdpSocket *socket = nullptr;
+    std::unique_ptr<QDtls> session;
+};
+#endif
+
 void tst_QCoapQUdpConnection::initTestCase()
 {
 #if defined(COAP_TEST_SERVER_IP) || defined(QT_TEST_SERVER)
@@ -179,6 +298,326 @@ void tst_QCoapQUdpConnection::sendRequest()
     QVERIFY(QString(data.toHex()).endsWith(dataHexaPayload));
 }
 
+void tst_QCoapQUdpConnection::batchedDatagrams()
+{
+    QUdpSocket peer;
+    QVERIFY(peer.bind(QHostAddress::LocalHost, 0));
+
+    QCoapQUdpConnectionForTest connection;
+    QSignalSpy spyConnectionReadyRead(&connection, &QCoapQUdpConnection::readyRead);
+
+    // The frames written in the same iteration of the event loop are sent together
+    const QList<QByteArray> frames = { "first", "second", "third" };
+    for (const auto &frame : frames)
+        connection.sendRequest(frame, QStringLiteral("127.0.0.1"), peer.localPort());
+
+    QList<QByteArray> received;
+    const auto receive = [&peer, &received]() {
+        while (peer.hasPendingDatagrams())
+            received.append(peer.receiveDatagram().data());
+        return received.size();
+    };
+    QTRY_COMPARE(receive(), frames.size());
+    QCOMPARE(received, frames);
+    QCOMPARE(connection.statistics().sentDatagrams, quint64(3));
+#ifdef Q_OS_LINUX
+    QCOMPARE(connection.statistics().sendCalls, quint64(1));
+#endif
+
+    // The datagrams pending on the socket are read together
+    const quint16 port = connection.socket()->localPort();
+    for (const auto &frame : frames)
+        QCOMPARE(peer.writeDatagram(frame, QHostAddress::LocalHost, port), frame.size());
+
+    QTRY_COMPARE(spyConnectionReadyRead.size(), frames.size());
+    for (qsizetype i = 0; i < frames.size(); ++i) {
+        QCOMPARE(spyConnectionReadyRead.at(i).at(0).value<QByteArray>(), frames.at(i));
+        const QHostAddress sender = spyConnectionReadyRead.at(i).at(1).value<QHostAddress>();
+        QVERIFY(sender.isEqual(QHostAddress::LocalHost));
+    }
+    QCOMPARE(connection.statistics().receivedDatagrams, quint64(3));
+#ifdef Q_OS_LINUX
+    QCOMPARE(connection.statistics().receiveCalls, quint64(2));
+
+    // The datagrams larger than the receive buffers are dropped
+    const QByteArray oversized(4096, 'x');
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("Dropping a datagram larger than"));
+    QCOMPARE(peer.writeDatagram(oversized, QHostAddress::LocalHost, port), oversized.size());
+    QCOMPARE(peer.writeDatagram(frames.first(), QHostAddress::LocalHost, port),
+             frames.first().size());
+
+    QTRY_COMPARE(spyConnectionReadyRead.size(), frames.size() + 1);
+    QCOMPARE(spyConnectionReadyRead.last().at(0).value<QByteArray>(), frames.first());
+    QCOMPARE(connection.statistics().oversizedDatagrams, quint64(1));
+    QCOMPARE(connection.statistics().receivedDatagrams, quint64(4));
+#endif
+}
+
+void tst_QCoapQUdpConnection::multiplePeers()
+{
+#if QT_CONFIG(dtls)
+    if (!hasPskCipher())
+        QSKIP("No PSK cipher is available for DTLS, skipping this test");
+
+    DtlsEchoServer first;
+    DtlsEchoServer second;
+
+    QCoapQUdpConnectionForTest connection(QtCoap::SecurityMode::PreSharedKey);
+    connection.setSecurityConfiguration(createConfiguration(QtCoap::SecurityMode::PreSharedKey));
+    connection.setSessionIdleTimeout(1000);
+    QSignalSpy spyConnectionReadyRead(&connection, &QCoapQUdpConnection::readyRead);
+
+    // Each server gets its own session on the same socket
+    const QString host = QStringLiteral("127.0.0.1");
+    connection.sendRequest("first", host, first.port());
+    connection.sendRequest("second", host, second.port());
+    connection.sendRequest("first again", host, first.port());
+
+    QTRY_COMPARE(spyConnectionReadyRead.size(), 3);
+    QList<QByteArray> echoes;
+    for (const auto &arguments : std::as_const(spyConnectionReadyRead))
+        echoes.append(arguments.at(0).value<QByteArray>());
+    std::sort(echoes.begin(), echoes.end());
+    QCOMPARE(echoes, QList<QByteArray>({ "first", "first again", "second" }));
+    QCOMPARE(connection.sessionCount(), 2);
+    QCOMPARE(first.handshakeCount, 1);
+    QCOMPARE(second.handshakeCount, 1);
+
+    // The idle sessions are shut down, and set up again when needed
+    QTRY_COMPARE(connection.sessionCount(), 0);
+    const QByteArray offeredSession = connection.cachedSession(QHostAddress::LocalHost,
+                                                               first.port());
+    connection.sendRequest("after idle", host, first.port());
+    QTRY_COMPARE(spyConnectionReadyRead.size(), 4);
+    QCOMPARE(spyConnectionReadyRead.last().at(0).value<QByteArray>(), QByteArray("after idle"));
+    QCOMPARE(first.handshakeCount, 2);
+
+    const CoapUdpStatistics statistics = connection.statistics();
+    QCOMPARE(statistics.fullHandshakes + statistics.abbreviatedHandshakes, quint64(3));
+    if (offeredSession.isEmpty())
+        QSKIP("The DTLS backend does not provide session tickets, skipping the resumption");
+
+    // The session set up with the first server is resumed after idling
+    QCOMPARE(statistics.abbreviatedHandshakes, quint64(1));
+    QCOMPARE(statistics.fullHandshakes, quint64(2));
+#else
+    QSKIP("DTLS is not supported, skipping this test");
+#endif
+}
+
+void tst_QCoapQUdpConnection::sessionSnapshot()
+{
+#if QT_CONFIG(dtls)
+    QCoapQUdpConnectionForTest connection(QtCoap::SecurityMode::PreSharedKey);
+    QVERIFY(!connection.restoreSessions("invalid"));
+
+    connection.cacheSession(QHostAddress::LocalHost, 5684, "session");
+    const QByteArray snapshot = connection.saveSessions();
+
+    QCoapQUdpConnectionForTest restored(QtCoap::SecurityMode::PreSharedKey);
+    QVERIFY(restored.restoreSessions(snapshot));
+    QCOMPARE(restored.cachedSession(QHostAddress::LocalHost, 5684), QByteArray("session"));
+    QVERIFY(restored.cachedSession(QHostAddress::LocalHost, 5685).isEmpty());
+
+    // The sessions are not resumed with another security configuration
+    restored.setSecurityConfiguration(createConfiguration(QtCoap::SecurityMode::PreSharedKey));
+    QVERIFY(restored.cachedSession(QHostAddress::LocalHost, 5684).isEmpty());
+#else
+    QSKIP("DTLS is not supported, skipping this test");
+#endif
+}
+
+void tst_QCoapQUdpConnection::peerRebinding()
+{
+#if QT_CONFIG(dtls)
+    if (!hasPskCipher())
+        QSKIP("No PSK cipher is available for DTLS, skipping this test");
+
+    DtlsEchoServer server;
+    const quint16 port = server.port();
+
+    QCoapQUdpConnectionForTest connection(QtCoap::SecurityMode::PreSharedKey);
+    connection.setSecurityConfiguration(createConfiguration(QtCoap::SecurityMode::PreSharedKey));
+    QSignalSpy spyConnectionReadyRead(&connection, &QCoapQUdpConnection::readyRead);
+
+    const QString host = QStringLiteral("127.0.0.1");
+    connection.sendRequest("before", host, port);
+    QTRY_COMPARE(spyConnectionReadyRead.size(), 1);
+
+    // The records coming from the new port are matched with the session
+    server.rebind();
+    server.send("notification");
+    QTRY_COMPARE(spyConnectionReadyRead.size(), 2);
+    QCOMPARE(spyConnectionReadyRead.last().at(0).value<QByteArray>(),
+             QByteArray("notification"));
+    QCOMPARE(connection.statistics().peerRebindings, quint64(1));
+
+    // The frames for the previous port go to the new one
+    connection.sendRequest("after", host, port);
+    QTRY_COMPARE(spyConnectionReadyRead.size(), 3);
+    QCOMPARE(spyConnectionReadyRead.last().at(0).value<QByteArray>(), QByteArray("after"));
+    QCOMPARE(connection.sessionCount(), 1);
+    QCOMPARE(server.handshakeCount, 2);
+#else
+    QSKIP("DTLS is not supported, skipping this test");
+#endif
+}
+
+void tst_QCoapQUdpConnection::connectAheadOfRequests()
+{
+    const QString host = QStringLiteral("127.0.0.1");
+
+    // Without security, the connection is ready once the socket is bound
+    QCoapQUdpConnectionForTest plainConnection;
+    QSignalSpy spyPlainConnected(&plainConnection, &QCoapConnection::connected);
+    plainConnection.connectToHost(host, QtCoap::DefaultPort);
+    QTRY_COMPARE(spyPlainConnected.size(), 1);
+    QCOMPARE(spyPlainConnected.first().at(0).toString(), host);
+    QCOMPARE(spyPlainConnected.first().at(1).value<quint16>(), quint16(QtCoap::DefaultPort));
+    QCOMPARE(plainConnection.state(), QCoapQUdpConnection::ConnectionState::Bound);
+
+#if QT_CONFIG(dtls)
+    if (!hasPskCipher())
+        QSKIP("No PSK cipher is available for DTLS, skipping this test");
+
+    DtlsEchoServer server;
+    QCoapQUdpConnectionForTest connection(QtCoap::SecurityMode::PreSharedKey);
+    connection.setSecurityConfiguration(createConfiguration(QtCoap::SecurityMode::PreSharedKey));
+    QSignalSpy spyConnected(&connection, &QCoapConnection::connected);
+    QSignalSpy spyConnectionReadyRead(&connection, &QCoapQUdpConnection::readyRead);
+
+    connection.connectToHost(host, server.port());
+    QTRY_COMPARE(spyConnected.size(), 1);
+    QCOMPARE(server.handshakeCount, 1);
+
+    // The first request is sent right away, without waiting for a handshake
+    connection.sendRequest("command", host, server.port());
+    QCOMPARE(connection.statistics().sentDatagrams, quint64(1));
+    QTRY_COMPARE(spyConnectionReadyRead.size(), 1);
+    QCOMPARE(server.handshakeCount, 1);
+#endif
+}
+
+void tst_QCoapQUdpConnection::boundedFrameQueue()
+{
+    const auto frame = [](quint16 messageId, const QByteArray &payload) {
+        QByteArray data("\x40\x01\x00\x00", 4);
+        qToBigEndian(messageId, data.data() + 2);
+        return data + payload;
+    };
+
+    // Retransmissions replace the queued frame of their message
+    CoapFrameQueue queue;
+    QVERIFY(queue.enqueue(frame(1, "first")));
+    QVERIFY(queue.enqueue(frame(2, "second")));
+    QVERIFY(queue.enqueue(frame(1, "again")));
+    QCOMPARE(queue.takeAll(), QList<QByteArray>({ frame(1, "again"), frame(2, "second") }));
+    QVERIFY(queue.isEmpty());
+
+    for (quint16 i = 0; i < CoapFrameQueue::Capacity; ++i)
+        QVERIFY(queue.enqueue(frame(i, "payload")));
+    QVERIFY(!queue.enqueue(frame(CoapFrameQueue::Capacity, "payload")));
+    QVERIFY(queue.enqueue(frame(0, "payload")));
+    QCOMPARE(queue.size(), CoapFrameQueue::Capacity);
+
+#if QT_CONFIG(dtls)
+    // The frames waiting for a stalled handshake are bounded too
+    QUdpSocket silentServer;
+    QVERIFY(silentServer.bind(QHostAddress::LocalHost, 0));
+
+    QCoapQUdpConnectionForTest connection(QtCoap::SecurityMode::PreSharedKey);
+    connection.setSecurityConfiguration(createConfiguration(QtCoap::SecurityMode::PreSharedKey));
+    const QString host = QStringLiteral("127.0.0.1");
+    for (quint16 i = 0; i < CoapFrameQueue::Capacity; ++i)
+        QVERIFY(connection.sendRequest(frame(i, "payload"), host, silentServer.localPort()));
+
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("Too many frames waiting"));
+    QVERIFY(!connection.sendRequest(frame(CoapFrameQueue::Capacity, "payload"), host,
+                                    silentServer.localPort()));
+    QVERIFY(connection.sendRequest(frame(0, "payload"), host, silentServer.localPort()));
+#endif
+}
+
+void tst_QCoapQUdpConnection::hostNameResolution()
+{
+    // Reachable through both IPv4 and IPv6, whatever localhost resolves to
+    QUdpSocket server;
+    QVERIFY(server.bind(QHostAddress::Any, 0));
+
+    QCoapQUdpConnectionForTest connection;
+    QSignalSpy spyReadyRead(&connection, &QCoapQUdpConnection::readyRead);
+    const QString host = QStringLiteral("localhost");
+
+    // The frames wait for the name to be resolved
+    QVERIFY(connection.sendRequest("first", host, server.localPort()));
+    QVERIFY(!connection.isResolved(host));
+    QTRY_VERIFY(server.hasPendingDatagrams());
+    QVERIFY(connection.isResolved(host));
+
+    const QNetworkDatagram request = server.receiveDatagram();
+    QCOMPARE(request.data(), QByteArray("first"));
+
+    // An answer from the address makes it the one used from now on
+    QVERIFY(!connection.isConfirmed(host));
+    server.writeDatagram(request.makeReply("answer"));
+    QTRY_COMPARE(spyReadyRead.size(), 1);
+    QVERIFY(connection.isConfirmed(host));
+
+    QVERIFY(connection.sendRequest("second", host, server.localPort()));
+    QTRY_VERIFY(server.hasPendingDatagrams());
+    QCOMPARE(server.receiveDatagram().data(), QByteArray("second"));
+
+    // An unknown name is reported
+    QSignalSpy spyError(&connection, &QCoapQUdpConnection::error);
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("Failed to resolve"));
+    QVERIFY(connection.sendRequest("lost", QStringLiteral("qtcoap.invalid"),
+                                   server.localPort()));
+    QTRY_COMPARE_WITH_TIMEOUT(spyError.size(), 1, 30000);
+    QCOMPARE(spyError.first().first().value<QAbstractSocket::SocketError>(),
+             QAbstractSocket::HostNotFoundError);
+}
+
+void tst_QCoapQUdpConnection::connectedSockets()
+{
+    QUdpSocket peer;
+    QVERIFY(peer.bind(QHostAddress::LocalHost, 0));
+    const QHostAddress address(QHostAddress::LocalHost);
+
+    QCoapQUdpConnectionForTest connection;
+    QSignalSpy spyReadyRead(&connection, &QCoapQUdpConnection::readyRead);
+    connection.setConnectedSocketThreshold(5);
+
+    const auto drain = [&peer]() {
+        while (peer.hasPendingDatagrams())
+            peer.receiveDatagram();
+    };
+
+    // A busy peer gets its own socket at the end of the period
+    for (int i = 0; i < 10; ++i)
+        QVERIFY(connection.sendRequest("busy", QStringLiteral("127.0.0.1"), peer.localPort()));
+    QTRY_COMPARE(connection.statistics().peerPromotions, quint64(1));
+    QVERIFY(connection.hasConnectedSocket(address, peer.localPort()));
+    drain();
+
+    // The peer still sees the same endpoint, and its answers come back
+    QVERIFY(connection.sendRequest("hot", QStringLiteral("127.0.0.1"), peer.localPort()));
+    QTRY_VERIFY(peer.hasPendingDatagrams());
+    const QNetworkDatagram request = peer.receiveDatagram();
+    QCOMPARE(request.data(), QByteArray("hot"));
+    QCOMPARE(request.senderPort(), int(connection.socket()->localPort()));
+
+    peer.writeDatagram(request.makeReply("answer"));
+    QTRY_COMPARE(spyReadyRead.size(), 1);
+    QCOMPARE(spyReadyRead.first().first().value<QByteArray>(), QByteArray("answer"));
+
+    // Once the traffic drops, the socket is closed
+    QTRY_COMPARE(connection.statistics().peerDemotions, quint64(1));
+    QVERIFY(!connection.hasConnectedSocket(address, peer.localPort()));
+    QVERIFY(connection.sendRequest("cold", QStringLiteral("127.0.0.1"), peer.localPort()));
+    QTRY_VERIFY(peer.hasPendingDatagrams());
+    QCOMPARE(peer.receiveDatagram().data(), QByteArray("cold"));
+}
+
 QTEST_MAIN(tst_QCoapQUdpConnection)
 
 #include "tst_qcoapqudpconnection.moc"
@@ -0,0 +1,244 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include <QtTest>
+#include <QCoreApplication>
+
+#include <QtCore/qdeadlinetimer.h>
+#include <QtCoap/qcoapnamespace.h>
+#include <QtNetwork/qtcpserver.h>
+#include <QtNetwork/qtcpsocket.h>
+#include <private/qcoaptcpconnection_p.h>
+
+class tst_QCoapTcpConnection : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void ctor();
+    void messageFraming_data();
+    void messageFraming();
+    void exchange();
+    void framesHeldUntilCsm();
+    void pingPong();
+    void bertBlockSize();
+};
+
+class QCoapTcpConnectionForTest : public QCoapTcpConnection
+{
+    Q_OBJECT
+public:
+    explicit QCoapTcpConnectionForTest(QObject *parent = nullptr) :
+        QCoapTcpConnection(QtCoap::SecurityMode::NoSecurity, parent)
+    {}
+
+    bool sendRequest(const QByteArray &request, quint16 port)
+    {
+        return d_func()->sendRequest(request, endpoint(port));
+    }
+    void receiveCsm(quint16 port, const QByteArray &options)
+    {
+        CoapReliableSession *session = &d_func()->sessions[endpoint(port)];
+        d_func()->processSignal(endpoint(port), session, 0xE1, QByteArray(), options);
+    }
+    uint bertBlockSize(quint16 port) { return d_func()->bertBlockSize(endpoint(port)); }
+
+private:
+    static CoapEndpoint endpoint(quint16 port)
+    {
+        return CoapEndpoint(QHostAddress(QHostAddress::LocalHost), port);
+    }
+};
+
+namespace {
+
+// CSM sent by the connection: Max-Message-Size of 1 MiB and Block-Wise-Transfer
+const QByteArray ExpectedCsm = QByteArray::fromHex("50e12310000020");
+// CSM sent by the servers of the tests, without any option
+const QByteArray ServerCsm = QByteArray::fromHex("00e1");
+
+/*
+    Accepts the connection from the client on \a server, and reads from it
+    until \a size bytes are received. The events are processed meanwhile,
+    for the connection to set up the session and write to it.
+*/
+QByteArray readFromClient(QTcpServer &server, QTcpSocket *&socket, qsizetype size)
+{
+    QByteArray data;
+    const QDeadlineTimer deadline(5000);
+    while (!deadline.hasExpired()) {
+        if (!socket)
+            socket = server.nextPendingConnection();
+        if (socket)
+            data.append(socket->readAll());
+        if (data.size() >= size)
+            break;
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    }
+    return data;
+}
+
+} // namespace
+
+void tst_QCoapTcpConnection::ctor()
+{
+    QCoapTcpConnection connection;
+    QVERIFY(!connection.isSecure());
+    QCOMPARE(connection.state(), QCoapConnection::ConnectionState::Unconnected);
+}
+
+void tst_QCoapTcpConnection::messageFraming_data()
+{
+    QTest::addColumn<QByteArray>("frame");
+    QTest::addColumn<QByteArray>("message");
+
+    // CON GET with token "ab" and Uri-Path "test"
+    QTest::newRow("short")
+            << QByteArray::fromHex("420112346162b474657374")
+            << QByteArray::fromHex("52016162b474657374");
+    QTest::newRow("no_token")
+            << QByteArray::fromHex("400112346162")
+            << QByteArray::fromHex("20016162");
+
+    const QByteArray payload(300, 'x');
+    QTest::newRow("extended_1byte")
+            << QByteArray::fromHex("5045abcdff") + payload.first(20)
+            << QByteArray::fromHex("d00845ff") + payload.first(20);
+    QTest::newRow("extended_2bytes")
+            << QByteArray::fromHex("5045abcdff") + payload
+            << QByteArray::fromHex("e0002045ff") + payload;
+}
+
+void tst_QCoapTcpConnection::messageFraming()
+{
+    QFETCH(QByteArray, frame);
+    QFETCH(QByteArray, message);
+
+    QCOMPARE(QCoapTcpConnectionPrivate::toTcpMessage(frame), message);
+    QCOMPARE(QCoapTcpConnectionPrivate::messageLength(message), message.size());
+    // The extended length is needed to know the size of the message
+    const bool extendedLength = (static_cast<quint8>(message.at(0)) >> 4) >= 13;
+    QCOMPARE(QCoapTcpConnectionPrivate::messageLength(message.first(1)),
+             extendedLength ? -1 : message.size());
+
+    // The message type and ID are not transferred over TCP
+    QByteArray expectedFrame = frame;
+    expectedFrame[0] = static_cast<char>(0x50 | (frame.at(0) & 0x0F));
+    expectedFrame[2] = 0x12;
+    expectedFrame[3] = 0x34;
+    QCOMPARE(QCoapTcpConnectionPrivate::fromTcpMessage(message, 0x1234), expectedFrame);
+}
+
+void tst_QCoapTcpConnection::exchange()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QCoapTcpConnectionForTest connection;
+    QSignalSpy spyReadyRead(&connection, &QCoapConnection::readyRead);
+
+    const QByteArray request = QByteArray::fromHex("420112346162b474657374");
+    QVERIFY(connection.sendRequest(request, server.serverPort()));
+
+    // The CSM is the first message of the connection, the request follows
+    // the CSM of the server
+    QTcpSocket *socket = nullptr;
+    QCOMPARE(readFromClient(server, socket, ExpectedCsm.size()), ExpectedCsm);
+    socket->write(ServerCsm);
+    const QByteArray tcpRequest = QByteArray::fromHex("52016162b474657374");
+    QCOMPARE(readFromClient(server, socket, tcpRequest.size()), tcpRequest);
+
+    // 2.05 Content with payload "hi", written in two parts
+    const QByteArray response = QByteArray::fromHex("32456162ff6869");
+    socket->write(response.first(3));
+    QTest::qWait(50);
+    QCOMPARE(spyReadyRead.size(), 0);
+    socket->write(response.sliced(3));
+
+    QTRY_COMPARE(spyReadyRead.size(), 1);
+    QCOMPARE(spyReadyRead.first().first().toByteArray(),
+             QByteArray::fromHex("524500016162ff6869"));
+    QCOMPARE(spyReadyRead.first().at(1).value<QHostAddress>(),
+             QHostAddress(QHostAddress::LocalHost));
+
+    // Acknowledgments are not sent over TCP
+    QVERIFY(connection.sendRequest(QByteArray::fromHex("60001234"), server.serverPort()));
+    QTest::qWait(100);
+    QCOMPARE(socket->bytesAvailable(), qint64(0));
+}
+
+void tst_QCoapTcpConnection::framesHeldUntilCsm()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QCoapTcpConnectionForTest connection;
+    QSignalSpy spyFrameDropped(&connection, &QCoapConnection::frameDropped);
+
+    // CON GET with token "ab", and CON POST with token "cd" and 200 bytes of payload
+    const QByteArray small = QByteArray::fromHex("420112346162b474657374");
+    const QByteArray large = QByteArray::fromHex("420212356364ff") + QByteArray(200, 'x');
+    QVERIFY(connection.sendRequest(small, server.serverPort()));
+    QVERIFY(connection.sendRequest(large, server.serverPort()));
+
+    QTcpSocket *socket = nullptr;
+    QCOMPARE(readFromClient(server, socket, ExpectedCsm.size()), ExpectedCsm);
+    QTest::qWait(100);
+    QVERIFY(socket->readAll().isEmpty());
+
+    // Max-Message-Size of 64 bytes, the large frame is dropped
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("larger than the Max-Message-Size"));
+    socket->write(QByteArray::fromHex("20e12140"));
+    const QByteArray tcpSmall = QByteArray::fromHex("52016162b474657374");
+    QCOMPARE(readFromClient(server, socket, tcpSmall.size()), tcpSmall);
+
+    QTRY_COMPARE(spyFrameDropped.size(), 1);
+    QCOMPARE(spyFrameDropped.first().at(0).toByteArray(), large);
+    QCOMPARE(spyFrameDropped.first().at(1).value<QtCoap::Error>(),
+             QtCoap::Error::RequestEntityTooLarge);
+    QCOMPARE(connection.bertBlockSize(server.serverPort()), 0u);
+}
+
+void tst_QCoapTcpConnection::pingPong()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QCoapTcpConnectionForTest connection;
+    QVERIFY(connection.sendRequest(QByteArray::fromHex("40011234"), server.serverPort()));
+
+    QTcpSocket *socket = nullptr;
+    QCOMPARE(readFromClient(server, socket, ExpectedCsm.size()), ExpectedCsm);
+    socket->write(ServerCsm);
+    QCOMPARE(readFromClient(server, socket, 2), QByteArray::fromHex("0001"));
+
+    socket->write(QByteArray::fromHex("01e270"));
+    QCOMPARE(readFromClient(server, socket, 3), QByteArray::fromHex("01e370"));
+}
+
+void tst_QCoapTcpConnection::bertBlockSize()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    const quint16 port = server.serverPort();
+
+    QCoapTcpConnectionForTest connection;
+    QVERIFY(connection.sendRequest(QByteArray::fromHex("40011234"), port));
+    QCOMPARE(connection.bertBlockSize(port), 0u);
+
+    // Max-Message-Size of 1152 bytes leaves no room for a BERT block
+    connection.receiveCsm(port, QByteArray::fromHex("22048020"));
+    QCOMPARE(connection.bertBlockSize(port), 0u);
+
+    // Max-Message-Size of 8192 bytes
+    connection.receiveCsm(port, QByteArray::fromHex("22200020"));
+    QCOMPARE(connection.bertBlockSize(port), 7168u);
+
+    // Max-Message-Size of 1 MiB, capped
+    connection.receiveCsm(port, QByteArray::fromHex("2310000020"));
+    QCOMPARE(connection.bertBlockSize(port), 65536u);
+}
+
+QTEST_MAIN(tst_QCoapTcpConnection)
+
+#include "tst_qcoaptcpconnection.moc"
@@ -0,0 +1,193 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include <QtTest>
+#include <QCoreApplication>
+
+#include <QtCoap/qcoapnamespace.h>
+#include <QtWebSockets/qwebsocket.h>
+#include <QtWebSockets/qwebsocketserver.h>
+#include <private/qcoapwebsocketconnection_p.h>
+
+class tst_QCoapWebSocketConnection : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void messageFraming_data();
+    void messageFraming();
+    void concurrentExchanges();
+    void framesHeldUntilCsm();
+    void pingPong();
+};
+
+class QCoapWebSocketConnectionForTest : public QCoapWebSocketConnection
+{
+    Q_OBJECT
+public:
+    bool sendRequest(const QByteArray &request, quint16 port)
+    {
+        return d_func()->sendRequest(request,
+                                     CoapEndpoint(QHostAddress(QHostAddress::LocalHost), port));
+    }
+    int sessionCount() { return int(d_func()->sessions.size()); }
+};
+
+/*
+    Accepts the WebSocket connections on the loopback interface, sends them
+    its CSM, and records the messages received from the client.
+*/
+class QCoapWebSocketServerForTest : public QObject
+{
+    Q_OBJECT
+public:
+    QCoapWebSocketServerForTest() :
+        server(QStringLiteral("coap"), QWebSocketServer::NonSecureMode)
+    {
+        server.setSupportedSubprotocols({ QStringLiteral("coap") });
+        connect(&server, &QWebSocketServer::newConnection, this, [this]() {
+            while (QWebSocket *socket = server.nextPendingConnection()) {
+                clients.append(socket);
+                if (!csm.isEmpty())
+                    socket->sendBinaryMessage(csm);
+                connect(socket, &QWebSocket::binaryMessageReceived, this,
+                        [this](const QByteArray &message) { messages.append(message); });
+            }
+        });
+    }
+
+    bool listen() { return server.listen(QHostAddress::LocalHost); }
+    quint16 port() const { return server.serverPort(); }
+
+    QWebSocketServer server;
+    QList<QWebSocket *> clients;
+    QList<QByteArray> messages;
+    // Without any option
+    QByteArray csm = QByteArray::fromHex("00e1");
+};
+
+namespace {
+
+// CSM sent by the connection: Max-Message-Size of 1 MiB and Block-Wise-Transfer
+const QByteArray ExpectedCsm = QByteArray::fromHex("00e12310000020");
+
+} // namespace
+
+void tst_QCoapWebSocketConnection::messageFraming_data()
+{
+    QTest::addColumn<QByteArray>("frame");
+    QTest::addColumn<QByteArray>("message");
+
+    // CON GET with token "ab" and Uri-Path "test"
+    QTest::newRow("request")
+            << QByteArray::fromHex("420112346162b474657374")
+            << QByteArray::fromHex("02016162b474657374");
+    const QByteArray payload(300, 'x');
+    QTest::newRow("large_payload")
+            << QByteArray::fromHex("5045abcdff") + payload
+            << QByteArray::fromHex("0045ff") + payload;
+}
+
+void tst_QCoapWebSocketConnection::messageFraming()
+{
+    QFETCH(QByteArray, frame);
+    QFETCH(QByteArray, message);
+
+    QCOMPARE(QCoapWebSocketConnectionPrivate::toWebSocketMessage(frame), message);
+
+    // The message type and ID are not transferred over WebSockets
+    QByteArray expectedFrame = frame;
+    expectedFrame[0] = static_cast<char>(0x50 | (frame.at(0) & 0x0F));
+    expectedFrame[2] = 0x12;
+    expectedFrame[3] = 0x34;
+    QCOMPARE(QCoapWebSocketConnectionPrivate::fromWebSocketMessage(message, 0x1234),
+             expectedFrame);
+
+    const CoapEndpoint endpoint(QHostAddress(QHostAddress::LocalHost), 8080);
+    QCOMPARE(QCoapWebSocketConnectionPrivate::webSocketUrl(endpoint),
+             QUrl("ws://127.0.0.1:8080/.well-known/coap"));
+}
+
+void tst_QCoapWebSocketConnection::concurrentExchanges()
+{
+    QCoapWebSocketServerForTest server;
+    QVERIFY(server.listen());
+
+    QCoapWebSocketConnectionForTest connection;
+    QSignalSpy spyReadyRead(&connection, &QCoapConnection::readyRead);
+
+    // Two exchanges in flight, with the tokens "a" and "b"
+    QVERIFY(connection.sendRequest(QByteArray::fromHex("4101000161"), server.port()));
+    QVERIFY(connection.sendRequest(QByteArray::fromHex("4101000262"), server.port()));
+
+    QTRY_COMPARE(server.messages.size(), 3);
+    QCOMPARE(server.clients.size(), 1);
+    QCOMPARE(connection.sessionCount(), 1);
+    QCOMPARE(server.clients.first()->requestUrl().path(), QStringLiteral("/.well-known/coap"));
+    QCOMPARE(server.messages.at(0), ExpectedCsm);
+    QCOMPARE(server.messages.at(1), QByteArray::fromHex("010161"));
+    QCOMPARE(server.messages.at(2), QByteArray::fromHex("010162"));
+
+    // The responses come back in any order over the same connection
+    QWebSocket *client = server.clients.first();
+    client->sendBinaryMessage(QByteArray::fromHex("014562"));
+    client->sendBinaryMessage(QByteArray::fromHex("014561"));
+
+    QTRY_COMPARE(spyReadyRead.size(), 2);
+    QCOMPARE(spyReadyRead.at(0).first().toByteArray(), QByteArray::fromHex("5145000162"));
+    QCOMPARE(spyReadyRead.at(1).first().toByteArray(), QByteArray::fromHex("5145000261"));
+
+    // Acknowledgments are not sent over WebSockets
+    QVERIFY(connection.sendRequest(QByteArray::fromHex("60001234"), server.port()));
+    QTest::qWait(100);
+    QCOMPARE(server.messages.size(), 3);
+}
+
+void tst_QCoapWebSocketConnection::framesHeldUntilCsm()
+{
+    QCoapWebSocketServerForTest server;
+    server.csm.clear();
+    QVERIFY(server.listen());
+
+    QCoapWebSocketConnectionForTest connection;
+    QSignalSpy spyFrameDropped(&connection, &QCoapConnection::frameDropped);
+
+    // CON GET with token "a", and CON POST with token "b" and 200 bytes of payload
+    const QByteArray large = QByteArray::fromHex("4102000262ff") + QByteArray(200, 'x');
+    QVERIFY(connection.sendRequest(QByteArray::fromHex("4101000161"), server.port()));
+    QVERIFY(connection.sendRequest(large, server.port()));
+
+    QTRY_COMPARE(server.messages.size(), 1);
+    QCOMPARE(server.messages.first(), ExpectedCsm);
+    QTest::qWait(100);
+    QCOMPARE(server.messages.size(), 1);
+
+    // Max-Message-Size of 64 bytes, the large frame is dropped
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("larger than the Max-Message-Size"));
+    server.clients.first()->sendBinaryMessage(QByteArray::fromHex("00e12140"));
+    QTRY_COMPARE(server.messages.size(), 2);
+    QCOMPARE(server.messages.at(1), QByteArray::fromHex("010161"));
+
+    QTRY_COMPARE(spyFrameDropped.size(), 1);
+    QCOMPARE(spyFrameDropped.first().at(0).toByteArray(), large);
+    QCOMPARE(spyFrameDropped.first().at(1).value<QtCoap::Error>(),
+             QtCoap::Error::RequestEntityTooLarge);
+}
+
+void tst_QCoapWebSocketConnection::pingPong()
+{
+    QCoapWebSocketServerForTest server;
+    QVERIFY(server.listen());
+
+    QCoapWebSocketConnectionForTest connection;
+    QVERIFY(connection.sendRequest(QByteArray::fromHex("40011234"), server.port()));
+    QTRY_COMPARE(server.messages.size(), 2);
+
+    server.clients.first()->sendBinaryMessage(QByteArray::fromHex("01e270"));
+    QTRY_COMPARE(server.messages.size(), 3);
+    QCOMPARE(server.messages.last(), QByteArray::fromHex("01e370"));
+}
+
+QTEST_MAIN(tst_QCoapWebSocketConnection)
+
+#include "tst_qcoapwebsocketconnection.moc"
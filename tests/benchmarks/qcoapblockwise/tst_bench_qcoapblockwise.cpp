@@ -0,0 +1,193 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include <QtTest>
+#include <QCoreApplication>
+
+#include <QtCoap/qcoapclient.h>
+#include <QtCoap/qcoaprequest.h>
+#include <QtCoap/qcoapreply.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qrandom.h>
+#include <private/qcoapclient_p.h>
+#include <private/qcoapconnection_p.h>
+#include <private/qcoapinternalreply_p.h>
+
+using namespace std::chrono_literals;
+
+/*
+    Emulates a lossy link to a server supporting both the Block2 and the
+    Q-Block2 options. Each response is delayed by the link latency, and
+    dropped with the given loss rate.
+*/
+class QCoapLossyBlockServer : public QCoapConnection
+{
+public:
+    QCoapLossyBlockServer(const QByteArray &resource, uint blockSize, uint maximumPayloads,
+                          double lossRate, std::chrono::milliseconds latency)
+        : resource(resource), blockSize(blockSize), maximumPayloads(maximumPayloads),
+          lossRate(lossRate), latency(latency), random(42)
+    {}
+
+    void bind(const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+        emit bound();
+    }
+
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+
+        QScopedPointer<QCoapInternalReply> request(QCoapInternalReply::createFromFrame(data));
+        const QCoapMessage message = *request->message();
+        if (message.type() == QCoapMessage::Type::Acknowledgment
+                || message.type() == QCoapMessage::Type::Reset) {
+            return;
+        }
+
+        const uint blockCount = (static_cast<uint>(resource.size()) + blockSize - 1) / blockSize;
+        QList<QByteArray> replies;
+        {
+            QMutexLocker locker(&mutex);
+            if (!message.hasOption(QCoapOption::QBlock2)) {
+                if (!isLost())
+                    replies.append(blockReply(message, QCoapOption::Block2,
+                                              request->currentBlockNumber()));
+            }
+
+            for (const QCoapOption &option : message.options(QCoapOption::QBlock2)) {
+                const uint value = option.uintValue();
+                const uint first = value >> 4;
+                const uint last = (value & 8) ? qMin(first + maximumPayloads, blockCount)
+                                              : first + 1;
+                for (uint block = first; block < last; ++block) {
+                    if (!isLost())
+                        replies.append(blockReply(message, QCoapOption::QBlock2, block));
+                }
+            }
+        }
+
+        QMetaObject::invokeMethod(this, [this, replies]() {
+            QTimer::singleShot(latency, this, [this, replies]() {
+                for (const QByteArray &reply : replies)
+                    emit readyRead(reply, QHostAddress(QHostAddress::LocalHost));
+            });
+        }, Qt::QueuedConnection);
+    }
+
+    void close() override {}
+
+private:
+    bool isLost()
+    {
+        return random.generateDouble() < lossRate;
+    }
+
+    QByteArray blockReply(const QCoapMessage &request, QCoapOption::OptionName name,
+                          uint block)
+    {
+        const bool confirmable = request.type() == QCoapMessage::Type::Confirmable;
+        const quint16 messageId = confirmable ? request.messageId() : ++lastMessageId;
+        const bool more = (block + 1) * blockSize < static_cast<uint>(resource.size());
+        const quint32 szx = qCountTrailingZeroBits(blockSize) - 4;
+        const QByteArray value =
+                QCoapOption(name, (block << 4) | (more ? 8u : 0u) | szx).opaqueValue();
+
+        // Piggybacked ACK for confirmable requests, NON otherwise, with a 2.05 Content code
+        QByteArray frame;
+        frame.append(static_cast<char>((confirmable ? 0x60 : 0x50) | request.tokenLength()));
+        frame.append(static_cast<char>(0x45));
+        frame.append(static_cast<char>(messageId >> 8));
+        frame.append(static_cast<char>(messageId & 0xFF));
+        frame.append(request.token());
+        frame.append(static_cast<char>(0xD0 | value.size()));
+        frame.append(static_cast<char>(name - 13));
+        frame.append(value);
+        frame.append(static_cast<char>(0xFF));
+        frame.append(resource.mid(block * blockSize, blockSize));
+        return frame;
+    }
+
+    const QByteArray resource;
+    const uint blockSize;
+    const uint maximumPayloads;
+    const double lossRate;
+    const std::chrono::milliseconds latency;
+
+    QMutex mutex;
+    QRandomGenerator random;
+    quint16 lastMessageId = 0;
+};
+
+class QCoapClientForLossyLinks : public QCoapClient
+{
+public:
+    explicit QCoapClientForLossyLinks(QCoapConnection *connection)
+    {
+        QCoapClientPrivate *privateClient = static_cast<QCoapClientPrivate *>(d_func());
+        privateClient->setConnection(connection);
+    }
+};
+
+class tst_QCoapBlockwise : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void download_data();
+    void download();
+};
+
+void tst_QCoapBlockwise::download_data()
+{
+    QTest::addColumn<bool>("qBlock");
+    QTest::addColumn<double>("lossRate");
+
+    for (double lossRate : { 0., 0.05, 0.2 }) {
+        const int percent = qRound(lossRate * 100);
+        QTest::addRow("block2_loss_%d%%", percent) << false << lossRate;
+        QTest::addRow("q_block2_loss_%d%%", percent) << true << lossRate;
+    }
+}
+
+void tst_QCoapBlockwise::download()
+{
+    QFETCH(bool, qBlock);
+    QFETCH(double, lossRate);
+
+    const uint blockSize = 512;
+    const uint maximumPayloads = 10;
+    QByteArray resource;
+    for (int i = 0; i < 16 * 1024; ++i)
+        resource.append(static_cast<char>('a' + i % 26));
+
+    auto connection = new QCoapLossyBlockServer(resource, blockSize, maximumPayloads,
+                                                lossRate, 20ms);
+    QCoapClientForLossyLinks client(connection);
+    client.setAckTimeout(100);
+    client.setAckRandomFactor(1);
+    client.setMaximumRetransmitCount(25);
+    client.setBlockSize(blockSize);
+    client.setQBlockEnabled(qBlock);
+    client.setMaximumPayloads(maximumPayloads);
+
+    // Classic blockwise transfers rely on confirmable requests to recover
+    // losses, Q-Block transfers always use Non-confirmable messages.
+    const QCoapRequest request(QUrl("coap://127.0.0.1/firmware"),
+                               QCoapMessage::Type::Confirmable);
+
+    QBENCHMARK {
+        QScopedPointer<QCoapReply> reply(client.get(request));
+        QVERIFY(reply);
+
+        QSignalSpy spyFinished(reply.data(), &QCoapReply::finished);
+        QVERIFY(spyFinished.wait(60000));
+        QVERIFY(reply->isSuccessful());
+        QCOMPARE(reply->readAll(), resource);
+    }
+}
+
+QTEST_MAIN(tst_QCoapBlockwise)
+
+#include "tst_bench_qcoapblockwise.moc"
@@ -0,0 +1,102 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include <QtTest>
+#include <QCoreApplication>
+
+#include <QtCore/qurl.h>
+#include <QtNetwork/qhostaddress.h>
+#include <private/qcoapconnection_p.h>
+#include <private/qcoapendpoint_p.h>
+
+/*
+    Transport dropping the frames, so that only the cost of handing them
+    to the connection is measured.
+*/
+class QCoapSinkConnection : public QCoapConnection
+{
+public:
+    void bind(const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+        emit bound();
+    }
+
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(data)
+        // Same check as for the sender of an answer
+        if (endpoint.address.isEqual(sender))
+            ++frameCount;
+    }
+
+    void close() override {}
+
+    void send(const QByteArray &frame, const CoapEndpoint &endpoint)
+    {
+        static_cast<QCoapConnectionPrivate *>(QObjectPrivate::get(this))->sendRequest(frame,
+                                                                                    endpoint);
+    }
+
+    QHostAddress sender;
+    qsizetype frameCount = 0;
+};
+
+class tst_QCoapEndpoint : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void perFrameOverhead_data();
+    void perFrameOverhead();
+};
+
+namespace {
+
+constexpr int FrameCount = 10 * 1000;
+
+} // namespace
+
+void tst_QCoapEndpoint::perFrameOverhead_data()
+{
+    QTest::addColumn<QString>("url");
+    QTest::addColumn<bool>("parsedPerFrame");
+
+    QTest::newRow("ipv4, parsed once") << "coap://10.20.30.40:5683/sensor" << false;
+    QTest::newRow("ipv4, parsed per frame") << "coap://10.20.30.40:5683/sensor" << true;
+    QTest::newRow("ipv6, parsed once") << "coap://[2001:db8::1]:5683/sensor" << false;
+    QTest::newRow("ipv6, parsed per frame") << "coap://[2001:db8::1]:5683/sensor" << true;
+}
+
+/*
+    Hands FrameCount frames to the connection, with the endpoint parsed
+    once per exchange, or parsed again from the target for each frame as
+    the host was when it was passed around as a string.
+*/
+void tst_QCoapEndpoint::perFrameOverhead()
+{
+    QFETCH(QString, url);
+    QFETCH(bool, parsedPerFrame);
+
+    const QUrl target(url);
+    const CoapEndpoint endpoint = CoapEndpoint::fromUrl(target);
+    const QByteArray frame(64, 'x');
+
+    QCoapSinkConnection connection;
+    connection.sender = endpoint.address;
+    connection.send(frame, endpoint);
+
+    QBENCHMARK {
+        for (int i = 0; i < FrameCount; ++i) {
+            if (parsedPerFrame)
+                connection.send(frame, CoapEndpoint::fromUrl(target));
+            else
+                connection.send(frame, endpoint);
+        }
+    }
+    QVERIFY(connection.frameCount > FrameCount);
+}
+
+QTEST_MAIN(tst_QCoapEndpoint)
+
+#include "tst_bench_qcoapendpoint.moc"
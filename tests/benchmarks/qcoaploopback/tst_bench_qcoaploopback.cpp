@@ -0,0 +1,168 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include <QtTest>
+#include <QCoreApplication>
+
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qeventloop.h>
+#include <QtCoap/qcoapclient.h>
+#include <QtCoap/qcoapreply.h>
+#include <QtCoap/qcoaprequest.h>
+#include <private/qcoapclient_p.h>
+#include <private/qcoaploopbackconnection_p.h>
+
+#include <algorithm>
+
+class QCoapClientForLoopbackBenchmarks : public QCoapClient
+{
+public:
+    explicit QCoapClientForLoopbackBenchmarks(QCoapLoopbackConnection *connection)
+    {
+        QCoapClientPrivate *privateClient = static_cast<QCoapClientPrivate *>(d_func());
+        privateClient->setConnection(connection);
+    }
+};
+
+class tst_QCoapLoopback : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void throughput_data();
+    void throughput();
+    void latency_data();
+    void latency();
+
+private:
+    static QCoapRequest request(QCoapMessage::Type type);
+    static QCoapScriptedResponder responder(bool separate);
+};
+
+namespace {
+
+// Requests in flight at once in the throughput benchmark
+constexpr int ConcurrentRequests = 10000;
+// Requests sent one after the other in the latency benchmark
+constexpr int SequentialRequests = 2000;
+// Above which the benchmark is considered stuck
+constexpr int Timeout = 60 * 1000;
+
+} // namespace
+
+QCoapRequest tst_QCoapLoopback::request(QCoapMessage::Type type)
+{
+    QCoapRequest request(QUrl(QStringLiteral("coap://127.0.0.1/sensors/temperature")));
+    request.setType(type);
+    return request;
+}
+
+QCoapScriptedResponder tst_QCoapLoopback::responder(bool separate)
+{
+    QCoapScriptedResponder responder;
+    responder.addResource(QStringLiteral("/sensors/temperature"), QByteArray(64, 'x'));
+    responder.setSeparateResponses(separate);
+    return responder;
+}
+
+void tst_QCoapLoopback::throughput_data()
+{
+    QTest::addColumn<QCoapMessage::Type>("type");
+    QTest::addColumn<bool>("separate");
+
+    QTest::newRow("confirmable") << QCoapMessage::Type::Confirmable << false;
+    QTest::newRow("confirmable, separate") << QCoapMessage::Type::Confirmable << true;
+    QTest::newRow("non-confirmable") << QCoapMessage::Type::NonConfirmable << false;
+}
+
+/*
+    Sends ConcurrentRequests requests at once through the loopback
+    connection, and reports the number of exchanges completed per second.
+    Without any socket, this measures the client and the protocol alone.
+*/
+void tst_QCoapLoopback::throughput()
+{
+    QFETCH(QCoapMessage::Type, type);
+    QFETCH(bool, separate);
+
+    auto *connection = new QCoapLoopbackConnection(responder(separate));
+    QCoapClientForLoopbackBenchmarks client(connection);
+    // Keep the exchanges from timing out while they queue up
+    client.setAckTimeout(Timeout);
+
+    int finished = 0;
+    QEventLoop loop;
+    connect(&client, &QCoapClient::finished, &loop, [&finished, &loop](QCoapReply *reply) {
+        reply->deleteLater();
+        if (++finished == ConcurrentRequests)
+            loop.quit();
+    });
+    QTimer::singleShot(Timeout, &loop, &QEventLoop::quit);
+
+    const QCoapRequest coapRequest = request(type);
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < ConcurrentRequests; ++i)
+            QVERIFY(client.get(coapRequest));
+        loop.exec();
+    }
+    const qint64 elapsed = qMax<qint64>(timer.nsecsElapsed(), 1);
+
+    QCOMPARE(finished, ConcurrentRequests);
+    qInfo("%.0f exchanges per second, %.2f frames written per exchange",
+          ConcurrentRequests * 1e9 / elapsed,
+          double(connection->framesWritten()) / ConcurrentRequests);
+}
+
+void tst_QCoapLoopback::latency_data()
+{
+    QTest::addColumn<QCoapMessage::Type>("type");
+
+    QTest::newRow("confirmable") << QCoapMessage::Type::Confirmable;
+    QTest::newRow("non-confirmable") << QCoapMessage::Type::NonConfirmable;
+}
+
+/*
+    Sends SequentialRequests requests one after the other, and reports the
+    median and the 99th percentile of the time from sending a request to
+    its reply being finished.
+*/
+void tst_QCoapLoopback::latency()
+{
+    QFETCH(QCoapMessage::Type, type);
+
+    auto *connection = new QCoapLoopbackConnection(responder(false));
+    QCoapClientForLoopbackBenchmarks client(connection);
+
+    const QCoapRequest coapRequest = request(type);
+    QList<qint64> roundTrips;
+    roundTrips.reserve(SequentialRequests);
+
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < SequentialRequests; ++i) {
+            QEventLoop loop;
+            QElapsedTimer timer;
+            timer.start();
+            QCoapReply *reply = client.get(coapRequest);
+            QVERIFY(reply);
+            connect(reply, &QCoapReply::finished, &loop, &QEventLoop::quit);
+            QTimer::singleShot(Timeout, &loop, &QEventLoop::quit);
+            if (!reply->isFinished())
+                loop.exec();
+            roundTrips.append(timer.nsecsElapsed());
+
+            QVERIFY(reply->isFinished());
+            delete reply;
+        }
+    }
+
+    std::sort(roundTrips.begin(), roundTrips.end());
+    qInfo("median %.1f us, 99th percentile %.1f us",
+          roundTrips.at(roundTrips.size() / 2) / 1e3,
+          roundTrips.at(roundTrips.size() * 99 / 100) / 1e3);
+}
+
+QTEST_MAIN(tst_QCoapLoopback)
+
+#include "tst_bench_qcoaploopback.moc"
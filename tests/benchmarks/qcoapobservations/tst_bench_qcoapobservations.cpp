@@ -0,0 +1,138 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include <QtTest>
+#include <QCoreApplication>
+
+#include <QtCoap/qcoapclient.h>
+#include <QtCoap/qcoaprequest.h>
+#include <QtCoap/qcoapreply.h>
+#include <private/qcoapclient_p.h>
+#include <private/qcoapconnection_p.h>
+#include <private/qcoapprotocol_p.h>
+
+#if defined(__GLIBC__)
+#  include <malloc.h>
+#endif
+
+/*
+    Emulates a server which never answers, so that the observations
+    stay registered while the memory is measured.
+*/
+class QCoapSilentServer : public QCoapConnection
+{
+public:
+    void bind(const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(endpoint)
+        emit bound();
+    }
+
+    void writeData(const QByteArray &data, const CoapEndpoint &endpoint) override
+    {
+        Q_UNUSED(data)
+        Q_UNUSED(endpoint)
+    }
+
+    void close() override {}
+};
+
+class QCoapClientForMemoryTests : public QCoapClient
+{
+public:
+    QCoapClientForMemoryTests()
+    {
+        QCoapClientPrivate *privateClient = static_cast<QCoapClientPrivate *>(d_func());
+        privateClient->setConnection(new QCoapSilentServer);
+    }
+
+    // Waits until the protocol processed the requests sent so far
+    void waitForProtocol()
+    {
+        QCoapClientPrivate *privateClient = static_cast<QCoapClientPrivate *>(d_func());
+        QMetaObject::invokeMethod(privateClient->protocol, []() {},
+                                  Qt::BlockingQueuedConnection);
+    }
+};
+
+class tst_QCoapObservations : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void memoryPerObservation_data();
+    void memoryPerObservation();
+
+private:
+    static qint64 allocatedBytes();
+};
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#  define MEASURE_ALLOCATED_BYTES
+#endif
+
+void tst_QCoapObservations::initTestCase()
+{
+#ifdef MEASURE_ALLOCATED_BYTES
+    // The observations are allocated by the protocol in the worker thread,
+    // and mallinfo2() only reports the main arena. A single arena makes all
+    // the threads allocate from it. This must happen before any thread is
+    // started.
+    mallopt(M_ARENA_MAX, 1);
+#endif
+}
+
+qint64 tst_QCoapObservations::allocatedBytes()
+{
+#ifdef MEASURE_ALLOCATED_BYTES
+    return static_cast<qint64>(mallinfo2().uordblks);
+#else
+    return -1;
+#endif
+}
+
+void tst_QCoapObservations::memoryPerObservation_data()
+{
+    QTest::addColumn<bool>("compact");
+
+    QTest::newRow("reply") << false;
+    QTest::newRow("compact") << true;
+}
+
+void tst_QCoapObservations::memoryPerObservation()
+{
+    QFETCH(bool, compact);
+
+    if (allocatedBytes() < 0)
+        QSKIP("Measuring the allocated memory is not supported on this platform");
+
+    const int observationCount = 100 * 1000;
+
+    QCoapClientForMemoryTests client;
+    // Keep the regular observations from timing out while registering
+    client.setAckTimeout(3600 * 1000);
+    client.waitForProtocol();
+
+    QList<QCoapReply *> replies;
+    replies.reserve(observationCount);
+
+    const qint64 allocatedBefore = allocatedBytes();
+    for (int i = 0; i < observationCount; ++i) {
+        const QCoapRequest request(QUrl(QString("coap://10.0.0.1/sensors/%1").arg(i)));
+        if (compact)
+            QVERIFY(client.observeCompact(request) > 0);
+        else
+            replies.append(client.observe(request));
+    }
+    client.waitForProtocol();
+    const qint64 allocatedAfter = allocatedBytes();
+
+    QTest::setBenchmarkResult(qreal(allocatedAfter - allocatedBefore) / observationCount,
+                              QTest::BytesAllocated);
+    qDeleteAll(replies);
+}
+
+QTEST_MAIN(tst_QCoapObservations)
+
+#include "tst_bench_qcoapobservations.moc"
@@ -0,0 +1,142 @@
+// Copyright (C) 2025 The Qt Company Ltd.
+// SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only
+
+#include <QtTest>
+#include <QCoreApplication>
+
+#include <QtCore/qdeadlinetimer.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtNetwork/qnetworkdatagram.h>
+#include <QtNetwork/qudpsocket.h>
+#include <private/qcoapqudpconnection_p.h>
+
+/*
+    Exposes the transport of the connection, and the number of calls made
+    to the socket to read and write the datagrams.
+*/
+class QCoapQUdpConnectionForBenchmarks : public QCoapQUdpConnection
+{
+public:
+    explicit QCoapQUdpConnectionForBenchmarks(bool batched)
+    {
+        d_func()->batchedIo = batched;
+    }
+
+    void send(const QByteArray &frame, quint16 port)
+    {
+        d_func()->sendRequest(frame, CoapEndpoint(QHostAddress(QHostAddress::LocalHost), port));
+    }
+
+    CoapUdpStatistics statistics() { return d_func()->statistics; }
+};
+
+class tst_QCoapUdpBatching : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void throughput_data();
+    void throughput();
+
+private:
+    static bool transfer(QCoapQUdpConnectionForBenchmarks &connection, QUdpSocket &peer,
+                         bool sending);
+};
+
+namespace {
+
+// Datagrams sent before waiting for them, so that the socket buffers do not overflow
+constexpr int BurstSize = 256;
+constexpr int BurstCount = 40;
+constexpr int MessageCount = BurstSize * BurstCount;
+
+} // namespace
+
+void tst_QCoapUdpBatching::throughput_data()
+{
+    QTest::addColumn<bool>("sending");
+    QTest::addColumn<bool>("batched");
+
+    QTest::newRow("send, batched") << true << true;
+    QTest::newRow("send, per datagram") << true << false;
+    QTest::newRow("receive, batched") << false << true;
+    QTest::newRow("receive, per datagram") << false << false;
+}
+
+/*
+    Exchanges CoAP-sized datagrams over the loopback interface, and reports
+    the time taken along with the number of messages per second and of
+    socket calls per message.
+*/
+void tst_QCoapUdpBatching::throughput()
+{
+    QFETCH(bool, sending);
+    QFETCH(bool, batched);
+
+    QUdpSocket peer;
+    QVERIFY(peer.bind(QHostAddress::LocalHost, 0));
+    QCoapQUdpConnectionForBenchmarks connection(batched);
+
+    // Bind the socket of the connection
+    connection.send("warm-up", peer.localPort());
+    QTRY_VERIFY(peer.hasPendingDatagrams());
+    peer.receiveDatagram();
+
+    const CoapUdpStatistics before = connection.statistics();
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK_ONCE {
+        QVERIFY(transfer(connection, peer, sending));
+    }
+    const qint64 elapsed = qMax<qint64>(timer.nsecsElapsed(), 1);
+    const CoapUdpStatistics after = connection.statistics();
+
+    const quint64 calls = sending ? after.sendCalls - before.sendCalls
+                                  : after.receiveCalls - before.receiveCalls;
+    qInfo("%.0f messages per second, %.3f socket calls per message",
+          MessageCount * 1e9 / elapsed, double(calls) / MessageCount);
+}
+
+/*
+    Sends MessageCount datagrams from the \a connection to the \a peer if
+    \a sending is \c true, or the other way around otherwise, and waits
+    until they are all received.
+*/
+bool tst_QCoapUdpBatching::transfer(QCoapQUdpConnectionForBenchmarks &connection,
+                                    QUdpSocket &peer, bool sending)
+{
+    const QByteArray frame(64, 'x');
+    const quint16 connectionPort = connection.socket()->localPort();
+
+    int received = 0;
+    QObject context;
+    QObject::connect(&connection, &QCoapConnection::readyRead, &context,
+                     [&received]() { ++received; });
+
+    for (int burst = 0; burst < BurstCount; ++burst) {
+        for (int i = 0; i < BurstSize; ++i) {
+            if (sending)
+                connection.send(frame, peer.localPort());
+            else
+                peer.writeDatagram(frame, QHostAddress::LocalHost, connectionPort);
+        }
+
+        const QDeadlineTimer deadline(5000);
+        while (received < (burst + 1) * BurstSize) {
+            if (deadline.hasExpired())
+                return false;
+
+            QCoreApplication::processEvents();
+            while (sending && peer.hasPendingDatagrams()) {
+                char buffer[128];
+                peer.readDatagram(buffer, sizeof(buffer));
+                ++received;
+            }
+        }
+    }
+    return true;
+}
+
+QTEST_MAIN(tst_QCoapUdpBatching)
+
+#include "tst_bench_qcoapudpbatching.moc"